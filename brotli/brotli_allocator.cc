@@ -0,0 +1,114 @@
+#include "brotli/brotli_allocator.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+
+namespace brotli {
+
+namespace {
+
+// Precedes each block handed out, records which size class it belongs to.
+// Padded so that the returned memory is aligned like malloc's.
+struct alignas(alignof(std::max_align_t)) BlockHeader {
+  uint32_t size_class;
+};
+
+constexpr uint32_t kMinSizeClass = 6;  // 64 bytes
+
+uint32_t SizeClassFor(size_t size) {
+  uint32_t size_class = kMinSizeClass;
+  while ((size_t(1) << size_class) < size) {
+    size_class++;
+  }
+  return size_class;
+}
+
+}  // namespace
+
+BrotliAllocator& BrotliAllocator::Shared() {
+  // Leaked so that it outlives any encoders destroyed during shutdown.
+  static BrotliAllocator* shared = new BrotliAllocator();
+  return *shared;
+}
+
+BrotliAllocator::~BrotliAllocator() { Release(); }
+
+void* BrotliAllocator::Alloc(void* opaque, size_t size) {
+  return static_cast<BrotliAllocator*>(opaque)->Allocate(size);
+}
+
+void BrotliAllocator::Free(void* opaque, void* address) {
+  if (address) {
+    static_cast<BrotliAllocator*>(opaque)->Deallocate(address);
+  }
+}
+
+BrotliAllocator::Stats BrotliAllocator::GetStats() {
+  absl::MutexLock lock(&mutex_);
+  return stats_;
+}
+
+void BrotliAllocator::Release() {
+  std::vector<std::vector<void*>> blocks;
+  {
+    absl::MutexLock lock(&mutex_);
+    blocks = std::move(free_blocks_);
+    free_blocks_.clear();
+    stats_.cached_bytes = 0;
+  }
+
+  for (const auto& size_class : blocks) {
+    for (void* block : size_class) {
+      free(block);
+    }
+  }
+}
+
+void* BrotliAllocator::Allocate(size_t size) {
+  uint32_t size_class = SizeClassFor(size);
+  {
+    absl::MutexLock lock(&mutex_);
+    stats_.allocations++;
+    if (size_class < free_blocks_.size() && !free_blocks_[size_class].empty()) {
+      BlockHeader* header =
+          static_cast<BlockHeader*>(free_blocks_[size_class].back());
+      free_blocks_[size_class].pop_back();
+      stats_.reused++;
+      stats_.cached_bytes -= size_t(1) << size_class;
+      return header + 1;
+    }
+  }
+
+  BlockHeader* header = static_cast<BlockHeader*>(
+      malloc(sizeof(BlockHeader) + (size_t(1) << size_class)));
+  if (!header) {
+    return nullptr;
+  }
+  header->size_class = size_class;
+  return header + 1;
+}
+
+void BrotliAllocator::Deallocate(void* address) {
+  BlockHeader* header = static_cast<BlockHeader*>(address) - 1;
+  uint32_t size_class = header->size_class;
+  uint64_t block_size = uint64_t(1) << size_class;
+  {
+    absl::MutexLock lock(&mutex_);
+    if (stats_.cached_bytes + block_size <= max_cached_bytes_) {
+      if (free_blocks_.size() <= size_class) {
+        free_blocks_.resize(size_class + 1);
+      }
+      free_blocks_[size_class].push_back(header);
+      stats_.cached_bytes += block_size;
+      return;
+    }
+  }
+  free(header);
+}
+
+}  // namespace brotli
@@ -0,0 +1,71 @@
+#ifndef BROTLI_BROTLI_ALLOCATOR_H_
+#define BROTLI_BROTLI_ALLOCATOR_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+
+namespace brotli {
+
+/*
+ * A memory allocator for the brotli encoder (passed via its alloc_func and
+ * free_func hooks) which recycles freed blocks instead of returning them to
+ * the system.
+ *
+ * Each brotli encoder instance allocates its hash tables and ring buffer
+ * (several megabytes at high qualities) on creation and frees them on
+ * destruction. Encoders are short lived and typically created with the same
+ * settings, so the same block sizes are requested over and over. Blocks are
+ * grouped into power of two size classes, freed blocks are kept for reuse
+ * until the total size held exceeds 'max_cached_bytes'.
+ *
+ * Safe to use from multiple threads.
+ */
+class BrotliAllocator {
+ public:
+  // The allocator used by SharedBrotliEncoder. Never destroyed.
+  static BrotliAllocator& Shared();
+
+  explicit BrotliAllocator(uint64_t max_cached_bytes = 256 << 20)
+      : max_cached_bytes_(max_cached_bytes) {}
+  ~BrotliAllocator();
+
+  BrotliAllocator(const BrotliAllocator&) = delete;
+  BrotliAllocator& operator=(const BrotliAllocator&) = delete;
+
+  // brotli_alloc_func and brotli_free_func, 'opaque' is the allocator.
+  static void* Alloc(void* opaque, size_t size);
+  static void Free(void* opaque, void* address);
+
+  struct Stats {
+    // Number of blocks requested.
+    uint64_t allocations = 0;
+    // Number of requests served with a recycled block.
+    uint64_t reused = 0;
+    // Total size of the freed blocks currently held for reuse.
+    uint64_t cached_bytes = 0;
+  };
+
+  Stats GetStats();
+
+  // Returns all cached blocks to the system.
+  void Release();
+
+ private:
+  void* Allocate(size_t size);
+  void Deallocate(void* address);
+
+  const uint64_t max_cached_bytes_;
+
+  absl::Mutex mutex_;
+  // Free blocks, indexed by size class.
+  std::vector<std::vector<void*>> free_blocks_ ABSL_GUARDED_BY(mutex_);
+  Stats stats_ ABSL_GUARDED_BY(mutex_);
+};
+
+}  // namespace brotli
+
+#endif  // BROTLI_BROTLI_ALLOCATOR_H_
@@ -0,0 +1,90 @@
+#include "brotli/brotli_allocator.h"
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "brotli/encode.h"
+#include "brotli/shared_brotli_encoder.h"
+#include "gtest/gtest.h"
+
+namespace brotli {
+
+class BrotliAllocatorTest : public ::testing::Test {};
+
+TEST_F(BrotliAllocatorTest, ReusesFreedBlocks) {
+  BrotliAllocator allocator;
+
+  void* a = BrotliAllocator::Alloc(&allocator, 1000);
+  ASSERT_NE(a, nullptr);
+  memset(a, 1, 1000);
+  BrotliAllocator::Free(&allocator, a);
+  ASSERT_EQ(allocator.GetStats().cached_bytes, 1024);
+
+  // Same size class.
+  void* b = BrotliAllocator::Alloc(&allocator, 600);
+  ASSERT_EQ(b, a);
+  ASSERT_EQ(allocator.GetStats().cached_bytes, 0);
+
+  // Different size class.
+  void* c = BrotliAllocator::Alloc(&allocator, 2000);
+  ASSERT_NE(c, nullptr);
+  ASSERT_NE(c, a);
+
+  auto stats = allocator.GetStats();
+  ASSERT_EQ(stats.allocations, 3);
+  ASSERT_EQ(stats.reused, 1);
+
+  BrotliAllocator::Free(&allocator, b);
+  BrotliAllocator::Free(&allocator, c);
+  BrotliAllocator::Free(&allocator, nullptr);
+  ASSERT_EQ(allocator.GetStats().cached_bytes, 1024 + 2048);
+
+  allocator.Release();
+  ASSERT_EQ(allocator.GetStats().cached_bytes, 0);
+}
+
+TEST_F(BrotliAllocatorTest, MaxCachedBytes) {
+  BrotliAllocator allocator(1024);
+
+  void* a = BrotliAllocator::Alloc(&allocator, 1024);
+  void* b = BrotliAllocator::Alloc(&allocator, 1024);
+  BrotliAllocator::Free(&allocator, a);
+  // Exceeds the limit, so is returned to the system.
+  BrotliAllocator::Free(&allocator, b);
+  ASSERT_EQ(allocator.GetStats().cached_bytes, 1024);
+}
+
+TEST_F(BrotliAllocatorTest, EncodersReuseMemory) {
+  BrotliAllocator allocator;
+  std::string data(100000, 'a');
+  for (uint32_t i = 0; i < data.size(); i++) {
+    data[i] = 'a' + (i * 7919) % 26;
+  }
+
+  auto compress = [&](std::vector<uint8_t>& sink) {
+    BrotliEncoderState* state = BrotliEncoderCreateInstance(
+        &BrotliAllocator::Alloc, &BrotliAllocator::Free, &allocator);
+    ASSERT_NE(state, nullptr);
+    ASSERT_TRUE(BrotliEncoderSetParameter(state, BROTLI_PARAM_QUALITY, 11));
+    ASSERT_TRUE(SharedBrotliEncoder::CompressToSink(data, true, state, &sink));
+    BrotliEncoderDestroyInstance(state);
+  };
+
+  std::vector<uint8_t> first;
+  compress(first);
+  auto before = allocator.GetStats();
+  ASSERT_GT(before.allocations, 0);
+
+  // The second encoder only uses recycled memory, and produces the same
+  // output.
+  std::vector<uint8_t> second;
+  compress(second);
+  auto after = allocator.GetStats();
+  ASSERT_EQ(after.allocations - before.allocations,
+            after.reused - before.reused);
+  ASSERT_EQ(first, second);
+}
+
+}  // namespace brotli
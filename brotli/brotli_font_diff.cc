@@ -1,5 +1,8 @@
 #include "brotli/brotli_font_diff.h"
 
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
 #include "absl/types/span.h"
 #include "brotli/brotli_stream.h"
 #include "brotli/glyf_differ.h"
@@ -7,13 +10,16 @@
 #include "brotli/loca_differ.h"
 #include "brotli/table_range.h"
 #include "common/hb_set_unique_ptr.h"
+#include "common/thread_pool.h"
 
 namespace brotli {
 
+using absl::flat_hash_map;
 using absl::Span;
 using absl::Status;
 using common::FontData;
 using common::hb_set_unique_ptr;
+using common::ThreadPool;
 
 static bool HasTable(hb_face_t* face, hb_tag_t tag) {
   hb_blob_t* table = hb_face_reference_table(face, tag);
@@ -28,32 +34,38 @@ static bool HasTable(hb_face_t* base, hb_face_t* derived, hb_tag_t tag) {
 
 /*
  * Writes out a brotli encoded copy of the 'derived' subsets glyf table using
- * the 'base' subset as a shared dictionary.
+ * the 'base' subset as a shared dictionary. If no output stream is given each
+ * table is instead encoded into its own stream, see TableRange.
  *
  * Performs the comparison using the glyph ids in the plans for each subset and
  * does not actually compare any glyph bytes. Common ranges are glyphs are
  * encoded using backwards references to the base dictionary. Novel glyph data
  * found in 'derived' is encoded as compressed data without the use of the
- * shared dictionary.
+ * shared dictionary, except for per table streams where it's compressed at
+ * 'quality' with the base table as the dictionary.
  */
 class DiffDriver {
   struct RangeAndDiffer {
     RangeAndDiffer(hb_face_t* base_face, hb_face_t* derived_face, hb_tag_t tag,
-                   const BrotliStream& base_stream, TableDiffer* differ_)
-        : range(base_face, derived_face, tag, base_stream), differ(differ_) {}
+                   const BrotliStream* base_stream, unsigned quality,
+                   TableDiffer* differ_)
+        : range(base_stream
+                    ? TableRange(base_face, derived_face, tag, *base_stream)
+                    : TableRange(base_face, derived_face, tag, quality)),
+          differ(differ_) {}
 
     TableRange range;
     std::unique_ptr<TableDiffer> differ;
   };
 
  public:
-  DiffDriver(hb_subset_plan_t* base_plan, hb_face_t* base_face,
-             hb_subset_plan_t* derived_plan, hb_face_t* derived_face,
-             const hb_set_t* custom_diff_tables, BrotliStream& stream)
+  DiffDriver(const hb_map_t* base_new_to_old_, hb_face_t* base_face,
+             const hb_map_t* derived_old_to_new_, hb_face_t* derived_face,
+             const hb_set_t* custom_diff_tables, BrotliStream* stream,
+             unsigned quality = 5)
       : out(stream),
-        base_new_to_old(hb_subset_plan_new_to_old_glyph_mapping(base_plan)),
-        derived_old_to_new(
-            hb_subset_plan_old_to_new_glyph_mapping(derived_plan)) {
+        base_new_to_old(base_new_to_old_),
+        derived_old_to_new(derived_old_to_new_) {
     hb_blob_t* head =
         hb_face_reference_table(derived_face, HB_TAG('h', 'e', 'a', 'd'));
     const char* head_data = hb_blob_get_data(head, nullptr);
@@ -84,7 +96,7 @@ class DiffDriver {
           if (HasTable(base_face, derived_face, HMTX) &&
               HasTable(base_face, derived_face, HHEA)) {
             differs.push_back(RangeAndDiffer(
-                base_face, derived_face, HMTX, stream,
+                base_face, derived_face, HMTX, stream, quality,
                 new HmtxDiffer(TableRange::to_span(base_face, HHEA),
                                TableRange::to_span(derived_face, HHEA))));
           }
@@ -94,7 +106,7 @@ class DiffDriver {
           if (HasTable(base_face, derived_face, VMTX) &&
               HasTable(base_face, derived_face, VHEA)) {
             differs.push_back(RangeAndDiffer(
-                base_face, derived_face, VMTX, stream,
+                base_face, derived_face, VMTX, stream, quality,
                 new HmtxDiffer(TableRange::to_span(base_face, VHEA),
                                TableRange::to_span(derived_face, VHEA))));
           }
@@ -104,7 +116,7 @@ class DiffDriver {
           if (HasTable(base_face, derived_face, GLYF) &&
               HasTable(base_face, derived_face, LOCA)) {
             differs.push_back(RangeAndDiffer(
-                base_face, derived_face, LOCA, stream,
+                base_face, derived_face, LOCA, stream, quality,
                 new LocaDiffer(is_base_short_loca, is_derived_short_loca)));
           }
           break;
@@ -113,7 +125,7 @@ class DiffDriver {
           if (HasTable(base_face, derived_face, GLYF) &&
               HasTable(base_face, derived_face, LOCA)) {
             differs.push_back(RangeAndDiffer(
-                base_face, derived_face, GLYF, stream,
+                base_face, derived_face, GLYF, stream, quality,
                 new GlyfDiffer(TableRange::to_span(derived_face, LOCA),
                                is_base_short_loca, is_derived_short_loca)));
           }
@@ -126,10 +138,7 @@ class DiffDriver {
   std::vector<RangeAndDiffer> differs;
 
  private:
-  BrotliStream& out;
-
-  unsigned base_gid = 0;
-  unsigned derived_gid = 0;
+  BrotliStream* out;
 
   const hb_map_t* base_new_to_old;
   const hb_map_t* derived_old_to_new;
@@ -140,13 +149,72 @@ class DiffDriver {
   bool retain_gids;
 
  public:
-  Status MakeDiff() {
+  /*
+   * Produces the diff of each table. If 'pool' is set the tables are diffed
+   * concurrently, the output is the same either way.
+   */
+  Status MakeDiff(ThreadPool* pool) {
+    std::vector<GlyphRun> runs = GlyphRuns();
+
+    std::vector<Status> results(differs.size());
+    auto diff_table = [&](uint32_t i) {
+      results[i] = DiffTable(runs, differs[i]);
+    };
+    if (pool && differs.size() > 1) {
+      pool->ParallelFor(differs.size(), diff_table);
+    } else {
+      for (uint32_t i = 0; i < differs.size(); i++) {
+        diff_table(i);
+      }
+    }
+
+    for (uint32_t i = 0; i < differs.size(); i++) {
+      if (!results[i].ok()) {
+        return results[i];
+      }
+      TableRange& range = differs[i].range;
+      if (out) {
+        range.stream().four_byte_align_uncompressed();
+        out->append(range.stream());
+      } else {
+        range.stream().end_stream();
+      }
+    }
+
+    return absl::OkStatus();
+  }
+
+ private:
+  /*
+   * A run of consecutive derived glyphs which all relate to the base in the
+   * same way. The glyph walk is computed once as a list of runs, and then
+   * replayed by each of the table differs.
+   */
+  struct GlyphRun {
+    // First derived glyph in the run.
+    unsigned derived_gid;
+    unsigned length;
+    // Base glyph for the first glyph in the run. If 'base_advances' is set it
+    // increases along with derived_gid, otherwise it's the same for the whole
+    // run.
+    unsigned base_gid;
+    bool base_advances;
+    // If 'same_gid' is set base_derived_gid == derived_gid, otherwise it's
+    // 'base_derived_gid' for the whole run.
+    bool same_gid;
+    unsigned base_derived_gid;
+    bool is_base_empty;
+  };
+
+  std::vector<GlyphRun> GlyphRuns() const {
     // Notation:
     // base_gid:      glyph id in the base subset glyph space.
     // *_derived_gid: glyph id in the derived subset glyph space.
     // *_old_gid:     glyph id in the original font glyph space.
-
-    while (derived_gid < derived_glyph_count) {
+    std::vector<GlyphRun> runs;
+    unsigned base_gid = 0;
+    for (unsigned derived_gid = 0; derived_gid < derived_glyph_count;
+         derived_gid++) {
       bool is_base_empty = false;
       unsigned base_derived_gid = BaseToDerivedGid(base_gid, &is_base_empty);
       if (is_base_empty && derived_gid == base_derived_gid &&
@@ -158,15 +226,46 @@ class DiffDriver {
         base_derived_gid = HB_MAP_VALUE_INVALID;
       }
 
-      for (auto& range_and_differ : differs) {
-        TableDiffer* differ = range_and_differ.differ.get();
-        TableRange& range = range_and_differ.range;
+      bool base_advances = base_derived_gid == derived_gid ||
+                           (base_gid == derived_gid && is_base_empty);
+      bool same_gid = base_derived_gid == derived_gid;
+
+      GlyphRun* last = runs.empty() ? nullptr : &runs.back();
+      if (last && last->base_advances == base_advances &&
+          last->same_gid == same_gid &&
+          last->is_base_empty == is_base_empty &&
+          (same_gid || last->base_derived_gid == base_derived_gid) &&
+          last->base_gid + (base_advances ? last->length : 0) == base_gid) {
+        last->length++;
+      } else {
+        runs.push_back(GlyphRun{derived_gid, 1, base_gid, base_advances,
+                                same_gid, base_derived_gid, is_base_empty});
+      }
+
+      if (base_advances) {
+        base_gid++;
+      }
+    }
+    return runs;
+  }
+
+  static Status DiffTable(const std::vector<GlyphRun>& runs,
+                          RangeAndDiffer& range_and_differ) {
+    TableDiffer* differ = range_and_differ.differ.get();
+    TableRange& range = range_and_differ.range;
+
+    for (const GlyphRun& run : runs) {
+      for (unsigned i = 0; i < run.length; i++) {
+        unsigned derived_gid = run.derived_gid + i;
+        unsigned base_gid = run.base_gid + (run.base_advances ? i : 0);
+        unsigned base_derived_gid =
+            run.same_gid ? derived_gid : run.base_derived_gid;
 
         bool was_new_data = differ->IsNewData();
         unsigned base_length = 0;
         unsigned derived_length = 0;
-        differ->Process(derived_gid, base_gid, base_derived_gid, is_base_empty,
-                        &base_length, &derived_length);
+        differ->Process(derived_gid, base_gid, base_derived_gid,
+                        run.is_base_empty, &base_length, &derived_length);
 
         if (derived_gid > 0 && was_new_data != differ->IsNewData()) {
           if (was_new_data) {
@@ -181,39 +280,21 @@ class DiffDriver {
 
         range.Extend(base_length, derived_length);
       }
-
-      if (base_derived_gid == derived_gid ||
-          (base_gid == derived_gid && is_base_empty)) {
-        base_gid++;
-      }
-      derived_gid++;
     }
 
     // Finalize and commit any outstanding changes.
-    for (auto& range_and_differ : differs) {
-      TableDiffer* differ = range_and_differ.differ.get();
-      TableRange& range = range_and_differ.range;
-      unsigned base_length = 0;
-      unsigned derived_length = 0;
-      differ->Finalize(&base_length, &derived_length);
-      range.Extend(base_length, derived_length);
-      if (differ->IsNewData()) {
-        Status s = range.CommitNew();
-        if (!s.ok()) {
-          return s;
-        }
-      } else {
-        range.CommitExisting();
-      }
-      range.stream().four_byte_align_uncompressed();
-      out.append(range.stream());
+    unsigned base_length = 0;
+    unsigned derived_length = 0;
+    differ->Finalize(&base_length, &derived_length);
+    range.Extend(base_length, derived_length);
+    if (differ->IsNewData()) {
+      return range.CommitNew();
     }
-
+    range.CommitExisting();
     return absl::OkStatus();
   }
 
- private:
-  unsigned BaseToDerivedGid(unsigned gid, bool* is_base_empty) {
+  unsigned BaseToDerivedGid(unsigned gid, bool* is_base_empty) const {
     if (retain_gids) {
       if (gid < base_glyph_count) {
         // If retain gids is set gids are equivalent in all three spaces.
@@ -269,7 +350,7 @@ void BrotliFontDiff::SortForDiff(const hb_set_t* immutable_tables,
 
 Status BrotliFontDiff::Diff(hb_subset_plan_t* base_plan, hb_blob_t* base,
                             hb_subset_plan_t* derived_plan, hb_blob_t* derived,
-                            FontData* patch) const {
+                            FontData* patch, ThreadPool* pool) const {
   Span<const uint8_t> base_span = TableRange::to_span(base);
   Span<const uint8_t> derived_span = TableRange::to_span(derived);
 
@@ -286,8 +367,10 @@ Status BrotliFontDiff::Diff(hb_subset_plan_t* base_plan, hb_blob_t* base,
   unsigned base_start_offset = 0;
   unsigned base_end_offset = 0;
 
-  DiffDriver diff_driver(base_plan, base_face, derived_plan, derived_face,
-                         custom_diff_tables_.get(), out);
+  DiffDriver diff_driver(hb_subset_plan_new_to_old_glyph_mapping(base_plan),
+                         base_face,
+                         hb_subset_plan_old_to_new_glyph_mapping(derived_plan),
+                         derived_face, custom_diff_tables_.get(), &out);
 
   const hb_set_t* tag_sets[] = {immutable_tables_.get(),
                                 custom_diff_tables_.get()};
@@ -350,7 +433,7 @@ Status BrotliFontDiff::Diff(hb_subset_plan_t* base_plan, hb_blob_t* base,
     return absl::InternalError("dict insert of immutable tables failed.");
   }
 
-  s = diff_driver.MakeDiff();
+  s = diff_driver.MakeDiff(pool);
   if (!s.ok()) {
     return s;
   }
@@ -374,4 +457,26 @@ Status BrotliFontDiff::Diff(hb_subset_plan_t* base_plan, hb_blob_t* base,
   return absl::OkStatus();
 }
 
+Status BrotliFontDiff::DiffTables(const hb_map_t* base_new_to_old,
+                                  hb_face_t* base_face,
+                                  const hb_map_t* derived_old_to_new,
+                                  hb_face_t* derived_face, const hb_set_t* tags,
+                                  flat_hash_map<hb_tag_t, FontData>* patches,
+                                  ThreadPool* pool, unsigned quality) {
+  DiffDriver diff_driver(base_new_to_old, base_face, derived_old_to_new,
+                         derived_face, tags, nullptr, quality);
+  Status s = diff_driver.MakeDiff(pool);
+  if (!s.ok()) {
+    return s;
+  }
+
+  for (auto& range_and_differ : diff_driver.differs) {
+    TableRange& range = range_and_differ.range;
+    Span<const uint8_t> data = range.stream().compressed_data();
+    (*patches)[range.tag()].copy((const char*)data.data(), data.size());
+  }
+
+  return absl::OkStatus();
+}
+
 }  // namespace brotli
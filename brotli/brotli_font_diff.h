@@ -1,9 +1,11 @@
 #ifndef BROTLI_BROTLI_FONT_DIFF_H_
 #define BROTLI_BROTLI_FONT_DIFF_H_
 
+#include "absl/container/flat_hash_map.h"
 #include "absl/status/status.h"
 #include "common/font_data.h"
 #include "common/hb_set_unique_ptr.h"
+#include "common/thread_pool.h"
 #include "hb-subset.h"
 
 namespace brotli {
@@ -26,9 +28,33 @@ class BrotliFontDiff {
       : immutable_tables_(hb_set_copy(immutable_tables), &hb_set_destroy),
         custom_diff_tables_(hb_set_copy(custom_diff_tables), &hb_set_destroy) {}
 
+  /*
+   * If 'pool' is set the glyf, loca, hmtx and vmtx streams are generated
+   * concurrently on it, the patch is the same either way.
+   */
   absl::Status Diff(hb_subset_plan_t* base_plan, hb_blob_t* base,
                     hb_subset_plan_t* derived_plan, hb_blob_t* derived,
-                    common::FontData* patch) const;
+                    common::FontData* patch,
+                    common::ThreadPool* pool = nullptr) const;
+
+  /*
+   * Diffs each of the glyph indexed tables (glyf, loca, hmtx and vmtx) listed
+   * in 'tags' separately. The patch produced for a table decodes to the table
+   * in 'derived_face' using the same table in 'base_face' as the dictionary.
+   *
+   * The glyph id maps are those of the subset plans that produced the two
+   * fonts. Glyphs present in both fonts are referenced from the base table
+   * instead of being compressed again, novel glyph data is compressed at
+   * brotli 'quality' with the base table as the dictionary. Tables which
+   * aren't in both fonts are skipped. If 'pool' is set the tables are diffed
+   * concurrently on it.
+   */
+  static absl::Status DiffTables(
+      const hb_map_t* base_new_to_old, hb_face_t* base_face,
+      const hb_map_t* derived_old_to_new, hb_face_t* derived_face,
+      const hb_set_t* tags,
+      absl::flat_hash_map<hb_tag_t, common::FontData>* patches /* OUT */,
+      common::ThreadPool* pool = nullptr, unsigned quality = 5);
 
  private:
   common::hb_set_unique_ptr immutable_tables_;
@@ -1,19 +1,23 @@
 #include "brotli/brotli_font_diff.h"
 
+#include "absl/container/flat_hash_map.h"
 #include "absl/types/span.h"
 #include "common/brotli_binary_patch.h"
 #include "common/hb_set_unique_ptr.h"
+#include "common/thread_pool.h"
 #include "gtest/gtest.h"
 #include "hb-subset.h"
 
 namespace brotli {
 
+using absl::flat_hash_map;
 using absl::Span;
 using absl::Status;
 using common::BrotliBinaryPatch;
 using common::FontData;
 using common::hb_set_unique_ptr;
 using common::make_hb_set;
+using common::ThreadPool;
 
 const std::string kTestDataDir = "common/testdata/";
 
@@ -191,6 +195,101 @@ TEST_F(BrotliFontDiffTest, LongLoca) {
   hb_blob_destroy(derived_blob);
 }
 
+TEST_F(BrotliFontDiffTest, Diff_Parallel) {
+  hb_set_add_range(hb_subset_input_glyph_set(input), 1000, 5000);
+  hb_subset_plan_t* base_plan =
+      hb_subset_plan_create_or_fail(noto_sans_jp, input);
+  hb_face_t* base_face = hb_subset_plan_execute_or_fail(base_plan);
+  SortTables(noto_sans_jp, base_face);
+  hb_blob_t* base_blob = hb_face_reference_blob(base_face);
+  FontData base(base_face);
+  ASSERT_TRUE(base_plan);
+
+  hb_set_add_range(hb_subset_input_glyph_set(input), 500, 750);
+  hb_set_add_range(hb_subset_input_glyph_set(input), 8000, 8100);
+  hb_subset_plan_t* derived_plan =
+      hb_subset_plan_create_or_fail(noto_sans_jp, input);
+  hb_face_t* derived_face = hb_subset_plan_execute_or_fail(derived_plan);
+  SortTables(noto_sans_jp, derived_face);
+  hb_blob_t* derived_blob = hb_face_reference_blob(derived_face);
+  FontData derived(derived_face);
+  ASSERT_TRUE(derived_plan);
+
+  BrotliFontDiff differ(immutable_tables.get(), custom_tables.get());
+  FontData expected;
+  ASSERT_EQ(
+      differ.Diff(base_plan, base_blob, derived_plan, derived_blob, &expected),
+      absl::OkStatus());
+
+  ThreadPool pool(3);
+  FontData patch;
+  ASSERT_EQ(differ.Diff(base_plan, base_blob, derived_plan, derived_blob,
+                        &patch, &pool),
+            absl::OkStatus());
+  ASSERT_EQ(patch.str(), expected.str());
+  Check(base, patch, derived);
+
+  hb_subset_plan_destroy(base_plan);
+  hb_subset_plan_destroy(derived_plan);
+  hb_face_destroy(base_face);
+  hb_face_destroy(derived_face);
+  hb_blob_destroy(base_blob);
+  hb_blob_destroy(derived_blob);
+}
+
+TEST_F(BrotliFontDiffTest, DiffTables) {
+  hb_set_add_range(hb_subset_input_glyph_set(input), 1000, 5000);
+  hb_subset_plan_t* base_plan =
+      hb_subset_plan_create_or_fail(noto_sans_jp, input);
+  ASSERT_TRUE(base_plan);
+  hb_face_t* base_face = hb_subset_plan_execute_or_fail(base_plan);
+  FontData base(base_face);
+  hb_face_t* base_font = base.reference_face();
+
+  hb_set_add_range(hb_subset_input_glyph_set(input), 500, 750);
+  hb_set_add_range(hb_subset_input_glyph_set(input), 8000, 8100);
+  hb_subset_plan_t* derived_plan =
+      hb_subset_plan_create_or_fail(noto_sans_jp, input);
+  ASSERT_TRUE(derived_plan);
+  hb_face_t* derived_face = hb_subset_plan_execute_or_fail(derived_plan);
+  FontData derived(derived_face);
+  hb_face_t* derived_font = derived.reference_face();
+
+  flat_hash_map<hb_tag_t, FontData> patches;
+  ASSERT_EQ(BrotliFontDiff::DiffTables(
+                hb_subset_plan_new_to_old_glyph_mapping(base_plan), base_font,
+                hb_subset_plan_old_to_new_glyph_mapping(derived_plan),
+                derived_font, custom_tables.get(), &patches),
+            absl::OkStatus());
+
+  // NotoSansJP has no vmtx table.
+  ASSERT_EQ(patches.size(), 3);
+  for (const auto& [tag, patch] : patches) {
+    hb_blob_t* table = hb_face_reference_table(base_font, tag);
+    FontData base_table(table);
+    hb_blob_destroy(table);
+    table = hb_face_reference_table(derived_font, tag);
+    FontData derived_table(table);
+    hb_blob_destroy(table);
+
+    FontData patched;
+    EXPECT_EQ(BrotliBinaryPatch().Patch(base_table, patch, &patched),
+              absl::OkStatus());
+    EXPECT_EQ(patched.str(), derived_table.str());
+    if (tag == HB_TAG('g', 'l', 'y', 'f')) {
+      // Most of the derived glyphs are referenced from the base.
+      EXPECT_LT(patch.size(), derived_table.size() / 2);
+    }
+  }
+
+  hb_subset_plan_destroy(base_plan);
+  hb_subset_plan_destroy(derived_plan);
+  hb_face_destroy(base_face);
+  hb_face_destroy(derived_face);
+  hb_face_destroy(base_font);
+  hb_face_destroy(derived_font);
+}
+
 TEST_F(BrotliFontDiffTest, ShortToLongLoca) {
   hb_set_add_range(hb_subset_input_glyph_set(input), 1000, 1200);
   hb_subset_plan_t* base_plan =
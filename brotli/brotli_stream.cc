@@ -217,6 +217,31 @@ Status BrotliStream::insert_compressed_with_partial_dict(
     partial_dict = partial_dict.subspan(0, dictionary_size_);
   }
 
+  DictionaryPointer dictionary(nullptr, nullptr);
+  if (partial_dict.size() > 0) {
+    dictionary = SharedBrotliEncoder::CreateDictionary(partial_dict);
+    if (!dictionary) {
+      return absl::InternalError("Failed to create brotli dictionary.");
+    }
+  }
+
+  return insert_compressed(bytes, dictionary.get(), partial_dict.size());
+}
+
+Status BrotliStream::insert_compressed_with_dict(
+    Span<const uint8_t> bytes,
+    const BrotliEncoderPreparedDictionary* dictionary) {
+  return insert_compressed(bytes, dictionary, dictionary_size_);
+}
+
+Status BrotliStream::insert_compressed(
+    Span<const uint8_t> bytes,
+    const BrotliEncoderPreparedDictionary* dictionary,
+    unsigned dictionary_prefix_size) {
+  if (!bytes.size()) {
+    return absl::OkStatus();
+  }
+
   if (!uncompressed_size_ && dictionary_size_) {
     // If uncompressed size is zero but the dict is non-zero then
     // the brotli encoder call would add a stream header as would normally
@@ -228,19 +253,11 @@ Status BrotliStream::insert_compressed_with_partial_dict(
   // the regular brotli encoder which will start byte aligned.
   byte_align();
 
-  DictionaryPointer dictionary(nullptr, nullptr);
-  if (partial_dict.size() > 0) {
-    dictionary = SharedBrotliEncoder::CreateDictionary(partial_dict);
-    if (!dictionary) {
-      return absl::InternalError("Failed to create brotli dictionary.");
-    }
-  }
-
   // dictionary_size is added to the stream offset so that static dictionary
   // references (which are window + dictionary size + static word id) will be
   // created with the right distance.
   unsigned stream_offset =
-      uncompressed_size_ + dictionary_size_ - partial_dict.size();
+      uncompressed_size_ + dictionary_size_ - dictionary_prefix_size;
 
   if (stream_offset > window_size_) {
     // this trick fails if stream_offset > window size since
@@ -250,7 +267,7 @@ Status BrotliStream::insert_compressed_with_partial_dict(
     return absl::InternalError("stream offset exceeds window size.");
   }
 
-  EncoderStatePointer state = create_encoder(stream_offset, dictionary.get());
+  EncoderStatePointer state = create_encoder(stream_offset, dictionary);
   if (!state) {
     return absl::InternalError("Failed to create brotli encoder.");
   }
@@ -284,8 +301,8 @@ void BrotliStream::end_stream() {
 EncoderStatePointer BrotliStream::create_encoder(
     unsigned stream_offset,
     const BrotliEncoderPreparedDictionary* dictionary) const {
-  EncoderStatePointer state =
-      SharedBrotliEncoder::CreateEncoder(5, 0, stream_offset, dictionary);
+  EncoderStatePointer state = SharedBrotliEncoder::CreateEncoder(
+      quality_, 0, stream_offset, dictionary);
   if (!state) {
     return state;
   }
@@ -15,13 +15,15 @@ namespace brotli {
  */
 class BrotliStream {
  public:
+  // 'quality' is the brotli quality used for the compressed inserts.
   BrotliStream(unsigned window_bits, unsigned dictionary_size = 0,
-               unsigned starting_offset = 0)
+               unsigned starting_offset = 0, unsigned quality = 5)
       : starting_offset_(starting_offset),
         uncompressed_size_(starting_offset),
         window_bits_(std::max(std::min(window_bits, 24u), 10u)),
         window_size_((1 << window_bits_) - 16),
         dictionary_size_(dictionary_size),
+        quality_(quality),
         buffer_() {}
 
   static unsigned WindowBitsFor(unsigned base_size, unsigned derived_size) {
@@ -49,6 +51,13 @@ class BrotliStream {
   absl::Status insert_compressed_with_partial_dict(
       absl::Span<const uint8_t> bytes, absl::Span<const uint8_t> partial_dict);
 
+  // Insert bytes and compress them using the full dictionary, 'dictionary'
+  // must have been prepared from the dictionary bytes [0, dictionary_size()).
+  // The prepared dictionary can be reused between calls.
+  absl::Status insert_compressed_with_dict(
+      absl::Span<const uint8_t> bytes,
+      const BrotliEncoderPreparedDictionary* dictionary);
+
   // Appends another stream onto this one. The other stream must have been
   // started with a starting_offset == this.uncompressed_size_.
   void append(BrotliStream& other) {
@@ -91,6 +100,13 @@ class BrotliStream {
       unsigned stream_offset,
       const BrotliEncoderPreparedDictionary* dictionary) const;
 
+  // Compresses bytes where 'dictionary' covers the dictionary bytes
+  // [0, dictionary_prefix_size).
+  absl::Status insert_compressed(
+      absl::Span<const uint8_t> bytes,
+      const BrotliEncoderPreparedDictionary* dictionary,
+      unsigned dictionary_prefix_size);
+
   bool add_mlen(unsigned size);
 
   void add_stream_header();
@@ -102,6 +118,7 @@ class BrotliStream {
   unsigned window_bits_;
   unsigned window_size_;
   unsigned dictionary_size_;
+  unsigned quality_;
   BrotliBitBuffer buffer_;
 };
 
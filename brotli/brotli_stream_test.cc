@@ -1,6 +1,9 @@
 #include "brotli/brotli_stream.h"
 
+#include <vector>
+
 #include "absl/types/span.h"
+#include "brotli/shared_brotli_encoder.h"
 #include "common/brotli_binary_patch.h"
 #include "gtest/gtest.h"
 
@@ -116,6 +119,38 @@ TEST_F(BrotliStreamTest, InsertMultipleCompressedWithPartialDict) {
   CheckDecompressesTo(stream, data, dict);
 }
 
+TEST_F(BrotliStreamTest, InsertCompressedWithPreparedDict) {
+  std::vector<uint8_t> dict;
+  for (unsigned i = 0; i < 500; i++) {
+    dict.push_back(i % 256);
+  }
+  DictionaryPointer prepared = SharedBrotliEncoder::CreateDictionary(dict, 9);
+  ASSERT_TRUE(prepared);
+
+  std::vector<uint8_t> data;
+  data.insert(data.end(), dict.begin() + 300, dict.begin() + 310);
+  data.insert(data.end(), dict.begin() + 5, dict.begin() + 155);
+  data.insert(data.end(), dict.begin() + 200, dict.begin() + 350);
+
+  // The prepared dictionary is reused and used part way through the stream.
+  BrotliStream stream(22, dict.size(), 0, 9);
+  stream.insert_uncompressed(Span<const uint8_t>(data).subspan(0, 10));
+  ASSERT_TRUE(stream
+                  .insert_compressed_with_dict(
+                      Span<const uint8_t>(data).subspan(10, 150),
+                      prepared.get())
+                  .ok());
+  ASSERT_TRUE(stream
+                  .insert_compressed_with_dict(
+                      Span<const uint8_t>(data).subspan(160, 150),
+                      prepared.get())
+                  .ok());
+  stream.end_stream();
+
+  EXPECT_LT(stream.compressed_data().size(), 100);
+  CheckDecompressesTo(stream, data, dict);
+}
+
 TEST_F(BrotliStreamTest, InsertUncompressed) {
   BrotliStream stream(22);
   uint8_t data[] = {'H', 'e', 'l', 'l', 'o', ' ', 'w', 'o', 'r', 'l', 'd'};
@@ -6,6 +6,7 @@
 #include "absl/log/log.h"
 #include "absl/strings/string_view.h"
 #include "absl/types/span.h"
+#include "brotli/brotli_allocator.h"
 #include "brotli/encode.h"
 
 namespace brotli {
@@ -17,23 +18,38 @@ typedef std::unique_ptr<BrotliEncoderPreparedDictionary,
                         decltype(&BrotliEncoderDestroyPreparedDictionary)>
     DictionaryPointer;
 
-/* A collection of utilities that ease using the existing brotli encoder API. */
+/*
+ * A collection of utilities that ease using the existing brotli encoder API.
+ *
+ * Encoders and dictionaries are allocated with BrotliAllocator::Shared(), so
+ * their memory is recycled between instances.
+ */
 class SharedBrotliEncoder {
  public:
-  static DictionaryPointer CreateDictionary(absl::Span<const uint8_t> data) {
+  static DictionaryPointer CreateDictionary(
+      absl::Span<const uint8_t> data, unsigned quality = BROTLI_MAX_QUALITY) {
     return DictionaryPointer(
         BrotliEncoderPrepareDictionary(
-            BROTLI_SHARED_DICTIONARY_RAW, data.size(), data.data(),
-            BROTLI_MAX_QUALITY, nullptr, nullptr, nullptr),
+            BROTLI_SHARED_DICTIONARY_RAW, data.size(), data.data(), quality,
+            &BrotliAllocator::Alloc, &BrotliAllocator::Free,
+            &BrotliAllocator::Shared()),
         &BrotliEncoderDestroyPreparedDictionary);
   }
 
+  // If window_bits is 0 the brotli default window size is used.
   static EncoderStatePointer CreateEncoder(
       unsigned quality, size_t font_size, unsigned stream_offset,
-      const BrotliEncoderPreparedDictionary* dictionary) {
+      const BrotliEncoderPreparedDictionary* dictionary,
+      unsigned window_bits = 0) {
     EncoderStatePointer state = EncoderStatePointer(
-        BrotliEncoderCreateInstance(nullptr, nullptr, nullptr),
+        BrotliEncoderCreateInstance(&BrotliAllocator::Alloc,
+                                    &BrotliAllocator::Free,
+                                    &BrotliAllocator::Shared()),
         &BrotliEncoderDestroyInstance);
+    if (!state) {
+      LOG(WARNING) << "Failed to create brotli encoder.";
+      return state;
+    }
 
     if (!BrotliEncoderSetParameter(state.get(), BROTLI_PARAM_QUALITY,
                                    quality)) {
@@ -41,6 +57,12 @@ class SharedBrotliEncoder {
       return EncoderStatePointer(nullptr, nullptr);
     }
 
+    if (window_bits && !BrotliEncoderSetParameter(
+                           state.get(), BROTLI_PARAM_LGWIN, window_bits)) {
+      LOG(WARNING) << "Failed to set brotli window size.";
+      return EncoderStatePointer(nullptr, nullptr);
+    }
+
     if (font_size && !BrotliEncoderSetParameter(
                          state.get(), BROTLI_PARAM_SIZE_HINT, font_size)) {
       LOG(WARNING) << "Failed to set brotli size hint.";
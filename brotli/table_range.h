@@ -59,8 +59,29 @@ class TableRange {
     tag_ = tag;
   }
 
+  // A range whose stream is independent of the rest of the font: it decodes
+  // to just the derived table, with the base table as the dictionary. New
+  // data is compressed at 'quality' and may reference the base table.
+  TableRange(hb_face_t* base_face, hb_face_t* derived_face, hb_tag_t tag,
+             unsigned quality) {
+    derived_ = to_span(derived_face, tag);
+    base_ = to_span(base_face, tag);
+
+    out.reset(new BrotliStream(
+        BrotliStream::WindowBitsFor(base_.size(), derived_.size()),
+        base_.size(), 0, quality));
+
+    base_table_offset_ = 0;
+    tag_ = tag;
+    quality_ = quality;
+  }
+
  private:
   absl::Span<const uint8_t> derived_;
+  // Only set for independent ranges, prepared on the first new data.
+  absl::Span<const uint8_t> base_;
+  DictionaryPointer base_dictionary_{nullptr, nullptr};
+  unsigned quality_ = 0;
 
   unsigned base_table_offset_;
   unsigned base_offset_ = 0;
@@ -85,8 +106,21 @@ class TableRange {
   }
 
   absl::Status CommitNew() {
-    absl::Status s = out->insert_compressed(absl::Span<const uint8_t>(
-        derived_.data() + derived_offset_, derived_length_));
+    absl::Span<const uint8_t> bytes(derived_.data() + derived_offset_,
+                                    derived_length_);
+    absl::Status s;
+    if (!base_.empty() && !bytes.empty()) {
+      if (!base_dictionary_) {
+        base_dictionary_ =
+            SharedBrotliEncoder::CreateDictionary(base_, quality_);
+        if (!base_dictionary_) {
+          return absl::InternalError("Failed to create brotli dictionary.");
+        }
+      }
+      s = out->insert_compressed_with_dict(bytes, base_dictionary_.get());
+    } else {
+      s = out->insert_compressed(bytes);
+    }
     if (!s.ok()) {
       return s;
     }
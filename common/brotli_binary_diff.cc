@@ -5,6 +5,7 @@
 #include "absl/log/log.h"
 #include "absl/status/status.h"
 #include "brotli/shared_brotli_encoder.h"
+#include "common/brotli_dictionary_cache.h"
 #include "common/font_data.h"
 
 namespace common {
@@ -38,9 +39,18 @@ Status BrotliBinaryDiff::Diff(const FontData& font_base, string_view data,
   // There's a decent amount of overhead in creating a dictionary, even if it's
   // completely empty. So don't set a dictionary unless it's non-empty.
   DictionaryPointer dictionary(nullptr, nullptr);
+  BrotliDictionaryCache::Dictionary cached_dictionary;
+  const BrotliEncoderPreparedDictionary* prepared = nullptr;
   if (font_base.size() > 0) {
-    dictionary = SharedBrotliEncoder::CreateDictionary(font_base.span());
-    if (!dictionary) {
+    if (dictionary_cache_) {
+      cached_dictionary = dictionary_cache_->Get(font_base, quality_);
+      prepared = cached_dictionary.get();
+    } else {
+      dictionary =
+          SharedBrotliEncoder::CreateDictionary(font_base.span(), quality_);
+      prepared = dictionary.get();
+    }
+    if (!prepared) {
       return absl::InternalError("Failed to create the shared dictionary.");
     }
   }
@@ -48,7 +58,7 @@ Status BrotliBinaryDiff::Diff(const FontData& font_base, string_view data,
   // Don't give the encoder an estimated size if this is not all the data.
   unsigned data_size = !stream_offset && is_last ? data.size() : 0;
   EncoderStatePointer state = SharedBrotliEncoder::CreateEncoder(
-      quality_, data_size, stream_offset, dictionary.get());
+      quality_, data_size, stream_offset, prepared, window_bits_);
   if (!state) {
     return absl::InternalError("Failed to create the encoder.");
   }
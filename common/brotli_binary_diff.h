@@ -5,6 +5,7 @@
 
 #include "absl/status/status.h"
 #include "common/binary_diff.h"
+#include "common/brotli_dictionary_cache.h"
 #include "common/font_data.h"
 
 namespace common {
@@ -13,8 +14,15 @@ namespace common {
 // with a shared dictionary.
 class BrotliBinaryDiff : public BinaryDiff {
  public:
-  BrotliBinaryDiff() : quality_(9) {}
-  BrotliBinaryDiff(unsigned quality) : quality_(quality) {}
+  BrotliBinaryDiff() : quality_(9), window_bits_(0) {}
+  // If window_bits is 0 the brotli default window size is used. If
+  // 'dictionary_cache' is provided (not owned) prepared dictionaries for the
+  // base are taken from it.
+  BrotliBinaryDiff(unsigned quality, unsigned window_bits = 0,
+                   BrotliDictionaryCache* dictionary_cache = nullptr)
+      : quality_(quality),
+        window_bits_(window_bits),
+        dictionary_cache_(dictionary_cache) {}
 
   absl::Status Diff(const FontData& font_base, const FontData& font_derived,
                     FontData* patch /* OUT */) const override;
@@ -24,8 +32,12 @@ class BrotliBinaryDiff : public BinaryDiff {
                     unsigned stream_offset, bool is_last,
                     std::vector<uint8_t>& sink) const;
 
+  unsigned quality() const { return quality_; }
+
  private:
   unsigned quality_;
+  unsigned window_bits_;
+  BrotliDictionaryCache* dictionary_cache_ = nullptr;
 };
 
 }  // namespace common
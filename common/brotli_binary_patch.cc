@@ -1,9 +1,13 @@
 #include "common/brotli_binary_patch.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
 #include <vector>
 
 #include "absl/log/log.h"
 #include "absl/status/status.h"
+#include "brotli/brotli_allocator.h"
 #include "brotli/decode.h"
 #include "common/binary_patch.h"
 #include "common/font_data.h"
@@ -16,11 +20,21 @@ namespace common {
 
 using absl::Status;
 using absl::string_view;
+using brotli::BrotliAllocator;
 
 DecoderStatePointer CreateDecoder(const FontData& base) {
+  // Attaching a raw dictionary only records a pointer to it, the expensive
+  // part of a decoder is its ring buffer. That is recycled between sequential
+  // patches by the shared allocator.
   DecoderStatePointer state = DecoderStatePointer(
-      BrotliDecoderCreateInstance(nullptr, nullptr, nullptr),
+      BrotliDecoderCreateInstance(&BrotliAllocator::Alloc,
+                                  &BrotliAllocator::Free,
+                                  &BrotliAllocator::Shared()),
       &BrotliDecoderDestroyInstance);
+  if (!state) {
+    LOG(WARNING) << "Failed to create brotli decoder.";
+    return state;
+  }
 
   if (!BrotliDecoderAttachDictionary(
           state.get(), BROTLI_SHARED_DICTIONARY_RAW, base.size(),
@@ -100,6 +114,46 @@ Status BrotliBinaryPatch::Patch(const FontData& font_base,
   return absl::OkStatus();
 }
 
+Status BrotliBinaryPatch::Patch(const FontData& font_base,
+                                const FontData& patch,
+                                uint32_t max_uncompressed_length,
+                                FontData* font_derived /* OUT */) const {
+  DecoderStatePointer state = CreateDecoder(font_base);
+  if (!state) {
+    return absl::InternalError("Decoder creation failed.");
+  }
+
+  // Ownership is passed to the blob held by font_derived.
+  uint8_t* buffer = reinterpret_cast<uint8_t*>(
+      malloc(std::max(max_uncompressed_length, (uint32_t)1)));
+  if (!buffer) {
+    return absl::ResourceExhaustedError("Failed to allocate patch output.");
+  }
+
+  size_t available_in = patch.size();
+  const uint8_t* next_in = reinterpret_cast<const uint8_t*>(patch.data());
+  size_t available_out = max_uncompressed_length;
+  uint8_t* next_out = buffer;
+  BrotliDecoderResult result = BrotliDecoderDecompressStream(
+      state.get(), &available_in, &next_in, &available_out, &next_out,
+      nullptr);
+  if (result == BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT) {
+    free(buffer);
+    return absl::InvalidArgumentError(
+        "Decoded patch exceeds the max uncompressed length.");
+  }
+  if (result != BROTLI_DECODER_RESULT_SUCCESS || available_in) {
+    free(buffer);
+    return absl::InternalError("Brotli decoder failed.");
+  }
+
+  uint32_t length = max_uncompressed_length - available_out;
+  *font_derived = FontData(make_hb_blob(
+      hb_blob_create(reinterpret_cast<const char*>(buffer), length,
+                     HB_MEMORY_MODE_READONLY, buffer, &free)));
+  return absl::OkStatus();
+}
+
 Status BrotliBinaryPatch::Patch(const FontData& font_base,
                                 const std::vector<FontData>& patch,
                                 FontData* font_derived) const {
@@ -1,6 +1,8 @@
 #ifndef COMMON_BROTLI_BINARY_PATCH_H_
 #define COMMON_BROTLI_BINARY_PATCH_H_
 
+#include <cstdint>
+
 #include "absl/status/status.h"
 #include "common/binary_patch.h"
 #include "common/font_data.h"
@@ -17,6 +19,15 @@ class BrotliBinaryPatch : public BinaryPatch {
   absl::Status Patch(const FontData& font_base,
                      const std::vector<FontData>& patch,
                      FontData* font_derived) const override;
+
+  // Applies 'patch' when an upper bound on the decoded size is known, such as
+  // the max uncompressed length field of IFT patches. The output is decoded
+  // directly into a single allocation of 'max_uncompressed_length' bytes which
+  // is then owned by 'font_derived' without copying. Fails if the decoded data
+  // would be longer than 'max_uncompressed_length'.
+  absl::Status Patch(const FontData& font_base, const FontData& patch,
+                     uint32_t max_uncompressed_length,
+                     FontData* font_derived /* OUT */) const;
 };
 
 }  // namespace common
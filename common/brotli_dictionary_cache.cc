@@ -0,0 +1,85 @@
+#include "common/brotli_dictionary_cache.h"
+
+#include <cstdint>
+#include <memory>
+
+#include "absl/hash/hash.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "brotli/shared_brotli_encoder.h"
+#include "common/font_data.h"
+
+using absl::string_view;
+using brotli::SharedBrotliEncoder;
+
+namespace common {
+
+BrotliDictionaryCache::Dictionary BrotliDictionaryCache::Get(
+    const FontData& data, unsigned quality) {
+  Key key(absl::Hash<string_view>()(data.str()), quality);
+  {
+    absl::MutexLock lock(&mutex_);
+    auto it = entries_.find(key);
+    if (it != entries_.end() && it->second.prepared->data == data) {
+      hits_++;
+      lru_.erase(it->second.last_used);
+      it->second.last_used = clock_++;
+      lru_[it->second.last_used] = key;
+      return Dictionary(it->second.prepared,
+                        it->second.prepared->dictionary.get());
+    }
+    misses_++;
+  }
+
+  // Prepared without holding the lock so that other threads aren't blocked.
+  auto prepared = std::make_shared<Prepared>();
+  prepared->data.copy(data.str());
+  prepared->dictionary =
+      SharedBrotliEncoder::CreateDictionary(prepared->data.span(), quality);
+  if (!prepared->dictionary) {
+    return nullptr;
+  }
+  Dictionary dictionary(prepared, prepared->dictionary.get());
+
+  absl::MutexLock lock(&mutex_);
+  auto [it, inserted] = entries_.try_emplace(key);
+  if (!inserted) {
+    // Either another thread prepared the same data first, or the hash
+    // collided with different data. In both cases the existing entry is kept.
+    return dictionary;
+  }
+
+  it->second.prepared = std::move(prepared);
+  it->second.last_used = clock_++;
+  lru_[it->second.last_used] = key;
+  total_size_ += data.size();
+  EvictIfNeeded();
+  return dictionary;
+}
+
+uint64_t BrotliDictionaryCache::SizeBytes() {
+  absl::MutexLock lock(&mutex_);
+  return total_size_;
+}
+
+uint32_t BrotliDictionaryCache::Hits() {
+  absl::MutexLock lock(&mutex_);
+  return hits_;
+}
+
+uint32_t BrotliDictionaryCache::Misses() {
+  absl::MutexLock lock(&mutex_);
+  return misses_;
+}
+
+void BrotliDictionaryCache::EvictIfNeeded() {
+  while (total_size_ > max_size_bytes_ && !lru_.empty()) {
+    auto oldest = lru_.begin();
+    auto it = entries_.find(oldest->second);
+    total_size_ -= it->second.prepared->data.size();
+    entries_.erase(it);
+    lru_.erase(oldest);
+  }
+}
+
+}  // namespace common
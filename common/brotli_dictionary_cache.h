@@ -0,0 +1,82 @@
+#ifndef COMMON_BROTLI_DICTIONARY_CACHE_H_
+#define COMMON_BROTLI_DICTIONARY_CACHE_H_
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/btree_map.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/synchronization/mutex.h"
+#include "brotli/encode.h"
+#include "brotli/shared_brotli_encoder.h"
+#include "common/font_data.h"
+
+namespace common {
+
+/*
+ * An in memory cache of prepared brotli dictionaries, keyed by the dictionary
+ * bytes and the quality it was prepared at. Preparing a dictionary is
+ * expensive for large inputs, this allows diffs which share a base (for
+ * example all of the patches leaving one node of an IFT patch graph) to
+ * prepare it only once.
+ *
+ * Once the total size of the cached dictionary data exceeds the configured
+ * maximum the least recently used entries are removed. Prepared dictionaries
+ * are reference counted, so evicting one that is still in use is safe.
+ *
+ * Safe to use from multiple threads.
+ */
+class BrotliDictionaryCache {
+ public:
+  typedef std::shared_ptr<const BrotliEncoderPreparedDictionary> Dictionary;
+
+  // The size limit counts the dictionary bytes, the prepared form uses a
+  // few times more memory than that.
+  explicit BrotliDictionaryCache(uint64_t max_size_bytes = 64 << 20)
+      : max_size_bytes_(max_size_bytes) {}
+
+  /*
+   * Returns the dictionary for 'data' prepared at 'quality', preparing it if
+   * it's not cached. Returns null if preparation failed. Concurrent misses on
+   * the same data may each prepare it.
+   */
+  Dictionary Get(const FontData& data, unsigned quality);
+
+  uint64_t SizeBytes();
+  uint32_t Hits();
+  uint32_t Misses();
+
+ private:
+  // Hash of the data, quality.
+  typedef std::pair<uint64_t, unsigned> Key;
+
+  struct Prepared {
+    // The prepared dictionary refers to the data, so a copy is kept with it.
+    FontData data;
+    brotli::DictionaryPointer dictionary{nullptr, nullptr};
+  };
+
+  struct Entry {
+    std::shared_ptr<const Prepared> prepared;
+    uint64_t last_used = 0;
+  };
+
+  void EvictIfNeeded() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  const uint64_t max_size_bytes_;
+
+  absl::Mutex mutex_;
+  absl::flat_hash_map<Key, Entry> entries_ ABSL_GUARDED_BY(mutex_);
+  // last used -> key, the front is the least recently used entry.
+  absl::btree_map<uint64_t, Key> lru_ ABSL_GUARDED_BY(mutex_);
+  uint64_t clock_ ABSL_GUARDED_BY(mutex_) = 0;
+  uint64_t total_size_ ABSL_GUARDED_BY(mutex_) = 0;
+  uint32_t hits_ ABSL_GUARDED_BY(mutex_) = 0;
+  uint32_t misses_ ABSL_GUARDED_BY(mutex_) = 0;
+};
+
+}  // namespace common
+
+#endif  // COMMON_BROTLI_DICTIONARY_CACHE_H_
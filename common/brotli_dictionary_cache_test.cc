@@ -0,0 +1,100 @@
+#include "common/brotli_dictionary_cache.h"
+
+#include <memory>
+
+#include "absl/status/status.h"
+#include "brotli/shared_brotli_encoder.h"
+#include "common/brotli_binary_diff.h"
+#include "common/brotli_binary_patch.h"
+#include "common/file_font_provider.h"
+#include "common/font_data.h"
+#include "gtest/gtest.h"
+
+namespace common {
+
+class BrotliDictionaryCacheTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    FileFontProvider font_provider("common/testdata/");
+    EXPECT_EQ(font_provider.GetFont("Roboto-Regular.Meows.ttf", &subset_a_),
+              absl::OkStatus());
+    EXPECT_EQ(font_provider.GetFont("Roboto-Regular.Awesome.ttf", &subset_b_),
+              absl::OkStatus());
+  }
+
+  FontData subset_a_;
+  FontData subset_b_;
+};
+
+TEST_F(BrotliDictionaryCacheTest, Get) {
+  BrotliDictionaryCache cache;
+
+  auto a = cache.Get(subset_a_, 11);
+  ASSERT_NE(a, nullptr);
+  ASSERT_EQ(cache.Misses(), 1);
+  ASSERT_EQ(cache.Hits(), 0);
+
+  // Equal data hits, even if it's a different buffer.
+  FontData a_copy;
+  a_copy.copy(subset_a_.str());
+  ASSERT_EQ(cache.Get(a_copy, 11), a);
+  ASSERT_EQ(cache.Hits(), 1);
+
+  // Different data or quality misses.
+  auto b = cache.Get(subset_b_, 11);
+  ASSERT_NE(b, nullptr);
+  ASSERT_NE(b, a);
+  auto a_q5 = cache.Get(subset_a_, 5);
+  ASSERT_NE(a_q5, nullptr);
+  ASSERT_NE(a_q5, a);
+
+  ASSERT_EQ(cache.Misses(), 3);
+  ASSERT_EQ(cache.Hits(), 1);
+  ASSERT_EQ(cache.SizeBytes(), 2 * subset_a_.size() + subset_b_.size());
+}
+
+TEST_F(BrotliDictionaryCacheTest, Eviction) {
+  BrotliDictionaryCache cache(subset_a_.size() + subset_b_.size());
+
+  auto a = cache.Get(subset_a_, 11);
+  cache.Get(subset_b_, 11);
+  ASSERT_EQ(cache.SizeBytes(), subset_a_.size() + subset_b_.size());
+
+  // a is the least recently used, so is evicted.
+  cache.Get(subset_a_, 5);
+  ASSERT_EQ(cache.SizeBytes(), subset_b_.size() + subset_a_.size());
+  cache.Get(subset_b_, 11);
+  ASSERT_EQ(cache.Hits(), 1);
+  cache.Get(subset_a_, 11);
+  ASSERT_EQ(cache.Hits(), 1);
+
+  // Evicted dictionaries remain usable by holders.
+  auto state = brotli::SharedBrotliEncoder::CreateEncoder(11, 0, 0, a.get());
+  ASSERT_NE(state, nullptr);
+}
+
+TEST_F(BrotliDictionaryCacheTest, CachedDiff) {
+  BrotliDictionaryCache cache;
+  BrotliBinaryDiff cached_differ(11, 0, &cache);
+  BrotliBinaryDiff differ(11);
+
+  FontData expected;
+  ASSERT_EQ(differ.Diff(subset_a_, subset_b_, &expected), absl::OkStatus());
+
+  for (int i = 0; i < 2; i++) {
+    FontData patch;
+    ASSERT_EQ(cached_differ.Diff(subset_a_, subset_b_, &patch),
+              absl::OkStatus());
+    ASSERT_EQ(patch.str(), expected.str());
+
+    FontData patched;
+    ASSERT_EQ(BrotliBinaryPatch().Patch(subset_a_, patch, &patched),
+              absl::OkStatus());
+    ASSERT_EQ(patched.str(), subset_b_.str());
+  }
+
+  ASSERT_EQ(cache.Misses(), 1);
+  ASSERT_EQ(cache.Hits(), 1);
+}
+
+}  // namespace common
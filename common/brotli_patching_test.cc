@@ -65,6 +65,28 @@ TEST_F(BrotliPatchingTest, DiffAndPatch) {
   EXPECT_EQ(Span<const char>(patched), Span<const char>(subset_b_));
 }
 
+TEST_F(BrotliPatchingTest, DiffAndPatch_MaxUncompressedLength) {
+  FontData patch;
+  EXPECT_EQ(diff_->Diff(subset_a_, subset_b_, &patch), absl::OkStatus());
+
+  BrotliBinaryPatch patcher;
+  for (uint32_t max_length : {subset_b_.size(), subset_b_.size() + 100}) {
+    FontData patched;
+    EXPECT_EQ(patcher.Patch(subset_a_, patch, max_length, &patched),
+              absl::OkStatus());
+    EXPECT_EQ(Span<const char>(patched), Span<const char>(subset_b_));
+  }
+
+  FontData patched;
+  EXPECT_TRUE(absl::IsInvalidArgument(
+      patcher.Patch(subset_a_, patch, subset_b_.size() - 1, &patched)));
+
+  FontData empty;
+  EXPECT_EQ(diff_->Diff(empty, empty, &patch), absl::OkStatus());
+  EXPECT_EQ(patcher.Patch(empty, patch, 0, &patched), absl::OkStatus());
+  EXPECT_TRUE(patched.empty());
+}
+
 TEST_F(BrotliPatchingTest, StitchingWithEmptyBase) {
   FontData empty;
 
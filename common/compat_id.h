@@ -3,6 +3,7 @@
 
 #include <cstdint>
 #include <iostream>
+#include <utility>
 
 #include "common/font_helper.h"
 
@@ -41,6 +42,12 @@ class CompatId {
            value_[2] == other.value_[2] && value_[3] == other.value_[3];
   }
 
+  template <typename H>
+  friend H AbslHashValue(H h, const CompatId& id) {
+    return H::combine(std::move(h), id.value_[0], id.value_[1], id.value_[2],
+                      id.value_[3]);
+  }
+
  private:
   uint32_t value_[4];
 };
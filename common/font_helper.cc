@@ -1,6 +1,7 @@
 #include "common/font_helper.h"
 
 #include <cstdint>
+#include <optional>
 
 #include "absl/container/btree_set.h"
 #include "absl/container/flat_hash_map.h"
@@ -9,6 +10,7 @@
 #include "common/font_data.h"
 #include "common/hb_set_unique_ptr.h"
 #include "common/indexed_data_reader.h"
+#include "common/try.h"
 #include "hb-ot.h"
 #include "hb-subset.h"
 #include "hb.h"
@@ -128,6 +130,217 @@ StatusOr<uint32_t> FontHelper::GvarSharedTupleCount(const hb_face_t* face) {
   return *count;
 }
 
+namespace {
+
+struct CffIndex {
+  FontHelper::CffCharStrings entries;
+  // Total size of the INDEX in bytes.
+  uint32_t size = 0;
+};
+
+// Reads the header of the CFF INDEX at the start of data. CFF2 INDEXes use a
+// 32 bit count instead of a 16 bit one.
+StatusOr<CffIndex> ReadCffIndex(string_view data, bool is_cff2) {
+  CffIndex index;
+  uint32_t count_size = is_cff2 ? 4 : 2;
+  if (is_cff2) {
+    index.entries.count = TRY(FontHelper::ReadUInt32(data));
+  } else {
+    index.entries.count = TRY(FontHelper::ReadUInt16(data));
+  }
+  if (!index.entries.count) {
+    // Empty INDEX has only the count field.
+    index.size = count_size;
+    return index;
+  }
+
+  index.entries.offset_size =
+      TRY(FontHelper::ReadUInt8(data.substr(count_size)));
+  if (index.entries.offset_size < 1 || index.entries.offset_size > 4) {
+    return absl::InvalidArgumentError(
+        StrCat("Invalid CFF INDEX offSize: ", (int)index.entries.offset_size));
+  }
+
+  uint64_t offsets_size =
+      (uint64_t)(index.entries.count + 1) * index.entries.offset_size;
+  uint64_t header_size = count_size + 1 + offsets_size;
+  if (header_size > data.size()) {
+    return absl::InvalidArgumentError("CFF INDEX offsets exceed the table.");
+  }
+
+  index.entries.offsets = data.substr(count_size + 1, offsets_size);
+  index.entries.data = data.substr(header_size - 1);
+
+  // The last offset is one past the end of the INDEX data.
+  uint32_t last_offset = 0;
+  for (uint32_t i = offsets_size - index.entries.offset_size;
+       i < offsets_size; i++) {
+    last_offset = (last_offset << 8) | (uint8_t)index.entries.offsets[i];
+  }
+  if (last_offset < 1 || last_offset > index.entries.data.size()) {
+    return absl::InvalidArgumentError("CFF INDEX data exceeds the table.");
+  }
+  index.size = header_size - 1 + last_offset;
+  return index;
+}
+
+struct CharStringsOperand {
+  uint32_t value = 0;
+  // Offset within the DICT of the 4 byte value of a 5 byte integer operand.
+  std::optional<uint32_t> long_int_offset;
+};
+
+// Finds the operand of the CharStrings (17) operator in a Top DICT.
+StatusOr<CharStringsOperand> FindCharStringsOffset(string_view dict) {
+  constexpr uint8_t kCharStringsOp = 17;
+  int64_t last_operand = -1;
+  uint32_t last_operand_start = 0;
+  uint32_t i = 0;
+  while (i < dict.size()) {
+    uint8_t b0 = dict[i];
+    if (b0 > 21) {
+      last_operand_start = i;
+    }
+    if (b0 <= 21) {
+      // Operator, 12 is the escape for two byte operators.
+      if (b0 == 12) {
+        i += 2;
+        last_operand = -1;
+        continue;
+      }
+      if (b0 == kCharStringsOp) {
+        if (last_operand < 0) {
+          return absl::InvalidArgumentError(
+              "Invalid CharStrings offset in CFF Top DICT.");
+        }
+        CharStringsOperand operand{(uint32_t)last_operand};
+        if ((uint8_t)dict[last_operand_start] == 29) {
+          operand.long_int_offset = last_operand_start + 1;
+        }
+        return operand;
+      }
+      i++;
+      last_operand = -1;
+    } else if (b0 == 28) {
+      last_operand = TRY(FontHelper::ReadInt16(dict.substr(i + 1)));
+      i += 3;
+    } else if (b0 == 29) {
+      last_operand = TRY(FontHelper::ReadInt32(dict.substr(i + 1)));
+      i += 5;
+    } else if (b0 == 30) {
+      // Real number, nibbles terminated by 0xf.
+      i++;
+      while (i < dict.size() && ((uint8_t)dict[i] & 0x0f) != 0x0f &&
+             ((uint8_t)dict[i] & 0xf0) != 0xf0) {
+        i++;
+      }
+      i++;
+      last_operand = -1;
+    } else if (b0 >= 32 && b0 <= 246) {
+      last_operand = (int64_t)b0 - 139;
+      i++;
+    } else if (b0 >= 247 && b0 <= 254) {
+      if (i + 1 >= dict.size()) {
+        break;
+      }
+      int64_t b1 = (uint8_t)dict[i + 1];
+      last_operand = b0 <= 250 ? (b0 - 247) * 256 + b1 + 108
+                               : -(b0 - 251) * 256 - b1 - 108;
+      i += 2;
+    } else {
+      return absl::InvalidArgumentError(
+          StrCat("Invalid byte in CFF DICT: ", (int)b0));
+    }
+  }
+
+  return absl::NotFoundError("CharStrings not found in CFF Top DICT.");
+}
+
+}  // namespace
+
+StatusOr<string_view> FontHelper::CffCharStrings::DataFor(uint32_t gid) const {
+  switch (offset_size) {
+    case 1:
+      return IndexedDataReader<uint8_t, 1>(offsets, data).DataFor(gid);
+    case 2:
+      return IndexedDataReader<uint16_t, 1>(offsets, data).DataFor(gid);
+    case 3:
+      return IndexedDataReader<uint32_t, 1, 3>(offsets, data).DataFor(gid);
+    case 4:
+      return IndexedDataReader<uint32_t, 1>(offsets, data).DataFor(gid);
+    default:
+      return absl::NotFoundError(
+          StrCat("Entry ", gid, " not found in CharStrings INDEX."));
+  }
+}
+
+StatusOr<FontHelper::CffCharStrings> FontHelper::CffCharStringsIndex(
+    const hb_face_t* face, hb_tag_t tag) {
+  if (tag != kCFF && tag != kCFF2) {
+    return absl::InvalidArgumentError(
+        StrCat("Not a CFF table: ", ToString(tag)));
+  }
+
+  bool is_cff2 = tag == kCFF2;
+  auto table = TableData(face, tag);
+  string_view cff = table.str();
+  if (cff.empty()) {
+    return absl::NotFoundError(StrCat(ToString(tag), " not in the font."));
+  }
+  if (cff.size() < 5) {
+    return absl::InvalidArgumentError(
+        StrCat(ToString(tag), " table is too short."));
+  }
+
+  // Header: major (1), minor (1), hdrSize (1), then offSize (1) for CFF or
+  // topDictLength (2) for CFF2.
+  uint8_t header_size = TRY(ReadUInt8(cff.substr(2)));
+  string_view top_dict;
+  if (is_cff2) {
+    uint16_t top_dict_length = TRY(ReadUInt16(cff.substr(3)));
+    if ((uint32_t)header_size + top_dict_length > cff.size()) {
+      return absl::InvalidArgumentError("CFF2 Top DICT exceeds the table.");
+    }
+    top_dict = cff.substr(header_size, top_dict_length);
+  } else {
+    if (header_size > cff.size()) {
+      return absl::InvalidArgumentError("CFF header exceeds the table.");
+    }
+    // Name INDEX, then the Top DICT INDEX which holds a single DICT.
+    CffIndex name_index = TRY(ReadCffIndex(cff.substr(header_size), false));
+    CffIndex top_dict_index = TRY(
+        ReadCffIndex(cff.substr(header_size + name_index.size), false));
+    top_dict = TRY(top_dict_index.entries.DataFor(0));
+  }
+
+  auto operand = TRY(FindCharStringsOffset(top_dict));
+  if (operand.value >= cff.size()) {
+    return absl::InvalidArgumentError("CharStrings offset exceeds the table.");
+  }
+
+  CffIndex charstrings =
+      TRY(ReadCffIndex(cff.substr(operand.value), is_cff2));
+  charstrings.entries.index_offset = operand.value;
+  charstrings.entries.index_size = charstrings.size;
+  if (operand.long_int_offset) {
+    charstrings.entries.operand_offset =
+        (top_dict.data() - cff.data()) + *operand.long_int_offset;
+  }
+  return charstrings.entries;
+}
+
+StatusOr<string_view> FontHelper::CffData(const hb_face_t* face,
+                                          uint32_t gid) {
+  auto charstrings = TRY(CffCharStringsIndex(face, kCFF));
+  return charstrings.DataFor(gid);
+}
+
+StatusOr<string_view> FontHelper::Cff2Data(const hb_face_t* face,
+                                           uint32_t gid) {
+  auto charstrings = TRY(CffCharStringsIndex(face, kCFF2));
+  return charstrings.DataFor(gid);
+}
+
 flat_hash_map<uint32_t, uint32_t> FontHelper::GidToUnicodeMap(hb_face_t* face) {
   hb_map_t* unicode_to_gid = hb_map_create();
   hb_face_collect_nominal_glyph_mapping(face, unicode_to_gid, nullptr);
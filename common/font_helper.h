@@ -3,6 +3,7 @@
 
 #include <cmath>
 #include <cstdint>
+#include <optional>
 
 #include "absl/container/btree_set.h"
 #include "absl/container/flat_hash_map.h"
@@ -42,6 +43,7 @@ struct CompareTableOffsets {
 class FontHelper {
  public:
   constexpr static hb_tag_t kIFT = HB_TAG('I', 'F', 'T', ' ');
+  constexpr static hb_tag_t kIFTX = HB_TAG('I', 'F', 'T', 'X');
   constexpr static hb_tag_t kLoca = HB_TAG('l', 'o', 'c', 'a');
   constexpr static hb_tag_t kGlyf = HB_TAG('g', 'l', 'y', 'f');
   constexpr static hb_tag_t kHead = HB_TAG('h', 'e', 'a', 'd');
@@ -142,6 +144,39 @@ class FontHelper {
 
   static absl::StatusOr<uint32_t> GvarSharedTupleCount(const hb_face_t* face);
 
+  /*
+   * The CharStrings INDEX of a CFF or CFF2 table, one entry per glyph.
+   */
+  struct CffCharStrings {
+    uint32_t count = 0;
+    uint8_t offset_size = 0;
+    absl::string_view offsets;
+    // Begins one byte before the first CharString, INDEX offsets are 1 based.
+    absl::string_view data;
+
+    // Location of the INDEX within the table.
+    uint32_t index_offset = 0;
+    uint32_t index_size = 0;
+    // Table offset of the Top DICT's CharStrings operand, only set when it's
+    // encoded as a 5 byte integer (so can be overwritten in place).
+    std::optional<uint32_t> operand_offset;
+
+    absl::StatusOr<absl::string_view> DataFor(uint32_t gid) const;
+  };
+
+  /*
+   * Locates the CharStrings INDEX in the CFF (tag = kCFF) or CFF2 (tag = kCFF2)
+   * table of face. The returned views point into the face's table data.
+   */
+  static absl::StatusOr<CffCharStrings> CffCharStringsIndex(
+      const hb_face_t* face, hb_tag_t tag);
+
+  static absl::StatusOr<absl::string_view> CffData(const hb_face_t* face,
+                                                   uint32_t gid);
+
+  static absl::StatusOr<absl::string_view> Cff2Data(const hb_face_t* face,
+                                                    uint32_t gid);
+
   static absl::StatusOr<absl::string_view> Loca(const hb_face_t* face) {
     auto result = FontHelper::TableData(face, kLoca).str();
     if (result.empty()) {
@@ -67,7 +67,8 @@ const uint8_t roboto_glyf_gid37_A[] = {
 class FontHelperTest : public ::testing::Test {
  protected:
   FontHelperTest()
-      : noto_sans_jp_otf(make_hb_face(nullptr)),
+      : ahem_otf(make_hb_face(nullptr)),
+        noto_sans_jp_otf(make_hb_face(nullptr)),
         noto_sans_ift_ttf(make_hb_face(nullptr)),
         roboto_ab(make_hb_face(nullptr)),
         roboto_Awesome(make_hb_face(nullptr)),
@@ -94,6 +95,10 @@ class FontHelperTest : public ::testing::Test {
         hb_blob_create_from_file("common/testdata/Roboto[wdth,wght].abcd.ttf"));
     roboto_vf_abcd = make_hb_face(hb_face_create(blob.get(), 0));
 
+    blob = make_hb_blob(
+        hb_blob_create_from_file("common/testdata/Ahem.optimized.otf"));
+    ahem_otf = make_hb_face(hb_face_create(blob.get(), 0));
+
     blob = make_hb_blob(
         hb_blob_create_from_file("common/testdata/NotoSansJP-Regular.otf"));
     noto_sans_jp_otf = make_hb_face(hb_face_create(blob.get(), 0));
@@ -103,6 +108,7 @@ class FontHelperTest : public ::testing::Test {
     noto_sans_ift_ttf = make_hb_face(hb_face_create(blob.get(), 0));
   }
 
+  hb_face_unique_ptr ahem_otf;
   hb_face_unique_ptr noto_sans_jp_otf;
   hb_face_unique_ptr noto_sans_ift_ttf;
   hb_face_unique_ptr roboto_ab;
@@ -367,6 +373,48 @@ TEST_F(FontHelperTest, GvarData_NotFound) {
   ASSERT_TRUE(absl::IsNotFound(data.status())) << data.status();
 }
 
+TEST_F(FontHelperTest, CffData) {
+  // .notdef
+  auto data = FontHelper::CffData(ahem_otf.get(), 0);
+  ASSERT_TRUE(data.ok()) << data.status();
+  ASSERT_EQ(data->size(), 23);
+
+  // space
+  data = FontHelper::CffData(ahem_otf.get(), 1);
+  ASSERT_TRUE(data.ok()) << data.status();
+  ASSERT_EQ(*data, "\x0e");  // endchar
+
+  const uint8_t expected[] = {0xf9, 0xb4, 0x04, 0xfe, 0x7c, 0xfa,
+                              0x7c, 0xfa, 0x7c, 0x07, 0x0e};
+  data = FontHelper::CffData(ahem_otf.get(), 244);
+  ASSERT_TRUE(data.ok()) << data.status();
+  ASSERT_EQ(*data, absl::string_view((const char*)expected, 11));
+
+  data = FontHelper::CffData(ahem_otf.get(), 245);
+  ASSERT_TRUE(absl::IsNotFound(data.status())) << data.status();
+}
+
+TEST_F(FontHelperTest, CffCharStringsIndex) {
+  auto charstrings =
+      FontHelper::CffCharStringsIndex(ahem_otf.get(), FontHelper::kCFF);
+  ASSERT_TRUE(charstrings.ok()) << charstrings.status();
+  ASSERT_EQ(charstrings->count, 245);
+  ASSERT_EQ(charstrings->offset_size, 2);
+
+  charstrings =
+      FontHelper::CffCharStringsIndex(ahem_otf.get(), FontHelper::kGlyf);
+  ASSERT_TRUE(absl::IsInvalidArgument(charstrings.status()))
+      << charstrings.status();
+}
+
+TEST_F(FontHelperTest, CffData_NotFound) {
+  auto data = FontHelper::CffData(roboto.get(), 0);
+  ASSERT_TRUE(absl::IsNotFound(data.status())) << data.status();
+
+  data = FontHelper::Cff2Data(ahem_otf.get(), 0);
+  ASSERT_TRUE(absl::IsNotFound(data.status())) << data.status();
+}
+
 TEST_F(FontHelperTest, Loca) {
   auto s = FontHelper::Loca(roboto_ab.get());
   ASSERT_TRUE(s.ok()) << s.status();
@@ -58,4 +58,8 @@ flat_hash_set<uint32_t> to_hash_set(const hb_set_t* set) {
   return out;
 }
 
+hb_map_unique_ptr make_hb_map(hb_map_t* map) {
+  return hb_map_unique_ptr(map, &hb_map_destroy);
+}
+
 }  // namespace common
@@ -22,6 +22,10 @@ hb_set_unique_ptr make_hb_set(int length, ...);
 
 absl::flat_hash_set<uint32_t> to_hash_set(const hb_set_t* set);
 
+typedef std::unique_ptr<hb_map_t, decltype(&hb_map_destroy)> hb_map_unique_ptr;
+
+hb_map_unique_ptr make_hb_map(hb_map_t* map);
+
 }  // namespace common
 
 #endif  // COMMON_HB_SET_UNIQUE_PTR_H_
@@ -11,16 +11,18 @@ namespace common {
  * Helper class to read indexed data from a font. Indexed data
  * is data that has been segmented into chunks which are listed
  * in an offset table (for example loca + glyf).
+ *
+ * Each offset is 'width' bytes wide, by default the size of 'offset_type'.
+ * Narrower widths are used for formats with 24 bit offsets (eg. CFF INDEX).
  */
-template <typename offset_type, int offset_multiplier>
+template <typename offset_type, int offset_multiplier,
+          int width = sizeof(offset_type)>
 class IndexedDataReader {
  public:
   IndexedDataReader(absl::string_view offsets, absl::string_view data)
       : offsets_(offsets), data_(data) {}
 
   absl::StatusOr<absl::string_view> DataFor(uint32_t id) const {
-    constexpr int width = sizeof(offset_type);
-
     uint32_t start_index = id * width;
     uint32_t end_index = (id + 1) * width;
     if (end_index + width > offsets_.size()) {
@@ -28,9 +30,10 @@ class IndexedDataReader {
           absl::StrCat("Entry ", id, " not found in offset table."));
     }
 
-    offset_type start_offset =
+    // Scaled in 32 bits, multiplied short offsets can exceed offset_type.
+    uint32_t start_offset =
         ReadValue(start_index, offsets_) * offset_multiplier;
-    offset_type end_offset = ReadValue(end_index, offsets_) * offset_multiplier;
+    uint32_t end_offset = ReadValue(end_index, offsets_) * offset_multiplier;
     if (end_offset < start_offset) {
       return absl::InvalidArgumentError("Invalid index. end < start.");
     }
@@ -43,11 +46,11 @@ class IndexedDataReader {
   }
 
  private:
-  offset_type ReadValue(uint32_t index, absl::string_view offsets) const {
+  uint32_t ReadValue(uint32_t index, absl::string_view offsets) const {
     uint32_t value = 0;
-    for (uint32_t i = 0; i < sizeof(offset_type); i++) {
+    for (int i = 0; i < width; i++) {
       uint8_t v = offsets[index + i];
-      value |= ((uint32_t)v) << (8 * (sizeof(offset_type) - i - 1));
+      value |= ((uint32_t)v) << (8 * (width - i - 1));
     }
     return value;
   }
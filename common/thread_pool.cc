@@ -0,0 +1,152 @@
+#include "common/thread_pool.h"
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <thread>
+
+#include "absl/synchronization/mutex.h"
+
+namespace common {
+
+namespace {
+
+// Identifies the pool and queue owned by the current thread (if it is a
+// worker thread).
+thread_local const ThreadPool* current_pool = nullptr;
+thread_local uint32_t current_queue = 0;
+
+}  // namespace
+
+ThreadPool::ThreadPool(uint32_t num_threads) {
+  for (uint32_t i = 0; i < num_threads + 1; i++) {
+    queues_.push_back(std::make_unique<WorkQueue>());
+  }
+  for (uint32_t i = 0; i < num_threads; i++) {
+    workers_.emplace_back([this, i] { WorkerLoop(i); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  Wait();
+  {
+    absl::MutexLock lock(&mutex_);
+    shutdown_ = true;
+  }
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+void ThreadPool::Schedule(std::function<void()> task) {
+  uint32_t queue_index =
+      (current_pool == this) ? current_queue : queues_.size() - 1;
+  {
+    // The counters must be raised before the task becomes visible in a
+    // queue, otherwise another thread could run and retire it first which
+    // would let outstanding_ reach zero (and queued_ underflow) while the
+    // scheduling task is still running.
+    absl::MutexLock lock(&mutex_);
+    queued_++;
+    outstanding_++;
+  }
+
+  WorkQueue& queue = *queues_[queue_index];
+  absl::MutexLock lock(&queue.mutex);
+  queue.tasks.push_back(std::move(task));
+}
+
+bool ThreadPool::RunOne(uint32_t queue_index) {
+  std::function<void()> task;
+  {
+    // Own queue first, newest task first.
+    WorkQueue& queue = *queues_[queue_index];
+    absl::MutexLock lock(&queue.mutex);
+    if (!queue.tasks.empty()) {
+      task = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+    }
+  }
+
+  for (uint32_t i = 1; !task && i < queues_.size(); i++) {
+    // Otherwise steal the oldest task from another queue.
+    WorkQueue& queue = *queues_[(queue_index + i) % queues_.size()];
+    absl::MutexLock lock(&queue.mutex);
+    if (!queue.tasks.empty()) {
+      task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+    }
+  }
+
+  if (!task) {
+    return false;
+  }
+
+  {
+    absl::MutexLock lock(&mutex_);
+    queued_--;
+  }
+
+  task();
+
+  absl::MutexLock lock(&mutex_);
+  outstanding_--;
+  return true;
+}
+
+void ThreadPool::WorkerLoop(uint32_t queue_index) {
+  current_pool = this;
+  current_queue = queue_index;
+  while (true) {
+    if (RunOne(queue_index)) {
+      continue;
+    }
+
+    absl::MutexLock lock(&mutex_);
+    mutex_.Await(absl::Condition(this, &ThreadPool::WorkerShouldWake));
+    if (shutdown_ && !queued_) {
+      return;
+    }
+  }
+}
+
+void ThreadPool::Wait() {
+  // Waiting threads help out using the external queue as their own.
+  uint32_t queue_index = queues_.size() - 1;
+  while (true) {
+    if (RunOne(queue_index)) {
+      continue;
+    }
+
+    absl::MutexLock lock(&mutex_);
+    mutex_.Await(absl::Condition(this, &ThreadPool::WaiterShouldWake));
+    if (!outstanding_) {
+      return;
+    }
+  }
+}
+
+void ThreadPool::ParallelFor(uint32_t count,
+                             const std::function<void(uint32_t)>& fn) {
+  TaskGroup group{this, count};
+  for (uint32_t i = 0; i < count; i++) {
+    Schedule([&group, &fn, i] {
+      fn(i);
+      group.remaining--;
+    });
+  }
+
+  uint32_t queue_index =
+      (current_pool == this) ? current_queue : queues_.size() - 1;
+  while (group.remaining > 0) {
+    if (RunOne(queue_index)) {
+      continue;
+    }
+
+    // Tasks lock mutex_ after they finish, which re-evaluates the condition.
+    absl::MutexLock lock(&mutex_);
+    mutex_.Await(absl::Condition(&group, &TaskGroup::ShouldWake));
+  }
+}
+
+}  // namespace common
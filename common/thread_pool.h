@@ -0,0 +1,101 @@
+#ifndef COMMON_THREAD_POOL_H_
+#define COMMON_THREAD_POOL_H_
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+
+namespace common {
+
+/*
+ * A fixed size pool of worker threads which execute scheduled tasks.
+ *
+ * Each worker owns a task queue. Tasks scheduled from within a running task
+ * are pushed onto the current worker's queue and run most recent first, idle
+ * workers steal the oldest tasks from the other queues. Tasks may schedule
+ * further tasks, which allows a recursive computation to be split into
+ * child tasks without blocking on them.
+ */
+class ThreadPool {
+ public:
+  explicit ThreadPool(uint32_t num_threads);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool(ThreadPool&&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+  ThreadPool& operator=(ThreadPool&&) = delete;
+
+  /*
+   * Queues 'task' for execution on one of the workers.
+   */
+  void Schedule(std::function<void()> task);
+
+  /*
+   * Blocks until all scheduled tasks, including any tasks scheduled by those
+   * tasks, have finished. The calling thread helps run queued tasks while
+   * it waits. Must not be called from within a task.
+   */
+  void Wait();
+
+  /*
+   * Runs fn(0), ..., fn(count - 1) on the pool and blocks until all of them
+   * have finished. Unlike Wait() this may be called from within a task, the
+   * calling thread runs queued tasks while it waits.
+   */
+  void ParallelFor(uint32_t count, const std::function<void(uint32_t)>& fn);
+
+  uint32_t NumThreads() const { return workers_.size(); }
+
+ private:
+  struct WorkQueue {
+    absl::Mutex mutex;
+    std::deque<std::function<void()>> tasks ABSL_GUARDED_BY(mutex);
+  };
+
+  // Runs at most one task, preferring the queue at 'queue_index'. Returns
+  // false if no task was available.
+  bool RunOne(uint32_t queue_index);
+  void WorkerLoop(uint32_t queue_index);
+
+  bool WorkerShouldWake() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    return queued_ > 0 || shutdown_;
+  }
+
+  bool WaiterShouldWake() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    return queued_ > 0 || outstanding_ == 0;
+  }
+
+  // Tracks the tasks created by a single ParallelFor() call.
+  struct TaskGroup {
+    const ThreadPool* pool;
+    std::atomic<uint32_t> remaining;
+
+    bool ShouldWake() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(pool->mutex_) {
+      return pool->queued_ > 0 || remaining == 0;
+    }
+  };
+
+  // One queue per worker, plus a final queue which receives tasks
+  // scheduled from outside of the pool.
+  std::vector<std::unique_ptr<WorkQueue>> queues_;
+  std::vector<std::thread> workers_;
+
+  absl::Mutex mutex_;
+  // Number of tasks sitting in a queue.
+  uint64_t queued_ ABSL_GUARDED_BY(mutex_) = 0;
+  // Number of tasks which have been scheduled but have not yet finished.
+  uint64_t outstanding_ ABSL_GUARDED_BY(mutex_) = 0;
+  bool shutdown_ ABSL_GUARDED_BY(mutex_) = false;
+};
+
+}  // namespace common
+
+#endif  // COMMON_THREAD_POOL_H_
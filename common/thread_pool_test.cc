@@ -0,0 +1,117 @@
+#include "common/thread_pool.h"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace common {
+
+class ThreadPoolTest : public ::testing::Test {};
+
+TEST_F(ThreadPoolTest, RunsAllTasks) {
+  ThreadPool pool(4);
+  std::atomic<uint32_t> count = 0;
+  for (uint32_t i = 0; i < 1000; i++) {
+    pool.Schedule([&count] { count++; });
+  }
+  pool.Wait();
+  EXPECT_EQ(count, 1000);
+
+  // The pool can be reused after a wait.
+  pool.Schedule([&count] { count++; });
+  pool.Wait();
+  EXPECT_EQ(count, 1001);
+}
+
+TEST_F(ThreadPoolTest, TasksScheduleTasks) {
+  ThreadPool pool(4);
+  std::atomic<uint32_t> count = 0;
+
+  // Builds a binary tree of tasks of the given depth.
+  std::function<void(uint32_t)> spawn = [&](uint32_t depth) {
+    count++;
+    if (!depth) {
+      return;
+    }
+    pool.Schedule([&spawn, depth] { spawn(depth - 1); });
+    pool.Schedule([&spawn, depth] { spawn(depth - 1); });
+  };
+
+  pool.Schedule([&spawn] { spawn(10); });
+  pool.Wait();
+  EXPECT_EQ(count, (1 << 11) - 1);
+}
+
+TEST_F(ThreadPoolTest, NestedScheduleStress) {
+  // Children are scheduled from inside running tasks and may be stolen and
+  // finished by other workers before the parent returns. Wait() must not
+  // return until every task, including the parents, has completed.
+  ThreadPool pool(8);
+  for (uint32_t round = 0; round < 200; round++) {
+    std::atomic<uint32_t> running = 0;
+    std::atomic<uint32_t> finished = 0;
+
+    std::function<void(uint32_t)> spawn = [&](uint32_t depth) {
+      running++;
+      if (depth) {
+        for (uint32_t i = 0; i < 3; i++) {
+          pool.Schedule([&spawn, depth] { spawn(depth - 1); });
+        }
+      }
+      // Give other workers a chance to steal and finish the children
+      // before this task returns.
+      std::this_thread::yield();
+      finished++;
+      running--;
+    };
+
+    for (uint32_t i = 0; i < 4; i++) {
+      pool.Schedule([&spawn] { spawn(4); });
+    }
+    pool.Wait();
+
+    ASSERT_EQ(running, 0) << "round " << round;
+    // 4 trees of (3^5 - 1) / 2 tasks.
+    ASSERT_EQ(finished, 4 * 121) << "round " << round;
+  }
+}
+
+TEST_F(ThreadPoolTest, ParallelFor) {
+  ThreadPool pool(4);
+  std::vector<uint32_t> values(100);
+  pool.ParallelFor(values.size(),
+                   [&values](uint32_t i) { values[i] = i * 2; });
+  for (uint32_t i = 0; i < values.size(); i++) {
+    ASSERT_EQ(values[i], i * 2);
+  }
+}
+
+TEST_F(ThreadPoolTest, ParallelFor_FromTask) {
+  ThreadPool pool(2);
+  std::atomic<uint32_t> count = 0;
+  for (uint32_t i = 0; i < 8; i++) {
+    pool.Schedule([&pool, &count] {
+      pool.ParallelFor(10, [&count](uint32_t i) { count++; });
+    });
+  }
+  pool.Wait();
+  EXPECT_EQ(count, 80);
+}
+
+TEST_F(ThreadPoolTest, NoWorkers) {
+  // With no workers all tasks are run by the waiting thread.
+  ThreadPool pool(0);
+  uint32_t count = 0;
+  for (uint32_t i = 0; i < 10; i++) {
+    pool.Schedule([&count] { count++; });
+  }
+  EXPECT_EQ(count, 0);
+  pool.Wait();
+  EXPECT_EQ(count, 10);
+}
+
+}  // namespace common
@@ -1,5 +1,10 @@
 #include "common/woff2.h"
 
+#include <string>
+
+// woff2 internals, for the font normalization done by the encoder.
+#include "src/font.h"
+#include "src/normalize.h"
 #include "woff2/decode.h"
 #include "woff2/encode.h"
 #include "woff2/output.h"
@@ -9,15 +14,20 @@ using absl::string_view;
 using woff2::ComputeWOFF2FinalSize;
 using woff2::ConvertTTFToWOFF2;
 using woff2::ConvertWOFF2ToTTF;
+using woff2::FontFileSize;
 using woff2::MaxWOFF2CompressedSize;
+using woff2::NormalizeFont;
+using woff2::ReadFont;
 using woff2::WOFF2Params;
 using woff2::WOFF2StringOut;
+using woff2::WriteFont;
 
 namespace common {
 
-StatusOr<FontData> Woff2::EncodeWoff2(string_view font, bool glyf_transform) {
+StatusOr<FontData> Woff2::EncodeWoff2(string_view font, bool glyf_transform,
+                                      unsigned quality) {
   WOFF2Params params;
-  params.brotli_quality = 11;
+  params.brotli_quality = quality;
   params.allow_transforms = glyf_transform;
   size_t buffer_size =
       MaxWOFF2CompressedSize((const uint8_t*)font.data(), font.size());
@@ -54,4 +64,27 @@ StatusOr<FontData> Woff2::DecodeWoff2(string_view font) {
   return result;
 }
 
-}  // namespace common
\ No newline at end of file
+StatusOr<FontData> Woff2::Canonicalize(string_view font) {
+  // This is the normalization that ConvertTTFToWOFF2() applies before
+  // compressing. It lays the tables out in the same order, with the same
+  // padding, that ConvertWOFF2ToTTF() writes them in so the decoded font is
+  // exactly the normalized font.
+  woff2::Font parsed;
+  if (!ReadFont((const uint8_t*)font.data(), font.size(), &parsed)) {
+    return absl::InvalidArgumentError("Failed to parse the font.");
+  }
+
+  if (!NormalizeFont(&parsed)) {
+    return absl::InternalError("Font normalization failed.");
+  }
+
+  std::string buffer(FontFileSize(parsed), 0);
+  if (!WriteFont(parsed, (uint8_t*)buffer.data(), buffer.size())) {
+    return absl::InternalError("Failed writing the normalized font.");
+  }
+
+  FontData result(buffer);
+  return result;
+}
+
+}  // namespace common
@@ -9,8 +9,16 @@ namespace common {
 
 struct Woff2 {
   static absl::StatusOr<FontData> EncodeWoff2(absl::string_view font,
-                                              bool glyf_transform = true);
+                                              bool glyf_transform = true,
+                                              unsigned quality = 11);
   static absl::StatusOr<FontData> DecodeWoff2(absl::string_view font);
+
+  /*
+   * Returns the same font as DecodeWoff2(EncodeWoff2(font, false)), but
+   * without compressing and decompressing the font. Only the normalization
+   * applied by the woff2 encoder (glyph and table layout, checksums) is done.
+   */
+  static absl::StatusOr<FontData> Canonicalize(absl::string_view font);
 };
 
 }  // namespace common
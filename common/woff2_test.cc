@@ -64,6 +64,30 @@ TEST_F(Woff2Test, DecodeWoff2) {
             Span<const uint8_t>((const uint8_t*)font->data(), 4));
 }
 
+TEST_F(Woff2Test, Canonicalize) {
+  for (const char* path : {
+           "common/testdata/Roboto-Regular.abcd.ttf",
+           "common/testdata/Roboto[wdth,wght].abcd.ttf",
+           "common/testdata/NotoNastaliqUrdu.subset.ttf",
+           "common/testdata/Ahem.optimized.otf",
+       }) {
+    FontData input = from_file(path);
+    auto woff2 = Woff2::EncodeWoff2(input.str(), false);
+    ASSERT_TRUE(woff2.ok()) << path << ": " << woff2.status();
+    auto expected = Woff2::DecodeWoff2(woff2->str());
+    ASSERT_TRUE(expected.ok()) << path << ": " << expected.status();
+
+    auto canonical = Woff2::Canonicalize(input.str());
+    ASSERT_TRUE(canonical.ok()) << path << ": " << canonical.status();
+    ASSERT_EQ(canonical->str(), expected->str()) << path;
+  }
+}
+
+TEST_F(Woff2Test, Canonicalize_Fails) {
+  auto ttf = Woff2::Canonicalize("not a font");
+  ASSERT_TRUE(absl::IsInvalidArgument(ttf.status())) << ttf.status();
+}
+
 TEST_F(Woff2Test, DecodeWoff2_Fails) {
   auto ttf = Woff2::DecodeWoff2(font.str());
   ASSERT_TRUE(absl::IsInternal(ttf.status())) << ttf.status();
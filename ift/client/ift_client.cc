@@ -0,0 +1,621 @@
+#include "ift/client/ift_client.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/container/btree_set.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "common/brotli_binary_patch.h"
+#include "common/compat_id.h"
+#include "common/font_data.h"
+#include "common/font_helper.h"
+#include "common/indexed_data_reader.h"
+#include "common/try.h"
+#include "hb.h"
+#include "ift/proto/format_2_patch_map.h"
+#include "ift/proto/ift_table.h"
+#include "ift/proto/patch_encoding.h"
+#include "ift/proto/patch_map.h"
+#include "ift/proto/patch_map_index.h"
+#include "ift/url_template.h"
+
+using absl::btree_set;
+using absl::flat_hash_map;
+using absl::Status;
+using absl::StatusOr;
+using absl::StrCat;
+using absl::string_view;
+using common::BrotliBinaryPatch;
+using common::CompatId;
+using common::FontData;
+using common::FontHelper;
+using common::IndexedDataReader;
+using ift::proto::Format2PatchMap;
+using ift::proto::GLYPH_KEYED;
+using ift::proto::IFTTable;
+using ift::proto::PatchEncoding;
+using ift::proto::PatchMap;
+using ift::proto::PatchMapIndex;
+using ift::proto::TABLE_KEYED_FULL;
+using ift::proto::TABLE_KEYED_PARTIAL;
+
+namespace ift::client {
+
+namespace {
+
+// Largest offset that can be stored in a short loca or gvar offset array.
+constexpr uint32_t kMaxShortOffset = 0x1FFFE;
+
+Status CheckCompatId(string_view patch, uint32_t offset, CompatId expected) {
+  std::string id;
+  expected.WriteTo(id);
+  if (patch.substr(offset, id.size()) != id) {
+    return absl::InvalidArgumentError(
+        "Patch compat id does not match the patch map.");
+  }
+  return absl::OkStatus();
+}
+
+struct Candidate {
+  SelectedPatch patch;
+  uint32_t intersection_size;
+};
+
+// Adds the entries of 'table' which match 'target' to 'candidates'.
+void CollectCandidates(const IFTTable& table, hb_tag_t map_tag,
+                       const TargetSubset& target,
+                       std::vector<Candidate>& candidates) {
+  auto entries = table.GetPatchMap().GetEntries();
+  PatchMapIndex index(table.GetPatchMap());
+  for (const auto& match : index.Activated(
+           target.codepoints, target.feature_tags, target.design_space)) {
+    const auto& entry = entries[match.entry_index];
+    candidates.push_back(Candidate{
+        SelectedPatch{
+            URLTemplate::PatchToUrl(table.GetUrlTemplate(), entry.patch_index),
+            entry.encoding, table.GetId(), map_tag},
+        match.codepoint_intersection});
+  }
+}
+
+// Returns the per glyph data for 'gid' from 'data' indexed by 'offsets'.
+StatusOr<string_view> DataFor(string_view offsets, string_view data,
+                              bool short_offsets, uint32_t gid) {
+  if (short_offsets) {
+    return IndexedDataReader<uint16_t, 2>(offsets, data).DataFor(gid);
+  }
+  return IndexedDataReader<uint32_t, 1>(offsets, data).DataFor(gid);
+}
+
+void WriteOffsets(const std::vector<uint32_t>& offsets, bool short_offsets,
+                  std::string& out) {
+  for (uint32_t offset : offsets) {
+    if (short_offsets) {
+      FontHelper::WriteUInt16(offset / 2, out);
+    } else {
+      FontHelper::WriteUInt32(offset, out);
+    }
+  }
+}
+
+/*
+ * Concatenates the data of 'glyph_count' glyphs, taking the data for gids in
+ * 'replacements' from there and everything else from the existing table.
+ * Short offsets require even sized glyph data, if the result doesn't fit in
+ * short offsets 'short_offsets' is cleared.
+ */
+Status ConcatGlyphData(
+    string_view offsets, string_view data, bool& short_offsets,
+    uint32_t glyph_count,
+    const flat_hash_map<uint32_t, string_view>& replacements,
+    std::string& new_data, std::vector<uint32_t>& new_offsets) {
+  bool input_short_offsets = short_offsets;
+  new_offsets.reserve(glyph_count + 1);
+  new_offsets.push_back(0);
+  for (uint32_t gid = 0; gid < glyph_count; gid++) {
+    auto it = replacements.find(gid);
+    if (it != replacements.end()) {
+      new_data.append(it->second);
+    } else {
+      new_data.append(TRY(DataFor(offsets, data, input_short_offsets, gid)));
+    }
+    if (input_short_offsets && new_data.size() % 2) {
+      new_data.push_back(0);
+    }
+    new_offsets.push_back(new_data.size());
+  }
+
+  if (short_offsets && new_data.size() > kMaxShortOffset) {
+    short_offsets = false;
+  }
+  return absl::OkStatus();
+}
+
+Status PatchGlyf(hb_face_t* face,
+                 const flat_hash_map<uint32_t, string_view>& replacements,
+                 flat_hash_map<hb_tag_t, FontData>& tables) {
+  FontData head = FontHelper::TableData(face, FontHelper::kHead);
+  if (head.size() < 52) {
+    return absl::InvalidArgumentError("invalid head table, too short.");
+  }
+  FontData loca = FontHelper::TableData(face, FontHelper::kLoca);
+  FontData glyf = FontHelper::TableData(face, FontHelper::kGlyf);
+
+  bool short_loca = !head.str()[51];
+  bool was_short_loca = short_loca;
+  std::string new_glyf;
+  std::vector<uint32_t> offsets;
+  TRYV(ConcatGlyphData(loca.str(), glyf.str(), short_loca,
+                       hb_face_get_glyph_count(face), replacements, new_glyf,
+                       offsets));
+
+  std::string new_loca;
+  WriteOffsets(offsets, short_loca, new_loca);
+  tables[FontHelper::kGlyf].copy(new_glyf);
+  tables[FontHelper::kLoca].copy(new_loca);
+
+  if (was_short_loca && !short_loca) {
+    std::string new_head(head.str());
+    new_head[51] = 1;  // indexToLocFormat = long
+    tables[FontHelper::kHead].copy(new_head);
+  }
+  return absl::OkStatus();
+}
+
+Status PatchGvar(hb_face_t* face,
+                 const flat_hash_map<uint32_t, string_view>& replacements,
+                 flat_hash_map<hb_tag_t, FontData>& tables) {
+  constexpr uint32_t header_size = 20;
+  FontData gvar_data = FontHelper::TableData(face, FontHelper::kGvar);
+  string_view gvar = gvar_data.str();
+  if (gvar.size() < header_size) {
+    return absl::InvalidArgumentError("gvar table is too short.");
+  }
+
+  uint16_t axis_count = TRY(FontHelper::ReadUInt16(gvar.substr(4)));
+  uint16_t shared_tuple_count = TRY(FontHelper::ReadUInt16(gvar.substr(6)));
+  uint32_t shared_tuples_offset = TRY(FontHelper::ReadUInt32(gvar.substr(8)));
+  uint16_t glyph_count = TRY(FontHelper::ReadUInt16(gvar.substr(12)));
+  uint16_t flags = TRY(FontHelper::ReadUInt16(gvar.substr(14)));
+  uint32_t data_offset = TRY(FontHelper::ReadUInt32(gvar.substr(16)));
+
+  uint32_t shared_tuples_size = axis_count * shared_tuple_count * 2;
+  if (shared_tuples_offset > gvar.size() ||
+      gvar.size() - shared_tuples_offset < shared_tuples_size ||
+      data_offset > gvar.size()) {
+    return absl::InvalidArgumentError("gvar table is too short.");
+  }
+
+  bool short_offsets = !(flags & 0x01);
+  uint32_t offset_size = short_offsets ? 2 : 4;
+  string_view offsets =
+      gvar.substr(header_size, (glyph_count + 1) * offset_size);
+
+  std::string new_data;
+  std::vector<uint32_t> new_offsets;
+  TRYV(ConcatGlyphData(offsets, gvar.substr(data_offset), short_offsets,
+                       glyph_count, replacements, new_data, new_offsets));
+  flags = short_offsets ? (flags & ~0x01) : (flags | 0x01);
+  offset_size = short_offsets ? 2 : 4;
+
+  // Shared tuples are placed between the offsets and the data array.
+  uint32_t new_shared_tuples_offset =
+      header_size + (glyph_count + 1) * offset_size;
+  std::string new_gvar(gvar.substr(0, 8));  // version, axis and tuple counts
+  new_gvar.reserve(new_shared_tuples_offset + shared_tuples_size +
+                   new_data.size());
+  FontHelper::WriteUInt32(new_shared_tuples_offset, new_gvar);
+  FontHelper::WriteUInt16(glyph_count, new_gvar);
+  FontHelper::WriteUInt16(flags, new_gvar);
+  FontHelper::WriteUInt32(new_shared_tuples_offset + shared_tuples_size,
+                          new_gvar);
+  WriteOffsets(new_offsets, short_offsets, new_gvar);
+  new_gvar.append(gvar.substr(shared_tuples_offset, shared_tuples_size));
+  new_gvar.append(new_data);
+
+  tables[FontHelper::kGvar].copy(new_gvar);
+  return absl::OkStatus();
+}
+
+/*
+ * Replaces the CharStrings INDEX of the CFF or CFF2 table 'tag'. When the
+ * INDEX is last in the table it's rewritten in place, otherwise the new INDEX
+ * is appended to the table and the Top DICT's CharStrings operand is updated
+ * to point at it. The old INDEX is left behind as unreferenced data.
+ */
+Status PatchCff(hb_face_t* face, hb_tag_t tag,
+                const flat_hash_map<uint32_t, string_view>& replacements,
+                flat_hash_map<hb_tag_t, FontData>& tables) {
+  auto charstrings = TRY(FontHelper::CffCharStringsIndex(face, tag));
+  if (!charstrings.count) {
+    return absl::OkStatus();
+  }
+  FontData table = FontHelper::TableData(face, tag);
+  string_view cff = table.str();
+
+  std::string data;
+  std::vector<uint32_t> offsets = {1};
+  offsets.reserve(charstrings.count + 1);
+  for (uint32_t gid = 0; gid < charstrings.count; gid++) {
+    auto it = replacements.find(gid);
+    if (it != replacements.end()) {
+      data.append(it->second);
+    } else {
+      data.append(TRY(charstrings.DataFor(gid)));
+    }
+    offsets.push_back(data.size() + 1);
+  }
+
+  uint8_t offset_size = 1;
+  while (offset_size < 4 && (offsets.back() >> (8 * offset_size))) {
+    offset_size++;
+  }
+
+  std::string index;
+  if (tag == FontHelper::kCFF2) {
+    FontHelper::WriteUInt32(charstrings.count, index);
+  } else {
+    FontHelper::WriteUInt16(charstrings.count, index);
+  }
+  FontHelper::WriteUInt8(offset_size, index);
+  for (uint32_t offset : offsets) {
+    switch (offset_size) {
+      case 1:
+        FontHelper::WriteUInt8(offset, index);
+        break;
+      case 2:
+        FontHelper::WriteUInt16(offset, index);
+        break;
+      case 3:
+        FontHelper::WriteUInt24(offset, index);
+        break;
+      default:
+        FontHelper::WriteUInt32(offset, index);
+    }
+  }
+  index.append(data);
+
+  std::string new_cff;
+  if (charstrings.index_offset + charstrings.index_size == cff.size()) {
+    new_cff.reserve(charstrings.index_offset + index.size());
+    new_cff.append(cff.substr(0, charstrings.index_offset));
+  } else if (charstrings.operand_offset) {
+    std::string operand;
+    FontHelper::WriteUInt32(cff.size(), operand);
+    new_cff.reserve(cff.size() + index.size());
+    new_cff.append(cff);
+    new_cff.replace(*charstrings.operand_offset, operand.size(), operand);
+  } else {
+    return absl::UnimplementedError(
+        StrCat("Can't relocate the CharStrings INDEX in ",
+               FontHelper::ToString(tag),
+               ", the Top DICT offset is not a 5 byte integer."));
+  }
+  new_cff.append(index);
+
+  tables[tag].copy(new_cff);
+  return absl::OkStatus();
+}
+
+/*
+ * Builds a new font from 'face' with the tables in 'replaced' swapped in and
+ * the tables in 'dropped' removed. Table order of 'face' is kept, new tables
+ * are added at the end.
+ */
+FontData RebuildFont(hb_face_t* face,
+                     const flat_hash_map<hb_tag_t, FontData>& replaced,
+                     const btree_set<hb_tag_t>& dropped = {}) {
+  std::vector<hb_tag_t> tags = FontHelper::GetOrderedTags(face);
+  for (const auto& [tag, data] : replaced) {
+    if (std::find(tags.begin(), tags.end(), tag) == tags.end()) {
+      tags.push_back(tag);
+    }
+  }
+  tags.erase(
+      std::remove_if(tags.begin(), tags.end(),
+                     [&](hb_tag_t tag) { return dropped.contains(tag); }),
+      tags.end());
+
+  hb_face_t* builder = hb_face_builder_create();
+  for (hb_tag_t tag : tags) {
+    auto it = replaced.find(tag);
+    auto blob = it != replaced.end()
+                    ? it->second.blob()
+                    : common::make_hb_blob(hb_face_reference_table(face, tag));
+    hb_face_builder_add_table(builder, tag, blob.get());
+  }
+
+  tags.push_back(0);  // null terminate the array as expected by hb.
+  hb_face_builder_sort_tables(builder, tags.data());
+
+  hb_blob_t* blob = hb_face_reference_blob(builder);
+  FontData result(blob);
+  hb_blob_destroy(blob);
+  hb_face_destroy(builder);
+  return result;
+}
+
+}  // namespace
+
+Status MemoryPatchProvider::GetFont(const std::string& id,
+                                    FontData* out) const {
+  auto it = patches_.find(id);
+  if (it == patches_.end()) {
+    return absl::NotFoundError(StrCat("Patch ", id, " was not found."));
+  }
+  out->shallow_copy(it->second);
+  return absl::OkStatus();
+}
+
+StatusOr<FontData> IftClient::Extend(
+    const FontData& font, const TargetSubset& target,
+    btree_set<std::string>* applied_uris) const {
+  FontData current;
+  current.shallow_copy(font);
+  btree_set<std::string> applied;
+
+  while (true) {
+    auto face = current.face();
+    auto selected = TRY(SelectPatches(face.get(), target));
+    if (selected.empty()) {
+      break;
+    }
+
+    for (const auto& patch : selected) {
+      if (!applied.insert(patch.url).second) {
+        return absl::InternalError(
+            StrCat("Patch ", patch.url, " was selected after being applied."));
+      }
+    }
+
+    if (PatchMap::IsInvalidating(selected.front().encoding)) {
+      const auto& patch = selected.front();
+      FontData patch_data;
+      TRYV(patches_.GetFont(patch.url, &patch_data));
+      current =
+          TRY(ApplyTableKeyedPatch(current, patch_data, patch.compat_id));
+      continue;
+    }
+
+    flat_hash_map<hb_tag_t, btree_set<std::string>> urls_by_map;
+    for (const auto& patch : selected) {
+      FontData patch_data;
+      TRYV(patches_.GetFont(patch.url, &patch_data));
+      current =
+          TRY(ApplyGlyphKeyedPatch(current, patch_data, patch.compat_id));
+      urls_by_map[patch.map_tag].insert(patch.url);
+    }
+    for (const auto& [map_tag, urls] : urls_by_map) {
+      current = TRY(MarkApplied(current, map_tag, urls));
+    }
+  }
+
+  if (applied_uris) {
+    applied_uris->insert(applied.begin(), applied.end());
+  }
+  return current;
+}
+
+StatusOr<std::vector<SelectedPatch>> IftClient::SelectPatches(
+    hb_face_t* face, const TargetSubset& target) {
+  std::vector<Candidate> candidates;
+  for (hb_tag_t map_tag : {FontHelper::kIFT, FontHelper::kIFTX}) {
+    FontData map_data = FontHelper::TableData(face, map_tag);
+    if (map_data.empty()) {
+      continue;
+    }
+    IFTTable table = TRY(Format2PatchMap::Deserialize(map_data.str()));
+    CollectCandidates(table, map_tag, target, candidates);
+  }
+
+  for (PatchEncoding encoding : {TABLE_KEYED_FULL, TABLE_KEYED_PARTIAL}) {
+    const Candidate* best = nullptr;
+    for (const auto& candidate : candidates) {
+      if (candidate.patch.encoding == encoding &&
+          (!best || candidate.intersection_size > best->intersection_size)) {
+        best = &candidate;
+      }
+    }
+    if (best) {
+      return std::vector<SelectedPatch>{best->patch};
+    }
+  }
+
+  std::vector<SelectedPatch> result;
+  btree_set<std::string> urls;
+  for (auto& candidate : candidates) {
+    if (candidate.patch.encoding == GLYPH_KEYED &&
+        urls.insert(candidate.patch.url).second) {
+      result.push_back(std::move(candidate.patch));
+    }
+  }
+  return result;
+}
+
+StatusOr<FontData> IftClient::ApplyTableKeyedPatch(const FontData& font,
+                                                   const FontData& patch,
+                                                   CompatId compat_id) {
+  // Format tag (4), reserved (4), compat id (16), patches count (2)
+  constexpr uint32_t compat_id_offset = 8;
+  constexpr uint32_t count_offset = 24;
+  constexpr uint32_t header_size = 26;
+  // tag (4), flags (1), max uncompressed length (4)
+  constexpr uint32_t entry_header_size = 9;
+  constexpr uint8_t replace_flag = 0b00000001;
+  constexpr uint8_t drop_flag = 0b00000010;
+
+  string_view data = patch.str();
+  if (data.size() < header_size || data.substr(0, 4) != "iftk") {
+    return absl::InvalidArgumentError("Not a table keyed patch.");
+  }
+  TRYV(CheckCompatId(data, compat_id_offset, compat_id));
+
+  uint16_t count = TRY(FontHelper::ReadUInt16(data.substr(count_offset)));
+  std::vector<uint32_t> offsets;
+  for (uint32_t i = 0; i <= count; i++) {
+    offsets.push_back(
+        TRY(FontHelper::ReadUInt32(data.substr(header_size + i * 4))));
+    if (offsets.back() > data.size() ||
+        (i > 0 && offsets.back() < offsets[i - 1] + entry_header_size)) {
+      return absl::InvalidArgumentError("Invalid table patch offsets.");
+    }
+  }
+
+  auto face = font.face();
+  flat_hash_map<hb_tag_t, FontData> replaced;
+  btree_set<hb_tag_t> dropped;
+  BrotliBinaryPatch brotli;
+  for (uint32_t i = 0; i < count; i++) {
+    string_view entry = data.substr(offsets[i], offsets[i + 1] - offsets[i]);
+    hb_tag_t tag = TRY(FontHelper::ReadUInt32(entry));
+    uint8_t flags = entry[4];
+    if (flags & drop_flag) {
+      replaced.erase(tag);
+      dropped.insert(tag);
+      continue;
+    }
+    dropped.erase(tag);
+
+    FontData base;
+    if (!(flags & replace_flag)) {
+      auto it = replaced.find(tag);
+      if (it != replaced.end()) {
+        base.shallow_copy(it->second);
+      } else {
+        base = FontHelper::TableData(face.get(), tag);
+      }
+    }
+
+    uint32_t max_length = TRY(FontHelper::ReadUInt32(entry.substr(5)));
+    FontData stream(entry.substr(entry_header_size));
+    FontData derived;
+    TRYV(brotli.Patch(base, stream, max_length, &derived));
+    replaced[tag] = std::move(derived);
+  }
+
+  return RebuildFont(face.get(), replaced, dropped);
+}
+
+StatusOr<FontData> IftClient::ApplyGlyphKeyedPatch(const FontData& font,
+                                                   const FontData& patch,
+                                                   CompatId compat_id) {
+  // Format tag (4), reserved (4), flags (1), compat id (16), max uncompressed
+  // length (4)
+  constexpr uint32_t flags_offset = 8;
+  constexpr uint32_t compat_id_offset = 9;
+  constexpr uint32_t max_length_offset = 25;
+  constexpr uint32_t data_stream_offset = 29;
+
+  string_view data = patch.str();
+  if (data.size() < data_stream_offset || data.substr(0, 4) != "ifgk") {
+    return absl::InvalidArgumentError("Not a glyph keyed patch.");
+  }
+  TRYV(CheckCompatId(data, compat_id_offset, compat_id));
+  bool u24_gids = data[flags_offset] & 0b00000001;
+  uint32_t max_length =
+      TRY(FontHelper::ReadUInt32(data.substr(max_length_offset)));
+
+  FontData empty;
+  FontData compressed_stream(data.substr(data_stream_offset));
+  FontData stream_data;
+  TRYV(BrotliBinaryPatch().Patch(empty, compressed_stream, max_length,
+                                 &stream_data));
+  string_view stream = stream_data.str();
+
+  uint32_t glyph_count = TRY(FontHelper::ReadUInt32(stream));
+  uint8_t table_count = TRY(FontHelper::ReadUInt8(stream.substr(4)));
+  uint32_t gid_width = u24_gids ? 3 : 2;
+  uint64_t header_size = 5 + (uint64_t)glyph_count * gid_width +
+                         table_count * 4 +
+                         ((uint64_t)glyph_count * table_count + 1) * 4;
+  if (header_size > stream.size()) {
+    return absl::InvalidArgumentError("Glyph keyed data stream is too short.");
+  }
+
+  std::vector<uint32_t> gids;
+  string_view gid_data = stream.substr(5);
+  for (uint32_t i = 0; i < glyph_count; i++) {
+    gids.push_back(u24_gids
+                       ? TRY(FontHelper::ReadUInt24(gid_data.substr(i * 3)))
+                       : TRY(FontHelper::ReadUInt16(gid_data.substr(i * 2))));
+  }
+
+  string_view tag_data = gid_data.substr(glyph_count * gid_width);
+  string_view offset_data = tag_data.substr(table_count * 4);
+  auto face = font.face();
+  uint32_t num_glyphs = hb_face_get_glyph_count(face.get());
+  auto face_tags = FontHelper::GetTags(face.get());
+
+  flat_hash_map<hb_tag_t, FontData> replaced;
+  for (uint32_t t = 0; t < table_count; t++) {
+    hb_tag_t tag = TRY(FontHelper::ReadUInt32(tag_data.substr(t * 4)));
+
+    // Glyphs that aren't in the font are skipped.
+    flat_hash_map<uint32_t, string_view> replacements;
+    for (uint32_t i = 0; i < glyph_count; i++) {
+      uint32_t index = t * glyph_count + i;
+      uint32_t start =
+          TRY(FontHelper::ReadUInt32(offset_data.substr(index * 4)));
+      uint32_t end =
+          TRY(FontHelper::ReadUInt32(offset_data.substr(index * 4 + 4)));
+      if (start > end || end > stream.size()) {
+        return absl::InvalidArgumentError(
+            "Invalid glyph data offsets in glyph keyed patch.");
+      }
+      if (gids[i] < num_glyphs) {
+        replacements[gids[i]] = stream.substr(start, end - start);
+      }
+    }
+
+    if (!face_tags.contains(tag)) {
+      continue;
+    }
+    if (tag == FontHelper::kGlyf) {
+      TRYV(PatchGlyf(face.get(), replacements, replaced));
+    } else if (tag == FontHelper::kGvar) {
+      TRYV(PatchGvar(face.get(), replacements, replaced));
+    } else if (tag == FontHelper::kCFF || tag == FontHelper::kCFF2) {
+      TRYV(PatchCff(face.get(), tag, replacements, replaced));
+    }
+  }
+
+  // The glyph data is owned by 'stream_data', replaced tables are copies so
+  // it doesn't need to outlive this call.
+  return RebuildFont(face.get(), replaced);
+}
+
+StatusOr<FontData> IftClient::MarkApplied(const FontData& font,
+                                          hb_tag_t map_tag,
+                                          const btree_set<std::string>& urls) {
+  auto face = font.face();
+  FontData map_data = FontHelper::TableData(face.get(), map_tag);
+  if (map_data.empty()) {
+    return absl::NotFoundError(
+        StrCat("Patch map ", FontHelper::ToString(map_tag), " not found."));
+  }
+
+  IFTTable table = TRY(Format2PatchMap::Deserialize(map_data.str()));
+  PatchMap updated;
+  for (const auto& entry : table.GetPatchMap().GetEntries()) {
+    bool ignored =
+        entry.ignored ||
+        urls.contains(
+            URLTemplate::PatchToUrl(table.GetUrlTemplate(), entry.patch_index));
+    TRYV(updated.AddEntry(entry.coverage, entry.patch_index, entry.encoding,
+                          ignored));
+  }
+  table.GetPatchMap() = std::move(updated);
+
+  std::string serialized = TRY(Format2PatchMap::Serialize(table));
+  flat_hash_map<hb_tag_t, FontData> replaced;
+  replaced[map_tag].copy(serialized);
+  return RebuildFont(face.get(), replaced);
+}
+
+}  // namespace ift::client
@@ -0,0 +1,129 @@
+#ifndef IFT_CLIENT_IFT_CLIENT_H_
+#define IFT_CLIENT_IFT_CLIENT_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/container/btree_set.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "common/axis_range.h"
+#include "common/compat_id.h"
+#include "common/font_data.h"
+#include "common/font_provider.h"
+#include "hb.h"
+#include "ift/proto/patch_encoding.h"
+
+namespace ift::client {
+
+/*
+ * Provides patches from an in memory map of url to patch data (for example
+ * ift::encoder::Encoder::Encoding::patches). The map is not owned and must
+ * outlive this provider.
+ */
+class MemoryPatchProvider : public common::FontProvider {
+ public:
+  explicit MemoryPatchProvider(
+      const absl::flat_hash_map<std::string, common::FontData>& patches)
+      : patches_(patches) {}
+
+  absl::Status GetFont(const std::string& id,
+                       common::FontData* out) const override;
+
+ private:
+  const absl::flat_hash_map<std::string, common::FontData>& patches_;
+};
+
+/*
+ * The subset definition that a font is being extended to support.
+ */
+struct TargetSubset {
+  absl::btree_set<uint32_t> codepoints;
+  absl::btree_set<hb_tag_t> feature_tags;
+  absl::flat_hash_map<hb_tag_t, common::AxisRange> design_space;
+};
+
+/*
+ * A patch selected from one of the patch maps ('IFT ' or 'IFTX') of a font.
+ */
+struct SelectedPatch {
+  std::string url;
+  ift::proto::PatchEncoding encoding;
+  // Compat id of the patch map which listed the patch, the patch must have
+  // the same id.
+  common::CompatId compat_id;
+  // Tag of the patch map which listed the patch.
+  hb_tag_t map_tag;
+};
+
+/*
+ * In process implementation of the IFT client extension algorithm
+ * (https://w3c.github.io/IFT/Overview.html#extending-font-subset) for format 2
+ * patch maps.
+ *
+ * Patches are loaded from 'patches' by url. Table keyed patches and glyph
+ * keyed patches to glyf/loca, gvar, CFF and CFF2 are supported.
+ */
+class IftClient {
+ public:
+  explicit IftClient(const common::FontProvider& patches)
+      : patches_(patches) {}
+
+  /*
+   * Repeatedly selects and applies patches to 'font' until no more patches
+   * are needed to support 'target'. Returns the extended font.
+   *
+   * if non null, applied_uris will be populated with the set of uris that
+   * were loaded and applied.
+   */
+  absl::StatusOr<common::FontData> Extend(
+      const common::FontData& font, const TargetSubset& target,
+      absl::btree_set<std::string>* applied_uris = nullptr) const;
+
+  /*
+   * Selects the next patches to apply to 'face' in order to support 'target'.
+   * This is either a single invalidating (table keyed) patch or all of the
+   * matching glyph keyed patches. An empty result means no more patches are
+   * needed.
+   *
+   * Full invalidation patches are preferred over partial invalidation ones,
+   * amongst those the entry whose coverage has the largest intersection with
+   * the target codepoints is chosen (earliest entry on ties).
+   */
+  static absl::StatusOr<std::vector<SelectedPatch>> SelectPatches(
+      hb_face_t* face, const TargetSubset& target);
+
+  /*
+   * Applies the table keyed patch 'patch' to 'font'. Fails if the patch's
+   * compat id is not 'compat_id'.
+   */
+  static absl::StatusOr<common::FontData> ApplyTableKeyedPatch(
+      const common::FontData& font, const common::FontData& patch,
+      common::CompatId compat_id);
+
+  /*
+   * Applies the glyph keyed patch 'patch' to 'font'. Fails if the patch's
+   * compat id is not 'compat_id'. The patch maps of 'font' are not modified,
+   * see MarkApplied().
+   */
+  static absl::StatusOr<common::FontData> ApplyGlyphKeyedPatch(
+      const common::FontData& font, const common::FontData& patch,
+      common::CompatId compat_id);
+
+  /*
+   * Sets the ignored bit on all entries of the patch map 'map_tag' in 'font'
+   * which reference one of 'urls'.
+   */
+  static absl::StatusOr<common::FontData> MarkApplied(
+      const common::FontData& font, hb_tag_t map_tag,
+      const absl::btree_set<std::string>& urls);
+
+ private:
+  const common::FontProvider& patches_;
+};
+
+}  // namespace ift::client
+
+#endif  // IFT_CLIENT_IFT_CLIENT_H_
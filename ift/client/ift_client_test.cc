@@ -0,0 +1,306 @@
+#include "ift/client/ift_client.h"
+
+#include <string>
+
+#include "absl/container/btree_set.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/strings/match.h"
+#include "common/font_data.h"
+#include "common/font_helper.h"
+#include "common/hb_set_unique_ptr.h"
+#include "gtest/gtest.h"
+#include "hb.h"
+#include "ift/encoder/encoder.h"
+#include "ift/proto/patch_encoding.h"
+#include "ift/testdata/test_segments.h"
+
+using absl::btree_set;
+using absl::flat_hash_set;
+using absl::StatusCode;
+using common::CompatId;
+using common::FontData;
+using common::FontHelper;
+using common::hb_set_unique_ptr;
+using common::make_hb_blob;
+using common::make_hb_set;
+using ift::encoder::Encoder;
+using ift::proto::TABLE_KEYED_PARTIAL;
+using ift::testdata::TestSegment1;
+using ift::testdata::TestSegment2;
+using ift::testdata::TestSegment3;
+using ift::testdata::TestSegment4;
+
+namespace ift::client {
+
+class IftClientTest : public ::testing::Test {
+ protected:
+  IftClientTest() {
+    auto blob = make_hb_blob(
+        hb_blob_create_from_file("ift/testdata/NotoSansJP-Regular.subset.ttf"));
+    noto_sans_jp_.set(blob.get());
+  }
+
+  absl::Status InitEncoderForMixedMode(Encoder& encoder) {
+    auto face = noto_sans_jp_.face();
+
+    hb_set_unique_ptr init = make_hb_set();
+    hb_set_add_range(init.get(), 0, hb_face_get_glyph_count(face.get()) - 1);
+    hb_set_unique_ptr excluded = make_hb_set();
+    hb_set_add_sorted_array(excluded.get(), testdata::TEST_SEGMENT_1,
+                            std::size(testdata::TEST_SEGMENT_1));
+    hb_set_add_sorted_array(excluded.get(), testdata::TEST_SEGMENT_2,
+                            std::size(testdata::TEST_SEGMENT_2));
+    hb_set_add_sorted_array(excluded.get(), testdata::TEST_SEGMENT_3,
+                            std::size(testdata::TEST_SEGMENT_3));
+    hb_set_add_sorted_array(excluded.get(), testdata::TEST_SEGMENT_4,
+                            std::size(testdata::TEST_SEGMENT_4));
+    hb_set_subtract(init.get(), excluded.get());
+    auto init_segment = common::to_hash_set(init.get());
+
+    encoder.SetFace(face.get());
+
+    auto sc = encoder.AddGlyphDataSegment(0, init_segment);
+    sc.Update(encoder.AddGlyphDataSegment(1, TestSegment1()));
+    sc.Update(encoder.AddGlyphDataSegment(2, TestSegment2()));
+    sc.Update(encoder.AddGlyphDataSegment(3, TestSegment3()));
+    sc.Update(encoder.AddGlyphDataSegment(4, TestSegment4()));
+
+    // target paritions: {{0, 1}, {2}, {3, 4}}
+    sc.Update(encoder.SetBaseSubsetFromSegments({0, 1}));
+    sc.Update(encoder.AddNonGlyphSegmentFromGlyphSegments({2}));
+    sc.Update(encoder.AddNonGlyphSegmentFromGlyphSegments({3, 4}));
+    sc.Update(encoder.AddGlyphDataActivationCondition(Encoder::Condition(2)));
+    sc.Update(encoder.AddGlyphDataActivationCondition(Encoder::Condition(3)));
+    sc.Update(encoder.AddGlyphDataActivationCondition(Encoder::Condition(4)));
+    return sc;
+  }
+
+  FontData noto_sans_jp_;
+
+  uint32_t chunk0_cp = 0x47;
+  uint32_t chunk1_cp = 0xb7;
+  uint32_t chunk2_cp = 0xb2;
+  uint32_t chunk3_cp = 0xeb;
+  uint32_t chunk4_cp = 0xa8;
+
+  uint32_t chunk0_gid = 40;
+  uint32_t chunk2_gid = 112;
+  uint32_t chunk3_gid = 169;
+  uint32_t chunk4_gid = 103;
+};
+
+TEST_F(IftClientTest, Extend_TableKeyedOnly) {
+  Encoder encoder;
+  auto face = noto_sans_jp_.face();
+  encoder.SetFace(face.get());
+
+  auto sc = encoder.SetBaseSubset({0x41, 0x42, 0x43});
+  encoder.AddNonGlyphDataSegment({0x45, 0x46, 0x47});
+  encoder.AddNonGlyphDataSegment({0x48, 0x49, 0x4A});
+  encoder.AddNonGlyphDataSegment({0x4B, 0x4C, 0x4D});
+  ASSERT_TRUE(sc.ok()) << sc;
+
+  auto encoding = encoder.Encode();
+  ASSERT_TRUE(encoding.ok()) << encoding.status();
+
+  MemoryPatchProvider provider(encoding->patches);
+  IftClient client(provider);
+  btree_set<std::string> applied;
+  auto extended =
+      client.Extend(encoding->init_font, {.codepoints = {0x49}}, &applied);
+  ASSERT_TRUE(extended.ok()) << extended.status();
+  ASSERT_EQ(applied.size(), 1);
+
+  auto extended_face = extended->face();
+  auto codepoints = FontHelper::ToCodepointsSet(extended_face.get());
+  ASSERT_TRUE(codepoints.contains(0x41));
+  ASSERT_FALSE(codepoints.contains(0x45));
+  ASSERT_TRUE(codepoints.contains(0x48));
+  ASSERT_TRUE(codepoints.contains(0x49));
+  ASSERT_FALSE(codepoints.contains(0x4B));
+
+  // Nothing further is needed for the same target.
+  auto selected =
+      IftClient::SelectPatches(extended_face.get(), {.codepoints = {0x49}});
+  ASSERT_TRUE(selected.ok()) << selected.status();
+  ASSERT_TRUE(selected->empty());
+
+  extended = client.Extend(encoding->init_font, {.codepoints = {0x45, 0x4B}});
+  ASSERT_TRUE(extended.ok()) << extended.status();
+  extended_face = extended->face();
+  codepoints = FontHelper::ToCodepointsSet(extended_face.get());
+  ASSERT_TRUE(codepoints.contains(0x45));
+  ASSERT_TRUE(codepoints.contains(0x4B));
+  ASSERT_FALSE(codepoints.contains(0x48));
+}
+
+TEST_F(IftClientTest, Extend_MixedMode) {
+  Encoder encoder;
+  auto sc = InitEncoderForMixedMode(encoder);
+  ASSERT_TRUE(sc.ok()) << sc;
+
+  auto encoding = encoder.Encode();
+  ASSERT_TRUE(encoding.ok()) << encoding.status();
+
+  MemoryPatchProvider provider(encoding->patches);
+  IftClient client(provider);
+  btree_set<std::string> applied;
+  auto extended = client.Extend(encoding->init_font,
+                                {.codepoints = {chunk3_cp, chunk4_cp}},
+                                &applied);
+  ASSERT_TRUE(extended.ok()) << extended.status();
+
+  uint32_t table_keyed = 0;
+  uint32_t glyph_keyed = 0;
+  for (const auto& url : applied) {
+    table_keyed += absl::EndsWith(url, ".tk");
+    glyph_keyed += absl::EndsWith(url, ".gk");
+  }
+  ASSERT_EQ(table_keyed, 1);
+  ASSERT_EQ(glyph_keyed, 2);
+
+  auto extended_face = extended->face();
+  auto codepoints = FontHelper::ToCodepointsSet(extended_face.get());
+  ASSERT_TRUE(codepoints.contains(chunk0_cp));
+  ASSERT_TRUE(codepoints.contains(chunk1_cp));
+  ASSERT_FALSE(codepoints.contains(chunk2_cp));
+  ASSERT_TRUE(codepoints.contains(chunk3_cp));
+  ASSERT_TRUE(codepoints.contains(chunk4_cp));
+
+  auto original_face = noto_sans_jp_.face();
+  for (uint32_t gid : {chunk0_gid, chunk3_gid, chunk4_gid}) {
+    ASSERT_EQ(*FontHelper::GlyfData(extended_face.get(), gid),
+              *FontHelper::GlyfData(original_face.get(), gid))
+        << gid;
+  }
+  ASSERT_TRUE(FontHelper::GlyfData(extended_face.get(), chunk2_gid)->empty());
+
+  // Applied glyph keyed entries are marked as ignored.
+  auto selected = IftClient::SelectPatches(
+      extended_face.get(), {.codepoints = {chunk3_cp, chunk4_cp}});
+  ASSERT_TRUE(selected.ok()) << selected.status();
+  ASSERT_TRUE(selected->empty());
+}
+
+TEST_F(IftClientTest, Extend_MixedMode_Cff) {
+  auto ahem = make_hb_blob(
+      hb_blob_create_from_file("common/testdata/Ahem.optimized.otf"));
+  FontData ahem_font(ahem.get());
+  auto original_face = ahem_font.face();
+
+  Encoder encoder;
+  encoder.SetFace(original_face.get());
+  flat_hash_set<uint32_t> segments[3];
+  for (uint32_t gid = 0; gid < 30; gid++) {
+    segments[gid / 10].insert(gid);
+  }
+  auto sc = encoder.AddGlyphDataSegment(0, segments[0]);
+  sc.Update(encoder.AddGlyphDataSegment(1, segments[1]));
+  sc.Update(encoder.AddGlyphDataSegment(2, segments[2]));
+  sc.Update(encoder.AddGlyphDataActivationCondition(Encoder::Condition(1)));
+  sc.Update(encoder.AddGlyphDataActivationCondition(Encoder::Condition(2)));
+  sc.Update(encoder.SetBaseSubsetFromSegments({0}));
+  ASSERT_TRUE(sc.ok()) << sc;
+
+  auto encoding = encoder.Encode();
+  ASSERT_TRUE(encoding.ok()) << encoding.status();
+
+  auto gid_to_unicode = FontHelper::GidToUnicodeMap(original_face.get());
+  ASSERT_TRUE(gid_to_unicode.contains(15));
+
+  MemoryPatchProvider provider(encoding->patches);
+  IftClient client(provider);
+  btree_set<std::string> applied;
+  auto extended = client.Extend(
+      encoding->init_font, {.codepoints = {gid_to_unicode[15]}}, &applied);
+  ASSERT_TRUE(extended.ok()) << extended.status();
+  ASSERT_EQ(applied.size(), 1);
+
+  auto extended_face = extended->face();
+  auto init_face = encoding->init_font.face();
+  ASSERT_EQ(hb_face_get_glyph_count(extended_face.get()),
+            hb_face_get_glyph_count(init_face.get()));
+  // Only the charstrings of segment 1 are replaced.
+  for (uint32_t gid = 0; gid < 30; gid++) {
+    auto before = FontHelper::CffData(init_face.get(), gid);
+    auto after = FontHelper::CffData(extended_face.get(), gid);
+    ASSERT_TRUE(before.ok()) << before.status();
+    ASSERT_TRUE(after.ok()) << after.status();
+    if (gid >= 10 && gid < 20) {
+      ASSERT_NE(*after, *before) << gid;
+    } else {
+      ASSERT_EQ(*after, *before) << gid;
+    }
+  }
+
+  // The rest of the CFF table still parses, the patched charstrings render.
+  hb_font_t* font = hb_font_create(extended_face.get());
+  hb_glyph_extents_t extents;
+  ASSERT_TRUE(hb_font_get_glyph_extents(font, 15, &extents));
+  hb_font_destroy(font);
+}
+
+TEST_F(IftClientTest, SelectPatches) {
+  Encoder encoder;
+  auto sc = InitEncoderForMixedMode(encoder);
+  ASSERT_TRUE(sc.ok()) << sc;
+
+  auto encoding = encoder.Encode();
+  ASSERT_TRUE(encoding.ok()) << encoding.status();
+  auto face = encoding->init_font.face();
+
+  auto selected =
+      IftClient::SelectPatches(face.get(), {.codepoints = {chunk0_cp}});
+  ASSERT_TRUE(selected.ok()) << selected.status();
+  ASSERT_TRUE(selected->empty());
+
+  // Invalidating patches are applied before any glyph keyed ones.
+  selected = IftClient::SelectPatches(face.get(), {.codepoints = {chunk3_cp}});
+  ASSERT_TRUE(selected.ok()) << selected.status();
+  ASSERT_EQ(selected->size(), 1);
+  ASSERT_EQ(selected->front().encoding, TABLE_KEYED_PARTIAL);
+  ASSERT_EQ(selected->front().map_tag, FontHelper::kIFT);
+  ASSERT_TRUE(encoding->patches.contains(selected->front().url));
+}
+
+TEST_F(IftClientTest, ApplyPatch_CompatIdMismatch) {
+  Encoder encoder;
+  auto sc = InitEncoderForMixedMode(encoder);
+  ASSERT_TRUE(sc.ok()) << sc;
+
+  auto encoding = encoder.Encode();
+  ASSERT_TRUE(encoding.ok()) << encoding.status();
+  auto face = encoding->init_font.face();
+
+  auto selected =
+      IftClient::SelectPatches(face.get(), {.codepoints = {chunk3_cp}});
+  ASSERT_TRUE(selected.ok()) << selected.status();
+  ASSERT_EQ(selected->size(), 1);
+  const FontData& patch = encoding->patches.at(selected->front().url);
+
+  auto result = IftClient::ApplyTableKeyedPatch(encoding->init_font, patch,
+                                                CompatId(1, 2, 3, 4));
+  ASSERT_EQ(result.status().code(), StatusCode::kInvalidArgument);
+
+  // Wrong patch type.
+  result = IftClient::ApplyGlyphKeyedPatch(encoding->init_font, patch,
+                                           selected->front().compat_id);
+  ASSERT_EQ(result.status().code(), StatusCode::kInvalidArgument);
+
+  result = IftClient::ApplyTableKeyedPatch(encoding->init_font, patch,
+                                           selected->front().compat_id);
+  ASSERT_TRUE(result.ok()) << result.status();
+}
+
+TEST_F(IftClientTest, MemoryPatchProvider) {
+  absl::flat_hash_map<std::string, FontData> patches;
+  patches["a.tk"].copy("abc");
+  MemoryPatchProvider provider(patches);
+
+  FontData out;
+  ASSERT_TRUE(provider.GetFont("a.tk", &out).ok());
+  ASSERT_EQ(out.str(), "abc");
+  ASSERT_EQ(provider.GetFont("b.tk", &out).code(), StatusCode::kNotFound);
+}
+
+}  // namespace ift::client
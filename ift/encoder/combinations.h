@@ -0,0 +1,69 @@
+#ifndef IFT_ENCODER_COMBINATIONS_H_
+#define IFT_ENCODER_COMBINATIONS_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "absl/types/span.h"
+
+namespace ift::encoder {
+
+/*
+ * Enumerates every combination of 1 to 'max_size' of the integers [0, n).
+ * Combinations are produced ordered by size and then lexicographically, and
+ * no allocation is done after construction:
+ *
+ *   for (CombinationIterator it(n, k); !it.Done(); it.Next()) {
+ *     for (uint32_t i : it.Current()) { ... }
+ *   }
+ */
+class CombinationIterator {
+ public:
+  CombinationIterator(uint32_t n, uint32_t max_size)
+      : n_(n), max_size_(max_size < n ? max_size : n) {
+    indices_.reserve(max_size_);
+    if (max_size_) {
+      indices_.push_back(0);
+    }
+  }
+
+  bool Done() const { return indices_.empty(); }
+
+  // The members of the current combination in increasing order.
+  absl::Span<const uint32_t> Current() const { return indices_; }
+
+  void Next() {
+    uint32_t size = indices_.size();
+
+    // Find the right most index which can still be advanced, then reset all
+    // of the indices after it to their smallest values.
+    for (uint32_t i = size; i-- > 0;) {
+      if (indices_[i] < n_ - size + i) {
+        indices_[i]++;
+        for (uint32_t j = i + 1; j < size; j++) {
+          indices_[j] = indices_[j - 1] + 1;
+        }
+        return;
+      }
+    }
+
+    // All combinations of this size are done, move on to the next size.
+    if (size == max_size_) {
+      indices_.clear();
+      return;
+    }
+    for (uint32_t i = 0; i < size; i++) {
+      indices_[i] = i;
+    }
+    indices_.push_back(size);
+  }
+
+ private:
+  uint32_t n_;
+  uint32_t max_size_;
+  std::vector<uint32_t> indices_;
+};
+
+}  // namespace ift::encoder
+
+#endif  // IFT_ENCODER_COMBINATIONS_H_
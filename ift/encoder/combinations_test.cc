@@ -0,0 +1,65 @@
+#include "ift/encoder/combinations.h"
+
+#include <cstdint>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace ift::encoder {
+
+static std::vector<std::vector<uint32_t>> All(uint32_t n, uint32_t max_size) {
+  std::vector<std::vector<uint32_t>> result;
+  for (CombinationIterator it(n, max_size); !it.Done(); it.Next()) {
+    result.emplace_back(it.Current().begin(), it.Current().end());
+  }
+  return result;
+}
+
+TEST(CombinationIteratorTest, Empty) {
+  ASSERT_TRUE(All(0, 3).empty());
+  ASSERT_TRUE(All(3, 0).empty());
+}
+
+TEST(CombinationIteratorTest, Singles) {
+  std::vector<std::vector<uint32_t>> expected = {{0}, {1}, {2}};
+  ASSERT_EQ(All(3, 1), expected);
+}
+
+TEST(CombinationIteratorTest, OrderedBySizeThenLexicographically) {
+  std::vector<std::vector<uint32_t>> expected = {
+      // l1
+      {0},
+      {1},
+      {2},
+      {3},
+
+      // l2
+      {0, 1},
+      {0, 2},
+      {0, 3},
+      {1, 2},
+      {1, 3},
+      {2, 3},
+
+      // l3
+      {0, 1, 2},
+      {0, 1, 3},
+      {0, 2, 3},
+      {1, 2, 3},
+  };
+  ASSERT_EQ(All(4, 3), expected);
+}
+
+TEST(CombinationIteratorTest, MaxSizeLargerThanN) {
+  std::vector<std::vector<uint32_t>> expected = {
+      {0}, {1}, {0, 1},
+  };
+  ASSERT_EQ(All(2, 5), expected);
+}
+
+TEST(CombinationIteratorTest, Count) {
+  // sum of (20 choose k) for k = 1..3
+  ASSERT_EQ(All(20, 3).size(), 20 + 190 + 1140);
+}
+
+}  // namespace ift::encoder
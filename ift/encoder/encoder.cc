@@ -1,25 +1,40 @@
 #include "ift/encoder/encoder.h"
 
 #include <algorithm>
+#include <cmath>
 #include <cstdint>
 #include <cstdio>
+#include <functional>
 #include <iterator>
+#include <limits>
 #include <memory>
+#include <numeric>
 #include <optional>
 
+#include "absl/container/btree_map.h"
+#include "absl/log/log.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_join.h"
 #include "absl/strings/string_view.h"
+#include "absl/types/span.h"
 #include "common/axis_range.h"
-#include "common/binary_diff.h"
+#include "common/brotli_binary_diff.h"
+#include "common/brotli_dictionary_cache.h"
 #include "common/compat_id.h"
 #include "common/font_data.h"
 #include "common/font_helper.h"
 #include "common/hb_set_unique_ptr.h"
+#include "common/thread_pool.h"
 #include "common/try.h"
 #include "common/woff2.h"
 #include "hb-subset.h"
+#include "ift/encoder/combinations.h"
+#include "ift/encoder/index_set.h"
+#include "ift/encoder/patch_sink.h"
+#include "ift/encoder/subset_cache.h"
 #include "ift/glyph_keyed_diff.h"
 #include "ift/proto/ift_table.h"
 #include "ift/proto/patch_encoding.h"
@@ -34,7 +49,8 @@ using absl::StatusOr;
 using absl::StrCat;
 using absl::string_view;
 using common::AxisRange;
-using common::BinaryDiff;
+using common::BrotliBinaryDiff;
+using common::BrotliDictionaryCache;
 using common::CompatId;
 using common::FontData;
 using common::FontHelper;
@@ -44,8 +60,10 @@ using common::hb_set_unique_ptr;
 using common::make_hb_blob;
 using common::make_hb_face;
 using common::make_hb_set;
+using common::ThreadPool;
 using common::Woff2;
 using ift::GlyphKeyedDiff;
+using ift::TableKeyedDiff;
 using ift::proto::GLYPH_KEYED;
 using ift::proto::IFTTable;
 using ift::proto::PatchEncoding;
@@ -91,34 +109,6 @@ void PrintTo(const Encoder::SubsetDefinition& def, std::ostream* os) {
   *os << "]";
 }
 
-void Encoder::AddCombinations(const std::vector<const SubsetDefinition*>& in,
-                              uint32_t choose,
-                              std::vector<Encoder::SubsetDefinition>& out) {
-  if (!choose || in.size() < choose) {
-    return;
-  }
-
-  if (choose == 1) {
-    for (auto item : in) {
-      out.push_back(*item);
-    }
-    return;
-  }
-
-  for (auto it = in.begin(); it != in.end(); it++) {
-    auto it_inner = it + 1;
-    std::vector<const SubsetDefinition*> remaining;
-    std::copy(it_inner, in.end(), std::back_inserter(remaining));
-
-    std::vector<Encoder::SubsetDefinition> combinations;
-    AddCombinations(remaining, choose - 1, combinations);
-    for (auto& s : combinations) {
-      s.Union(**it);
-      out.push_back(std::move(s));
-    }
-  }
-}
-
 StatusOr<FontData> Encoder::FullyExpandedSubset(
     const ProcessingContext& context) const {
   SubsetDefinition all;
@@ -145,8 +135,64 @@ bool is_subset(const flat_hash_set<uint32_t>& a,
                      [&a](const uint32_t& v) { return a.count(v) > 0; });
 }
 
+// Returns true if 'a' minus 'b' (as computed by SubsetDefinition::Subtract())
+// is empty, without materializing the difference.
+static bool IsCoveredBy(const Encoder::SubsetDefinition& a,
+                        const Encoder::SubsetDefinition& b) {
+  if (!is_subset(b.codepoints, a.codepoints) || !is_subset(b.gids, a.gids)) {
+    return false;
+  }
+  for (hb_tag_t tag : a.feature_tags) {
+    if (!b.feature_tags.contains(tag)) {
+      return false;
+    }
+  }
+  for (const auto& [tag, range] : a.design_space) {
+    // Subtract() only removes an axis when 'b' has a range for it.
+    auto e = b.design_space.find(tag);
+    if (e == b.design_space.end() || e->second.IsPoint()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+IndexSet Encoder::CoveredExtensions(const SubsetDefinition& subset) const {
+  IndexSet covered;
+  for (uint32_t i = 0; i < extension_subsets_.size(); i++) {
+    if (IsCoveredBy(extension_subsets_[i], subset)) {
+      covered.Insert(i);
+    }
+  }
+  return covered;
+}
+
+void Encoder::ForEachOutgoingEdge(
+    uint32_t remaining, uint32_t choose, uint32_t depth,
+    absl::FunctionRef<void(absl::Span<const uint32_t>)> edge) const {
+  if (!remaining) {
+    return;
+  }
+
+  bool last_level = max_depth_ && depth + 1 >= max_depth_;
+  if (!last_level) {
+    for (CombinationIterator it(remaining, choose); !it.Done(); it.Next()) {
+      edge(it.Current());
+    }
+    if (!include_all_segment_patches_ || remaining <= choose) {
+      // If remaining <= choose the last combination already adds everything.
+      return;
+    }
+  }
+
+  std::vector<uint32_t> everything(remaining);
+  std::iota(everything.begin(), everything.end(), 0);
+  edge(everything);
+}
+
 std::vector<Encoder::SubsetDefinition> Encoder::OutgoingEdges(
-    const SubsetDefinition& base_subset, uint32_t choose) const {
+    const SubsetDefinition& base_subset, uint32_t choose,
+    uint32_t depth) const {
   std::vector<SubsetDefinition> remaining_subsets;
   for (const auto& s : extension_subsets_) {
     SubsetDefinition filtered = s;
@@ -158,15 +204,18 @@ std::vector<Encoder::SubsetDefinition> Encoder::OutgoingEdges(
     remaining_subsets.push_back(std::move(filtered));
   }
 
-  std::vector<const SubsetDefinition*> input;
-  for (const auto& s : remaining_subsets) {
-    input.push_back(&s);
-  }
-
   std::vector<Encoder::SubsetDefinition> result;
-  for (uint32_t i = 1; i <= choose; i++) {
-    AddCombinations(input, i, result);
-  }
+  ForEachOutgoingEdge(
+      remaining_subsets.size(), choose, depth,
+      [&](absl::Span<const uint32_t> members) {
+        // Union from last to first, for overlapping design spaces the last
+        // member's range is the one kept.
+        SubsetDefinition combination;
+        for (auto m = members.rbegin(); m != members.rend(); m++) {
+          combination.Union(remaining_subsets[*m]);
+        }
+        result.push_back(std::move(combination));
+      });
 
   return result;
 }
@@ -446,6 +495,37 @@ StatusOr<Encoder::SubsetDefinition> Encoder::SubsetDefinitionForSegments(
   return result;
 }
 
+// Serializes 'design_space' in a canonical (sorted) form.
+static std::string DesignSpaceString(
+    const Encoder::design_space_t& design_space) {
+  absl::btree_map<hb_tag_t, AxisRange> sorted(design_space.begin(),
+                                              design_space.end());
+  std::string out;
+  for (const auto& [tag, range] : sorted) {
+    // %a is exact for floats.
+    absl::StrAppendFormat(&out, "%s:%a:%a,", FontHelper::ToString(tag),
+                          range.start(), range.end());
+  }
+  return out;
+}
+
+// Serializes 'def' in a canonical (sorted) form for use in cache keys and
+// fingerprints.
+static std::string CanonicalString(const Encoder::SubsetDefinition& def) {
+  btree_set<uint32_t> codepoints(def.codepoints.begin(), def.codepoints.end());
+  btree_set<uint32_t> gids(def.gids.begin(), def.gids.end());
+  return StrCat("cp=", absl::StrJoin(codepoints, ","),
+                ";gid=", absl::StrJoin(gids, ","),
+                ";features=", absl::StrJoin(def.feature_tags, ","),
+                ";ds=", DesignSpaceString(def.design_space));
+}
+
+static std::string CompatIdString(const CompatId& id) {
+  const uint32_t* values = id.as_ptr();
+  return absl::StrFormat("%08x%08x%08x%08x", values[0], values[1], values[2],
+                         values[3]);
+}
+
 StatusOr<Encoder::Encoding> Encoder::Encode() const {
   if (!face_) {
     return absl::FailedPreconditionError("Encoder must have a face set.");
@@ -453,6 +533,19 @@ StatusOr<Encoder::Encoding> Encoder::Encode() const {
 
   ProcessingContext context(next_id_);
   context.force_long_loca_and_gvar_ = false;
+  if (IsMixedMode()) {
+    auto tags = FontHelper::GetTags(face_.get());
+    context.desubroutinize_ =
+        tags.contains(FontHelper::kCFF) || tags.contains(FontHelper::kCFF2);
+  }
+  if (subset_cache_) {
+    hb_blob_unique_ptr blob = make_hb_blob(hb_face_reference_blob(face_.get()));
+    unsigned length = 0;
+    const char* data = hb_blob_get_data(blob.get(), &length);
+    context.source_hashes_.push_back(
+        std::pair(face_.get(), SubsetCache::Hash(string_view(data, length))));
+  }
+
   auto expanded = FullyExpandedSubset(context);
   if (!expanded.ok()) {
     return expanded.status();
@@ -460,21 +553,438 @@ StatusOr<Encoder::Encoding> Encoder::Encode() const {
 
   context.fully_expanded_subset_.shallow_copy(*expanded);
   auto expanded_face = expanded->face();
+  context.full_face_ =
+      make_hb_face(hb_subset_preprocess(expanded_face.get()));
+  std::string expanded_hash =
+      SubsetCache::Hash(context.fully_expanded_subset_.str());
+  if (subset_cache_) {
+    context.source_hashes_.push_back(
+        std::pair(context.full_face_.get(), expanded_hash));
+  }
   context.force_long_loca_and_gvar_ =
       FontHelper::HasLongLoca(expanded_face.get()) ||
       FontHelper::HasWideGvar(expanded_face.get());
 
-  auto init_font = Encode(context, base_subset_, true);
-  if (!init_font.ok()) {
-    return init_font.status();
+  // All subsets and patches are derived from the expanded subset, so along
+  // with the subsetter version and flags this identifies the source data.
+  context.source_fingerprint_ = SubsetCache::Hash(
+      StrCat(expanded_hash, ";hb=", hb_version_string(),
+             ";flags=", MixedModeSubsettingFlags(context)));
+
+  // Planning is done serially so that compat ids and patch ids are always
+  // assigned in the same order, the (expensive) building can then be done in
+  // any order.
+  auto root = PlanNode(context, base_subset_);
+  if (!root.ok()) {
+    return root.status();
+  }
+
+  ApplyPreviousEncoding(context);
+
+  std::unique_ptr<ThreadPool> pool;
+  if (num_threads_ > 1) {
+    // The calling thread also runs tasks while waiting on the pool.
+    pool = std::make_unique<ThreadPool>(num_threads_ - 1);
+    context.pool_ = pool.get();
+  }
+
+  InMemoryPatchSink in_memory_sink;
+  context.sink_ = patch_sink_ ? patch_sink_ : &in_memory_sink;
+
+  BrotliDictionaryCache owned_dictionary_cache;
+  context.dictionary_cache_ =
+      dictionary_cache_ ? dictionary_cache_ : &owned_dictionary_cache;
+
+  auto sc = BuildGraph(context);
+  if (!sc.ok()) {
+    return sc;
   }
 
   Encoding result;
-  result.init_font.shallow_copy(*init_font);
-  result.patches = std::move(context.patches_);
+  const GraphNode& root_node = context.nodes_[*root];
+  result.init_font.shallow_copy(root_node.reused ? previous_->init_font
+                                                 : root_node.font);
+  result.patches = in_memory_sink.TakePatches();
+  result.manifest = CreateManifest(context);
   return result;
 }
 
+// Reads a compat id stored at the start of 'data'.
+static StatusOr<CompatId> ReadCompatId(string_view data) {
+  uint32_t values[4];
+  for (uint32_t i = 0; i < 4; i++) {
+    values[i] = TRY(FontHelper::ReadUInt32(data.substr(i * 4)));
+  }
+  return CompatId(values);
+}
+
+StatusOr<Encoder::Encoding> Encoder::Recompress(
+    const Encoding& encoding) const {
+  // Format tag (4), reserved (4)
+  constexpr uint32_t table_keyed_compat_id_offset = 8;
+  // Format (1), reserved (4)
+  constexpr uint32_t ift_table_compat_id_offset = 5;
+
+  BrotliDictionaryCache owned_dictionary_cache;
+  BrotliBinaryDiff table_keyed_diff = TableKeyedBinaryDiff(
+      dictionary_cache_ ? dictionary_cache_ : &owned_dictionary_cache);
+  BrotliBinaryDiff glyph_keyed_diff(profile_.glyph_keyed_quality,
+                                    profile_.window_bits);
+
+  // Table keyed patches are listed by the compat id of the font they apply to.
+  flat_hash_map<CompatId, std::vector<const std::string*>> table_keyed;
+  std::vector<const std::string*> glyph_keyed;
+  for (const auto& [url, patch] : encoding.patches) {
+    string_view format = patch.str().substr(0, 4);
+    if (format == "iftk") {
+      CompatId base_id = TRY(
+          ReadCompatId(patch.str().substr(table_keyed_compat_id_offset)));
+      table_keyed[base_id].push_back(&url);
+    } else if (format == "ifgk") {
+      glyph_keyed.push_back(&url);
+    } else {
+      return absl::InvalidArgumentError(
+          StrCat("Patch ", url, " is not an IFT patch."));
+    }
+  }
+
+  std::unique_ptr<ThreadPool> pool;
+  if (num_threads_ > 1) {
+    pool = std::make_unique<ThreadPool>(num_threads_ - 1);
+  }
+  auto parallel_for = [&](uint32_t count,
+                          const std::function<void(uint32_t)>& fn) {
+    if (pool) {
+      pool->ParallelFor(count, fn);
+      return;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+      fn(i);
+    }
+  };
+
+  InMemoryPatchSink in_memory_sink;
+  PatchSink* sink = patch_sink_ ? patch_sink_ : &in_memory_sink;
+
+  std::vector<Status> results(glyph_keyed.size());
+  parallel_for(glyph_keyed.size(), [&](uint32_t i) {
+    const std::string& url = *glyph_keyed[i];
+    auto patch =
+        GlyphKeyedDiff::Recompress(encoding.patches.at(url), glyph_keyed_diff);
+    results[i] = patch.ok() ? sink->AddPatch(url, *patch) : patch.status();
+  });
+  for (const auto& sc : results) {
+    TRYV(sc);
+  }
+
+  // The graph is walked breadth first from the init font. Each table keyed
+  // patch is decoded to find the font it produces, which is the base for that
+  // font's outgoing patches.
+  std::vector<TableKeyedDiff::Tables> level(1);
+  {
+    hb_face_unique_ptr face = encoding.init_font.face();
+    for (hb_tag_t tag : FontHelper::GetTags(face.get())) {
+      level[0][tag] = FontHelper::TableData(face.get(), tag);
+    }
+  }
+
+  flat_hash_set<CompatId> visited;
+  uint32_t recompressed = 0;
+  while (!level.empty()) {
+    std::vector<std::pair<const TableKeyedDiff::Tables*, const std::string*>>
+        edges;
+    for (const auto& tables : level) {
+      auto ift_table = tables.find(FontHelper::kIFT);
+      if (ift_table == tables.end()) {
+        // Leaf nodes of a table keyed only encoding have no IFT table.
+        continue;
+      }
+
+      CompatId id = TRY(ReadCompatId(
+          ift_table->second.str().substr(ift_table_compat_id_offset)));
+      if (!visited.insert(id).second) {
+        continue;
+      }
+
+      auto it = table_keyed.find(id);
+      if (it == table_keyed.end()) {
+        continue;
+      }
+      for (const std::string* url : it->second) {
+        edges.push_back(std::pair(&tables, url));
+      }
+    }
+
+    std::vector<TableKeyedDiff::Tables> next(edges.size());
+    results.assign(edges.size(), absl::OkStatus());
+    parallel_for(edges.size(), [&](uint32_t i) {
+      const auto& [tables, url] = edges[i];
+      auto patch = TableKeyedDiff::Recompress(
+          encoding.patches.at(*url), *tables, table_keyed_diff, next[i]);
+      results[i] = patch.ok() ? sink->AddPatch(*url, *patch) : patch.status();
+    });
+    for (const auto& sc : results) {
+      TRYV(sc);
+    }
+
+    recompressed += edges.size();
+    level = std::move(next);
+  }
+
+  uint32_t table_keyed_count = encoding.patches.size() - glyph_keyed.size();
+  if (recompressed != table_keyed_count) {
+    return absl::InvalidArgumentError(
+        "Some table keyed patches can't be reached from the init font.");
+  }
+
+  Encoding result;
+  result.init_font.shallow_copy(encoding.init_font);
+  result.patches = in_memory_sink.TakePatches();
+  result.manifest = encoding.manifest;
+  return result;
+}
+
+// Size model used by Plan(). These only need to be in the right ballpark.
+//
+// Brotli typically compresses outline data to about half its size.
+constexpr double kOutlineCompressionRatio = 0.5;
+// Compressed cmap and layout data added to a table keyed patch per codepoint.
+constexpr double kBytesPerCodepoint = 4;
+// Patch header, IFT table updates and brotli framing.
+constexpr double kBytesPerPatch = 100;
+
+// Converts a count computed in floating point to an integer, saturating at
+// the largest representable value.
+static uint64_t SaturatingCount(double count) {
+  if (!(count < 18446744073709551616.0)) {
+    return std::numeric_limits<uint64_t>::max();
+  }
+  return count;
+}
+
+// Returns sum(C(r, k) for k in [0, q]) for every r in [0, n].
+static std::vector<double> PartialBinomialSums(uint32_t n, uint32_t q) {
+  // Uses S(r + 1) = 2 * S(r) - C(r, q), tracking C(r, q) alongside.
+  std::vector<double> sums(n + 1);
+  double c_r_q = q == 0 ? 1 : 0;
+  sums[0] = 1;
+  for (uint32_t r = 0; r < n; r++) {
+    sums[r + 1] = 2 * sums[r] - c_r_q;
+    if (r + 1 == q) {
+      c_r_q = 1;
+    } else if (r + 1 > q) {
+      c_r_q = c_r_q * (r + 1) / (r + 1 - q);
+    }
+  }
+  return sums;
+}
+
+// Returns C(n, m) for every m in [0, n].
+static std::vector<double> BinomialRow(uint32_t n) {
+  std::vector<double> row(n + 1);
+  row[0] = 1;
+  for (uint32_t m = 0; m < n; m++) {
+    row[m + 1] = row[m] * (n - m) / (m + 1);
+  }
+  return row;
+}
+
+static double GlyphCount(const Encoder::SubsetDefinition& def) {
+  return std::max(def.gids.size(), def.codepoints.size());
+}
+
+// Returns true if any codepoint, gid, feature or axis is in more than one of
+// 'subsets'.
+static bool AnyOverlap(
+    const std::vector<const Encoder::SubsetDefinition*>& subsets) {
+  flat_hash_set<uint32_t> codepoints;
+  flat_hash_set<uint32_t> gids;
+  flat_hash_set<hb_tag_t> tags;
+  flat_hash_set<hb_tag_t> axes;
+  for (const auto* s : subsets) {
+    for (uint32_t cp : s->codepoints) {
+      if (!codepoints.insert(cp).second) {
+        return true;
+      }
+    }
+    for (uint32_t gid : s->gids) {
+      if (!gids.insert(gid).second) {
+        return true;
+      }
+    }
+    for (hb_tag_t tag : s->feature_tags) {
+      if (!tags.insert(tag).second) {
+        return true;
+      }
+    }
+    for (const auto& [tag, range] : s->design_space) {
+      if (!axes.insert(tag).second) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+StatusOr<Encoder::EncodingPlan> Encoder::Plan() const {
+  if (!face_) {
+    return absl::FailedPreconditionError("Encoder must have a face set.");
+  }
+
+  EncodingPlan plan;
+
+  // Extension subsets already in the root never produce edges.
+  IndexSet in_root = CoveredExtensions(base_subset_);
+  std::vector<const SubsetDefinition*> remaining;
+  for (uint32_t i = 0; i < extension_subsets_.size(); i++) {
+    if (!in_root.Contains(i)) {
+      remaining.push_back(&extension_subsets_[i]);
+    }
+  }
+  plan.exact = !AnyOverlap(remaining);
+
+  // Average compressed size of one glyph's outlines.
+  double outline_bytes = 0;
+  for (hb_tag_t tag : {FontHelper::kGlyf, FontHelper::kCFF, FontHelper::kCFF2,
+                       FontHelper::kGvar}) {
+    hb_blob_unique_ptr table =
+        make_hb_blob(hb_face_reference_table(face_.get(), tag));
+    outline_bytes += hb_blob_get_length(table.get());
+  }
+  double bytes_per_glyph = kOutlineCompressionRatio * outline_bytes /
+                           std::max(1u, hb_face_get_glyph_count(face_.get()));
+
+  // With disjoint extension subsets every combination of them is a node: the
+  // nodes on level m are the C(n, m) combinations of m subsets. Each has an
+  // edge for every combination of 1 to jump_ahead_ of the other r = n - m,
+  // plus optionally one which adds all r.
+  //
+  // When the depth is limited a combination is a separate node at each depth
+  // it can be reached at. Nodes at the last level just have the one edge which
+  // adds everything remaining.
+  uint32_t n = remaining.size();
+  uint32_t j = std::min<uint32_t>(jump_ahead_, n);
+  std::vector<double> combinations = BinomialRow(n);
+  std::vector<double> edge_sums = PartialBinomialSums(n, j);
+  std::vector<double> member_sums =
+      n && j ? PartialBinomialSums(n - 1, j - 1) : std::vector<double>();
+  double total_nodes = 0;
+  double total_edges = 0;
+  // Number of edges which add any one of the remaining subsets.
+  double edges_per_subset = 0;
+  for (uint32_t m = 0; m <= n; m++) {
+    uint32_t r = n - m;
+    double inner = 0;
+    double last_level = 0;
+    if (!r) {
+      // Leaves are shared between all depths.
+      bool reachable = !n || j || include_all_segment_patches_ || max_depth_;
+      inner = reachable ? 1 : 0;
+    } else if (!max_depth_) {
+      inner = (!m || j) ? combinations[m] : 0;
+    } else {
+      uint32_t min_depth = m ? (j ? (m + j - 1) / j : max_depth_) : 0;
+      uint32_t max_depth = std::min(m, max_depth_ - 1);
+      if (min_depth <= max_depth) {
+        double depths = max_depth - min_depth + 1;
+        if (max_depth == max_depth_ - 1) {
+          last_level = combinations[m];
+          depths -= 1;
+        }
+        inner = depths * combinations[m];
+      }
+    }
+
+    bool all_edge = r && include_all_segment_patches_ && r > j;
+    double edges = r ? inner * (edge_sums[r] - 1 + all_edge) + last_level : 0;
+
+    double nodes = inner + last_level;
+    plan.nodes_per_level.push_back(SaturatingCount(nodes));
+    plan.edges_per_level.push_back(SaturatingCount(edges));
+    total_nodes += nodes;
+    total_edges += edges;
+
+    if (r) {
+      // A node is missing any one subset with probability r / n, in which
+      // case that subset is in sum(C(r - 1, k - 1), k = 1..j) of the node's
+      // combination edges.
+      double combination_members = j ? member_sums[r - 1] : 0;
+      edges_per_subset +=
+          ((double)r / n) *
+          (inner * (combination_members + all_edge) + last_level);
+    }
+  }
+  plan.node_count = SaturatingCount(total_nodes);
+  plan.table_keyed_patch_count = SaturatingCount(total_edges);
+
+  double table_keyed_bytes = kBytesPerPatch * total_edges;
+  for (const auto* s : remaining) {
+    double bytes = kBytesPerCodepoint * s->codepoints.size();
+    if (!IsMixedMode()) {
+      // Otherwise outlines are in the glyph keyed patches.
+      bytes += bytes_per_glyph * GlyphCount(*s);
+    }
+    table_keyed_bytes += bytes * edges_per_subset;
+  }
+
+  double glyph_keyed_bytes = 0;
+  if (IsMixedMode()) {
+    flat_hash_set<uint32_t> reachable_segments;
+    for (const auto& condition : activation_conditions_) {
+      reachable_segments.insert(condition.activated_segment_id);
+    }
+
+    double bytes_per_set = 0;
+    for (uint32_t id : reachable_segments) {
+      auto e = glyph_data_segments_.find(id);
+      if (e == glyph_data_segments_.end()) {
+        return absl::InvalidArgumentError(
+            StrCat("Glyph data segment ", id, " was not provided."));
+      }
+      bytes_per_set += kBytesPerPatch + bytes_per_glyph * GlyphCount(e->second);
+    }
+
+    // There's a patch set for each distinct design space in the graph, which
+    // comes from the root plus any combination of the extension subsets that
+    // have a design space.
+    std::vector<SubsetDefinition> spaces;
+    for (const auto* s : remaining) {
+      if (!s->design_space.empty()) {
+        SubsetDefinition space;
+        space.design_space = s->design_space;
+        spaces.push_back(std::move(space));
+      }
+    }
+
+    constexpr uint32_t kMaxEnumeratedSpaces = 16;
+    double set_count = std::pow(2.0, spaces.size());
+    if (spaces.size() <= kMaxEnumeratedSpaces) {
+      flat_hash_set<std::string> seen;
+      for (uint32_t mask = 0; mask < (1u << spaces.size()); mask++) {
+        SubsetDefinition combined;
+        combined.design_space = base_subset_.design_space;
+        for (uint32_t i = 0; i < spaces.size(); i++) {
+          if (mask & (1u << i)) {
+            combined.Union(spaces[i]);
+          }
+        }
+        if (seen.insert(DesignSpaceString(combined.design_space)).second) {
+          plan.glyph_keyed_patch_counts.push_back(
+              std::pair(combined.design_space, reachable_segments.size()));
+        }
+      }
+      set_count = seen.size();
+    }
+
+    plan.glyph_keyed_patch_count =
+        SaturatingCount(set_count * reachable_segments.size());
+    glyph_keyed_bytes = set_count * bytes_per_set;
+  }
+
+  plan.estimated_bytes = SaturatingCount(table_keyed_bytes + glyph_keyed_bytes);
+  return plan;
+}
+
 bool Encoder::AllocatePatchSet(ProcessingContext& context,
                                const design_space_t& design_space,
                                std::string& uri_template,
@@ -500,39 +1010,32 @@ bool Encoder::AllocatePatchSet(ProcessingContext& context,
   return true;
 }
 
-Status Encoder::EnsureGlyphKeyedPatchesPopulated(
-    ProcessingContext& context, const design_space_t& design_space,
-    std::string& uri_template, CompatId& compat_id) const {
+Status Encoder::EnsureGlyphKeyedPatchSet(ProcessingContext& context,
+                                         const design_space_t& design_space,
+                                         std::string& uri_template,
+                                         CompatId& compat_id) const {
   if (glyph_data_segments_.empty()) {
     return absl::OkStatus();
   }
 
+  AllocatePatchSet(context, design_space, uri_template, compat_id);
+  return absl::OkStatus();
+}
+
+Status Encoder::PopulateGlyphKeyedPatches(ProcessingContext& context,
+                                          const design_space_t& design_space,
+                                          const std::string& uri_template,
+                                          CompatId compat_id) const {
   flat_hash_set<uint32_t> reachable_segments;
   for (const auto& condition : activation_conditions_) {
     reachable_segments.insert(condition.activated_segment_id);
   }
 
-  if (!AllocatePatchSet(context, design_space, uri_template, compat_id)) {
-    // Patches have already been populated for this design space.
-    return absl::OkStatus();
-  }
-
-  auto full_face = context.fully_expanded_subset_.face();
-  FontData instance;
-  instance.set(full_face.get());
-
-  if (!design_space.empty()) {
-    // If a design space is provided, apply it.
-    auto result = Instance(context, full_face.get(), design_space);
-    if (!result.ok()) {
-      return result.status();
-    }
-    instance.shallow_copy(*result);
-  }
-
-  GlyphKeyedDiff differ(instance, compat_id,
-                        {FontHelper::kGlyf, FontHelper::kGvar});
+  // This may run concurrently with other patch sets so only read from context.
+  auto reused_segments = context.reused_segments_.find(design_space);
 
+  std::vector<uint32_t> segment_ids;
+  std::vector<btree_set<uint32_t>> gid_sets;
   for (uint32_t index : reachable_segments) {
     auto e = glyph_data_segments_.find(index);
     if (e == glyph_data_segments_.end()) {
@@ -540,18 +1043,54 @@ Status Encoder::EnsureGlyphKeyedPatchesPopulated(
           StrCat("Glyph data segment ", index, " was not provided."));
     }
 
-    std::string url = URLTemplate::PatchToUrl(uri_template, index);
+    if (reused_segments != context.reused_segments_.end() &&
+        reused_segments->second.contains(index)) {
+      // Glyph data is unchanged, only the compat id may need updating.
+      std::string url = URLTemplate::PatchToUrl(uri_template, index);
+      auto patch = GlyphKeyedDiff::WithCompatId(*PreviousPatch(url), compat_id);
+      if (!patch.ok()) {
+        return patch.status();
+      }
+      TRYV(context.AddPatch(url, *patch));
+      continue;
+    }
 
-    SubsetDefinition subset = e->second;
+    const SubsetDefinition& subset = e->second;
     btree_set<uint32_t> gids;
     std::copy(subset.gids.begin(), subset.gids.end(),
               std::inserter(gids, gids.begin()));
-    auto patch = differ.CreatePatch(gids);
-    if (!patch.ok()) {
-      return patch.status();
+    segment_ids.push_back(index);
+    gid_sets.push_back(std::move(gids));
+  }
+
+  if (gid_sets.empty()) {
+    return absl::OkStatus();
+  }
+
+  FontData instance;
+  instance.shallow_copy(context.fully_expanded_subset_);
+
+  if (!design_space.empty()) {
+    // If a design space is provided, apply it.
+    auto result = GetInstance(context, design_space);
+    if (!result.ok()) {
+      return result.status();
     }
+    instance.shallow_copy((*result)->font);
+  }
+
+  GlyphKeyedDiff differ(instance, compat_id,
+                        {FontHelper::kGlyf, FontHelper::kGvar,
+                         FontHelper::kCFF, FontHelper::kCFF2},
+                        profile_.glyph_keyed_quality, profile_.window_bits);
+  auto patches = differ.CreatePatches(gid_sets, context.pool_);
+  if (!patches.ok()) {
+    return patches.status();
+  }
 
-    context.patches_[url].shallow_copy(*patch);
+  for (uint32_t i = 0; i < segment_ids.size(); i++) {
+    std::string url = URLTemplate::PatchToUrl(uri_template, segment_ids[i]);
+    TRYV(context.AddPatch(url, (*patches)[i]));
   }
 
   return absl::OkStatus();
@@ -781,66 +1320,500 @@ Status Encoder::PopulateGlyphKeyedPatchMap(PatchMap& patch_map) const {
   return absl::OkStatus();
 }
 
-StatusOr<FontData> Encoder::Encode(ProcessingContext& context,
-                                   const SubsetDefinition& base_subset,
-                                   bool is_root) const {
-  auto it = context.built_subsets_.find(base_subset);
-  if (it != context.built_subsets_.end()) {
-    FontData copy;
-    copy.shallow_copy(it->second);
-    return copy;
+StatusOr<uint32_t> Encoder::PlanNode(ProcessingContext& context,
+                                     SubsetDefinition base_subset,
+                                     uint32_t depth) const {
+  IndexSet extensions = CoveredExtensions(base_subset);
+  std::vector<uint32_t> remaining;
+  for (uint32_t i = 0; i < extension_subsets_.size(); i++) {
+    if (!extensions.Contains(i)) {
+      remaining.push_back(i);
+    }
   }
 
-  std::string table_keyed_uri_template = UrlTemplate(0);
-  CompatId table_keyed_compat_id = context.GenerateCompatId();
-  std::string glyph_keyed_uri_template;
-  CompatId glyph_keyed_compat_id;
-  auto sc = EnsureGlyphKeyedPatchesPopulated(context, base_subset.design_space,
-                                             glyph_keyed_uri_template,
-                                             glyph_keyed_compat_id);
-  if (!sc.ok()) {
-    return sc;
+  // Depth only changes a node's edges when it's limited, and leaves have no
+  // edges.
+  uint32_t depth_key = (max_depth_ && !remaining.empty()) ? depth : 0;
+  auto key = std::pair(extensions, depth_key);
+  auto it = context.node_indices_.find(key);
+  if (it != context.node_indices_.end()) {
+    return it->second;
+  }
+
+  uint32_t index = context.nodes_.size();
+  context.node_indices_[key] = index;
+  context.nodes_.emplace_back();
+  {
+    GraphNode& node = context.nodes_.back();
+    node.subset = std::move(base_subset);
+    node.extensions = std::move(extensions);
+    node.depth = depth_key;
+    node.is_root = depth == 0;
+    node.table_keyed_compat_id = context.GenerateCompatId();
+    TRYV(EnsureGlyphKeyedPatchSet(context, node.subset.design_space,
+                                  node.glyph_keyed_uri_template,
+                                  node.glyph_keyed_compat_id));
+  }
+
+  // Edges are added to remaining extension subsets in the same order as
+  // OutgoingEdges().
+  uint32_t edge_count = 0;
+  ForEachOutgoingEdge(remaining.size(), jump_ahead_, depth,
+                      [&](absl::Span<const uint32_t>) { edge_count++; });
+  if (!edge_count) {
+    // This is a leaf node.
+    return index;
+  }
+
+  uint32_t first_edge = context.edges_.size();
+  context.nodes_[index].first_edge = first_edge;
+  context.nodes_[index].edge_count = edge_count;
+  for (uint32_t i = 0; i < edge_count; i++) {
+    GraphEdge edge;
+    edge.from = index;
+    edge.patch_id = context.next_id_++;
+    context.edges_.push_back(edge);
+  }
+
+  uint32_t edge_index = first_edge;
+  Status status;
+  ForEachOutgoingEdge(
+      remaining.size(), jump_ahead_, depth,
+      [&](absl::Span<const uint32_t> members) {
+        uint32_t current_edge = edge_index++;
+        if (!status.ok()) {
+          return;
+        }
+
+        auto next = PlanEdgeTarget(context, index, remaining, members);
+        if (!next.ok()) {
+          status = next.status();
+          return;
+        }
+
+        // Check if the main table URL will change with this subset
+        std::string next_glyph_keyed_uri_template;
+        GraphEdge& edge = context.edges_[current_edge];
+        edge.to = *next;
+        edge.replace_url_template =
+            IsMixedMode() && (next_glyph_keyed_uri_template !=
+                              context.nodes_[index].glyph_keyed_uri_template);
+        context.nodes_[*next].incoming_edges.push_back(current_edge);
+      });
+  if (!status.ok()) {
+    return status;
   }
 
-  std::vector<SubsetDefinition> subsets =
-      OutgoingEdges(base_subset, jump_ahead_);
+  return index;
+}
+
+StatusOr<uint32_t> Encoder::PlanEdgeTarget(
+    ProcessingContext& context, uint32_t from,
+    const std::vector<uint32_t>& remaining,
+    absl::Span<const uint32_t> members) const {
+  uint32_t depth = context.nodes_[from].depth + 1;
+  IndexSet next_extensions = context.nodes_[from].extensions;
+  for (uint32_t i : members) {
+    next_extensions.Insert(remaining[i]);
+  }
+
+  // Most edges lead to an existing node, which can be found from the
+  // extension indices alone. Only materialize the subset definition (and
+  // check what else it covers) the first time a set of indices is seen.
+  auto key = std::pair(std::move(next_extensions), max_depth_ ? depth : 0);
+  auto existing = context.node_indices_.find(key);
+  if (existing != context.node_indices_.end()) {
+    return existing->second;
+  }
+
+  SubsetDefinition next_subset = context.nodes_[from].subset;
+  for (auto m = members.rbegin(); m != members.rend(); m++) {
+    next_subset.Union(extension_subsets_[remaining[*m]]);
+  }
+
+  auto next = PlanNode(context, std::move(next_subset), depth);
+  if (!next.ok()) {
+    return next.status();
+  }
+  context.node_indices_[key] = *next;
+  return *next;
+}
+
+Status Encoder::BuildGraph(ProcessingContext& context) const {
+  // Each edge waits on both of it's end points.
+  context.edge_dependencies_ =
+      std::make_unique<std::atomic<uint32_t>[]>(context.edges_.size());
+  context.node_dependents_ =
+      std::make_unique<std::atomic<uint32_t>[]>(context.nodes_.size());
+  for (uint32_t i = 0; i < context.edges_.size(); i++) {
+    context.edge_dependencies_[i] = 2;
+
+    const GraphEdge& edge = context.edges_[i];
+    if (!context.nodes_[edge.from].reused) {
+      context.node_dependents_[edge.from]++;
+      context.node_dependents_[edge.to]++;
+    }
+  }
+
+  for (const auto& [design_space, uri_template] :
+       context.patch_set_uri_templates_) {
+    const design_space_t* ds = &design_space;
+    const std::string* uri = &uri_template;
+    CompatId compat_id = context.glyph_keyed_compat_ids_.at(design_space);
+    context.Schedule([this, &context, ds, uri, compat_id] {
+      return PopulateGlyphKeyedPatches(context, *ds, *uri, compat_id);
+    });
+  }
+
+  for (uint32_t i = 0; i < context.nodes_.size(); i++) {
+    const GraphNode& node = context.nodes_[i];
+    if (node.reused) {
+      for (uint32_t j = 0; j < node.edge_count; j++) {
+        std::string url = URLTemplate::PatchToUrl(
+            UrlTemplate(0), context.edges_[node.first_edge + j].patch_id);
+        TRYV(context.AddPatch(url, *PreviousPatch(url)));
+      }
+    }
+
+    // A reused node only needs to be built if it's the target of a patch
+    // which is being regenerated.
+    bool needed = !node.reused;
+    for (uint32_t edge_index : node.incoming_edges) {
+      needed |= !context.nodes_[context.edges_[edge_index].from].reused;
+    }
+    if (!needed) {
+      continue;
+    }
+
+    context.Schedule([this, &context, i] {
+      TRYV(BuildNode(context, i));
+      OnNodeBuilt(context, i);
+      return absl::OkStatus();
+    });
+  }
+
+  if (context.pool_) {
+    context.pool_->Wait();
+  }
+  return context.status();
+}
+
+void Encoder::OnNodeBuilt(ProcessingContext& context,
+                          uint32_t node_index) const {
+  const GraphNode& node = context.nodes_[node_index];
+  auto schedule_if_ready = [this, &context](uint32_t edge_index) {
+    if (context.nodes_[context.edges_[edge_index].from].reused) {
+      // The existing patch is used.
+      return;
+    }
+    if (context.edge_dependencies_[edge_index].fetch_sub(1) == 1) {
+      context.Schedule([this, &context, edge_index] {
+        TRYV(BuildEdge(context, edge_index));
+        OnEdgeBuilt(context, edge_index);
+        return absl::OkStatus();
+      });
+    }
+  };
+
+  for (uint32_t i = 0; i < node.edge_count; i++) {
+    schedule_if_ready(node.first_edge + i);
+  }
+  for (uint32_t edge_index : node.incoming_edges) {
+    schedule_if_ready(edge_index);
+  }
+}
+
+void Encoder::OnEdgeBuilt(ProcessingContext& context,
+                          uint32_t edge_index) const {
+  const GraphEdge& edge = context.edges_[edge_index];
+  for (uint32_t node_index : {edge.from, edge.to}) {
+    GraphNode& node = context.nodes_[node_index];
+    if (context.node_dependents_[node_index].fetch_sub(1) == 1 &&
+        !node.is_root) {
+      // No other patches need this font, so free it. The root is kept since
+      // it's the init font.
+      node.font.reset();
+      node.glyph_mapping = GlyphMapping();
+    }
+  }
+}
+
+void Encoder::ApplyPreviousEncoding(ProcessingContext& context) const {
+  const Manifest* previous = previous_ ? &previous_->manifest : nullptr;
+  if (previous) {
+    // New ids must be distinct from those of all previous generations. A new
+    // seed gives a different sequence of compat ids than prior generations.
+    context.gen_.seed(std::mt19937::default_seed + previous->generation + 1);
+    context.next_patch_set_id_ =
+        std::max(context.next_patch_set_id_, previous->next_patch_set_id);
+    for (const auto& [_, node] : previous->nodes) {
+      context.reserved_compat_ids_.insert(node.compat_id);
+    }
+    for (const auto& [_, set] : previous->glyph_keyed_patch_sets) {
+      context.reserved_compat_ids_.insert(set.compat_id);
+    }
+  }
+
+  if (IsMixedMode()) {
+    // Visit the patch sets in node order so that any new ids are assigned
+    // deterministically.
+    for (const GraphNode& node : context.nodes_) {
+      if (!context.glyph_keyed_patch_sets_.contains(
+              node.subset.design_space)) {
+        FingerprintGlyphKeyedPatchSet(context, node.subset.design_space);
+      }
+    }
+    for (GraphNode& node : context.nodes_) {
+      node.glyph_keyed_uri_template =
+          context.patch_set_uri_templates_.at(node.subset.design_space);
+      node.glyph_keyed_compat_id =
+          context.glyph_keyed_compat_ids_.at(node.subset.design_space);
+    }
+  }
+
+  // Node 0 is the root, all other nodes are reachable from it.
+  FingerprintNode(context, 0);
+  if (!previous) {
+    return;
+  }
+
+  uint32_t next_patch_id = std::max(next_id_, previous->next_patch_id);
+  for (GraphNode& node : context.nodes_) {
+    if (node.reused) {
+      const Manifest::Node& previous_node =
+          previous->nodes.at(node.subset_hash);
+      node.table_keyed_compat_id = previous_node.compat_id;
+      for (uint32_t i = 0; i < node.edge_count; i++) {
+        context.edges_[node.first_edge + i].patch_id =
+            previous_node.patch_ids[i];
+      }
+      continue;
+    }
+
+    node.table_keyed_compat_id = context.GenerateCompatId();
+    for (uint32_t i = 0; i < node.edge_count; i++) {
+      context.edges_[node.first_edge + i].patch_id = next_patch_id++;
+    }
+  }
+  context.next_id_ = next_patch_id;
+}
+
+void Encoder::FingerprintGlyphKeyedPatchSet(
+    ProcessingContext& context, const design_space_t& design_space) const {
+  std::string design_space_string = DesignSpaceString(design_space);
+
+  Manifest::GlyphKeyedPatchSet set;
+  set.uri_template = context.patch_set_uri_templates_.at(design_space);
+  set.compat_id = context.glyph_keyed_compat_ids_.at(design_space);
+
+  // The mapping is formed from the segment definitions and the conditions.
+  std::string inputs = StrCat(context.source_fingerprint_,
+                              ";ds=", design_space_string);
+  for (const auto& [id, segment] : glyph_data_segments_) {
+    absl::StrAppend(&inputs, ";segment=", id, ":", CanonicalString(segment));
+  }
+  for (const auto& condition : activation_conditions_) {
+    absl::StrAppend(&inputs, ";condition=");
+    for (const auto& group : condition.required_groups) {
+      absl::StrAppend(&inputs, "{", absl::StrJoin(group, ","), "}");
+    }
+    absl::StrAppend(&inputs, ":",
+                    absl::StrJoin(condition.required_features, ","), ":",
+                    condition.activated_segment_id);
+  }
+  set.fingerprint = SubsetCache::Hash(inputs);
+
+  // A segment's patch only depends on its glyphs.
+  for (const auto& condition : activation_conditions_) {
+    uint32_t id = condition.activated_segment_id;
+    auto segment = glyph_data_segments_.find(id);
+    if (segment == glyph_data_segments_.end()) {
+      // PopulateGlyphKeyedPatches() reports this.
+      continue;
+    }
+    btree_set<uint32_t> gids(segment->second.gids.begin(),
+                             segment->second.gids.end());
+    set.segment_fingerprints[id] = SubsetCache::Hash(
+        StrCat(context.source_fingerprint_, ";ds=", design_space_string,
+               ";gids=", absl::StrJoin(gids, ",")));
+  }
+
+  const Manifest::GlyphKeyedPatchSet* previous_set = nullptr;
+  if (previous_) {
+    auto it = previous_->manifest.glyph_keyed_patch_sets.find(
+        SubsetCache::Hash(design_space_string));
+    if (it != previous_->manifest.glyph_keyed_patch_sets.end()) {
+      previous_set = &it->second;
+    }
+  }
+
+  if (previous_set) {
+    // Keep the urls stable.
+    set.uri_template = previous_set->uri_template;
+
+    flat_hash_set<uint32_t>& reused = context.reused_segments_[design_space];
+    for (const auto& [id, fingerprint] : set.segment_fingerprints) {
+      auto previous_fingerprint = previous_set->segment_fingerprints.find(id);
+      if (previous_fingerprint != previous_set->segment_fingerprints.end() &&
+          previous_fingerprint->second == fingerprint &&
+          PreviousPatch(URLTemplate::PatchToUrl(set.uri_template, id))) {
+        reused.insert(id);
+      }
+    }
+
+    if (previous_set->fingerprint == set.fingerprint &&
+        reused.size() == set.segment_fingerprints.size()) {
+      // Nothing has changed so the compat id can be kept.
+      set.compat_id = previous_set->compat_id;
+    } else {
+      set.compat_id = context.GenerateCompatId();
+    }
+  } else if (previous_) {
+    set.uri_template = UrlTemplate(context.next_patch_set_id_++);
+    set.compat_id = context.GenerateCompatId();
+  }
+
+  context.patch_set_uri_templates_[design_space] = set.uri_template;
+  context.glyph_keyed_compat_ids_[design_space] = set.compat_id;
+  context.glyph_keyed_patch_sets_[design_space] = std::move(set);
+}
+
+void Encoder::FingerprintNode(ProcessingContext& context,
+                              uint32_t node_index) const {
+  GraphNode& node = context.nodes_[node_index];
+  if (!node.fingerprint.empty()) {
+    return;
+  }
+
+  // The node's font is determined by its subset, ids and patch mappings. Node
+  // ids are not included, they are kept only if the fingerprint matches.
+  std::string identity = CanonicalString(node.subset);
+  if (max_depth_) {
+    // The same subset can be at multiple depths.
+    absl::StrAppend(&identity, ";depth=", node.depth);
+  }
+  node.subset_hash = SubsetCache::Hash(identity);
+  std::string inputs =
+      StrCat(context.source_fingerprint_, ";subset=", node.subset_hash,
+             ";root=", node.is_root, ";url=", UrlTemplate(0));
+  if (IsMixedMode()) {
+    const Manifest::GlyphKeyedPatchSet& set =
+        context.glyph_keyed_patch_sets_.at(node.subset.design_space);
+    absl::StrAppend(&inputs, ";glyph_keyed=", set.uri_template, ":",
+                    CompatIdString(set.compat_id), ":", set.fingerprint);
+  }
+
+  // Including the fingerprints of the next nodes means that a match implies
+  // that everything reachable from this node is unchanged as well.
+  bool next_reused = true;
+  for (uint32_t i = 0; i < node.edge_count; i++) {
+    const GraphEdge& edge = context.edges_[node.first_edge + i];
+    FingerprintNode(context, edge.to);
+    const GraphNode& next = context.nodes_[edge.to];
+    absl::StrAppend(&inputs, ";edge=", next.subset_hash, ":", next.fingerprint,
+                    ":", edge.replace_url_template);
+    next_reused &= next.reused;
+  }
+  node.fingerprint = SubsetCache::Hash(inputs);
+
+  if (!previous_ || !next_reused) {
+    return;
+  }
+
+  auto previous = previous_->manifest.nodes.find(node.subset_hash);
+  if (previous == previous_->manifest.nodes.end() ||
+      previous->second.fingerprint != node.fingerprint ||
+      previous->second.patch_ids.size() != node.edge_count) {
+    return;
+  }
+  for (uint32_t patch_id : previous->second.patch_ids) {
+    if (!PreviousPatch(URLTemplate::PatchToUrl(UrlTemplate(0), patch_id))) {
+      return;
+    }
+  }
+  if (node.is_root && previous_->init_font.empty()) {
+    return;
+  }
+
+  node.reused = true;
+}
+
+const FontData* Encoder::PreviousPatch(const std::string& url) const {
+  auto it = previous_->patches.find(url);
+  if (it == previous_->patches.end()) {
+    return nullptr;
+  }
+  return &it->second;
+}
+
+Encoder::Manifest Encoder::CreateManifest(
+    const ProcessingContext& context) const {
+  Manifest manifest;
+  if (previous_) {
+    manifest.generation = previous_->manifest.generation + 1;
+  }
+  manifest.next_patch_id = context.next_id_;
+  manifest.next_patch_set_id = context.next_patch_set_id_;
+
+  for (const GraphNode& node : context.nodes_) {
+    Manifest::Node& entry = manifest.nodes[node.subset_hash];
+    entry.fingerprint = node.fingerprint;
+    entry.compat_id = node.table_keyed_compat_id;
+    for (uint32_t i = 0; i < node.edge_count; i++) {
+      entry.patch_ids.push_back(context.edges_[node.first_edge + i].patch_id);
+    }
+  }
+
+  for (const auto& [design_space, set] : context.glyph_keyed_patch_sets_) {
+    manifest.glyph_keyed_patch_sets[SubsetCache::Hash(
+        DesignSpaceString(design_space))] = set;
+  }
+
+  return manifest;
+}
+
+Status Encoder::BuildNode(ProcessingContext& context,
+                          uint32_t node_index) const {
+  GraphNode& node = context.nodes_[node_index];
 
   // The first subset forms the base file, the remaining subsets are made
   // reachable via patches.
-  auto full_face = context.fully_expanded_subset_.face();
-  auto base = CutSubset(context, full_face.get(), base_subset);
+  auto base = CutSubset(context, context.full_face_.get(), node.subset,
+                        UseFontDiff() ? &node.glyph_mapping : nullptr);
   if (!base.ok()) {
     return base.status();
   }
 
-  if (subsets.empty() && !IsMixedMode()) {
+  if (!node.edge_count && !IsMixedMode()) {
     // This is a leaf node, a IFT table isn't needed.
-    context.built_subsets_[base_subset].shallow_copy(*base);
-    return base;
+    node.font.shallow_copy(*base);
+    return absl::OkStatus();
   }
 
   IFTTable table_keyed;
   IFTTable glyph_keyed;
-  table_keyed.SetId(table_keyed_compat_id);
-  table_keyed.SetUrlTemplate(table_keyed_uri_template);
-  glyph_keyed.SetId(glyph_keyed_compat_id);
-  glyph_keyed.SetUrlTemplate(glyph_keyed_uri_template);
+  table_keyed.SetId(node.table_keyed_compat_id);
+  table_keyed.SetUrlTemplate(UrlTemplate(0));
+  glyph_keyed.SetId(node.glyph_keyed_compat_id);
+  glyph_keyed.SetUrlTemplate(node.glyph_keyed_uri_template);
 
   PatchMap& glyph_keyed_patch_map = glyph_keyed.GetPatchMap();
-  sc = PopulateGlyphKeyedPatchMap(glyph_keyed_patch_map);
-  if (!sc.ok()) {
-    return sc;
+  TRYV(PopulateGlyphKeyedPatchMap(glyph_keyed_patch_map));
+
+  // Edge coverage isn't stored in the plan, so regenerate it. OutgoingEdges()
+  // is deterministic so this matches the order used during planning.
+  std::vector<SubsetDefinition> subsets =
+      OutgoingEdges(node.subset, jump_ahead_, node.depth);
+  if (subsets.size() != node.edge_count) {
+    return absl::InternalError("Planned edges do not match the node.");
   }
 
-  std::vector<uint32_t> ids;
   PatchMap& table_keyed_patch_map = table_keyed.GetPatchMap();
   PatchEncoding encoding =
       IsMixedMode() ? TABLE_KEYED_PARTIAL : TABLE_KEYED_FULL;
-  for (const auto& s : subsets) {
-    uint32_t id = context.next_id_++;
-    ids.push_back(id);
-
-    PatchMap::Coverage coverage = s.ToCoverage();
+  for (uint32_t i = 0; i < subsets.size(); i++) {
+    uint32_t id = context.edges_[node.first_edge + i].patch_id;
+    PatchMap::Coverage coverage = subsets[i].ToCoverage();
     TRYV(table_keyed_patch_map.AddEntry(coverage, id, encoding));
   }
 
@@ -853,10 +1826,11 @@ StatusOr<FontData> Encoder::Encode(ProcessingContext& context,
     return new_base.status();
   }
 
-  if (is_root) {
-    // For the root node round trip the font through woff2 so that the base for
-    // patching can be a decoded woff2 font file.
-    base = RoundTripWoff2(new_base->str(), false);
+  if (node.is_root) {
+    // For the root node canonicalize the font to the form a woff2 round trip
+    // (without the glyf transform) produces, so that the base for patching can
+    // be a decoded woff2 font file.
+    base = Woff2::Canonicalize(new_base->str());
     if (!base.ok()) {
       return base.status();
     }
@@ -864,89 +1838,127 @@ StatusOr<FontData> Encoder::Encode(ProcessingContext& context,
     base->shallow_copy(*new_base);
   }
 
-  context.built_subsets_[base_subset].shallow_copy(*base);
+  node.font.shallow_copy(*base);
+  return absl::OkStatus();
+}
 
-  uint32_t i = 0;
-  for (const auto& s : subsets) {
-    uint32_t id = ids[i++];
-    SubsetDefinition combined_subset = Combine(base_subset, s);
-    auto next = Encode(context, combined_subset, false);
-    if (!next.ok()) {
-      return next.status();
-    }
+Status Encoder::BuildEdge(ProcessingContext& context,
+                          uint32_t edge_index) const {
+  const GraphEdge& edge = context.edges_[edge_index];
+  const GraphNode& base = context.nodes_[edge.from];
+  const GraphNode& next = context.nodes_[edge.to];
+
+  FontData patch;
+  auto differ = GetDifferFor(context, next.font, base.table_keyed_compat_id,
+                             edge.replace_url_template);
+  if (!differ.ok()) {
+    return differ.status();
+  }
+  TableKeyedDiff::GlyphMappings glyph_mappings{
+      base.glyph_mapping.new_to_old.get(), next.glyph_mapping.old_to_new.get()};
+  bool has_glyph_mappings =
+      glyph_mappings.base_new_to_old && glyph_mappings.derived_old_to_new;
+  TRYV((*differ)->Diff(base.font, next.font, &patch, context.pool_,
+                       has_glyph_mappings ? &glyph_mappings : nullptr));
+
+  std::string url = URLTemplate::PatchToUrl(UrlTemplate(0), edge.patch_id);
+  return context.AddPatch(url, patch);
+}
 
-    // Check if the main table URL will change with this subset
-    std::string next_glyph_keyed_uri_template;
-    CompatId next_glyph_keyed_compat_id;
-    auto sc = EnsureGlyphKeyedPatchesPopulated(
-        context, base_subset.design_space, glyph_keyed_uri_template,
-        glyph_keyed_compat_id);
-    if (!sc.ok()) {
-      return sc;
-    }
+StatusOr<std::unique_ptr<const TableKeyedDiff>> Encoder::GetDifferFor(
+    const ProcessingContext& context, const FontData& font_data,
+    CompatId compat_id, bool replace_url_template) const {
+  BrotliBinaryDiff binary_diff =
+      TableKeyedBinaryDiff(context.dictionary_cache_);
+  if (!IsMixedMode()) {
+    return std::unique_ptr<const TableKeyedDiff>(
+        FullFontTableKeyedDiff(compat_id, binary_diff));
+  }
 
-    bool replace_url_template =
-        IsMixedMode() &&
-        (next_glyph_keyed_uri_template != glyph_keyed_uri_template);
+  if (replace_url_template) {
+    return std::unique_ptr<const TableKeyedDiff>(
+        ReplaceIftMapTableKeyedDiff(compat_id, binary_diff));
+  }
 
-    FontData patch;
-    auto differ =
-        GetDifferFor(*next, table_keyed_compat_id, replace_url_template);
-    if (!differ.ok()) {
-      return differ.status();
-    }
-    sc = (*differ)->Diff(*base, *next, &patch);
-    if (!sc.ok()) {
-      return sc;
-    }
+  return std::unique_ptr<const TableKeyedDiff>(
+      MixedModeTableKeyedDiff(compat_id, binary_diff));
+}
 
-    std::string url = URLTemplate::PatchToUrl(table_keyed_uri_template, id);
-    context.patches_[url].shallow_copy(patch);
+hb_subset_input_t* Encoder::CreateSubsetInput(
+    const ProcessingContext& context, hb_face_t* font,
+    const SubsetDefinition& def) const {
+  hb_subset_input_t* input = hb_subset_input_create_or_fail();
+  if (!input) {
+    return nullptr;
   }
 
-  return base;
+  def.ConfigureInput(input, font);
+
+  SetMixedModeSubsettingFlagsIfNeeded(context, input);
+  return input;
 }
 
-StatusOr<std::unique_ptr<const BinaryDiff>> Encoder::GetDifferFor(
-    const FontData& font_data, CompatId compat_id,
-    bool replace_url_template) const {
-  if (!IsMixedMode()) {
-    return std::unique_ptr<const BinaryDiff>(
-        Encoder::FullFontTableKeyedDiff(compat_id));
+Status Encoder::PlanGlyphMapping(const ProcessingContext& context,
+                                hb_face_t* font, const SubsetDefinition& def,
+                                GlyphMapping& glyph_mapping) const {
+  hb_subset_input_t* input = CreateSubsetInput(context, font, def);
+  if (!input) {
+    return absl::InternalError("Failed to create subset input.");
   }
 
-  if (replace_url_template) {
-    return std::unique_ptr<const BinaryDiff>(
-        Encoder::ReplaceIftMapTableKeyedDiff(compat_id));
+  hb_subset_plan_t* plan = hb_subset_plan_create_or_fail(font, input);
+  hb_subset_input_destroy(input);
+  if (!plan) {
+    return absl::InternalError("Harfbuzz subset planning failed.");
   }
 
-  return std::unique_ptr<const BinaryDiff>(
-      Encoder::MixedModeTableKeyedDiff(compat_id));
+  glyph_mapping.new_to_old.reset(
+      hb_map_copy(hb_subset_plan_new_to_old_glyph_mapping(plan)));
+  glyph_mapping.old_to_new.reset(
+      hb_map_copy(hb_subset_plan_old_to_new_glyph_mapping(plan)));
+  hb_subset_plan_destroy(plan);
+  return absl::OkStatus();
 }
 
 StatusOr<hb_face_unique_ptr> Encoder::CutSubsetFaceBuilder(
     const ProcessingContext& context, hb_face_t* font,
-    const SubsetDefinition& def) const {
-  hb_subset_input_t* input = hb_subset_input_create_or_fail();
+    const SubsetDefinition& def, GlyphMapping* glyph_mapping) const {
+  hb_subset_input_t* input = CreateSubsetInput(context, font, def);
   if (!input) {
     return absl::InternalError("Failed to create subset input.");
   }
 
-  def.ConfigureInput(input, font);
+  if (!glyph_mapping) {
+    hb_face_unique_ptr result = make_hb_face(hb_subset_or_fail(font, input));
+    hb_subset_input_destroy(input);
+    if (!result.get()) {
+      return absl::InternalError("Harfbuzz subsetting operation failed.");
+    }
+    return result;
+  }
 
-  SetMixedModeSubsettingFlagsIfNeeded(context, input);
+  hb_subset_plan_t* plan = hb_subset_plan_create_or_fail(font, input);
+  hb_subset_input_destroy(input);
+  if (!plan) {
+    return absl::InternalError("Harfbuzz subset planning failed.");
+  }
+
+  glyph_mapping->new_to_old.reset(
+      hb_map_copy(hb_subset_plan_new_to_old_glyph_mapping(plan)));
+  glyph_mapping->old_to_new.reset(
+      hb_map_copy(hb_subset_plan_old_to_new_glyph_mapping(plan)));
 
-  hb_face_unique_ptr result = make_hb_face(hb_subset_or_fail(font, input));
+  hb_face_unique_ptr result =
+      make_hb_face(hb_subset_plan_execute_or_fail(plan));
+  hb_subset_plan_destroy(plan);
   if (!result.get()) {
     return absl::InternalError("Harfbuzz subsetting operation failed.");
   }
-
-  hb_subset_input_destroy(input);
   return result;
 }
 
 StatusOr<FontData> Encoder::GenerateBaseGvar(
-    const ProcessingContext& context, hb_face_t* font,
+    const ProcessingContext& context,
     const design_space_t& design_space) const {
   // When generating a gvar table for use with glyph keyed patches care
   // must be taken to ensure that the shared tuples in the gvar
@@ -959,14 +1971,14 @@ StatusOr<FontData> Encoder::GenerateBaseGvar(
   //
   // To keep the shared tuples correct we subset in two steps:
   // 1. Run instancing only, keeping everything else, this matches
-  //    the processing done in EnsureGlyphKeyedPatchesPopulated()
+  //    the processing done in PopulateGlyphKeyedPatches()
   //    and will result in the same shared tuples.
   // 2. Run the glyph base subset, with no instancing specified.
   //    if there is no specified instancing then harfbuzz will
   //    not modify shared tuples.
 
   // Step 1: Instancing
-  auto instance = Instance(context, font, design_space);
+  auto instance = GetInstance(context, design_space);
   if (!instance.ok()) {
     return instance.status();
   }
@@ -977,9 +1989,8 @@ StatusOr<FontData> Encoder::GenerateBaseGvar(
   // so clear out the design space.
   subset.design_space = {};
 
-  hb_face_unique_ptr instanced_face = instance->face();
   auto face_builder =
-      CutSubsetFaceBuilder(context, instanced_face.get(), subset);
+      CutSubsetFaceBuilder(context, (*instance)->face.get(), subset);
   if (!face_builder.ok()) {
     return face_builder.status();
   }
@@ -994,25 +2005,95 @@ StatusOr<FontData> Encoder::GenerateBaseGvar(
 void Encoder::SetMixedModeSubsettingFlagsIfNeeded(
     const ProcessingContext& context, hb_subset_input_t* input) const {
   if (IsMixedMode()) {
-    // Mixed mode requires stable gids set flags accordingly.
-    hb_subset_input_set_flags(
-        input, hb_subset_input_get_flags(input) | HB_SUBSET_FLAGS_RETAIN_GIDS |
+    hb_subset_input_set_flags(input, hb_subset_input_get_flags(input) |
+                                         MixedModeSubsettingFlags(context));
+  }
+}
+
+hb_subset_flags_t Encoder::MixedModeSubsettingFlags(
+    const ProcessingContext& context) const {
+  if (!IsMixedMode()) {
+    return HB_SUBSET_FLAGS_DEFAULT;
+  }
+
+  // Mixed mode requires stable gids set flags accordingly.
+  unsigned flags = HB_SUBSET_FLAGS_RETAIN_GIDS |
                    HB_SUBSET_FLAGS_NOTDEF_OUTLINE |
-                   HB_SUBSET_FLAGS_PASSTHROUGH_UNRECOGNIZED);
+                   HB_SUBSET_FLAGS_PASSTHROUGH_UNRECOGNIZED;
+
+  if (context.force_long_loca_and_gvar_) {
+    // IFTB requirements flag has the side effect of forcing long loca and
+    // gvar.
+    flags |= HB_SUBSET_FLAGS_IFTB_REQUIREMENTS;
+  }
+
+  if (context.desubroutinize_) {
+    // Subroutines are renumbered per subset, so CharStrings which call them
+    // can't be shared between the base and the glyph keyed patches.
+    flags |= HB_SUBSET_FLAGS_DESUBROUTINIZE;
+  }
 
-    if (context.force_long_loca_and_gvar_) {
-      // IFTB requirements flag has the side effect of forcing long loca and
-      // gvar.
-      hb_subset_input_set_flags(input, hb_subset_input_get_flags(input) |
-                                           HB_SUBSET_FLAGS_IFTB_REQUIREMENTS);
+  return (hb_subset_flags_t)flags;
+}
+
+std::string Encoder::CacheKey(const ProcessingContext& context,
+                              hb_face_t* font, string_view operation,
+                              const SubsetDefinition& def) const {
+  if (!subset_cache_ || context.source_hashes_.empty()) {
+    return "";
+  }
+
+  const std::string* source_hash = nullptr;
+  for (const auto& [source_face, hash] : context.source_hashes_) {
+    if (source_face == font) {
+      source_hash = &hash;
+      break;
     }
   }
+  if (!source_hash) {
+    // Not one of the known source fonts, so there's no cheap way to identify
+    // it.
+    return "";
+  }
+
+  std::string key =
+      StrCat(operation, ";source=", *source_hash,
+             ";hb=", hb_version_string(),
+             ";flags=", MixedModeSubsettingFlags(context), ";",
+             CanonicalString(def));
+  if (IsMixedMode() && def.IsVariable()) {
+    // CutSubset() also replaces gvar with one generated from the base subset.
+    absl::StrAppend(&key, ";base=", CanonicalString(base_subset_));
+  }
+  return key;
+}
+
+void Encoder::AddToCache(string_view cache_key, const FontData& font) const {
+  auto sc = subset_cache_->Put(cache_key, font);
+  if (!sc.ok()) {
+    // The cache is just an optimization, so keep going.
+    LOG(WARNING) << "Failed to add entry to the subset cache: " << sc;
+  }
 }
 
 StatusOr<FontData> Encoder::CutSubset(const ProcessingContext& context,
                                       hb_face_t* font,
-                                      const SubsetDefinition& def) const {
-  auto result = CutSubsetFaceBuilder(context, font, def);
+                                      const SubsetDefinition& def,
+                                      GlyphMapping* glyph_mapping) const {
+  std::string cache_key = CacheKey(context, font, "subset", def);
+  if (!cache_key.empty()) {
+    auto cached = subset_cache_->Get(cache_key);
+    if (cached.ok() && glyph_mapping) {
+      // The glyph mapping isn't cached, planning the subset is enough to
+      // recover it.
+      TRYV(PlanGlyphMapping(context, font, def, *glyph_mapping));
+    }
+    if (cached.ok()) {
+      return cached;
+    }
+  }
+
+  auto result = CutSubsetFaceBuilder(context, font, def, glyph_mapping);
   if (!result.ok()) {
     return result.status();
   }
@@ -1026,7 +2107,7 @@ StatusOr<FontData> Encoder::CutSubset(const ProcessingContext& context,
     // Create such a gvar table here and overwrite the one that was otherwise
     // generated by the normal subsetting operation. The patch generation will
     // handle including a replacement gvar patch when needed.
-    auto base_gvar = GenerateBaseGvar(context, font, def.design_space);
+    auto base_gvar = GenerateBaseGvar(context, def.design_space);
     if (!base_gvar.ok()) {
       return base_gvar.status();
     }
@@ -1039,12 +2120,25 @@ StatusOr<FontData> Encoder::CutSubset(const ProcessingContext& context,
   hb_blob_unique_ptr blob = make_hb_blob(hb_face_reference_blob(result->get()));
 
   FontData subset(blob.get());
+  if (!cache_key.empty()) {
+    AddToCache(cache_key, subset);
+  }
   return subset;
 }
 
 StatusOr<FontData> Encoder::Instance(const ProcessingContext& context,
                                      hb_face_t* face,
                                      const design_space_t& design_space) const {
+  SubsetDefinition def;
+  def.design_space = design_space;
+  std::string cache_key = CacheKey(context, face, "instance", def);
+  if (!cache_key.empty()) {
+    auto cached = subset_cache_->Get(cache_key);
+    if (cached.ok()) {
+      return cached;
+    }
+  }
+
   hb_subset_input_t* input = hb_subset_input_create_or_fail();
 
   // Keep everything in this subset, except for applying the design space.
@@ -1066,9 +2160,42 @@ StatusOr<FontData> Encoder::Instance(const ProcessingContext& context,
   hb_blob_unique_ptr out = make_hb_blob(hb_face_reference_blob(subset.get()));
 
   FontData result(out.get());
+  if (!cache_key.empty()) {
+    AddToCache(cache_key, result);
+  }
   return result;
 }
 
+StatusOr<const Encoder::InstancedFont*> Encoder::GetInstance(
+    const ProcessingContext& context,
+    const design_space_t& design_space) const {
+  {
+    absl::MutexLock lock(&context.instances_mutex_);
+    auto it = context.instances_.find(design_space);
+    if (it != context.instances_.end()) {
+      return &it->second;
+    }
+  }
+
+  // Instancing is done without holding the lock. If two threads race to
+  // create the same instance the results are identical, so the first one
+  // stored wins.
+  auto font = Instance(context, context.full_face_.get(), design_space);
+  if (!font.ok()) {
+    return font.status();
+  }
+
+  InstancedFont instance;
+  instance.font.shallow_copy(*font);
+  hb_face_unique_ptr face = instance.font.face();
+  instance.face = make_hb_face(hb_subset_preprocess(face.get()));
+
+  absl::MutexLock lock(&context.instances_mutex_);
+  auto it =
+      context.instances_.try_emplace(design_space, std::move(instance)).first;
+  return &it->second;
+}
+
 StatusOr<FontData> Encoder::RoundTripWoff2(string_view font,
                                            bool glyf_transform) {
   auto r = Woff2::EncodeWoff2(font, glyf_transform);
@@ -1080,9 +2207,39 @@ StatusOr<FontData> Encoder::RoundTripWoff2(string_view font,
 }
 
 CompatId Encoder::ProcessingContext::GenerateCompatId() {
-  return CompatId(
-      this->random_values_(this->gen_), this->random_values_(this->gen_),
-      this->random_values_(this->gen_), this->random_values_(this->gen_));
+  while (true) {
+    CompatId id(
+        this->random_values_(this->gen_), this->random_values_(this->gen_),
+        this->random_values_(this->gen_), this->random_values_(this->gen_));
+    if (!reserved_compat_ids_.contains(id)) {
+      return id;
+    }
+  }
+}
+
+void Encoder::ProcessingContext::Schedule(std::function<Status()> task) {
+  auto run = [this, task = std::move(task)] {
+    if (!status().ok()) {
+      return;
+    }
+
+    auto sc = task();
+    if (!sc.ok()) {
+      absl::MutexLock lock(&mutex_);
+      status_.Update(sc);
+    }
+  };
+
+  if (!pool_) {
+    run();
+    return;
+  }
+  pool_->Schedule(std::move(run));
+}
+
+Status Encoder::ProcessingContext::status() {
+  absl::MutexLock lock(&mutex_);
+  return status_;
 }
 
 }  // namespace ift::encoder
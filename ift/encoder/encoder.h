@@ -1,20 +1,36 @@
 #ifndef IFT_ENCODER_ENCODER_H_
 #define IFT_ENCODER_ENCODER_H_
 
+#include <atomic>
 #include <cstdint>
+#include <functional>
 #include <initializer_list>
+#include <memory>
 #include <random>
+#include <utility>
+#include <vector>
 
 #include "absl/container/btree_map.h"
 #include "absl/container/btree_set.h"
 #include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
+#include "absl/container/node_hash_map.h"
+#include "absl/functional/function_ref.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/span.h"
 #include "common/axis_range.h"
+#include "common/brotli_binary_diff.h"
+#include "common/brotli_dictionary_cache.h"
 #include "common/compat_id.h"
 #include "common/font_data.h"
+#include "common/hb_set_unique_ptr.h"
+#include "common/thread_pool.h"
 #include "hb-subset.h"
+#include "ift/encoder/index_set.h"
+#include "ift/encoder/patch_sink.h"
+#include "ift/encoder/subset_cache.h"
 #include "ift/proto/patch_map.h"
 #include "ift/table_keyed_diff.h"
 
@@ -28,10 +44,6 @@ class Encoder {
  public:
   typedef absl::flat_hash_map<hb_tag_t, common::AxisRange> design_space_t;
 
-  // TODO(garretrieger): add api to configure brotli quality level (for glyph
-  // and table keyed).
-  //                     Default to 11 but in tests run lower quality.
-
   // TODO XXXXXX be consistent with terminology used for patches/segments (ie.
   // standardize on one or the other throughout).
 
@@ -85,6 +97,95 @@ class Encoder {
    */
   void SetJumpAhead(uint32_t count) { this->jump_ahead_ = count; }
 
+  /*
+   * Limits the depth of the table keyed patch graph, so that any node can be
+   * reached in at most 'max_depth' patches. Nodes at depth max_depth - 1 only
+   * have a single patch which adds everything remaining. Defaults to 0, which
+   * is unlimited.
+   */
+  void SetMaxDepth(uint32_t max_depth) { this->max_depth_ = max_depth; }
+
+  /*
+   * If set, every node in the table keyed patch graph has (in addition to the
+   * usual patches) a patch which adds everything remaining. Defaults to false.
+   */
+  void SetIncludeAllSegmentPatches(bool value) {
+    this->include_all_segment_patches_ = value;
+  }
+
+  /*
+   * Configures how many threads are used to build the subsets and patches
+   * of the encoding. The output is the same regardless of the thread count.
+   * Defaults to 1.
+   */
+  void SetThreads(uint32_t count) { this->num_threads_ = count; }
+
+  /*
+   * Configures a persistent cache of subsetting results, 'cache' is not owned
+   * and must outlive this encoder. When set, subset and instanced fonts are
+   * loaded from the cache if present, otherwise they are added to it.
+   */
+  void SetSubsetCache(SubsetCache* cache) { this->subset_cache_ = cache; }
+
+  /*
+   * Configures a cache of prepared brotli dictionaries, 'cache' is not owned
+   * and must outlive this encoder. All table keyed patches leaving a node share
+   * the node's tables as their dictionaries, so caching avoids preparing them
+   * repeatedly. If not set a cache is created for each call to Encode() or
+   * Recompress(); setting one allows it to be shared or inspected.
+   */
+  void SetDictionaryCache(common::BrotliDictionaryCache* cache) {
+    this->dictionary_cache_ = cache;
+  }
+
+  /*
+   * Brotli settings used by each stage of the encoder which compresses data.
+   * The defaults give the smallest encoding.
+   */
+  struct EncodeProfile {
+    unsigned table_keyed_quality = 11;
+    unsigned glyph_keyed_quality = 11;
+    // Brotli window size (lgwin) for the patches, 0 uses the brotli default.
+    unsigned window_bits = 0;
+    // When not in mixed mode, diff the glyf, loca, hmtx and vmtx tables using
+    // the glyph mappings of the subset plans (see brotli::BrotliFontDiff).
+    // Glyphs shared with the base are referenced without searching for them,
+    // only new glyph data is compressed at 'table_keyed_quality'. Much faster
+    // for fonts with large glyf tables.
+    bool font_diff = false;
+
+    // Much faster to produce than Release(), at the cost of larger patches.
+    // Intended for iterating on a config.
+    static EncodeProfile Draft() {
+      EncodeProfile profile;
+      profile.table_keyed_quality = 5;
+      profile.glyph_keyed_quality = 5;
+      return profile;
+    }
+
+    // Maximum compression.
+    static EncodeProfile Release() { return EncodeProfile(); }
+  };
+
+  /*
+   * Configures the brotli settings used to produce the patches. Defaults to
+   * EncodeProfile::Release(). This doesn't change which patches are produced
+   * or what they decode to, so patches reused from a previous encoding (see
+   * SetPreviousEncoding()) keep the compression they were produced with. Use
+   * Recompress() to change the compression of an existing encoding.
+   */
+  void SetEncodeProfile(const EncodeProfile& profile) {
+    this->profile_ = profile;
+  }
+
+  /*
+   * Configures a sink which receives each patch as soon as it has been
+   * generated, 'sink' is not owned and must outlive this encoder. When set
+   * Encoding::patches will be left empty, otherwise all patches are collected
+   * there.
+   */
+  void SetPatchSink(PatchSink* sink) { this->patch_sink_ = sink; }
+
   /*
    * Adds a segmentation of glyph data.
    *
@@ -165,11 +266,65 @@ class Encoder {
   absl::Status AddNonGlyphSegmentFromGlyphSegments(
       const absl::flat_hash_set<uint32_t>& ids);
 
+  /*
+   * Records the ids and input fingerprints of everything in an encoding. This
+   * is what allows a later encoder to determine which parts of a previous
+   * encoding are unaffected by a configuration change, see
+   * SetPreviousEncoding().
+   */
+  struct Manifest {
+    struct Node {
+      // Covers all inputs to this node's font and to the nodes reachable
+      // from it.
+      std::string fingerprint;
+      common::CompatId compat_id;
+      // Patch ids of the node's outgoing edges, in order.
+      std::vector<uint32_t> patch_ids;
+    };
+
+    struct GlyphKeyedPatchSet {
+      std::string uri_template;
+      common::CompatId compat_id;
+      // Covers all inputs to the patch set, including the glyph keyed mapping.
+      std::string fingerprint;
+      // Covers the inputs to each individual segment's patch.
+      absl::btree_map<uint32_t, std::string> segment_fingerprints;
+    };
+
+    // Incremented each time an encoding is derived from a previous one.
+    uint32_t generation = 0;
+    // Ids which have never been used by this or any previous generation.
+    uint32_t next_patch_id = 0;
+    uint32_t next_patch_set_id = 1;
+
+    // Keyed by a hash of the node's subset definition.
+    absl::flat_hash_map<std::string, Node> nodes;
+    // Keyed by a hash of the patch set's design space.
+    absl::flat_hash_map<std::string, GlyphKeyedPatchSet> glyph_keyed_patch_sets;
+  };
+
   struct Encoding {
     common::FontData init_font;
+    // Empty if a patch sink was configured.
     absl::flat_hash_map<std::string, common::FontData> patches;
+    Manifest manifest;
   };
 
+  /*
+   * Enables incremental encoding. Encode() will reuse the compat ids, patch ids
+   * and patches of 'previous' for the parts of the encoding whose inputs are
+   * unchanged, only the remainder is regenerated. 'previous' is not owned and
+   * must outlive any calls to Encode().
+   *
+   * Table keyed graph nodes are only reused when their font and everything
+   * reachable from them are unchanged. A glyph keyed patch set keeps its compat
+   * id only if none of its patches or its mapping changed, otherwise it gets a
+   * new compat id and unchanged segment patches are reused with the new id.
+   */
+  void SetPreviousEncoding(const Encoding* previous) {
+    this->previous_ = previous;
+  }
+
   /*
    * Create an IFT encoded version of 'font' that initially supports
    * the configured base subset but can be extended via patches to support any
@@ -180,6 +335,53 @@ class Encoder {
    */
   absl::StatusOr<Encoding> Encode() const;
 
+  /*
+   * Re-encodes every patch in 'encoding' (which can be from any encoder
+   * configuration) with the configured encode profile. No subsetting is done:
+   * the fonts that table keyed patches apply to are reconstructed by applying
+   * patches to the init font. Patch contents, urls, the init font and the
+   * manifest are unchanged, so this can be used to take an encoding produced
+   * with EncodeProfile::Draft() up to release quality. The configured patch
+   * sink and thread count are used.
+   */
+  absl::StatusOr<Encoding> Recompress(const Encoding& encoding) const;
+
+  /*
+   * Summary of the encoding that Encode() would produce, see Plan().
+   */
+  struct EncodingPlan {
+    // The table keyed patch graph. Level i holds the nodes which include i
+    // more extension segments than the root, edges_per_level[i] counts the
+    // edges leaving those nodes.
+    uint64_t node_count = 0;
+    std::vector<uint64_t> nodes_per_level;
+    std::vector<uint64_t> edges_per_level;
+
+    // One table keyed patch is produced per edge.
+    uint64_t table_keyed_patch_count = 0;
+
+    // Number of glyph keyed patches in each patch set, listed by the design
+    // space of the patch set.
+    std::vector<std::pair<design_space_t, uint64_t>> glyph_keyed_patch_counts;
+    uint64_t glyph_keyed_patch_count = 0;
+
+    // Rough total size of all patches, from a simple per glyph size model.
+    uint64_t estimated_bytes = 0;
+
+    // False if some extension segments overlap. Overlapping segments may
+    // cause graph nodes to coincide, so the table keyed counts become upper
+    // bounds.
+    bool exact = true;
+  };
+
+  /*
+   * Computes the shape and approximate size of the encoding without doing any
+   * subsetting or compression. The graph is counted combinatorially rather
+   * than expanded, so this is fast even for configurations which would
+   * produce millions of patches. Counts saturate at UINT64_MAX.
+   */
+  absl::StatusOr<EncodingPlan> Plan() const;
+
   // TODO(garretrieger): update handling of encoding for use in woff2,
   // see: https://w3c.github.io/IFT/Overview.html#ift-and-compression
   static absl::StatusOr<common::FontData> RoundTripWoff2(
@@ -244,11 +446,23 @@ class Encoder {
     return absl::OkStatus();
   }
 
+  /*
+   * Returns the subsets added by each of the outgoing edges of a node at
+   * 'depth' in the graph which has subset 'base'.
+   */
   std::vector<SubsetDefinition> OutgoingEdges(const SubsetDefinition& base,
-                                              uint32_t choose) const;
+                                              uint32_t choose,
+                                              uint32_t depth = 0) const;
 
  private:
   struct ProcessingContext;
+  struct InstancedFont;
+
+  // The glyph id maps of the subset plan which produced a font.
+  struct GlyphMapping {
+    common::hb_map_unique_ptr new_to_old = common::make_hb_map(nullptr);
+    common::hb_map_unique_ptr old_to_new = common::make_hb_map(nullptr);
+  };
 
   // Returns the font subset which would be reach if all segments where added to
   // the font.
@@ -265,24 +479,87 @@ class Encoder {
     return absl::StrCat(patch_set_id, "_{id}.gk");
   }
 
-  static void AddCombinations(const std::vector<const SubsetDefinition*>& in,
-                              uint32_t number,
-                              std::vector<SubsetDefinition>& out);
-
   SubsetDefinition Combine(const SubsetDefinition& s1,
                            const SubsetDefinition& s2) const;
 
   /*
-   * Create an IFT encoded version of 'font' that initially supports
-   * 'base_subset' but can be extended via patches to support any combination of
-   * 'subsets'.
+   * Returns the indices of the extension subsets which are entirely contained
+   * in 'subset'. These are the extension subsets that are not reachable from
+   * a node with that subset.
+   */
+  IndexSet CoveredExtensions(const SubsetDefinition& subset) const;
+
+  /*
+   * Calls 'edge' with the members of each outgoing edge of a node at 'depth'
+   * which has 'remaining' extension subsets left to add. Members are indices
+   * into the node's remaining extension subsets.
+   */
+  void ForEachOutgoingEdge(
+      uint32_t remaining, uint32_t choose, uint32_t depth,
+      absl::FunctionRef<void(absl::Span<const uint32_t>)> edge) const;
+
+  /*
+   * Adds a node for 'base_subset' and (recursively) all nodes reachable from
+   * it to the patch graph in 'context'. This only assigns compat ids and patch
+   * ids, no subsetting or diffing is done.
    *
-   * Returns: the IFT encoded initial font. Patches() will be populated with the
-   * set of associated patch files.
+   * Returns: the index of the node for 'base_subset'.
    */
-  absl::StatusOr<common::FontData> Encode(ProcessingContext& context,
-                                          const SubsetDefinition& base_subset,
-                                          bool is_root = true) const;
+  absl::StatusOr<uint32_t> PlanNode(ProcessingContext& context,
+                                    SubsetDefinition base_subset,
+                                    uint32_t depth = 0) const;
+
+  /*
+   * Returns the index of the node reached from node 'from' by the edge that
+   * adds 'members' of 'remaining' (the extension subsets not in 'from'),
+   * planning the node if it's new.
+   */
+  absl::StatusOr<uint32_t> PlanEdgeTarget(
+      ProcessingContext& context, uint32_t from,
+      const std::vector<uint32_t>& remaining,
+      absl::Span<const uint32_t> members) const;
+
+  /*
+   * Builds the fonts and patches for all of the nodes and edges in the
+   * planned graph. If the context has a thread pool, independent nodes and
+   * edges are built concurrently.
+   */
+  absl::Status BuildGraph(ProcessingContext& context) const;
+
+  /*
+   * Computes the fingerprints of the planned graph and glyph keyed patch sets.
+   * If there is a previous encoding the ids of all unchanged nodes and patch
+   * sets are replaced with the previous ones, and all changed nodes and patch
+   * sets are given ids which are not used by the previous encoding.
+   */
+  void ApplyPreviousEncoding(ProcessingContext& context) const;
+
+  // Computes the fingerprints of 'node_index' and all nodes reachable from it
+  // and determines which of them can be reused from the previous encoding.
+  void FingerprintNode(ProcessingContext& context, uint32_t node_index) const;
+
+  void FingerprintGlyphKeyedPatchSet(ProcessingContext& context,
+                                     const design_space_t& design_space) const;
+
+  // Returns the patch with 'url' from the previous encoding, or null.
+  const common::FontData* PreviousPatch(const std::string& url) const;
+
+  Manifest CreateManifest(const ProcessingContext& context) const;
+
+  // Cuts the subset for a planned node and adds its IFT tables.
+  absl::Status BuildNode(ProcessingContext& context, uint32_t node_index) const;
+
+  // Creates the table keyed patch for a planned edge, requires both end
+  // points to have been built.
+  absl::Status BuildEdge(ProcessingContext& context, uint32_t edge_index) const;
+
+  // Called once a node has been built, schedules any edges which are now ready
+  // to be built.
+  void OnNodeBuilt(ProcessingContext& context, uint32_t node_index) const;
+
+  // Called once an edge has been built, releases the fonts of any nodes which
+  // are no longer needed.
+  void OnEdgeBuilt(ProcessingContext& context, uint32_t edge_index) const;
 
   absl::StatusOr<SubsetDefinition> SubsetDefinitionForSegments(
       const absl::flat_hash_set<uint32_t>& ids) const;
@@ -293,54 +570,114 @@ class Encoder {
    */
   bool IsMixedMode() const { return !glyph_data_segments_.empty(); }
 
-  absl::Status EnsureGlyphKeyedPatchesPopulated(
-      ProcessingContext& context, const design_space_t& design_space,
-      std::string& uri_template, common::CompatId& compat_id) const;
+  /*
+   * Ensures a glyph keyed patch set is allocated for 'design_space', returning
+   * its uri template and compat id. The actual patches are created later by
+   * PopulateGlyphKeyedPatches().
+   */
+  absl::Status EnsureGlyphKeyedPatchSet(ProcessingContext& context,
+                                        const design_space_t& design_space,
+                                        std::string& uri_template,
+                                        common::CompatId& compat_id) const;
+
+  absl::Status PopulateGlyphKeyedPatches(ProcessingContext& context,
+                                         const design_space_t& design_space,
+                                         const std::string& uri_template,
+                                         common::CompatId compat_id) const;
 
   absl::Status PopulateGlyphKeyedPatchMap(
       ift::proto::PatchMap& patch_map) const;
 
+  /*
+   * Returns a face builder holding the subset of 'font' for 'def'. If
+   * 'glyph_mapping' is non-null it's set to the glyph mapping of the subset.
+   */
   absl::StatusOr<common::hb_face_unique_ptr> CutSubsetFaceBuilder(
       const ProcessingContext& context, hb_face_t* font,
-      const SubsetDefinition& def) const;
+      const SubsetDefinition& def,
+      GlyphMapping* glyph_mapping /* OUT */ = nullptr) const;
+
+  hb_subset_input_t* CreateSubsetInput(const ProcessingContext& context,
+                                       hb_face_t* font,
+                                       const SubsetDefinition& def) const;
+
+  // Sets 'glyph_mapping' to that of the subset of 'font' for 'def', without
+  // cutting the subset.
+  absl::Status PlanGlyphMapping(const ProcessingContext& context,
+                                hb_face_t* font, const SubsetDefinition& def,
+                                GlyphMapping& glyph_mapping /* OUT */) const;
+
+  // True if table keyed patches should be generated with BrotliFontDiff.
+  bool UseFontDiff() const { return profile_.font_diff && !IsMixedMode(); }
 
   absl::StatusOr<common::FontData> GenerateBaseGvar(
-      const ProcessingContext& context, hb_face_t* font,
+      const ProcessingContext& context,
       const design_space_t& design_space) const;
 
   void SetMixedModeSubsettingFlagsIfNeeded(const ProcessingContext& context,
                                            hb_subset_input_t* input) const;
 
-  absl::StatusOr<common::FontData> CutSubset(const ProcessingContext& context,
-                                             hb_face_t* font,
-                                             const SubsetDefinition& def) const;
+  hb_subset_flags_t MixedModeSubsettingFlags(
+      const ProcessingContext& context) const;
+
+  /*
+   * Returns the subset cache key for applying 'operation' with 'def' to 'font'.
+   * Returns an empty string if the result should not be cached.
+   */
+  std::string CacheKey(const ProcessingContext& context, hb_face_t* font,
+                       absl::string_view operation,
+                       const SubsetDefinition& def) const;
+
+  void AddToCache(absl::string_view cache_key,
+                  const common::FontData& font) const;
+
+  absl::StatusOr<common::FontData> CutSubset(
+      const ProcessingContext& context, hb_face_t* font,
+      const SubsetDefinition& def,
+      GlyphMapping* glyph_mapping /* OUT */ = nullptr) const;
 
   absl::StatusOr<common::FontData> Instance(
       const ProcessingContext& context, hb_face_t* font,
       const design_space_t& design_space) const;
 
-  absl::StatusOr<std::unique_ptr<const common::BinaryDiff>> GetDifferFor(
-      const common::FontData& font_data, common::CompatId compat_id,
-      bool replace_url_template) const;
+  /*
+   * Returns the fully expanded subset instanced to 'design_space'. Each
+   * design space is only instanced (and preprocessed) once per encoding.
+   */
+  absl::StatusOr<const InstancedFont*> GetInstance(
+      const ProcessingContext& context,
+      const design_space_t& design_space) const;
+
+  absl::StatusOr<std::unique_ptr<const TableKeyedDiff>> GetDifferFor(
+      const ProcessingContext& context, const common::FontData& font_data,
+      common::CompatId compat_id, bool replace_url_template) const;
+
+  common::BrotliBinaryDiff TableKeyedBinaryDiff(
+      common::BrotliDictionaryCache* dictionary_cache) const {
+    return common::BrotliBinaryDiff(profile_.table_keyed_quality,
+                                    profile_.window_bits, dictionary_cache);
+  }
 
   static ift::TableKeyedDiff* FullFontTableKeyedDiff(
-      common::CompatId base_compat_id) {
-    return new TableKeyedDiff(base_compat_id);
+      common::CompatId base_compat_id, common::BrotliBinaryDiff binary_diff) {
+    return new TableKeyedDiff(base_compat_id, binary_diff);
   }
 
   static ift::TableKeyedDiff* MixedModeTableKeyedDiff(
-      common::CompatId base_compat_id) {
-    return new TableKeyedDiff(base_compat_id, {"IFTX", "glyf", "loca", "gvar"});
+      common::CompatId base_compat_id, common::BrotliBinaryDiff binary_diff) {
+    return new TableKeyedDiff(base_compat_id,
+                              {"IFTX", "glyf", "loca", "gvar", "CFF ", "CFF2"},
+                              binary_diff);
   }
 
   static ift::TableKeyedDiff* ReplaceIftMapTableKeyedDiff(
-      common::CompatId base_compat_id) {
-    // the replacement differ is used during design space expansions, both
-    // gvar and "IFT " are overwritten to be compatible with the new design
+      common::CompatId base_compat_id, common::BrotliBinaryDiff binary_diff) {
+    // the replacement differ is used during design space expansions, gvar,
+    // CFF2 and "IFT " are overwritten to be compatible with the new design
     // space. Glyph segment patches for all prev loaded glyphs will be
     // downloaded to repopulate variation data for existing glyphs.
-    return new TableKeyedDiff(base_compat_id, {"glyf", "loca"},
-                              {"IFTX", "gvar"});
+    return new TableKeyedDiff(base_compat_id, {"glyf", "loca", "CFF "},
+                              {"IFTX", "gvar", "CFF2"}, binary_diff);
   }
 
   bool AllocatePatchSet(ProcessingContext& context,
@@ -356,7 +693,62 @@ class Encoder {
   SubsetDefinition base_subset_;
   std::vector<SubsetDefinition> extension_subsets_;
   uint32_t jump_ahead_ = 1;
+  uint32_t max_depth_ = 0;
+  bool include_all_segment_patches_ = false;
+  uint32_t num_threads_ = 1;
   uint32_t next_id_ = 0;
+  SubsetCache* subset_cache_ = nullptr;
+  PatchSink* patch_sink_ = nullptr;
+  const Encoding* previous_ = nullptr;
+  EncodeProfile profile_;
+  common::BrotliDictionaryCache* dictionary_cache_ = nullptr;
+
+  // An edge in the table keyed patch graph, one table keyed patch is produced
+  // per edge.
+  struct GraphEdge {
+    uint32_t from = 0;
+    uint32_t to = 0;
+    uint32_t patch_id = 0;
+    bool replace_url_template = false;
+  };
+
+  // A node in the table keyed patch graph, one font subset is produced per
+  // node.
+  struct GraphNode {
+    SubsetDefinition subset;
+    // Extension subsets contained in 'subset', see CoveredExtensions().
+    IndexSet extensions;
+    // Only set when the depth is limited, in which case nodes at different
+    // depths have different edges. Leaf nodes are always at depth 0.
+    uint32_t depth = 0;
+    bool is_root = false;
+    common::CompatId table_keyed_compat_id;
+    std::string glyph_keyed_uri_template;
+    common::CompatId glyph_keyed_compat_id;
+
+    // Outgoing edges are edges_[first_edge, first_edge + edge_count).
+    uint32_t first_edge = 0;
+    uint32_t edge_count = 0;
+    std::vector<uint32_t> incoming_edges;
+
+    // Populated by ApplyPreviousEncoding(). When 'reused' is set the font and
+    // outgoing patches are unchanged from the previous encoding.
+    std::string subset_hash;
+    std::string fingerprint;
+    bool reused = false;
+
+    // Populated by BuildNode(), and released once all patches which are
+    // generated from it have been created.
+    common::FontData font;
+    // Only populated when UseFontDiff() is true.
+    GlyphMapping glyph_mapping;
+  };
+
+  struct InstancedFont {
+    common::FontData font;
+    // Preprocessed face of 'font', for cutting subsets from.
+    common::hb_face_unique_ptr face = common::make_hb_face(nullptr);
+  };
 
   struct ProcessingContext {
     ProcessingContext(uint32_t next_id)
@@ -368,7 +760,24 @@ class Encoder {
     std::uniform_int_distribution<uint32_t> random_values_;
 
     common::FontData fully_expanded_subset_;
+    // Preprocessed face of fully_expanded_subset_. All subsets are cut from
+    // this so that harfbuzz's table accelerators are only built once and then
+    // shared across nodes and threads.
+    common::hb_face_unique_ptr full_face_ = common::make_hb_face(nullptr);
     bool force_long_loca_and_gvar_ = false;
+    // Set for CFF and CFF2 fonts in mixed mode so that each CharString is
+    // self contained and can be moved by glyph keyed patches.
+    bool desubroutinize_ = false;
+
+    // Instances of fully_expanded_subset_, populated on demand by
+    // GetInstance().
+    mutable absl::Mutex instances_mutex_;
+    mutable absl::node_hash_map<design_space_t, InstancedFont> instances_
+        ABSL_GUARDED_BY(instances_mutex_);
+
+    // Content hashes of the fonts which subsets are cut from, keyed by the
+    // face. Only populated if there is a subset cache.
+    std::vector<std::pair<const hb_face_t*, std::string>> source_hashes_;
 
     uint32_t next_id_ = 0;
     uint32_t next_patch_set_id_ =
@@ -377,10 +786,54 @@ class Encoder {
     absl::flat_hash_map<design_space_t, common::CompatId>
         glyph_keyed_compat_ids_;
 
-    absl::flat_hash_map<SubsetDefinition, common::FontData> built_subsets_;
-    absl::flat_hash_map<std::string, common::FontData> patches_;
+    // Populated by ApplyPreviousEncoding().
+    std::string source_fingerprint_;
+    absl::flat_hash_map<design_space_t, Manifest::GlyphKeyedPatchSet>
+        glyph_keyed_patch_sets_;
+    // Segments whose patch can be reused from the previous encoding.
+    absl::flat_hash_map<design_space_t, absl::flat_hash_set<uint32_t>>
+        reused_segments_;
+    // Ids used by the previous encoding, newly generated compat ids must not
+    // collide with them.
+    absl::flat_hash_set<common::CompatId> reserved_compat_ids_;
+
+    // The planned graph, node 0 is the root. Nodes and edges are only added
+    // during planning, after which only GraphNode::font is modified.
+    //
+    // Nodes are looked up by a set of extension subset indices and depth, both
+    // by GraphNode::extensions and by the sets which edges were planned with
+    // (which may be missing extension subsets the target covers).
+    absl::flat_hash_map<std::pair<IndexSet, uint32_t>, uint32_t> node_indices_;
+    std::vector<GraphNode> nodes_;
+    std::vector<GraphEdge> edges_;
+
+    // Number of end points of each edge which still need to be built.
+    std::unique_ptr<std::atomic<uint32_t>[]> edge_dependencies_;
+    // Number of edges which still need each node's font.
+    std::unique_ptr<std::atomic<uint32_t>[]> node_dependents_;
+
+    // Optional, if not set all tasks are run on the calling thread.
+    common::ThreadPool* pool_ = nullptr;
+
+    PatchSink* sink_ = nullptr;
+    common::BrotliDictionaryCache* dictionary_cache_ = nullptr;
+
+    absl::Mutex mutex_;
+    absl::Status status_ ABSL_GUARDED_BY(mutex_);
 
     common::CompatId GenerateCompatId();
+
+    absl::Status AddPatch(const std::string& url,
+                          const common::FontData& patch) {
+      return sink_->AddPatch(url, patch);
+    }
+
+    // Runs 'task' on the pool (or immediately if there is no pool). Tasks
+    // are skipped once any task has failed, the first failure is kept in
+    // status_.
+    void Schedule(std::function<absl::Status()> task);
+
+    absl::Status status();
   };
 };
 
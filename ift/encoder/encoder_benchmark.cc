@@ -0,0 +1,187 @@
+// Benchmarks for the subsetting work done by the encoder. Run with:
+//
+//   bazel run -c opt //ift/encoder:encoder_benchmark
+
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#include "absl/container/flat_hash_set.h"
+#include "benchmark/benchmark.h"
+#include "brotli/brotli_allocator.h"
+#include "common/font_data.h"
+#include "common/hb_set_unique_ptr.h"
+#include "hb-subset.h"
+#include "ift/encoder/encoder.h"
+#include "ift/testdata/test_segments.h"
+
+using absl::flat_hash_set;
+using brotli::BrotliAllocator;
+using common::FontData;
+using common::hb_blob_unique_ptr;
+using common::hb_face_unique_ptr;
+using common::hb_set_unique_ptr;
+using common::make_hb_blob;
+using common::make_hb_face;
+using common::make_hb_set;
+using ift::encoder::Encoder;
+
+namespace {
+
+constexpr char kFont[] = "ift/testdata/NotoSansJP-Regular.subset.ttf";
+
+FontData FromFile(const char* filename) {
+  hb_blob_unique_ptr blob =
+      make_hb_blob(hb_blob_create_from_file_or_fail(filename));
+  if (!blob.get()) {
+    abort();
+  }
+  return FontData(blob.get());
+}
+
+// The test segments, the first segment is every glyph not in the others.
+std::vector<flat_hash_set<uint32_t>> Segments(const FontData& font) {
+  std::vector<flat_hash_set<uint32_t>> segments = {
+      {},
+      ift::testdata::TestSegment1(),
+      ift::testdata::TestSegment2(),
+      ift::testdata::TestSegment3(),
+      ift::testdata::TestSegment4(),
+  };
+
+  hb_face_unique_ptr face = font.face();
+  for (uint32_t gid = 0; gid < hb_face_get_glyph_count(face.get()); gid++) {
+    bool excluded = false;
+    for (uint32_t i = 1; i < segments.size(); i++) {
+      excluded |= segments[i].contains(gid);
+    }
+    if (!excluded) {
+      segments[0].insert(gid);
+    }
+  }
+  return segments;
+}
+
+// Glyph sets of the nodes in a table keyed graph over the test segments: the
+// first segment plus every combination of the remaining ones.
+std::vector<hb_set_unique_ptr> NodeGlyphSets(const FontData& font) {
+  std::vector<flat_hash_set<uint32_t>> segments = Segments(font);
+  uint32_t count = segments.size() - 1;
+
+  std::vector<hb_set_unique_ptr> nodes;
+  for (uint32_t mask = 0; mask < (1u << count); mask++) {
+    hb_set_unique_ptr gids = make_hb_set();
+    for (uint32_t gid : segments[0]) {
+      hb_set_add(gids.get(), gid);
+    }
+    for (uint32_t i = 0; i < count; i++) {
+      if (!(mask & (1u << i))) {
+        continue;
+      }
+      for (uint32_t gid : segments[i + 1]) {
+        hb_set_add(gids.get(), gid);
+      }
+    }
+    nodes.push_back(std::move(gids));
+  }
+  return nodes;
+}
+
+// Cuts the subset for every node in the graph from the same source font.
+// Without preprocessing (arg 0) a new face is created from the font data for
+// each node, which is what the encoder used to do; with preprocessing (arg 1)
+// a single preprocessed face is shared by all nodes.
+void BM_CutNodeSubsets(benchmark::State& state) {
+  bool preprocessed = state.range(0);
+  FontData font = FromFile(kFont);
+  std::vector<hb_set_unique_ptr> nodes = NodeGlyphSets(font);
+
+  hb_face_unique_ptr original = font.face();
+  hb_face_unique_ptr shared =
+      make_hb_face(hb_subset_preprocess(original.get()));
+
+  for (auto _ : state) {
+    for (const auto& gids : nodes) {
+      hb_face_unique_ptr face =
+          preprocessed ? make_hb_face(hb_face_reference(shared.get()))
+                       : font.face();
+
+      hb_subset_input_t* input = hb_subset_input_create_or_fail();
+      hb_set_union(hb_subset_input_glyph_set(input), gids.get());
+      hb_face_unique_ptr subset =
+          make_hb_face(hb_subset_or_fail(face.get(), input));
+      hb_subset_input_destroy(input);
+      if (!subset.get()) {
+        state.SkipWithError("Subsetting failed.");
+        return;
+      }
+
+      hb_blob_unique_ptr blob =
+          make_hb_blob(hb_face_reference_blob(subset.get()));
+      benchmark::DoNotOptimize(blob.get());
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * nodes.size());
+}
+BENCHMARK(BM_CutNodeSubsets)
+    ->ArgName("preprocessed")
+    ->Arg(0)
+    ->Arg(1)
+    ->Unit(benchmark::kMillisecond);
+
+// A complete mixed mode encoding of the test segments, with the release (arg 0)
+// or draft (arg 1) encode profile. Also reports the number of brotli encoder
+// memory allocations per encoding, and how many of those reused memory.
+void BM_Encode(benchmark::State& state) {
+  bool draft = state.range(0);
+  FontData font = FromFile(kFont);
+  std::vector<flat_hash_set<uint32_t>> segments = Segments(font);
+  BrotliAllocator::Stats start = BrotliAllocator::Shared().GetStats();
+
+  for (auto _ : state) {
+    Encoder encoder;
+    {
+      hb_face_t* face = font.reference_face();
+      encoder.SetFace(face);
+      hb_face_destroy(face);
+    }
+    encoder.SetEncodeProfile(draft ? Encoder::EncodeProfile::Draft()
+                                   : Encoder::EncodeProfile::Release());
+
+    auto s = absl::OkStatus();
+    for (uint32_t i = 0; i < segments.size(); i++) {
+      s.Update(encoder.AddGlyphDataSegment(i, segments[i]));
+    }
+    s.Update(encoder.SetBaseSubsetFromSegments({0}));
+    for (uint32_t i = 1; i < segments.size(); i++) {
+      s.Update(
+          encoder.AddGlyphDataActivationCondition(Encoder::Condition(i)));
+      s.Update(encoder.AddNonGlyphSegmentFromGlyphSegments({i}));
+    }
+    if (!s.ok()) {
+      state.SkipWithError("Failed to configure the encoder.");
+      return;
+    }
+
+    auto encoding = encoder.Encode();
+    if (!encoding.ok()) {
+      state.SkipWithError("Encoding failed.");
+      return;
+    }
+    benchmark::DoNotOptimize(encoding->patches.size());
+  }
+
+  BrotliAllocator::Stats end = BrotliAllocator::Shared().GetStats();
+  state.counters["brotli_allocs"] = benchmark::Counter(
+      end.allocations - start.allocations, benchmark::Counter::kAvgIterations);
+  state.counters["brotli_reused"] = benchmark::Counter(
+      end.reused - start.reused, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_Encode)
+    ->ArgName("draft")
+    ->Arg(0)
+    ->Arg(1)
+    ->Unit(benchmark::kMillisecond);
+
+}  // namespace
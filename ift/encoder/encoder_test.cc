@@ -6,20 +6,25 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <filesystem>
 
 #include "absl/container/btree_map.h"
 #include "absl/container/btree_set.h"
 #include "absl/container/flat_hash_set.h"
+#include "absl/strings/match.h"
 #include "absl/strings/string_view.h"
 #include "absl/types/span.h"
 #include "common/axis_range.h"
 #include "common/binary_patch.h"
 #include "common/brotli_binary_patch.h"
+#include "common/brotli_dictionary_cache.h"
 #include "common/font_data.h"
 #include "common/font_helper.h"
 #include "common/hb_set_unique_ptr.h"
 #include "gtest/gtest.h"
 #include "ift/client/fontations_client.h"
+#include "ift/encoder/patch_sink.h"
+#include "ift/encoder/subset_cache.h"
 #include "ift/proto/ift_table.h"
 #include "ift/proto/patch_map.h"
 #include "ift/testdata/test_segments.h"
@@ -35,6 +40,7 @@ using absl::string_view;
 using common::AxisRange;
 using common::BinaryPatch;
 using common::BrotliBinaryPatch;
+using common::BrotliDictionaryCache;
 using common::FontData;
 using common::FontHelper;
 using common::hb_set_unique_ptr;
@@ -229,6 +235,37 @@ TEST_F(EncoderTest, OutgoingEdges) {
   ASSERT_EQ(combos, expected);
 }
 
+TEST_F(EncoderTest, OutgoingEdges_MaxDepthAndIncludeAll) {
+  Encoder encoder;
+  encoder.AddNonGlyphDataSegment({1, 2});
+  encoder.AddNonGlyphDataSegment({3, 4});
+  encoder.AddNonGlyphDataSegment({5, 6});
+  encoder.SetMaxDepth(3);
+  encoder.SetIncludeAllSegmentPatches(true);
+
+  Encoder::SubsetDefinition s1{1, 2};
+  Encoder::SubsetDefinition s2{3, 4};
+  Encoder::SubsetDefinition s3{5, 6};
+
+  auto combos = encoder.OutgoingEdges({}, 1, 0);
+  std::vector<Encoder::SubsetDefinition> expected = {
+      s1, s2, s3, {1, 2, 3, 4, 5, 6}};
+  ASSERT_EQ(combos, expected);
+
+  // Already includes everything remaining, so no extra edge.
+  combos = encoder.OutgoingEdges(s1, 2, 1);
+  expected = {s2, s3, {3, 4, 5, 6}};
+  ASSERT_EQ(combos, expected);
+
+  // Last level.
+  combos = encoder.OutgoingEdges({}, 1, 2);
+  expected = {{1, 2, 3, 4, 5, 6}};
+  ASSERT_EQ(combos, expected);
+
+  combos = encoder.OutgoingEdges({1, 2, 3, 4, 5, 6}, 1, 2);
+  ASSERT_TRUE(combos.empty());
+}
+
 TEST_F(EncoderTest, OutgoingEdges_DesignSpace_PointToRange) {
   Encoder::SubsetDefinition base{1, 2};
   base.design_space[kWght] = AxisRange::Point(300);
@@ -611,6 +648,53 @@ TEST_F(EncoderTest, Encode_ThreeSubsets_Mixed) {
   // TODO XXXXX Check graph instead
 }
 
+TEST_F(EncoderTest, Encode_Mixed_Cff) {
+  FontData ahem = from_file("common/testdata/Ahem.optimized.otf");
+  Encoder encoder;
+  {
+    hb_face_t* face = ahem.reference_face();
+    encoder.SetFace(face);
+    hb_face_destroy(face);
+  }
+
+  flat_hash_set<uint32_t> segments[3];
+  for (uint32_t gid = 0; gid < 30; gid++) {
+    segments[gid / 10].insert(gid);
+  }
+
+  auto s = encoder.AddGlyphDataSegment(0, segments[0]);
+  s.Update(encoder.AddGlyphDataSegment(1, segments[1]));
+  s.Update(encoder.AddGlyphDataSegment(2, segments[2]));
+  s.Update(encoder.AddGlyphDataActivationCondition(Encoder::Condition(1)));
+  s.Update(encoder.AddGlyphDataActivationCondition(Encoder::Condition(2)));
+  s.Update(encoder.SetBaseSubsetFromSegments({0}));
+  ASSERT_TRUE(s.ok()) << s;
+
+  auto encoding = encoder.Encode();
+  ASSERT_TRUE(encoding.ok()) << encoding.status();
+
+  // One glyph keyed patch per segment, each carrying CFF CharStrings.
+  ASSERT_EQ(encoding->patches.size(), 2);
+  for (const auto& [url, patch] : encoding->patches) {
+    ASSERT_EQ(patch.str(0, 4), "ifgk") << url;
+
+    FontData empty;
+    FontData compressed_stream(patch.str(29));
+    FontData stream;
+    auto sc = BrotliBinaryPatch().Patch(empty, compressed_stream, &stream);
+    ASSERT_TRUE(sc.ok()) << sc;
+
+    // glyphCount (4), tableCount (1), glyphIds (10 * 2), tables[0]
+    ASSERT_EQ(stream.str(0, 5), string_view("\x00\x00\x00\x0a\x01", 5));
+    ASSERT_EQ(stream.str(25, 29), "CFF ");
+  }
+
+  auto face = encoding->init_font.face();
+  ASSERT_FALSE(FontHelper::TableData(face.get(), FontHelper::kCFF).empty());
+  ASSERT_FALSE(
+      FontHelper::TableData(face.get(), HB_TAG('I', 'F', 'T', 'X')).empty());
+}
+
 TEST_F(EncoderTest, Encode_ThreeSubsets_Mixed_WithFeatureMappings) {
   Encoder encoder;
   {
@@ -718,6 +802,601 @@ TEST_F(EncoderTest, Encode_FourSubsets_WithJumpAhead) {
   ASSERT_EQ(g, expected);
 }
 
+TEST_F(EncoderTest, Encode_FourSubsets_MaxDepth) {
+  Encoder encoder;
+  hb_face_t* face = font.reference_face();
+  encoder.SetFace(face);
+  hb_face_destroy(face);
+  auto s = encoder.SetBaseSubset({'a'});
+  ASSERT_TRUE(s.ok()) << s;
+  encoder.AddNonGlyphDataSegment({'b'});
+  encoder.AddNonGlyphDataSegment({'c'});
+  encoder.AddNonGlyphDataSegment({'d'});
+  encoder.SetMaxDepth(2);
+
+  auto encoding = encoder.Encode();
+  ASSERT_TRUE(encoding.ok()) << encoding.status();
+  ASSERT_EQ(encoding->patches.size(), 6);
+
+  graph g;
+  auto sc = ToGraph(*encoding, g);
+  ASSERT_TRUE(sc.ok()) << sc;
+
+  graph expected{
+      {"a", {"ab", "ac", "ad"}},
+      {"ab", {"abcd"}},
+      {"ac", {"abcd"}},
+      {"ad", {"abcd"}},
+      {"abcd", {}},
+  };
+  ASSERT_EQ(g, expected);
+
+  auto plan = encoder.Plan();
+  ASSERT_TRUE(plan.ok()) << plan.status();
+  ASSERT_EQ(plan->node_count, 5);
+  ASSERT_EQ(plan->table_keyed_patch_count, 6);
+}
+
+TEST_F(EncoderTest, Encode_FourSubsets_MaxDepth_WithJumpAhead) {
+  Encoder encoder;
+  hb_face_t* face = font.reference_face();
+  encoder.SetFace(face);
+  hb_face_destroy(face);
+  auto s = encoder.SetBaseSubset({'a'});
+  ASSERT_TRUE(s.ok()) << s;
+  encoder.AddNonGlyphDataSegment({'b'});
+  encoder.AddNonGlyphDataSegment({'c'});
+  encoder.AddNonGlyphDataSegment({'d'});
+  encoder.SetJumpAhead(2);
+  encoder.SetMaxDepth(3);
+
+  auto encoding = encoder.Encode();
+  ASSERT_TRUE(encoding.ok()) << encoding.status();
+
+  // abc, abd and acd are reachable at both depth 1 and 2. At depth 2 they
+  // only have a single patch to abcd.
+  //
+  // depth 0: 6 patches, depth 1: 3 * 3 + 3 * 1 patches, depth 2: 3 patches.
+  ASSERT_EQ(encoding->patches.size(), 21);
+
+  auto plan = encoder.Plan();
+  ASSERT_TRUE(plan.ok()) << plan.status();
+  ASSERT_EQ(plan->node_count, 11);
+  ASSERT_EQ(plan->table_keyed_patch_count, 21);
+}
+
+TEST_F(EncoderTest, Encode_FourSubsets_IncludeAllSegmentPatches) {
+  Encoder encoder;
+  hb_face_t* face = font.reference_face();
+  encoder.SetFace(face);
+  hb_face_destroy(face);
+  auto s = encoder.SetBaseSubset({'a'});
+  ASSERT_TRUE(s.ok()) << s;
+  encoder.AddNonGlyphDataSegment({'b'});
+  encoder.AddNonGlyphDataSegment({'c'});
+  encoder.AddNonGlyphDataSegment({'d'});
+  encoder.SetIncludeAllSegmentPatches(true);
+
+  auto encoding = encoder.Encode();
+  ASSERT_TRUE(encoding.ok()) << encoding.status();
+  ASSERT_EQ(encoding->patches.size(), 16);
+
+  graph g;
+  auto sc = ToGraph(*encoding, g);
+  ASSERT_TRUE(sc.ok()) << sc;
+
+  graph expected{
+      {"a", {"ab", "ac", "ad", "abcd"}},
+      {"ab", {"abc", "abd", "abcd"}},
+      {"ac", {"abc", "acd", "abcd"}},
+      {"ad", {"abd", "acd", "abcd"}},
+      {"abc", {"abcd"}},
+      {"abd", {"abcd"}},
+      {"acd", {"abcd"}},
+      {"abcd", {}},
+  };
+  ASSERT_EQ(g, expected);
+
+  auto plan = encoder.Plan();
+  ASSERT_TRUE(plan.ok()) << plan.status();
+  ASSERT_EQ(plan->node_count, 8);
+  ASSERT_EQ(plan->table_keyed_patch_count, 16);
+}
+
+TEST_F(EncoderTest, Plan_FourSubsets_WithJumpAhead) {
+  Encoder encoder;
+  hb_face_t* face = font.reference_face();
+  encoder.SetFace(face);
+  hb_face_destroy(face);
+  auto s = encoder.SetBaseSubset({'a'});
+  ASSERT_TRUE(s.ok()) << s;
+  encoder.AddNonGlyphDataSegment({'b'});
+  encoder.AddNonGlyphDataSegment({'c'});
+  encoder.AddNonGlyphDataSegment({'d'});
+  encoder.SetJumpAhead(2);
+
+  auto plan = encoder.Plan();
+  ASSERT_TRUE(plan.ok()) << plan.status();
+  ASSERT_TRUE(plan->exact);
+
+  // Matches Encode_FourSubsets_WithJumpAhead.
+  ASSERT_EQ(plan->node_count, 8);
+  ASSERT_EQ(plan->table_keyed_patch_count, 18);
+  std::vector<uint64_t> expected_nodes = {1, 3, 3, 1};
+  std::vector<uint64_t> expected_edges = {6, 9, 3, 0};
+  ASSERT_EQ(plan->nodes_per_level, expected_nodes);
+  ASSERT_EQ(plan->edges_per_level, expected_edges);
+  ASSERT_EQ(plan->glyph_keyed_patch_count, 0);
+  ASSERT_GT(plan->estimated_bytes, 0);
+}
+
+TEST_F(EncoderTest, Plan_Overlapping) {
+  Encoder encoder;
+  hb_face_t* face = font.reference_face();
+  encoder.SetFace(face);
+  hb_face_destroy(face);
+  auto s = encoder.SetBaseSubset({'a'});
+  ASSERT_TRUE(s.ok()) << s;
+  encoder.AddNonGlyphDataSegment({'a'});
+  encoder.AddNonGlyphDataSegment({'b', 'c'});
+  encoder.AddNonGlyphDataSegment({'c', 'd'});
+
+  auto plan = encoder.Plan();
+  ASSERT_TRUE(plan.ok()) << plan.status();
+
+  // {'a'} is in the base so is ignored, the other two overlap.
+  ASSERT_FALSE(plan->exact);
+  ASSERT_EQ(plan->node_count, 4);
+  ASSERT_EQ(plan->table_keyed_patch_count, 4);
+}
+
+TEST_F(EncoderTest, Plan_Large) {
+  Encoder encoder;
+  hb_face_t* face = full_font.reference_face();
+  encoder.SetFace(face);
+  hb_face_destroy(face);
+  auto s = encoder.SetBaseSubset({'A'});
+  ASSERT_TRUE(s.ok()) << s;
+  for (uint32_t cp = 'a'; cp <= 'z'; cp++) {
+    encoder.AddNonGlyphDataSegment({cp});
+  }
+  for (uint32_t cp = '0'; cp <= '9'; cp++) {
+    encoder.AddNonGlyphDataSegment({cp});
+  }
+  encoder.SetJumpAhead(3);
+
+  auto plan = encoder.Plan();
+  ASSERT_TRUE(plan.ok()) << plan.status();
+  ASSERT_TRUE(plan->exact);
+
+  // 36 subsets.
+  ASSERT_EQ(plan->node_count, uint64_t(1) << 36);
+  ASSERT_EQ(plan->nodes_per_level.size(), 37);
+  ASSERT_EQ(plan->nodes_per_level[1], 36);
+  ASSERT_EQ(plan->edges_per_level[0], 36 + 630 + 7140);
+  ASSERT_EQ(plan->edges_per_level[35], 36);
+  ASSERT_EQ(plan->edges_per_level[36], 0);
+}
+
+TEST_F(EncoderTest, Plan_MixedMode) {
+  Encoder encoder;
+  {
+    hb_face_t* face = noto_sans_jp.reference_face();
+    encoder.SetFace(face);
+    hb_face_destroy(face);
+  }
+
+  auto s = encoder.AddGlyphDataSegment(0, segment_0);
+  s.Update(encoder.AddGlyphDataSegment(1, segment_1));
+  s.Update(encoder.AddGlyphDataSegment(2, segment_2));
+  s.Update(encoder.AddGlyphDataSegment(3, segment_3));
+  s.Update(encoder.AddGlyphDataActivationCondition(Encoder::Condition(1)));
+  s.Update(encoder.AddGlyphDataActivationCondition(Encoder::Condition(2)));
+  s.Update(encoder.AddGlyphDataActivationCondition(Encoder::Condition(3)));
+  s.Update(encoder.SetBaseSubsetFromSegments({0}));
+  s.Update(encoder.AddNonGlyphSegmentFromGlyphSegments({1}));
+  s.Update(encoder.AddNonGlyphSegmentFromGlyphSegments({2, 3}));
+  ASSERT_TRUE(s.ok()) << s;
+
+  auto plan = encoder.Plan();
+  ASSERT_TRUE(plan.ok()) << plan.status();
+  auto encoding = encoder.Encode();
+  ASSERT_TRUE(encoding.ok()) << encoding.status();
+
+  ASSERT_EQ(plan->node_count, 4);
+  ASSERT_EQ(plan->table_keyed_patch_count, 4);
+  ASSERT_EQ(plan->glyph_keyed_patch_count, 3);
+  ASSERT_EQ(plan->glyph_keyed_patch_counts.size(), 1);
+  ASSERT_EQ(plan->table_keyed_patch_count + plan->glyph_keyed_patch_count,
+            encoding->patches.size());
+}
+
+TEST_F(EncoderTest, Encode_ThreadsMatchSerial) {
+  auto encode = [&](uint32_t threads) {
+    Encoder encoder;
+    {
+      hb_face_t* face = noto_sans_jp.reference_face();
+      encoder.SetFace(face);
+      hb_face_destroy(face);
+    }
+
+    auto s = encoder.AddGlyphDataSegment(0, segment_0);
+    s.Update(encoder.AddGlyphDataSegment(1, segment_1));
+    s.Update(encoder.AddGlyphDataSegment(2, segment_2));
+    s.Update(encoder.AddGlyphDataSegment(3, segment_3));
+    s.Update(encoder.AddGlyphDataSegment(4, segment_4));
+    s.Update(encoder.AddGlyphDataActivationCondition(Encoder::Condition(2)));
+    s.Update(encoder.AddGlyphDataActivationCondition(Encoder::Condition(3)));
+    s.Update(encoder.AddGlyphDataActivationCondition(Encoder::Condition(4)));
+    s.Update(encoder.SetBaseSubsetFromSegments({0, 1}));
+    s.Update(encoder.AddNonGlyphSegmentFromGlyphSegments({2}));
+    s.Update(encoder.AddNonGlyphSegmentFromGlyphSegments({3}));
+    s.Update(encoder.AddNonGlyphSegmentFromGlyphSegments({4}));
+    EXPECT_TRUE(s.ok()) << s;
+
+    encoder.SetJumpAhead(2);
+    encoder.SetThreads(threads);
+    return encoder.Encode();
+  };
+
+  auto serial = encode(1);
+  ASSERT_TRUE(serial.ok()) << serial.status();
+  auto parallel = encode(4);
+  ASSERT_TRUE(parallel.ok()) << parallel.status();
+
+  ASSERT_EQ(serial->init_font.str(), parallel->init_font.str());
+  ASSERT_EQ(serial->patches.size(), parallel->patches.size());
+  for (const auto& [url, patch] : serial->patches) {
+    auto other = parallel->patches.find(url);
+    ASSERT_TRUE(other != parallel->patches.end()) << url;
+    ASSERT_EQ(patch.str(), other->second.str()) << url;
+  }
+}
+
+TEST_F(EncoderTest, Encode_SubsetCache) {
+  std::string directory = StrCat(testing::TempDir(), "/encoder_subset_cache");
+  std::filesystem::remove_all(directory);
+  auto cache = SubsetCache::Open(directory, 1 << 30);
+  ASSERT_TRUE(cache.ok()) << cache.status();
+
+  auto encode = [&](SubsetCache* subset_cache) {
+    Encoder encoder;
+    {
+      hb_face_t* face = noto_sans_jp.reference_face();
+      encoder.SetFace(face);
+      hb_face_destroy(face);
+    }
+
+    auto s = encoder.AddGlyphDataSegment(0, segment_0);
+    s.Update(encoder.AddGlyphDataSegment(1, segment_1));
+    s.Update(encoder.AddGlyphDataSegment(2, segment_2));
+    s.Update(encoder.AddGlyphDataActivationCondition(Encoder::Condition(1)));
+    s.Update(encoder.AddGlyphDataActivationCondition(Encoder::Condition(2)));
+    s.Update(encoder.SetBaseSubsetFromSegments({0}));
+    s.Update(encoder.AddNonGlyphSegmentFromGlyphSegments({1}));
+    s.Update(encoder.AddNonGlyphSegmentFromGlyphSegments({2}));
+    EXPECT_TRUE(s.ok()) << s;
+
+    encoder.SetSubsetCache(subset_cache);
+    return encoder.Encode();
+  };
+
+  auto uncached = encode(nullptr);
+  ASSERT_TRUE(uncached.ok()) << uncached.status();
+
+  auto first = encode(cache->get());
+  ASSERT_TRUE(first.ok()) << first.status();
+  uint32_t hits = (*cache)->Hits();
+  uint32_t misses = (*cache)->Misses();
+  EXPECT_GT(misses, 0);
+
+  // Second run is served entirely from the cache.
+  auto second = encode(cache->get());
+  ASSERT_TRUE(second.ok()) << second.status();
+  EXPECT_GT((*cache)->Hits(), hits);
+  EXPECT_EQ((*cache)->Misses(), misses);
+
+  for (const auto* encoding : {&*first, &*second}) {
+    ASSERT_EQ(uncached->init_font.str(), encoding->init_font.str());
+    ASSERT_EQ(uncached->patches.size(), encoding->patches.size());
+    for (const auto& [url, patch] : uncached->patches) {
+      auto other = encoding->patches.find(url);
+      ASSERT_TRUE(other != encoding->patches.end()) << url;
+      ASSERT_EQ(patch.str(), other->second.str()) << url;
+    }
+  }
+
+  std::filesystem::remove_all(directory);
+}
+
+TEST_F(EncoderTest, Encode_PatchSink) {
+  auto encode = [&](PatchSink* sink) {
+    Encoder encoder;
+    {
+      hb_face_t* face = noto_sans_jp.reference_face();
+      encoder.SetFace(face);
+      hb_face_destroy(face);
+    }
+
+    auto s = encoder.AddGlyphDataSegment(0, segment_0);
+    s.Update(encoder.AddGlyphDataSegment(1, segment_1));
+    s.Update(encoder.AddGlyphDataSegment(2, segment_2));
+    s.Update(encoder.AddGlyphDataSegment(3, segment_3));
+    s.Update(encoder.AddGlyphDataActivationCondition(Encoder::Condition(1)));
+    s.Update(encoder.AddGlyphDataActivationCondition(Encoder::Condition(2)));
+    s.Update(encoder.AddGlyphDataActivationCondition(Encoder::Condition(3)));
+    s.Update(encoder.SetBaseSubsetFromSegments({0}));
+    s.Update(encoder.AddNonGlyphSegmentFromGlyphSegments({1}));
+    s.Update(encoder.AddNonGlyphSegmentFromGlyphSegments({2}));
+    s.Update(encoder.AddNonGlyphSegmentFromGlyphSegments({3}));
+    EXPECT_TRUE(s.ok()) << s;
+
+    encoder.SetPatchSink(sink);
+    return encoder.Encode();
+  };
+
+  auto expected = encode(nullptr);
+  ASSERT_TRUE(expected.ok()) << expected.status();
+  ASSERT_FALSE(expected->patches.empty());
+
+  InMemoryPatchSink sink;
+  auto streamed = encode(&sink);
+  ASSERT_TRUE(streamed.ok()) << streamed.status();
+  ASSERT_TRUE(streamed->patches.empty());
+  ASSERT_EQ(streamed->init_font.str(), expected->init_font.str());
+
+  auto patches = sink.TakePatches();
+  ASSERT_EQ(patches.size(), expected->patches.size());
+  for (const auto& [url, patch] : expected->patches) {
+    auto other = patches.find(url);
+    ASSERT_TRUE(other != patches.end()) << url;
+    ASSERT_EQ(patch.str(), other->second.str()) << url;
+  }
+}
+
+TEST_F(EncoderTest, Encode_DraftProfile_Recompress) {
+  auto configure = [&](bool mixed_mode, Encoder& encoder) {
+    if (!mixed_mode) {
+      hb_face_t* face = font.reference_face();
+      encoder.SetFace(face);
+      hb_face_destroy(face);
+      auto s = encoder.SetBaseSubset({'a'});
+      encoder.AddNonGlyphDataSegment({'b'});
+      encoder.AddNonGlyphDataSegment({'c'});
+      EXPECT_TRUE(s.ok()) << s;
+      return;
+    }
+
+    hb_face_t* face = noto_sans_jp.reference_face();
+    encoder.SetFace(face);
+    hb_face_destroy(face);
+    auto s = encoder.AddGlyphDataSegment(0, segment_0);
+    s.Update(encoder.AddGlyphDataSegment(1, segment_1));
+    s.Update(encoder.AddGlyphDataSegment(2, segment_2));
+    s.Update(encoder.AddGlyphDataActivationCondition(Encoder::Condition(1)));
+    s.Update(encoder.AddGlyphDataActivationCondition(Encoder::Condition(2)));
+    s.Update(encoder.SetBaseSubsetFromSegments({0}));
+    s.Update(encoder.AddNonGlyphSegmentFromGlyphSegments({1}));
+    s.Update(encoder.AddNonGlyphSegmentFromGlyphSegments({2}));
+    EXPECT_TRUE(s.ok()) << s;
+  };
+
+  for (bool mixed_mode : {false, true}) {
+    Encoder draft_encoder;
+    configure(mixed_mode, draft_encoder);
+    draft_encoder.SetEncodeProfile(Encoder::EncodeProfile::Draft());
+    auto draft = draft_encoder.Encode();
+    ASSERT_TRUE(draft.ok()) << draft.status();
+
+    Encoder release_encoder;
+    configure(mixed_mode, release_encoder);
+    auto release = release_encoder.Encode();
+    ASSERT_TRUE(release.ok()) << release.status();
+
+    // Only the compression of the patches differs.
+    ASSERT_EQ(draft->init_font.str(), release->init_font.str());
+    ASSERT_EQ(draft->patches.size(), release->patches.size());
+    uint32_t draft_size = 0;
+    uint32_t release_size = 0;
+    for (const auto& [url, patch] : release->patches) {
+      ASSERT_TRUE(draft->patches.contains(url)) << url;
+      draft_size += draft->patches.at(url).size();
+      release_size += patch.size();
+    }
+    ASSERT_GT(draft_size, release_size);
+
+    // Recompressing the draft encoding matches a release encoding exactly.
+    Encoder recompressor;
+    recompressor.SetThreads(2);
+    auto recompressed = recompressor.Recompress(*draft);
+    ASSERT_TRUE(recompressed.ok()) << recompressed.status();
+    ASSERT_EQ(recompressed->init_font.str(), release->init_font.str());
+    ASSERT_EQ(recompressed->patches.size(), release->patches.size());
+    for (const auto& [url, patch] : release->patches) {
+      auto it = recompressed->patches.find(url);
+      ASSERT_TRUE(it != recompressed->patches.end()) << url;
+      ASSERT_EQ(it->second.str(), patch.str()) << url;
+    }
+  }
+}
+
+TEST_F(EncoderTest, Recompress_UnreachablePatch) {
+  Encoder encoder;
+  hb_face_t* face = font.reference_face();
+  encoder.SetFace(face);
+  hb_face_destroy(face);
+  auto s = encoder.SetBaseSubset({'a'});
+  ASSERT_TRUE(s.ok()) << s;
+  encoder.AddNonGlyphDataSegment({'b'});
+
+  auto encoding = encoder.Encode();
+  ASSERT_TRUE(encoding.ok()) << encoding.status();
+
+  // The patches no longer apply to the init font.
+  encoding->init_font.shallow_copy(font);
+  auto recompressed = encoder.Recompress(*encoding);
+  ASSERT_TRUE(absl::IsInvalidArgument(recompressed.status()))
+      << recompressed.status();
+}
+
+TEST_F(EncoderTest, Encode_FontDiff) {
+  auto configure = [&](Encoder& encoder) {
+    hb_face_t* face = full_font.reference_face();
+    encoder.SetFace(face);
+    hb_face_destroy(face);
+    auto s = encoder.SetBaseSubset({'a', 'b', 'c'});
+    encoder.AddNonGlyphDataSegment({'A', 'B', 'C', 'D', 'E', 'F'});
+    encoder.AddNonGlyphDataSegment({'T', 'U', 'V', 'W', 'X', 'Y'});
+    EXPECT_TRUE(s.ok()) << s;
+  };
+
+  Encoder font_diff_encoder;
+  configure(font_diff_encoder);
+  Encoder::EncodeProfile profile;
+  profile.font_diff = true;
+  font_diff_encoder.SetEncodeProfile(profile);
+  auto font_diff = font_diff_encoder.Encode();
+  ASSERT_TRUE(font_diff.ok()) << font_diff.status();
+
+  Encoder release_encoder;
+  configure(release_encoder);
+  auto release = release_encoder.Encode();
+  ASSERT_TRUE(release.ok()) << release.status();
+
+  ASSERT_EQ(font_diff->init_font.str(), release->init_font.str());
+  ASSERT_EQ(font_diff->patches.size(), release->patches.size());
+  bool any_differ = false;
+  for (const auto& [url, patch] : release->patches) {
+    ASSERT_TRUE(font_diff->patches.contains(url)) << url;
+    any_differ |= font_diff->patches.at(url).str() != patch.str();
+  }
+  ASSERT_TRUE(any_differ);
+
+  // The patches decode to the same fonts, so recompressing gives the release
+  // encoding.
+  Encoder recompressor;
+  auto recompressed = recompressor.Recompress(*font_diff);
+  ASSERT_TRUE(recompressed.ok()) << recompressed.status();
+  for (const auto& [url, patch] : release->patches) {
+    auto it = recompressed->patches.find(url);
+    ASSERT_TRUE(it != recompressed->patches.end()) << url;
+    ASSERT_EQ(it->second.str(), patch.str()) << url;
+  }
+}
+
+TEST_F(EncoderTest, Encode_DictionaryCache) {
+  auto encode = [&](BrotliDictionaryCache* cache) {
+    Encoder encoder;
+    hb_face_t* face = font.reference_face();
+    encoder.SetFace(face);
+    hb_face_destroy(face);
+    auto s = encoder.SetBaseSubset({'a'});
+    EXPECT_TRUE(s.ok()) << s;
+    encoder.AddNonGlyphDataSegment({'b'});
+    encoder.AddNonGlyphDataSegment({'c'});
+    encoder.SetDictionaryCache(cache);
+    return encoder.Encode();
+  };
+
+  auto expected = encode(nullptr);
+  ASSERT_TRUE(expected.ok()) << expected.status();
+
+  BrotliDictionaryCache cache;
+  auto encoding = encode(&cache);
+  ASSERT_TRUE(encoding.ok()) << encoding.status();
+
+  ASSERT_EQ(encoding->patches.size(), expected->patches.size());
+  for (const auto& [url, patch] : expected->patches) {
+    ASSERT_EQ(encoding->patches.at(url).str(), patch.str()) << url;
+  }
+
+  // The root has two outgoing patches which share its tables.
+  ASSERT_GT(cache.Hits(), 0);
+  ASSERT_GT(cache.Misses(), 0);
+}
+
+TEST_F(EncoderTest, Encode_Incremental) {
+  auto encode = [&](bool with_feature_dependency,
+                    const Encoder::Encoding* previous) {
+    Encoder encoder;
+    {
+      hb_face_t* face = noto_sans_jp.reference_face();
+      encoder.SetFace(face);
+      hb_face_destroy(face);
+    }
+
+    auto s = encoder.AddGlyphDataSegment(0, segment_0);
+    s.Update(encoder.AddGlyphDataSegment(1, segment_1));
+    s.Update(encoder.AddGlyphDataSegment(2, segment_2));
+    s.Update(encoder.AddGlyphDataSegment(3, segment_3));
+    s.Update(encoder.AddGlyphDataSegment(4, segment_4));
+    if (with_feature_dependency) {
+      s.Update(encoder.AddFeatureDependency(3, 4, HB_TAG('c', 'c', 'm', 'p')));
+    }
+    s.Update(encoder.AddGlyphDataActivationCondition(Encoder::Condition(3)));
+    s.Update(encoder.AddGlyphDataActivationCondition(Encoder::Condition(4)));
+    s.Update(encoder.SetBaseSubsetFromSegments({0, 1, 2}));
+    s.Update(encoder.AddNonGlyphSegmentFromGlyphSegments({3, 4}));
+    EXPECT_TRUE(s.ok()) << s;
+
+    encoder.SetPreviousEncoding(previous);
+    return encoder.Encode();
+  };
+
+  auto first = encode(false, nullptr);
+  ASSERT_TRUE(first.ok()) << first.status();
+  ASSERT_EQ(first->manifest.generation, 0);
+
+  // Nothing changed, everything is reused as is.
+  auto unchanged = encode(false, &*first);
+  ASSERT_TRUE(unchanged.ok()) << unchanged.status();
+  ASSERT_EQ(unchanged->manifest.generation, 1);
+  ASSERT_EQ(unchanged->init_font.data(), first->init_font.data());
+  ASSERT_EQ(unchanged->patches.size(), first->patches.size());
+  for (const auto& [url, patch] : first->patches) {
+    auto other = unchanged->patches.find(url);
+    ASSERT_TRUE(other != unchanged->patches.end()) << url;
+    ASSERT_EQ(patch.data(), other->second.data()) << url;
+  }
+
+  // The glyph keyed mapping changed, but the glyphs in each segment did not.
+  auto changed = encode(true, &*first);
+  ASSERT_TRUE(changed.ok()) << changed.status();
+  ASSERT_EQ(changed->manifest.generation, 1);
+  ASSERT_EQ(changed->patches.size(), first->patches.size());
+
+  uint32_t glyph_keyed_patches = 0;
+  for (const auto& [url, patch] : changed->patches) {
+    auto previous = first->patches.find(url);
+    if (!absl::EndsWith(url, ".gk")) {
+      // Every node changed so table keyed patches have new urls.
+      ASSERT_TRUE(previous == first->patches.end()) << url;
+      continue;
+    }
+
+    // Same glyph data, but with a new compat id.
+    glyph_keyed_patches++;
+    ASSERT_TRUE(previous != first->patches.end()) << url;
+    string_view before = previous->second.str();
+    string_view after = patch.str();
+    ASSERT_NE(before, after) << url;
+    ASSERT_EQ(before.substr(0, 9), after.substr(0, 9)) << url;
+    ASSERT_EQ(before.substr(25), after.substr(25)) << url;
+  }
+  ASSERT_EQ(glyph_keyed_patches, 2);
+
+  // And the updated encoding can be further updated.
+  auto again = encode(true, &*changed);
+  ASSERT_TRUE(again.ok()) << again.status();
+  ASSERT_EQ(again->manifest.generation, 2);
+  ASSERT_EQ(again->init_font.data(), changed->init_font.data());
+  for (const auto& [url, patch] : changed->patches) {
+    auto other = again->patches.find(url);
+    ASSERT_TRUE(other != again->patches.end()) << url;
+    ASSERT_EQ(patch.data(), other->second.data()) << url;
+  }
+}
+
 void ClearCompatIdFromFormat2(uint8_t* data) {
   for (uint32_t index = 5; index < (5 + 16); index++) {
     data[index] = 0;
@@ -837,6 +1516,25 @@ TEST_F(EncoderTest, RoundTripWoff2) {
   ASSERT_EQ(true_type_tag, Span<const uint8_t>((const uint8_t*)ttf->data(), 4));
 }
 
+TEST_F(EncoderTest, Encode_InitFontIsWoff2Canonical) {
+  Encoder encoder;
+  hb_face_t* face = font.reference_face();
+  encoder.SetFace(face);
+  hb_face_destroy(face);
+  auto s = encoder.SetBaseSubset({'a'});
+  ASSERT_TRUE(s.ok()) << s;
+  encoder.AddNonGlyphDataSegment({'b'});
+
+  auto encoding = encoder.Encode();
+  ASSERT_TRUE(encoding.ok()) << encoding.status();
+
+  // The init font must be unchanged by a woff2 round trip.
+  auto round_tripped =
+      Encoder::RoundTripWoff2(encoding->init_font.str(), false);
+  ASSERT_TRUE(round_tripped.ok()) << round_tripped.status();
+  ASSERT_EQ(round_tripped->str(), encoding->init_font.str());
+}
+
 TEST_F(EncoderTest, RoundTripWoff2_Fails) {
   auto ttf = Encoder::RoundTripWoff2(woff2_font.str());
   ASSERT_TRUE(absl::IsInternal(ttf.status())) << ttf.status();
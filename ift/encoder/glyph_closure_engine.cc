@@ -0,0 +1,636 @@
+#include "ift/encoder/glyph_closure_engine.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "common/font_data.h"
+#include "common/font_helper.h"
+#include "common/hb_set_unique_ptr.h"
+#include "common/indexed_data_reader.h"
+#include "common/try.h"
+#include "hb-ot.h"
+#include "hb-subset.h"
+
+using absl::Status;
+using absl::StatusOr;
+using absl::string_view;
+using common::FontData;
+using common::FontHelper;
+using common::hb_set_unique_ptr;
+using common::IndexedDataReader;
+using common::make_hb_face;
+using common::make_hb_font;
+using common::make_hb_set;
+
+namespace ift::encoder {
+
+namespace {
+
+constexpr hb_tag_t kColr = HB_TAG('C', 'O', 'L', 'R');
+
+// glyf composite glyph flags.
+constexpr uint16_t kArgsAreWords = 0x0001;
+constexpr uint16_t kHaveScale = 0x0008;
+constexpr uint16_t kMoreComponents = 0x0020;
+constexpr uint16_t kHaveXAndYScale = 0x0040;
+constexpr uint16_t kHaveTwoByTwo = 0x0080;
+
+// Returns the data starting at 'offset' in 'data'.
+StatusOr<string_view> At(string_view data, uint32_t offset) {
+  if (offset > data.size()) {
+    return absl::InvalidArgumentError("Offset is out of bounds.");
+  }
+  return data.substr(offset);
+}
+
+StatusOr<uint16_t> ReadUInt16(string_view data, uint32_t offset) {
+  return FontHelper::ReadUInt16(TRY(At(data, offset)));
+}
+
+StatusOr<uint32_t> ReadUInt32(string_view data, uint32_t offset) {
+  return FontHelper::ReadUInt32(TRY(At(data, offset)));
+}
+
+// Returns the data at the 16 bit offset stored at 'offset' in 'data'.
+StatusOr<string_view> Offset16(string_view data, uint32_t offset) {
+  return At(data, TRY(ReadUInt16(data, offset)));
+}
+
+/*
+ * The glyphs of an OpenType coverage table in coverage index order. Like
+ * harfbuzz, format 2 coverage indices are assigned in range order.
+ */
+StatusOr<std::vector<uint32_t>> ReadCoverage(string_view coverage) {
+  uint16_t format = TRY(ReadUInt16(coverage, 0));
+  uint16_t count = TRY(ReadUInt16(coverage, 2));
+  std::vector<uint32_t> glyphs;
+  if (format == 1) {
+    for (uint32_t i = 0; i < count; i++) {
+      glyphs.push_back(TRY(ReadUInt16(coverage, 4 + i * 2)));
+    }
+    return glyphs;
+  }
+
+  if (format == 2) {
+    for (uint32_t i = 0; i < count; i++) {
+      uint32_t start = TRY(ReadUInt16(coverage, 4 + i * 6));
+      uint32_t end = TRY(ReadUInt16(coverage, 6 + i * 6));
+      for (uint32_t gid = start; gid <= end; gid++) {
+        glyphs.push_back(gid);
+      }
+    }
+    return glyphs;
+  }
+
+  return absl::InvalidArgumentError("Unknown coverage format.");
+}
+
+/*
+ * The glyph dependencies introduced by a single GSUB lookup. Substitutions
+ * are unconditional, a ligature glyph is reachable once all of its
+ * components are.
+ */
+struct GsubLookupEdges {
+  std::vector<std::pair<uint32_t, uint32_t>> substitutions;
+  std::vector<std::pair<std::vector<uint32_t>, uint32_t>> ligatures;
+};
+
+/*
+ * Adds the edges of a single, multiple, alternate, or ligature substitution
+ * subtable to 'edges'. Other lookup types can't be represented as edges and
+ * are reported as unimplemented.
+ */
+Status ExtractGsubSubtable(string_view subtable, uint16_t lookup_type,
+                           GsubLookupEdges& edges) {
+  if (lookup_type < 1 || lookup_type > 4) {
+    return absl::UnimplementedError("GSUB lookup type is not modeled.");
+  }
+
+  uint16_t format = TRY(ReadUInt16(subtable, 0));
+  auto coverage = TRY(ReadCoverage(TRY(Offset16(subtable, 2))));
+
+  if (lookup_type == 1 && format == 1) {
+    uint16_t delta = TRY(ReadUInt16(subtable, 4));
+    for (uint32_t gid : coverage) {
+      edges.substitutions.push_back(std::pair(gid, (gid + delta) & 0xFFFF));
+    }
+    return absl::OkStatus();
+  }
+
+  if (format != 1 && !(lookup_type == 1 && format == 2)) {
+    return absl::UnimplementedError("GSUB subtable format is not modeled.");
+  }
+
+  // Each remaining format is an array parallel to the coverage. Like harfbuzz
+  // coverage glyphs without an array entry are ignored.
+  uint32_t count =
+      std::min<uint32_t>(TRY(ReadUInt16(subtable, 4)), coverage.size());
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t gid = coverage[i];
+    if (lookup_type == 1) {
+      edges.substitutions.push_back(
+          std::pair(gid, TRY(ReadUInt16(subtable, 6 + i * 2))));
+      continue;
+    }
+
+    // Sequence, AlternateSet, and LigatureSet tables.
+    string_view set = TRY(Offset16(subtable, 6 + i * 2));
+    uint16_t set_count = TRY(ReadUInt16(set, 0));
+    for (uint32_t j = 0; j < set_count; j++) {
+      if (lookup_type != 4) {
+        edges.substitutions.push_back(
+            std::pair(gid, TRY(ReadUInt16(set, 2 + j * 2))));
+        continue;
+      }
+
+      string_view ligature = TRY(Offset16(set, 2 + j * 2));
+      uint16_t ligature_glyph = TRY(ReadUInt16(ligature, 0));
+      uint16_t component_count = TRY(ReadUInt16(ligature, 2));
+      std::vector<uint32_t> components{gid};
+      // The first component is implied by the coverage.
+      for (uint32_t k = 1; k < component_count; k++) {
+        components.push_back(TRY(ReadUInt16(ligature, 2 + k * 2)));
+      }
+      edges.ligatures.push_back(
+          std::pair(std::move(components), ligature_glyph));
+    }
+  }
+  return absl::OkStatus();
+}
+
+StatusOr<GsubLookupEdges> ExtractGsubLookup(string_view lookup_list,
+                                            uint32_t lookup_index) {
+  uint16_t lookup_count = TRY(ReadUInt16(lookup_list, 0));
+  if (lookup_index >= lookup_count) {
+    return absl::InvalidArgumentError("GSUB lookup index is out of bounds.");
+  }
+
+  string_view lookup = TRY(Offset16(lookup_list, 2 + lookup_index * 2));
+  uint16_t lookup_type = TRY(ReadUInt16(lookup, 0));
+  uint16_t subtable_count = TRY(ReadUInt16(lookup, 4));
+
+  GsubLookupEdges edges;
+  for (uint32_t i = 0; i < subtable_count; i++) {
+    string_view subtable = TRY(Offset16(lookup, 6 + i * 2));
+    uint16_t subtable_type = lookup_type;
+    if (lookup_type == 7) {
+      // Extension substitution.
+      uint16_t format = TRY(ReadUInt16(subtable, 0));
+      subtable_type = TRY(ReadUInt16(subtable, 2));
+      if (format != 1 || subtable_type == 7) {
+        return absl::UnimplementedError("Unsupported GSUB extension.");
+      }
+      subtable = TRY(At(subtable, TRY(ReadUInt32(subtable, 4))));
+    }
+    TRYV(ExtractGsubSubtable(subtable, subtable_type, edges));
+  }
+  return edges;
+}
+
+// Adds 'gid' to 'glyphs', returns true if it was not already present.
+bool AddGlyph(hb_set_t* glyphs, uint32_t gid) {
+  if (hb_set_has(glyphs, gid)) {
+    return false;
+  }
+  hb_set_add(glyphs, gid);
+  return true;
+}
+
+}  // namespace
+
+GlyphClosureEngine::GlyphClosureEngine(hb_face_t* face)
+    : face_(make_hb_face(hb_face_reference(face))),
+      num_glyphs_(hb_face_get_glyph_count(face)),
+      unmodeled_lookups_(make_hb_set()),
+      base_layout_glyphs_(make_hb_set()) {
+  gsub_edges_.resize(num_glyphs_);
+  ligatures_by_component_.resize(num_glyphs_);
+  math_edges_.resize(num_glyphs_);
+  colr_edges_.resize(num_glyphs_);
+  component_edges_.resize(num_glyphs_);
+}
+
+StatusOr<std::unique_ptr<const GlyphClosureEngine>> GlyphClosureEngine::Create(
+    hb_face_t* face) {
+  std::unique_ptr<GlyphClosureEngine> engine(new GlyphClosureEngine(face));
+
+  auto tags = FontHelper::GetTags(face);
+  if (tags.contains(FontHelper::kCFF)) {
+    // CFF seac accents pull in components that aren't tracked here.
+    engine->requires_subset_plan_ = true;
+  }
+
+  engine->ExtractCmap();
+  TRYV(engine->ExtractGsub());
+  engine->ExtractMath();
+  engine->ExtractColr();
+  engine->ExtractGlyf();
+
+  for (auto* edges : {&engine->gsub_edges_, &engine->math_edges_,
+                      &engine->colr_edges_, &engine->component_edges_}) {
+    for (auto& targets : *edges) {
+      std::sort(targets.begin(), targets.end());
+      targets.erase(std::unique(targets.begin(), targets.end()),
+                    targets.end());
+    }
+  }
+
+  // notdef is always retained.
+  if (engine->num_glyphs_ > 0) {
+    hb_set_add(engine->base_layout_glyphs_.get(), 0);
+    engine->LayoutClosure({0}, engine->base_layout_glyphs_.get());
+  }
+
+  return std::unique_ptr<const GlyphClosureEngine>(std::move(engine));
+}
+
+void GlyphClosureEngine::GlyphClosure(const hb_set_t* codepoints,
+                                      hb_set_t* gids) const {
+  Closure closure = NewClosure();
+  closure.AddCodepoints(codepoints);
+  closure.Glyphs(gids);
+}
+
+void GlyphClosureEngine::ExtractCmap() {
+  hb_map_t* mapping = hb_map_create();
+  hb_set_unique_ptr unicodes = make_hb_set();
+  hb_face_collect_nominal_glyph_mapping(face_.get(), mapping, unicodes.get());
+  int index = -1;
+  uint32_t unicode, gid;
+  while (hb_map_next(mapping, &index, &unicode, &gid)) {
+    cmap_[unicode].push_back(gid);
+  }
+  hb_map_destroy(mapping);
+
+  // Glyphs of non-default variation sequences are retained for the sequence's
+  // base codepoint, regardless of the selector.
+  auto font = make_hb_font(hb_font_create(face_.get()));
+  hb_set_unique_ptr selectors = make_hb_set();
+  hb_face_collect_variation_selectors(face_.get(), selectors.get());
+  uint32_t selector = HB_SET_VALUE_INVALID;
+  while (hb_set_next(selectors.get(), &selector)) {
+    hb_set_clear(unicodes.get());
+    hb_face_collect_variation_unicodes(face_.get(), selector, unicodes.get());
+    unicode = HB_SET_VALUE_INVALID;
+    while (hb_set_next(unicodes.get(), &unicode)) {
+      if (!hb_font_get_variation_glyph(font.get(), unicode, selector, &gid)) {
+        continue;
+      }
+      auto& gids = cmap_[unicode];
+      if (std::find(gids.begin(), gids.end(), gid) == gids.end()) {
+        gids.push_back(gid);
+      }
+    }
+  }
+}
+
+Status GlyphClosureEngine::ExtractGsub() {
+  FontData gsub = FontHelper::TableData(face_.get(), FontHelper::kGSUB);
+  if (gsub.empty()) {
+    return absl::OkStatus();
+  }
+
+  string_view data = gsub.str();
+  auto major_version = ReadUInt16(data, 0);
+  auto minor_version = ReadUInt16(data, 2);
+  auto lookup_list = Offset16(data, 8);
+  if (!major_version.ok() || !minor_version.ok() || !lookup_list.ok()) {
+    requires_subset_plan_ = true;
+    return absl::OkStatus();
+  }
+
+  if (*major_version == 1 && *minor_version >= 1) {
+    // Feature variations can swap in lookups beyond the ones reachable from
+    // the feature list.
+    auto feature_variations = ReadUInt32(data, 10);
+    if (!feature_variations.ok() || *feature_variations) {
+      requires_subset_plan_ = true;
+      return absl::OkStatus();
+    }
+  }
+
+  // Only lookups reachable from the features harfbuzz retains by default
+  // participate in the subset closure.
+  hb_subset_input_t* input = hb_subset_input_create_or_fail();
+  if (!input) {
+    return absl::InternalError("Failed to create subset input.");
+  }
+  std::vector<hb_tag_t> features;
+  const hb_set_t* feature_set =
+      hb_subset_input_set(input, HB_SUBSET_SETS_LAYOUT_FEATURE_TAG);
+  hb_tag_t tag = HB_SET_VALUE_INVALID;
+  while (hb_set_next(feature_set, &tag)) {
+    features.push_back(tag);
+  }
+  features.push_back(HB_TAG_NONE);
+  hb_subset_input_destroy(input);
+
+  hb_set_unique_ptr lookups = make_hb_set();
+  hb_ot_layout_collect_lookups(face_.get(), HB_OT_TAG_GSUB, nullptr, nullptr,
+                               features.data(), lookups.get());
+
+  uint32_t lookup_index = HB_SET_VALUE_INVALID;
+  while (hb_set_next(lookups.get(), &lookup_index)) {
+    auto edges = ExtractGsubLookup(*lookup_list, lookup_index);
+    if (!edges.ok()) {
+      // Harfbuzz computes the closure of anything that isn't modeled.
+      hb_set_add(unmodeled_lookups_.get(), lookup_index);
+      continue;
+    }
+
+    for (const auto& [from, to] : edges->substitutions) {
+      AddEdge(gsub_edges_, from, to);
+    }
+    for (auto& [components, glyph] : edges->ligatures) {
+      std::vector<uint32_t> unique_components = components;
+      std::sort(unique_components.begin(), unique_components.end());
+      unique_components.erase(
+          std::unique(unique_components.begin(), unique_components.end()),
+          unique_components.end());
+      if (unique_components.back() >= num_glyphs_) {
+        // Can never be reached.
+        continue;
+      }
+      for (uint32_t component : unique_components) {
+        ligatures_by_component_[component].push_back(ligatures_.size());
+      }
+      ligatures_.push_back(Ligature{std::move(unique_components), glyph});
+    }
+  }
+
+  return absl::OkStatus();
+}
+
+void GlyphClosureEngine::ExtractMath() {
+  if (!hb_ot_math_has_data(face_.get())) {
+    return;
+  }
+
+  // Variants are only added for glyphs reached by the layout closure, they
+  // are not themselves expanded further.
+  auto font = make_hb_font(hb_font_create(face_.get()));
+  std::vector<hb_ot_math_glyph_variant_t> variants;
+  std::vector<hb_ot_math_glyph_part_t> parts;
+  for (uint32_t gid = 0; gid < num_glyphs_; gid++) {
+    for (hb_direction_t direction : {HB_DIRECTION_LTR, HB_DIRECTION_TTB}) {
+      unsigned count = hb_ot_math_get_glyph_variants(font.get(), gid, direction,
+                                                     0, nullptr, nullptr);
+      variants.resize(count);
+      hb_ot_math_get_glyph_variants(font.get(), gid, direction, 0, &count,
+                                    variants.data());
+      for (uint32_t i = 0; i < count; i++) {
+        AddEdge(math_edges_, gid, variants[i].glyph);
+      }
+
+      count = hb_ot_math_get_glyph_assembly(font.get(), gid, direction, 0,
+                                            nullptr, nullptr, nullptr);
+      parts.resize(count);
+      hb_ot_math_get_glyph_assembly(font.get(), gid, direction, 0, &count,
+                                    parts.data(), nullptr);
+      for (uint32_t i = 0; i < count; i++) {
+        AddEdge(math_edges_, gid, parts[i].glyph);
+      }
+    }
+  }
+}
+
+void GlyphClosureEngine::ExtractColr() {
+  FontData colr = FontHelper::TableData(face_.get(), kColr);
+  if (colr.empty()) {
+    return;
+  }
+
+  string_view data = colr.str();
+  auto version = ReadUInt16(data, 0);
+  auto base_count = ReadUInt16(data, 2);
+  auto base_records = ReadUInt32(data, 4);
+  auto layer_records = ReadUInt32(data, 8);
+  auto layer_count = ReadUInt16(data, 12);
+  if (!version.ok() || *version > 0 || !base_count.ok() ||
+      !base_records.ok() || !layer_records.ok() || !layer_count.ok()) {
+    // COLRv1 paint graphs are not modeled.
+    requires_subset_plan_ = true;
+    return;
+  }
+
+  // COLRv0 base glyphs depend on their layer glyphs, a single level deep.
+  for (uint32_t i = 0; i < *base_count; i++) {
+    uint32_t record = *base_records + i * 6;
+    auto gid = ReadUInt16(data, record);
+    auto first_layer = ReadUInt16(data, record + 2);
+    auto num_layers = ReadUInt16(data, record + 4);
+    if (!gid.ok() || !first_layer.ok() || !num_layers.ok()) {
+      requires_subset_plan_ = true;
+      return;
+    }
+
+    uint32_t end = std::min<uint32_t>(*first_layer + *num_layers,
+                                      *layer_count);
+    for (uint32_t layer = *first_layer; layer < end; layer++) {
+      auto layer_gid = ReadUInt16(data, *layer_records + layer * 4);
+      if (!layer_gid.ok()) {
+        requires_subset_plan_ = true;
+        return;
+      }
+      AddEdge(colr_edges_, *gid, *layer_gid);
+    }
+  }
+}
+
+void GlyphClosureEngine::ExtractGlyf() {
+  FontData glyf = FontHelper::TableData(face_.get(), FontHelper::kGlyf);
+  FontData loca = FontHelper::TableData(face_.get(), FontHelper::kLoca);
+  if (glyf.empty() || loca.empty()) {
+    return;
+  }
+  has_glyf_ = true;
+
+  bool long_loca = FontHelper::HasLongLoca(face_.get());
+  for (uint32_t gid = 0; gid < num_glyphs_; gid++) {
+    auto glyph =
+        long_loca
+            ? IndexedDataReader<uint32_t, 1>(loca.str(), glyf.str())
+                  .DataFor(gid)
+            : IndexedDataReader<uint16_t, 2>(loca.str(), glyf.str())
+                  .DataFor(gid);
+    if (!glyph.ok() || glyph->size() < 10) {
+      // Missing and malformed glyphs have no components.
+      continue;
+    }
+
+    auto contours = FontHelper::ReadInt16(*glyph);
+    if (!contours.ok() || *contours >= 0) {
+      continue;
+    }
+
+    // Composite glyph, walk the component records. Like harfbuzz, a truncated
+    // record ends the list.
+    uint32_t offset = 10;
+    while (true) {
+      auto flags = ReadUInt16(*glyph, offset);
+      auto component = ReadUInt16(*glyph, offset + 2);
+      if (!flags.ok() || !component.ok()) {
+        break;
+      }
+
+      uint32_t size = 4 + ((*flags & kArgsAreWords) ? 4 : 2);
+      if (*flags & kHaveScale) {
+        size += 2;
+      } else if (*flags & kHaveXAndYScale) {
+        size += 4;
+      } else if (*flags & kHaveTwoByTwo) {
+        size += 8;
+      }
+      if (offset + size > glyph->size()) {
+        break;
+      }
+
+      AddEdge(component_edges_, gid, *component);
+      if (!(*flags & kMoreComponents)) {
+        break;
+      }
+      offset += size;
+    }
+  }
+}
+
+void GlyphClosureEngine::AddEdge(std::vector<std::vector<uint32_t>>& edges,
+                                 uint32_t from, uint32_t to) {
+  if (from < num_glyphs_ && to < num_glyphs_) {
+    edges[from].push_back(to);
+  }
+}
+
+void GlyphClosureEngine::LayoutClosure(std::vector<uint32_t> added,
+                                       hb_set_t* glyphs) const {
+  auto add = [&](uint32_t gid) {
+    if (gid < num_glyphs_ && AddGlyph(glyphs, gid)) {
+      added.push_back(gid);
+    }
+  };
+
+  while (!added.empty()) {
+    while (!added.empty()) {
+      uint32_t gid = added.back();
+      added.pop_back();
+      for (uint32_t next : gsub_edges_[gid]) {
+        add(next);
+      }
+      for (uint32_t index : ligatures_by_component_[gid]) {
+        const Ligature& ligature = ligatures_[index];
+        if (std::all_of(
+                ligature.components.begin(), ligature.components.end(),
+                [&](uint32_t component) {
+                  return hb_set_has(glyphs, component);
+                })) {
+          add(ligature.glyph);
+        }
+      }
+    }
+
+    if (hb_set_is_empty(unmodeled_lookups_.get())) {
+      return;
+    }
+
+    // Contextual lookups depend on the whole glyph set, let harfbuzz close
+    // over them and then follow up on anything new.
+    hb_set_unique_ptr before = make_hb_set();
+    hb_set_union(before.get(), glyphs);
+    hb_ot_layout_lookups_substitute_closure(
+        face_.get(), unmodeled_lookups_.get(), glyphs);
+
+    hb_set_unique_ptr new_glyphs = make_hb_set();
+    hb_set_union(new_glyphs.get(), glyphs);
+    hb_set_subtract(new_glyphs.get(), before.get());
+    uint32_t gid = HB_SET_VALUE_INVALID;
+    while (hb_set_next(new_glyphs.get(), &gid) && gid < num_glyphs_) {
+      added.push_back(gid);
+    }
+  }
+}
+
+GlyphClosureEngine::Closure::Closure(const GlyphClosureEngine* engine)
+    : engine_(engine), layout_glyphs_(make_hb_set()) {
+  hb_set_union(layout_glyphs_.get(), engine->base_layout_glyphs_.get());
+}
+
+GlyphClosureEngine::Closure::Closure(const Closure& other)
+    : engine_(other.engine_), layout_glyphs_(make_hb_set()) {
+  hb_set_union(layout_glyphs_.get(), other.layout_glyphs_.get());
+}
+
+GlyphClosureEngine::Closure& GlyphClosureEngine::Closure::operator=(
+    const Closure& other) {
+  engine_ = other.engine_;
+  hb_set_clear(layout_glyphs_.get());
+  hb_set_union(layout_glyphs_.get(), other.layout_glyphs_.get());
+  return *this;
+}
+
+void GlyphClosureEngine::Closure::AddCodepoints(const hb_set_t* codepoints) {
+  std::vector<uint32_t> added;
+  uint32_t cp = HB_SET_VALUE_INVALID;
+  while (hb_set_next(codepoints, &cp)) {
+    auto it = engine_->cmap_.find(cp);
+    if (it == engine_->cmap_.end()) {
+      continue;
+    }
+    for (uint32_t gid : it->second) {
+      if (gid < engine_->num_glyphs_ && AddGlyph(layout_glyphs_.get(), gid)) {
+        added.push_back(gid);
+      }
+    }
+  }
+  engine_->LayoutClosure(std::move(added), layout_glyphs_.get());
+}
+
+void GlyphClosureEngine::Closure::Glyphs(hb_set_t* gids) const {
+  const auto& engine = *engine_;
+  hb_set_unique_ptr glyphs = make_hb_set();
+  hb_set_union(glyphs.get(), layout_glyphs_.get());
+  if (engine.num_glyphs_ > 0) {
+    hb_set_del_range(glyphs.get(), engine.num_glyphs_,
+                     HB_SET_VALUE_INVALID - 1);
+  }
+
+  // Each stage only follows edges from the glyphs of the previous stage.
+  for (const auto* edges : {&engine.math_edges_, &engine.colr_edges_}) {
+    std::vector<uint32_t> targets;
+    uint32_t gid = HB_SET_VALUE_INVALID;
+    while (hb_set_next(glyphs.get(), &gid)) {
+      const auto& next = (*edges)[gid];
+      targets.insert(targets.end(), next.begin(), next.end());
+    }
+    for (uint32_t target : targets) {
+      hb_set_add(glyphs.get(), target);
+    }
+  }
+
+  if (engine.has_glyf_) {
+    // Composite components are added recursively.
+    std::vector<uint32_t> pending;
+    uint32_t gid = HB_SET_VALUE_INVALID;
+    while (hb_set_next(glyphs.get(), &gid)) {
+      pending.push_back(gid);
+    }
+    while (!pending.empty()) {
+      uint32_t gid = pending.back();
+      pending.pop_back();
+      for (uint32_t component : engine.component_edges_[gid]) {
+        if (AddGlyph(glyphs.get(), component)) {
+          pending.push_back(component);
+        }
+      }
+    }
+  }
+
+  hb_set_union(gids, glyphs.get());
+}
+
+}  // namespace ift::encoder
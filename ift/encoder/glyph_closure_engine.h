@@ -0,0 +1,125 @@
+#ifndef IFT_ENCODER_GLYPH_CLOSURE_ENGINE_H_
+#define IFT_ENCODER_GLYPH_CLOSURE_ENGINE_H_
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "common/font_data.h"
+#include "common/hb_set_unique_ptr.h"
+#include "hb.h"
+
+namespace ift::encoder {
+
+/*
+ * Computes glyph closures (the set of glyphs a subset of the font needs in
+ * order to render a set of codepoints) from a glyph dependency graph which is
+ * extracted from the font once, instead of building a harfbuzz subset plan for
+ * every closure.
+ *
+ * The closure is computed in the same stages as harfbuzz's subsetter uses, so
+ * results match a subset plan's glyph set:
+ * - cmap, including non-default variation sequences.
+ * - GSUB, restricted to lookups reachable from the default subset layout
+ *   features. Single, multiple, alternate and ligature substitutions are
+ *   modeled natively. Contextual and reverse chaining lookups can't be
+ *   expressed as graph edges, those are closed over by harfbuzz, alternating
+ *   with the native closure until neither adds glyphs.
+ * - MATH glyph variants and assembly parts.
+ * - COLRv0 layers.
+ * - glyf composite components.
+ *
+ * Fonts with features the graph doesn't capture (CFF seac components, COLRv1,
+ * GSUB feature variations) report RequiresSubsetPlan() and closures for those
+ * should be computed with a subset plan instead.
+ */
+class GlyphClosureEngine {
+ public:
+  static absl::StatusOr<std::unique_ptr<const GlyphClosureEngine>> Create(
+      hb_face_t* face);
+
+  /*
+   * An in progress closure. Codepoints can be added incrementally, each
+   * addition only visits the parts of the graph reachable from the newly
+   * added glyphs. Copies are cheap relative to recomputing, so a closure of a
+   * common base set can be shared as the starting point for many others.
+   */
+  class Closure {
+   public:
+    Closure(const Closure& other);
+    Closure& operator=(const Closure& other);
+    Closure(Closure&&) = default;
+    Closure& operator=(Closure&&) = default;
+
+    // Adds the glyphs needed by 'codepoints' to this closure.
+    void AddCodepoints(const hb_set_t* codepoints);
+
+    // Adds the full glyph closure of all codepoints added so far to 'gids'.
+    void Glyphs(hb_set_t* gids) const;
+
+   private:
+    friend class GlyphClosureEngine;
+    explicit Closure(const GlyphClosureEngine* engine);
+
+    const GlyphClosureEngine* engine_;
+    // Glyphs reached through cmap and GSUB, closed under both.
+    common::hb_set_unique_ptr layout_glyphs_;
+  };
+
+  // True if this font's closures can't be computed exactly by the engine.
+  bool RequiresSubsetPlan() const { return requires_subset_plan_; }
+
+  Closure NewClosure() const { return Closure(this); }
+
+  // Adds the glyph closure of 'codepoints' to 'gids'.
+  void GlyphClosure(const hb_set_t* codepoints, hb_set_t* gids) const;
+
+ private:
+  struct Ligature {
+    std::vector<uint32_t> components;
+    uint32_t glyph;
+  };
+
+  explicit GlyphClosureEngine(hb_face_t* face);
+
+  void ExtractCmap();
+  absl::Status ExtractGsub();
+  void ExtractMath();
+  void ExtractColr();
+  void ExtractGlyf();
+
+  void AddEdge(std::vector<std::vector<uint32_t>>& edges, uint32_t from,
+               uint32_t to);
+
+  // Closes 'glyphs' under GSUB, 'added' are the glyphs in 'glyphs' whose
+  // substitutions have not yet been followed.
+  void LayoutClosure(std::vector<uint32_t> added, hb_set_t* glyphs) const;
+
+  common::hb_face_unique_ptr face_;
+  uint32_t num_glyphs_;
+  bool requires_subset_plan_ = false;
+
+  absl::flat_hash_map<uint32_t, std::vector<uint32_t>> cmap_;
+
+  // Edges are indexed by source gid.
+  std::vector<std::vector<uint32_t>> gsub_edges_;
+  std::vector<Ligature> ligatures_;
+  // Indices into ligatures_ by component gid.
+  std::vector<std::vector<uint32_t>> ligatures_by_component_;
+  // Active GSUB lookups which are closed over by harfbuzz.
+  common::hb_set_unique_ptr unmodeled_lookups_;
+  // Closure of notdef, the starting point of every closure.
+  common::hb_set_unique_ptr base_layout_glyphs_;
+
+  std::vector<std::vector<uint32_t>> math_edges_;
+  std::vector<std::vector<uint32_t>> colr_edges_;
+  std::vector<std::vector<uint32_t>> component_edges_;
+  bool has_glyf_ = false;
+};
+
+}  // namespace ift::encoder
+
+#endif  // IFT_ENCODER_GLYPH_CLOSURE_ENGINE_H_
@@ -0,0 +1,183 @@
+#include "ift/encoder/glyph_closure_engine.h"
+
+#include "common/font_data.h"
+#include "common/font_helper.h"
+#include "common/hb_set_unique_ptr.h"
+#include "gtest/gtest.h"
+#include "hb-subset.h"
+
+using common::FontData;
+using common::FontHelper;
+using common::hb_face_unique_ptr;
+using common::hb_set_unique_ptr;
+using common::make_hb_face;
+using common::make_hb_set;
+using common::make_hb_set_from_ranges;
+
+namespace ift::encoder {
+
+class GlyphClosureEngineTest : public ::testing::Test {
+ protected:
+  GlyphClosureEngineTest()
+      : roboto(from_file("common/testdata/Roboto-Regular.ttf")),
+        noto_nastaliq_urdu(
+            from_file("common/testdata/NotoNastaliqUrdu.subset.ttf")),
+        noto_sans_jp(from_file("ift/testdata/NotoSansJP-Regular.subset.ttf")) {}
+
+  static hb_face_unique_ptr from_file(const char* filename) {
+    hb_blob_t* blob = hb_blob_create_from_file_or_fail(filename);
+    if (!blob) {
+      assert(false);
+    }
+    FontData result(blob);
+    hb_blob_destroy(blob);
+    return result.face();
+  }
+
+  static hb_set_unique_ptr SubsetPlanClosure(hb_face_t* face,
+                                             const hb_set_t* codepoints) {
+    hb_subset_input_t* input = hb_subset_input_create_or_fail();
+    hb_set_union(hb_subset_input_unicode_set(input), codepoints);
+    hb_subset_plan_t* plan = hb_subset_plan_create_or_fail(face, input);
+    hb_subset_input_destroy(input);
+
+    hb_set_unique_ptr gids = make_hb_set();
+    hb_map_values(hb_subset_plan_new_to_old_glyph_mapping(plan), gids.get());
+    hb_subset_plan_destroy(plan);
+    return gids;
+  }
+
+  static hb_set_unique_ptr EngineClosure(const GlyphClosureEngine& engine,
+                                         const hb_set_t* codepoints) {
+    hb_set_unique_ptr gids = make_hb_set();
+    engine.GlyphClosure(codepoints, gids.get());
+    return gids;
+  }
+
+  /*
+   * Checks the engine against a subset plan for the full font, each single
+   * codepoint, and the full font minus each codepoint in 'sample'.
+   */
+  static void CheckMatchesSubsetPlan(hb_face_t* face,
+                                     const hb_set_t* sample = nullptr) {
+    auto engine = GlyphClosureEngine::Create(face);
+    ASSERT_TRUE(engine.ok()) << engine.status();
+    ASSERT_FALSE((*engine)->RequiresSubsetPlan());
+
+    hb_set_unique_ptr all = make_hb_set();
+    hb_face_collect_unicodes(face, all.get());
+    if (!sample) {
+      sample = all.get();
+    }
+
+    std::vector<hb_set_unique_ptr> inputs;
+    inputs.push_back(make_hb_set());
+    inputs.push_back(make_hb_set());
+    hb_set_union(inputs.back().get(), all.get());
+
+    uint32_t cp = HB_SET_VALUE_INVALID;
+    while (hb_set_next(sample, &cp)) {
+      inputs.push_back(make_hb_set(1, cp));
+      inputs.push_back(make_hb_set());
+      hb_set_union(inputs.back().get(), all.get());
+      hb_set_del(inputs.back().get(), cp);
+    }
+
+    for (const auto& codepoints : inputs) {
+      auto expected = SubsetPlanClosure(face, codepoints.get());
+      auto actual = EngineClosure(**engine, codepoints.get());
+      ASSERT_TRUE(hb_set_is_equal(expected.get(), actual.get()))
+          << "closure mismatch for " << hb_set_get_population(codepoints.get())
+          << " codepoints starting at " << hb_set_get_min(codepoints.get());
+    }
+  }
+
+  hb_face_unique_ptr roboto;
+  hb_face_unique_ptr noto_nastaliq_urdu;
+  hb_face_unique_ptr noto_sans_jp;
+};
+
+TEST_F(GlyphClosureEngineTest, Basic) {
+  auto engine = GlyphClosureEngine::Create(roboto.get());
+  ASSERT_TRUE(engine.ok()) << engine.status();
+
+  hb_set_unique_ptr codepoints = make_hb_set(1, 'a');
+  auto gids = EngineClosure(**engine, codepoints.get());
+  ASSERT_TRUE(hb_set_is_equal(gids.get(), make_hb_set(2, 0, 69).get()));
+
+  codepoints = make_hb_set();
+  gids = EngineClosure(**engine, codepoints.get());
+  ASSERT_TRUE(hb_set_is_equal(gids.get(), make_hb_set(1, 0).get()));
+}
+
+TEST_F(GlyphClosureEngineTest, Ligature) {
+  auto engine = GlyphClosureEngine::Create(roboto.get());
+  ASSERT_TRUE(engine.ok()) << engine.status();
+
+  // f + i forms the fi ligature (gid 444), neither alone does.
+  auto gids = EngineClosure(**engine, make_hb_set(1, 'f').get());
+  ASSERT_FALSE(hb_set_has(gids.get(), 444));
+  gids = EngineClosure(**engine, make_hb_set(1, 'i').get());
+  ASSERT_FALSE(hb_set_has(gids.get(), 444));
+  gids = EngineClosure(**engine, make_hb_set(2, 'f', 'i').get());
+  ASSERT_TRUE(hb_set_has(gids.get(), 444));
+}
+
+TEST_F(GlyphClosureEngineTest, Incremental) {
+  auto engine = GlyphClosureEngine::Create(noto_nastaliq_urdu.get());
+  ASSERT_TRUE(engine.ok()) << engine.status();
+
+  hb_set_unique_ptr all = make_hb_set();
+  hb_face_collect_unicodes(noto_nastaliq_urdu.get(), all.get());
+
+  hb_set_unique_ptr first = make_hb_set();
+  hb_set_unique_ptr second = make_hb_set();
+  uint32_t cp = HB_SET_VALUE_INVALID;
+  bool alternate = false;
+  while (hb_set_next(all.get(), &cp)) {
+    hb_set_add(alternate ? first.get() : second.get(), cp);
+    alternate = !alternate;
+  }
+
+  GlyphClosureEngine::Closure closure = (*engine)->NewClosure();
+  closure.AddCodepoints(first.get());
+  GlyphClosureEngine::Closure copy = closure;
+  closure.AddCodepoints(second.get());
+
+  hb_set_unique_ptr incremental = make_hb_set();
+  closure.Glyphs(incremental.get());
+  auto expected = EngineClosure(**engine, all.get());
+  ASSERT_TRUE(hb_set_is_equal(incremental.get(), expected.get()));
+
+  // The copy is unaffected by additions to the original.
+  hb_set_unique_ptr partial = make_hb_set();
+  copy.Glyphs(partial.get());
+  expected = EngineClosure(**engine, first.get());
+  ASSERT_TRUE(hb_set_is_equal(partial.get(), expected.get()));
+}
+
+TEST_F(GlyphClosureEngineTest, MatchesSubsetPlan_Roboto) {
+  hb_set_unique_ptr sample = make_hb_set_from_ranges(
+      3, 'A', 'Z', 'a', 'z', 0xC0, 0xFF);
+  CheckMatchesSubsetPlan(roboto.get(), sample.get());
+}
+
+TEST_F(GlyphClosureEngineTest, MatchesSubsetPlan_NotoNastaliqUrdu) {
+  // Mostly contextual lookups, exercises the harfbuzz fallback.
+  CheckMatchesSubsetPlan(noto_nastaliq_urdu.get());
+}
+
+TEST_F(GlyphClosureEngineTest, MatchesSubsetPlan_NotoSansJP) {
+  CheckMatchesSubsetPlan(noto_sans_jp.get());
+}
+
+TEST_F(GlyphClosureEngineTest, RequiresSubsetPlan_Cff) {
+  auto face = from_file("common/testdata/Ahem.optimized.otf");
+  ASSERT_TRUE(FontHelper::GetTags(face.get()).contains(FontHelper::kCFF));
+
+  auto engine = GlyphClosureEngine::Create(face.get());
+  ASSERT_TRUE(engine.ok()) << engine.status();
+  ASSERT_TRUE((*engine)->RequiresSubsetPlan());
+}
+
+}  // namespace ift::encoder
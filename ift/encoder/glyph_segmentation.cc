@@ -1,22 +1,35 @@
 #include "ift/encoder/glyph_segmentation.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cstdint>
 #include <cstdio>
+#include <memory>
+#include <optional>
 #include <sstream>
+#include <utility>
+#include <vector>
 
 #include "absl/container/btree_map.h"
 #include "absl/container/btree_set.h"
 #include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
+#include "absl/hash/hash.h"
 #include "absl/log/log.h"
 #include "absl/status/statusor.h"
-#include "common/compat_id.h"
+#include "absl/strings/str_join.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/span.h"
 #include "common/font_data.h"
 #include "common/font_helper.h"
 #include "common/hb_set_unique_ptr.h"
+#include "common/thread_pool.h"
 #include "common/try.h"
 #include "hb-subset.h"
-#include "ift/glyph_keyed_diff.h"
+#include "ift/encoder/glyph_closure_engine.h"
+#include "ift/encoder/patch_size_estimator.h"
+#include "ift/encoder/set_fingerprint.h"
 
 using absl::btree_map;
 using absl::btree_set;
@@ -25,14 +38,13 @@ using absl::flat_hash_set;
 using absl::Status;
 using absl::StatusOr;
 using absl::StrCat;
-using common::CompatId;
 using common::FontData;
 using common::FontHelper;
 using common::hb_face_unique_ptr;
 using common::hb_set_unique_ptr;
 using common::make_hb_face;
 using common::make_hb_set;
-using common::to_hash_set;
+using common::ThreadPool;
 
 namespace ift::encoder {
 
@@ -62,6 +74,21 @@ void subtract(btree_set<uint32_t>& a, const btree_set<uint32_t>& b) {
   }
 }
 
+// Removes gid from the group keyed by 'segments', dropping the group if it
+// becomes empty.
+void RemoveFromGroup(
+    btree_map<btree_set<segment_index_t>, btree_set<glyph_id_t>>& groups,
+    const btree_set<segment_index_t>& segments, glyph_id_t gid) {
+  auto it = groups.find(segments);
+  if (it == groups.end()) {
+    return;
+  }
+  it->second.erase(gid);
+  if (it->second.empty()) {
+    groups.erase(it);
+  }
+}
+
 class GlyphConditions {
  public:
   GlyphConditions() : and_segments(make_hb_set()), or_segments(make_hb_set()) {}
@@ -72,6 +99,66 @@ class GlyphConditions {
     hb_set_subtract(and_segments.get(), segments);
     hb_set_subtract(or_segments.get(), segments);
   }
+
+  bool IsEmpty() const {
+    return hb_set_is_empty(and_segments.get()) &&
+           hb_set_is_empty(or_segments.get());
+  }
+};
+
+/*
+ * A thread safe cache from codepoint sets to glyph sets. Codepoint sets are
+ * keyed by fingerprint so probes don't copy the set. Entries are spread over
+ * independently locked shards by key hash so that concurrent lookups rarely
+ * contend. Cached sets are never modified or removed, pointers to them
+ * stay valid for the life of the cache.
+ */
+class ConcurrentSetCache {
+ public:
+  // Returns the set cached for 'key' or nullptr if there is none.
+  const hb_set_t* Find(const SetFingerprint& key) {
+    Shard& shard = ShardFor(key);
+    absl::MutexLock lock(&shard.mutex);
+    auto it = shard.sets.find(key);
+    if (it == shard.sets.end()) {
+      misses++;
+      return nullptr;
+    }
+    hits++;
+    return it->second.get();
+  }
+
+  // Caches 'value' for 'key' and returns it. If another thread already cached
+  // a set for 'key' that one is kept and returned instead.
+  const hb_set_t* Insert(SetFingerprint key, hb_set_unique_ptr value) {
+    Shard& shard = ShardFor(key);
+    absl::MutexLock lock(&shard.mutex);
+    auto it = shard.sets.find(key);
+    if (it != shard.sets.end()) {
+      return it->second.get();
+    }
+    const hb_set_t* result = value.get();
+    shard.sets.insert(std::pair(std::move(key), std::move(value)));
+    return result;
+  }
+
+  std::atomic<uint32_t> hits = 0;
+  std::atomic<uint32_t> misses = 0;
+
+ private:
+  static constexpr uint32_t kNumShards = 16;
+
+  struct Shard {
+    absl::Mutex mutex;
+    flat_hash_map<SetFingerprint, hb_set_unique_ptr> sets
+        ABSL_GUARDED_BY(mutex);
+  };
+
+  Shard& ShardFor(const SetFingerprint& key) {
+    return shards_[absl::Hash<SetFingerprint>()(key) % kNumShards];
+  }
+
+  std::array<Shard, kNumShards> shards_;
 };
 
 class SegmentationContext;
@@ -87,6 +174,7 @@ class SegmentationContext {
       const std::vector<flat_hash_set<uint32_t>>& codepoint_segments)
       : preprocessed_face(make_hb_face(hb_subset_preprocess(face))),
         original_face(make_hb_face(hb_face_reference(face))),
+        original_font(face),
         segments(),
         initial_codepoints(make_hb_set(initial_segment)),
         all_codepoints(make_hb_set()),
@@ -96,6 +184,16 @@ class SegmentationContext {
       segments.push_back(make_hb_set(s));
     }
 
+    auto engine = GlyphClosureEngine::Create(preprocessed_face.get());
+    if (engine.ok() && !(*engine)->RequiresSubsetPlan()) {
+      closure_engine = std::move(*engine);
+      initial_layout_closure = closure_engine->NewClosure();
+      initial_layout_closure->AddCodepoints(initial_codepoints.get());
+    } else if (!engine.ok()) {
+      LOG(WARNING) << "Falling back to subset plan closures: "
+                   << engine.status();
+    }
+
     hb_set_union(all_codepoints.get(), initial_codepoints.get());
     for (const auto& s : segments) {
       hb_set_union(all_codepoints.get(), s.get());
@@ -113,32 +211,126 @@ class SegmentationContext {
       full_closure.reset(closure->release());
     }
 
-    gid_conditions.resize(hb_face_get_glyph_count(original_face.get()));
+    uint32_t glyph_count = hb_face_get_glyph_count(original_face.get());
+    gid_conditions.resize(glyph_count);
+    segment_gids.resize(segments.size());
+    if (glyph_count > 0) {
+      // Nothing has been grouped yet.
+      hb_set_add_range(dirty_glyphs.get(), 0, glyph_count - 1);
+    }
+  }
+
+  /*
+   * Must be called before the conditions of 'gid' are modified. Takes gid out
+   * of the glyph groups, it's placed back into the groups matching its new
+   * conditions by the next UpdateGlyphGroups().
+   */
+  void MarkDirty(glyph_id_t gid) {
+    if (hb_set_has(dirty_glyphs.get(), gid)) {
+      return;
+    }
+    hb_set_add(dirty_glyphs.get(), gid);
+
+    const auto& condition = gid_conditions[gid];
+    if (!hb_set_is_empty(condition.and_segments.get())) {
+      RemoveFromGroup(and_glyph_groups,
+                      to_btree_set(condition.and_segments.get()), gid);
+    }
+    if (!hb_set_is_empty(condition.or_segments.get())) {
+      auto or_segments = to_btree_set(condition.or_segments.get());
+      RemoveFromGroup(or_glyph_groups, or_segments, gid);
+      RemoveFromGroup(final_or_glyph_groups, or_segments, gid);
+    }
+    unmapped_glyphs.erase(gid);
+  }
+
+  /*
+   * Places all dirty glyphs into the and/or groups matching their current
+   * conditions, and glyphs without conditions into unmapped_glyphs. Returns
+   * the dirty glyphs which have or conditions keyed by those conditions, they
+   * still need to be placed into final_or_glyph_groups (see GroupGlyphs()).
+   */
+  btree_map<btree_set<segment_index_t>, std::vector<glyph_id_t>>
+  UpdateGlyphGroups() {
+    btree_map<btree_set<segment_index_t>, std::vector<glyph_id_t>>
+        dirty_or_groups;
+    glyph_id_t gid = HB_SET_VALUE_INVALID;
+    while (hb_set_next(dirty_glyphs.get(), &gid)) {
+      const auto& condition = gid_conditions[gid];
+      if (!hb_set_is_empty(condition.and_segments.get())) {
+        and_glyph_groups[to_btree_set(condition.and_segments.get())].insert(
+            gid);
+      }
+      if (!hb_set_is_empty(condition.or_segments.get())) {
+        auto or_segments = to_btree_set(condition.or_segments.get());
+        or_glyph_groups[or_segments].insert(gid);
+        dirty_or_groups[std::move(or_segments)].push_back(gid);
+      }
+      if (condition.IsEmpty() && !hb_set_has(initial_closure.get(), gid) &&
+          hb_set_has(full_closure.get(), gid)) {
+        unmapped_glyphs.insert(gid);
+      }
+    }
+    hb_set_clear(dirty_glyphs.get());
+    return dirty_or_groups;
   }
 
-  void ResetGroupings() {
-    unmapped_glyphs = {};
-    and_glyph_groups = {};
-    or_glyph_groups = {};
-    patch_id_to_segment_index = {};
-    fallback_segments = {};
+  // Returns the glyphs which are exclusive to 'segment', or nullptr if there
+  // are none.
+  const btree_set<glyph_id_t>* ExclusiveGlyphs(segment_index_t segment) const {
+    auto it = and_glyph_groups.find(btree_set<segment_index_t>{segment});
+    if (it == and_glyph_groups.end()) {
+      return nullptr;
+    }
+    return &it->second;
   }
 
+  // Safe to call concurrently.
   StatusOr<hb_set_unique_ptr> GlyphClosure(const hb_set_t* codepoints) {
-    auto cache_key = to_hash_set(codepoints);
+    SetFingerprint cache_key(codepoints);
 
-    auto it = glyph_closure_cache.find(cache_key);
-    if (it != glyph_closure_cache.end()) {
-      glyph_closure_cache_hit++;
+    const hb_set_t* cached = glyph_closure_cache.Find(cache_key);
+    if (cached) {
       hb_set_unique_ptr result = make_hb_set();
-      hb_set_union(result.get(), it->second.get());
+      hb_set_union(result.get(), cached);
       return result;
     }
 
-    glyph_closure_cache_miss++;
     closure_count_cumulative++;
     closure_count_delta++;
 
+    hb_set_unique_ptr gids = make_hb_set();
+    if (closure_engine) {
+      EngineClosure(codepoints, gids.get());
+    } else {
+      gids = TRY(SubsetPlanClosure(codepoints));
+    }
+
+    hb_set_unique_ptr cached_gids = make_hb_set();
+    hb_set_union(cached_gids.get(), gids.get());
+    glyph_closure_cache.Insert(std::move(cache_key), std::move(cached_gids));
+
+    return gids;
+  }
+
+  void EngineClosure(const hb_set_t* codepoints, hb_set_t* gids) const {
+    if (!hb_set_is_subset(initial_codepoints.get(), codepoints)) {
+      closure_engine->GlyphClosure(codepoints, gids);
+      return;
+    }
+
+    // Most closures are supersets of the initial segment, extend its closure
+    // instead of starting over.
+    GlyphClosureEngine::Closure closure = *initial_layout_closure;
+    hb_set_unique_ptr added = make_hb_set();
+    hb_set_union(added.get(), codepoints);
+    hb_set_subtract(added.get(), initial_codepoints.get());
+    closure.AddCodepoints(added.get());
+    closure.Glyphs(gids);
+  }
+
+  StatusOr<hb_set_unique_ptr> SubsetPlanClosure(
+      const hb_set_t* codepoints) const {
     hb_subset_input_t* input = hb_subset_input_create_or_fail();
     if (!input) {
       return absl::InternalError("Closure subset configuration failed.");
@@ -159,61 +351,89 @@ class SegmentationContext {
     hb_set_unique_ptr gids = make_hb_set();
     hb_map_values(new_to_old, gids.get());
     hb_subset_plan_destroy(plan);
-
-    hb_set_unique_ptr cached_gids = make_hb_set();
-    hb_set_union(cached_gids.get(), gids.get());
-    glyph_closure_cache.insert(std::pair(cache_key, std::move(cached_gids)));
-
     return gids;
   }
 
   void LogClosureCount(absl::string_view operation) {
     VLOG(0) << operation << ": cumulative number of glyph closures "
-            << closure_count_cumulative << " (+" << closure_count_delta << ")";
+            << closure_count_cumulative.load() << " (+"
+            << closure_count_delta.load() << ")";
     closure_count_delta = 0;
   }
 
   void LogCacheStats() {
-    double hit_rate = 100.0 * ((double)code_point_set_to_or_gids_cache_hit) /
-                      ((double)(code_point_set_to_or_gids_cache_hit +
-                                code_point_set_to_or_gids_cache_miss));
+    uint32_t or_gids_hits = code_point_set_to_or_gids_cache.hits;
+    uint32_t or_gids_misses = code_point_set_to_or_gids_cache.misses;
+    double hit_rate = 100.0 * ((double)or_gids_hits) /
+                      ((double)(or_gids_hits + or_gids_misses));
     VLOG(0) << "Codepoints to or_gids cache hit rate: " << hit_rate << "% ("
-            << code_point_set_to_or_gids_cache_hit << " hits, "
-            << code_point_set_to_or_gids_cache_miss << " misses)";
+            << or_gids_hits << " hits, " << or_gids_misses << " misses)";
 
-    double closure_hit_rate =
-        100.0 * ((double)glyph_closure_cache_hit) /
-        ((double)(glyph_closure_cache_hit + glyph_closure_cache_miss));
+    uint32_t closure_hits = glyph_closure_cache.hits;
+    uint32_t closure_misses = glyph_closure_cache.misses;
+    double closure_hit_rate = 100.0 * ((double)closure_hits) /
+                              ((double)(closure_hits + closure_misses));
     VLOG(0) << "Glyph closure cache hit rate: " << closure_hit_rate << "% ("
-            << glyph_closure_cache_hit << " hits, " << glyph_closure_cache_miss
-            << " misses)";
+            << closure_hits << " hits, " << closure_misses << " misses)";
   }
 
+  // Safe to call concurrently.
   StatusOr<const hb_set_t*> CodepointsToOrGids(const hb_set_t* codepoints) {
-    auto hash_set_codepoints = common::to_hash_set(codepoints);
+    SetFingerprint cache_key(codepoints);
 
-    auto it = code_point_set_to_or_gids_cache.find(hash_set_codepoints);
-    if (it != code_point_set_to_or_gids_cache.end()) {
-      code_point_set_to_or_gids_cache_hit++;
-      return it->second.get();
+    const hb_set_t* cached = code_point_set_to_or_gids_cache.Find(cache_key);
+    if (cached) {
+      return cached;
     }
 
-    code_point_set_to_or_gids_cache_miss++;
     hb_set_unique_ptr and_gids = make_hb_set();
     hb_set_unique_ptr or_gids = make_hb_set();
     hb_set_unique_ptr exclusive_gids = make_hb_set();
     TRYV(AnalyzeSegment(*this, codepoints, and_gids.get(), or_gids.get(),
                         exclusive_gids.get()));
 
-    const hb_set_t* or_gids_ptr = or_gids.get();
-    code_point_set_to_or_gids_cache.insert(
-        std::pair(hash_set_codepoints, std::move(or_gids)));
-    return or_gids_ptr;
+    return code_point_set_to_or_gids_cache.Insert(std::move(cache_key),
+                                                  std::move(or_gids));
+  }
+
+  /*
+   * Returns the estimated size of the glyph keyed patch for each of
+   * 'gid_sets'. Sizes are cached by gid set, any sets not in the cache are
+   * passed to the estimator together as a single batch.
+   */
+  StatusOr<std::vector<uint32_t>> PatchSizes(
+      absl::Span<const btree_set<glyph_id_t>> gid_sets) {
+    std::vector<btree_set<glyph_id_t>> missing;
+    for (const auto& gids : gid_sets) {
+      if (!patch_size_cache.contains(gids)) {
+        missing.push_back(gids);
+      }
+    }
+
+    if (!missing.empty()) {
+      auto sizes = TRY(patch_size_estimator->PatchSizes(missing));
+      for (uint32_t i = 0; i < missing.size(); i++) {
+        patch_size_cache[missing[i]] = sizes[i];
+      }
+    }
+
+    std::vector<uint32_t> result;
+    for (const auto& gids : gid_sets) {
+      result.push_back(patch_size_cache.at(gids));
+    }
+    return result;
   }
 
   // Init
   common::hb_face_unique_ptr preprocessed_face;
   common::hb_face_unique_ptr original_face;
+  FontData original_font;
+  // Null when closures need a subset plan.
+  std::unique_ptr<const GlyphClosureEngine> closure_engine;
+  std::optional<GlyphClosureEngine::Closure> initial_layout_closure;
+  // Owns the estimator when the caller didn't supply one.
+  std::unique_ptr<PatchSizeEstimator> default_patch_size_estimator;
+  PatchSizeEstimator* patch_size_estimator = nullptr;
   std::vector<hb_set_unique_ptr> segments;
 
   hb_set_unique_ptr initial_codepoints;
@@ -226,26 +446,37 @@ class SegmentationContext {
 
   // Phase 1
   std::vector<GlyphConditions> gid_conditions;
-
-  // Phase 2
-  btree_set<glyph_id_t> unmapped_glyphs;
+  // For each segment the glyphs whose conditions reference it, so that
+  // changing a segment only touches the glyphs which depend on it.
+  std::vector<btree_set<glyph_id_t>> segment_gids;
+  // Glyphs whose conditions changed since the groups were last updated.
+  hb_set_unique_ptr dirty_glyphs = make_hb_set();
+
+  // Phase 2, glyphs grouped by their conditions. Updated incrementally as
+  // conditions change, see MarkDirty(), UpdateGlyphGroups() and GroupGlyphs().
   btree_map<btree_set<segment_index_t>, btree_set<glyph_id_t>> and_glyph_groups;
   btree_map<btree_set<segment_index_t>, btree_set<glyph_id_t>> or_glyph_groups;
-  std::vector<segment_index_t> patch_id_to_segment_index;
+  // or_glyph_groups minus the glyphs which have undetected additional
+  // conditions, those are in unmapped_glyphs instead.
+  btree_map<btree_set<segment_index_t>, btree_set<glyph_id_t>>
+      final_or_glyph_groups;
+  // Glyphs needed by the full closure that can't be placed in an and/or group.
+  // These are added to the fallback group when the segmentation is built.
+  btree_set<glyph_id_t> unmapped_glyphs;
+  // All non-empty segments.
   btree_set<segment_index_t> fallback_segments;
 
+  // Not owned, may be null.
+  ThreadPool* pool = nullptr;
+
   // Caches and logging
-  flat_hash_map<flat_hash_set<uint32_t>, hb_set_unique_ptr> glyph_closure_cache;
-  uint32_t glyph_closure_cache_hit = 0;
-  uint32_t glyph_closure_cache_miss = 0;
+  ConcurrentSetCache glyph_closure_cache;
+  ConcurrentSetCache code_point_set_to_or_gids_cache;
 
-  flat_hash_map<flat_hash_set<uint32_t>, hb_set_unique_ptr>
-      code_point_set_to_or_gids_cache;
-  uint32_t code_point_set_to_or_gids_cache_hit = 0;
-  uint32_t code_point_set_to_or_gids_cache_miss = 0;
+  flat_hash_map<btree_set<glyph_id_t>, uint32_t> patch_size_cache;
 
-  uint32_t closure_count_cumulative = 0;
-  uint32_t closure_count_delta = 0;
+  std::atomic<uint32_t> closure_count_cumulative = 0;
+  std::atomic<uint32_t> closure_count_delta = 0;
 };
 
 Status AnalyzeSegment(SegmentationContext& context, const hb_set_t* codepoints,
@@ -308,96 +539,143 @@ Status AnalyzeSegment(SegmentationContext& context, const hb_set_t* codepoints,
   return absl::OkStatus();
 }
 
-Status AnalyzeSegment(SegmentationContext& context,
-                      segment_index_t segment_index,
-                      const hb_set_t* codepoints) {
-  hb_set_unique_ptr and_gids = make_hb_set();
-  hb_set_unique_ptr or_gids = make_hb_set();
-  hb_set_unique_ptr exclusive_gids = make_hb_set();
-  TRYV(AnalyzeSegment(context, codepoints, and_gids.get(), or_gids.get(),
-                      exclusive_gids.get()));
+/*
+ * The glyph sets produced by analyzing one segment.
+ */
+struct SegmentAnalysis {
+  SegmentAnalysis()
+      : and_gids(make_hb_set()),
+        or_gids(make_hb_set()),
+        exclusive_gids(make_hb_set()) {}
+
+  hb_set_unique_ptr and_gids;
+  hb_set_unique_ptr or_gids;
+  hb_set_unique_ptr exclusive_gids;
+  Status status;
+};
 
+void RecordConditions(SegmentationContext& context,
+                      segment_index_t segment_index,
+                      const SegmentAnalysis& analysis) {
+  auto& segment_gids = context.segment_gids[segment_index];
   hb_codepoint_t and_gid = HB_SET_VALUE_INVALID;
-  while (hb_set_next(exclusive_gids.get(), &and_gid)) {
+  while (hb_set_next(analysis.exclusive_gids.get(), &and_gid)) {
     // TODO(garretrieger): if we are assigning an exclusive gid there should be
     // no other and segments, check and error if this is violated.
+    context.MarkDirty(and_gid);
     hb_set_add(context.gid_conditions[and_gid].and_segments.get(),
                segment_index);
+    segment_gids.insert(and_gid);
   }
-  while (hb_set_next(and_gids.get(), &and_gid)) {
+  while (hb_set_next(analysis.and_gids.get(), &and_gid)) {
+    context.MarkDirty(and_gid);
     hb_set_add(context.gid_conditions[and_gid].and_segments.get(),
                segment_index);
+    segment_gids.insert(and_gid);
   }
 
   hb_codepoint_t or_gid = HB_SET_VALUE_INVALID;
-  while (hb_set_next(or_gids.get(), &or_gid)) {
+  while (hb_set_next(analysis.or_gids.get(), &or_gid)) {
+    context.MarkDirty(or_gid);
     hb_set_add(context.gid_conditions[or_gid].or_segments.get(), segment_index);
+    segment_gids.insert(or_gid);
   }
+}
 
+Status AnalyzeSegment(SegmentationContext& context,
+                      segment_index_t segment_index,
+                      const hb_set_t* codepoints) {
+  SegmentAnalysis analysis;
+  TRYV(AnalyzeSegment(context, codepoints, analysis.and_gids.get(),
+                      analysis.or_gids.get(), analysis.exclusive_gids.get()));
+  RecordConditions(context, segment_index, analysis);
   return absl::OkStatus();
 }
 
-Status GroupGlyphs(SegmentationContext& context) {
-  btree_set<segment_index_t> fallback_segments_set;
-  for (segment_index_t s = 0; s < context.segments.size(); s++) {
-    if (hb_set_is_empty(context.segments[s].get())) {
-      // Ignore empty segments.
-      continue;
+/*
+ * Analyzes all segments, concurrently if the context has a thread pool. The
+ * closures run in parallel but the resulting conditions are recorded in
+ * segment order so gid_conditions doesn't depend on scheduling.
+ */
+Status AnalyzeSegments(SegmentationContext& context) {
+  uint32_t count = context.segments.size();
+  std::vector<SegmentAnalysis> analyses(count);
+  auto analyze = [&](uint32_t i) {
+    SegmentAnalysis& analysis = analyses[i];
+    analysis.status = AnalyzeSegment(
+        context, context.segments[i].get(), analysis.and_gids.get(),
+        analysis.or_gids.get(), analysis.exclusive_gids.get());
+  };
+
+  if (context.pool) {
+    context.pool->ParallelFor(count, analyze);
+  } else {
+    for (uint32_t i = 0; i < count; i++) {
+      analyze(i);
     }
-    fallback_segments_set.insert(s);
   }
 
-  for (glyph_id_t gid = 0; gid < context.gid_conditions.size(); gid++) {
-    const auto& condition = context.gid_conditions[gid];
-    if (!hb_set_is_empty(condition.and_segments.get())) {
-      auto set = to_btree_set(condition.and_segments.get());
-      context.and_glyph_groups[set].insert(gid);
-    }
-    if (!hb_set_is_empty(condition.or_segments.get())) {
-      auto set = to_btree_set(condition.or_segments.get());
-      context.or_glyph_groups[set].insert(gid);
-    }
-
-    if (hb_set_is_empty(condition.and_segments.get()) &&
-        hb_set_is_empty(condition.or_segments.get()) &&
-        !hb_set_has(context.initial_closure.get(), gid) &&
-        hb_set_has(context.full_closure.get(), gid)) {
-      context.unmapped_glyphs.insert(gid);
-    }
+  for (segment_index_t i = 0; i < count; i++) {
+    TRYV(analyses[i].status);
+    RecordConditions(context, i, analyses[i]);
   }
+  return absl::OkStatus();
+}
+
+/*
+ * Places the glyphs whose conditions changed since the last call into the
+ * glyph groups. Glyphs with unchanged conditions keep their place, so the cost
+ * depends on the number of changed glyphs rather than the size of the font.
+ */
+Status GroupGlyphs(SegmentationContext& context) {
+  auto dirty_or_groups = context.UpdateGlyphGroups();
 
   // Any of the or_set conditions we've generated may have some additional
   // conditions that were not detected. Therefore we need to rule out the
   // presence of these additional conditions if an or group is able to be used.
-  for (auto& [or_group, glyphs] : context.or_glyph_groups) {
-    hb_set_unique_ptr all_other_codepoints = make_hb_set();
-    hb_set_union(all_other_codepoints.get(), context.all_codepoints.get());
+  //
+  // The check for a group only depends on the codepoints of the group's
+  // segments. A merge modifies segments, which marks every glyph referencing
+  // them as dirty, so only the groups of dirty glyphs need to be checked.
+  std::vector<hb_set_unique_ptr> all_other_codepoints;
+  for (const auto& [or_group, glyphs] : dirty_or_groups) {
+    hb_set_unique_ptr codepoints = make_hb_set();
+    hb_set_union(codepoints.get(), context.all_codepoints.get());
     for (uint32_t s : or_group) {
-      hb_set_subtract(all_other_codepoints.get(), context.segments[s].get());
+      hb_set_subtract(codepoints.get(), context.segments[s].get());
+    }
+    all_other_codepoints.push_back(std::move(codepoints));
+  }
+
+  if (context.pool) {
+    // Warm the cache concurrently, the loop below then only does lookups.
+    std::vector<Status> results(all_other_codepoints.size());
+    context.pool->ParallelFor(all_other_codepoints.size(), [&](uint32_t i) {
+      results[i] =
+          context.CodepointsToOrGids(all_other_codepoints[i].get()).status();
+    });
+    for (const auto& sc : results) {
+      TRYV(sc);
     }
+  }
 
-    const hb_set_t* or_gids =
-        TRY(context.CodepointsToOrGids(all_other_codepoints.get()));
+  uint32_t group_index = 0;
+  for (const auto& [or_group, glyphs] : dirty_or_groups) {
+    const hb_set_t* or_gids = TRY(context.CodepointsToOrGids(
+        all_other_codepoints[group_index++].get()));
 
     // Any "OR" glyphs associated with all other codepoints have some additional
     // conditions to activate so we can't safely include them into this or
     // condition. They are instead moved to the set of unmapped glyphs.
-    uint32_t gid = HB_SET_VALUE_INVALID;
-    while (hb_set_next(or_gids, &gid)) {
-      if (glyphs.erase(gid) > 0) {
+    for (glyph_id_t gid : glyphs) {
+      if (hb_set_has(or_gids, gid)) {
         context.unmapped_glyphs.insert(gid);
+      } else {
+        context.final_or_glyph_groups[or_group].insert(gid);
       }
     }
   }
 
-  for (uint32_t gid : context.unmapped_glyphs) {
-    // this glyph is not activated anywhere but is needed in the full closure
-    // so add it to an activation condition of any segment.
-    context.or_glyph_groups[fallback_segments_set].insert(gid);
-  }
-
-  context.fallback_segments = std::move(fallback_segments_set);
-
   return absl::OkStatus();
 }
 
@@ -494,25 +772,10 @@ Status GlyphSegmentation::GroupsToSegmentation(
   return absl::OkStatus();
 }
 
-StatusOr<uint32_t> PatchSizeBytes(hb_face_t* original_face,
+StatusOr<uint32_t> PatchSizeBytes(SegmentationContext& context,
                                   const absl::btree_set<glyph_id_t>& gids) {
-  FontData font_data(original_face);
-  CompatId id;
-  // Since this is just an estimate and we don't need ultra precise numbers run
-  // at a lower brotli quality to improve performance.
-  GlyphKeyedDiff diff(font_data, id, {FontHelper::kGlyf, FontHelper::kGvar}, 9);
-  auto patch_data = TRY(diff.CreatePatch(gids));
-  return patch_data.size();
-}
-
-hb_set_unique_ptr ToSegmentIndices(const hb_set_t* patches,
-                                   const std::vector<segment_index_t>& map) {
-  hb_set_unique_ptr out = make_hb_set();
-  patch_id_t next = HB_SET_VALUE_INVALID;
-  while (hb_set_next(patches, &next)) {
-    hb_set_add(out.get(), map[next]);
-  }
-  return out;
+  auto sizes = TRY(context.PatchSizes(absl::MakeConstSpan(&gids, 1)));
+  return sizes[0];
 }
 
 void MergeSegments(const SegmentationContext& context, const hb_set_t* segments,
@@ -533,15 +796,23 @@ StatusOr<uint32_t> EstimatePatchSize(SegmentationContext& context,
                       exclusive_gids.get()));
 
   auto btree_gids = to_btree_set(exclusive_gids.get());
-  return PatchSizeBytes(context.original_face.get(), btree_gids);
+  return PatchSizeBytes(context, btree_gids);
 }
 
+/*
+ * Merges the codepoints of 'segments' into base_segment_index, as long as the
+ * merged patch does not exceed the maximum patch size.
+ *
+ * Returns true if the merge was performed.
+ */
 StatusOr<bool> TryMerge(SegmentationContext& context,
                         segment_index_t base_segment_index,
-                        const hb_set_t* patches) {
+                        const btree_set<segment_index_t>& segments) {
   // Create a merged segment, and remove all of the others
-  hb_set_unique_ptr to_merge_segments =
-      ToSegmentIndices(patches, context.patch_id_to_segment_index);
+  hb_set_unique_ptr to_merge_segments = make_hb_set();
+  for (segment_index_t s : segments) {
+    hb_set_add(to_merge_segments.get(), s);
+  }
   hb_set_del(to_merge_segments.get(), base_segment_index);
 
   uint32_t size_before =
@@ -571,13 +842,19 @@ StatusOr<bool> TryMerge(SegmentationContext& context,
     // To avoid changing the indices of other segments set the ones we're
     // removing to empty sets. That effectively disables them.
     hb_set_clear(context.segments[segment_index].get());
+    context.fallback_segments.erase(segment_index);
   }
 
   // Remove all segments we touched here from gid_conditions so they can be
-  // recalculated.
+  // recalculated. Only glyphs which reference those segments are affected.
   hb_set_add(to_merge_segments.get(), base_segment_index);
-  for (auto& condition : context.gid_conditions) {
-    condition.RemoveSegments(to_merge_segments.get());
+  segment_index = HB_SET_VALUE_INVALID;
+  while (hb_set_next(to_merge_segments.get(), &segment_index)) {
+    for (glyph_id_t gid : context.segment_gids[segment_index]) {
+      context.MarkDirty(gid);
+      context.gid_conditions[gid].RemoveSegments(to_merge_segments.get());
+    }
+    context.segment_gids[segment_index].clear();
   }
 
   return true;
@@ -586,38 +863,53 @@ StatusOr<bool> TryMerge(SegmentationContext& context,
 /*
  * Search for a composite condition which can be merged into base_segment_index.
  *
+ * Candidates are visited in the order their conditions appear in a
+ * segmentation: or conditions before and conditions, each ordered by number
+ * of segments and then by segment indices.
+ *
  * Returns true if one was found and the merge succeeded, false otherwise.
  */
-template <typename ConditionIt>
 StatusOr<bool> TryMergingACompositeCondition(
-    SegmentationContext& context,
-    const GlyphSegmentation& candidate_segmentation,
-    segment_index_t base_segment_index, patch_id_t base_patch,
-    const ConditionIt& condition_it) {
-  auto next_condition = condition_it;
-  next_condition++;
-  while (next_condition != candidate_segmentation.Conditions().end()) {
-    if (next_condition->IsFallback()) {
-      // Merging the fallback will cause all segments to be merged into one,
-      // which is undesirable so don't consider the fallback.
-      next_condition++;
-      continue;
+    SegmentationContext& context, segment_index_t base_segment_index) {
+  // Every group which has base_segment_index in its condition contains at
+  // least one glyph referencing base_segment_index.
+  btree_set<std::pair<bool, btree_set<segment_index_t>>> found;
+  for (glyph_id_t gid : context.segment_gids[base_segment_index]) {
+    const auto& condition = context.gid_conditions[gid];
+    if (hb_set_get_population(condition.and_segments.get()) > 1) {
+      found.insert(std::pair(true, to_btree_set(condition.and_segments.get())));
     }
-
-    hb_set_unique_ptr triggering_patches = make_hb_set();
-    next_condition->TriggeringPatches(triggering_patches.get());
-    if (!hb_set_has(triggering_patches.get(), base_patch)) {
-      next_condition++;
-      continue;
+    if (!hb_set_is_empty(condition.or_segments.get())) {
+      auto or_segments = to_btree_set(condition.or_segments.get());
+      if (or_segments == context.fallback_segments ||
+          !context.final_or_glyph_groups.contains(or_segments)) {
+        // Merging the fallback will cause all segments to be merged into one,
+        // which is undesirable so don't consider the fallback. Or groups which
+        // had all of their glyphs moved to the fallback don't form a patch.
+        continue;
+      }
+      found.insert(std::pair(false, std::move(or_segments)));
     }
+  }
 
-    if (!TRY(TryMerge(context, base_segment_index, triggering_patches.get()))) {
-      next_condition++;
+  std::vector<std::pair<bool, btree_set<segment_index_t>>> candidates(
+      found.begin(), found.end());
+  std::stable_sort(candidates.begin(), candidates.end(),
+                   [](const auto& a, const auto& b) {
+                     if (a.first != b.first) {
+                       return !a.first;
+                     }
+                     return a.second.size() < b.second.size();
+                   });
+
+  for (const auto& [is_and, segments] : candidates) {
+    if (!TRY(TryMerge(context, base_segment_index, segments))) {
       continue;
     }
 
     VLOG(0) << "  Merging segments from composite patch into segment "
-            << base_segment_index << ": " << next_condition->ToString();
+            << base_segment_index << ": " << (is_and ? "and" : "or") << " {"
+            << absl::StrJoin(segments, ", ") << "}";
     return true;
   }
 
@@ -630,98 +922,70 @@ StatusOr<bool> TryMergingACompositeCondition(
  *
  * Returns true if found and the merge suceeded.
  */
-template <typename ConditionIt>
-StatusOr<bool> TryMergingABaseSegment(
-    SegmentationContext& context,
-    const GlyphSegmentation& candidate_segmentation,
-    segment_index_t base_segment_index, const ConditionIt& condition_it) {
-  auto next_condition = condition_it;
-  next_condition++;
-  while (next_condition != candidate_segmentation.Conditions().end()) {
-    if (!next_condition->IsExclusive()) {
+StatusOr<bool> TryMergingABaseSegment(SegmentationContext& context,
+                                      segment_index_t base_segment_index) {
+  for (segment_index_t s = base_segment_index + 1; s < context.segments.size();
+       s++) {
+    if (!context.ExclusiveGlyphs(s)) {
       // Only interested in other base patches.
-      next_condition++;
       continue;
     }
 
-    hb_set_unique_ptr triggering_patches = make_hb_set();
-    next_condition->TriggeringPatches(triggering_patches.get());
-
-    if (!TRY(TryMerge(context, base_segment_index, triggering_patches.get()))) {
-      next_condition++;
+    if (!TRY(TryMerge(context, base_segment_index, {s}))) {
       continue;
     }
 
     VLOG(0) << "  Merging segments from base patch into segment "
-            << base_segment_index << ": " << next_condition->ToString();
+            << base_segment_index << ": " << s;
     return true;
   }
 
   return false;
 }
 
-StatusOr<bool> IsPatchTooSmall(SegmentationContext& context,
-                               const GlyphSegmentation& candidate_segmentation,
-                               segment_index_t base_segment_index,
-                               patch_id_t base_patch) {
-  auto patch_glyphs = candidate_segmentation.GidSegments().find(base_patch);
-  if (patch_glyphs == candidate_segmentation.GidSegments().end()) {
-    return absl::InternalError(StrCat("patch ", base_patch, " not found."));
-  }
-  uint32_t patch_size_bytes =
-      TRY(PatchSizeBytes(context.original_face.get(), patch_glyphs->second));
-  if (patch_size_bytes >= context.patch_size_min_bytes) {
-    return false;
-  }
-
-  VLOG(0) << "Patch " << base_patch << " (segment " << base_segment_index
-          << ") is too small "
-          << "(" << patch_size_bytes << " < " << context.patch_size_min_bytes
-          << "). Merging...";
-
-  return true;
-}
-
 /*
  * Searches segments starting from start_segment for the next who's exclusive
  * gids patch is too small. If found, try increasing the size of the patch via
  * merging.
  *
+ * This works directly off of the glyph groups in the context so that no
+ * segmentation needs to be built between merges.
+ *
  * If a merge was performed returns the segment which was modified to allow
  * groupings to be updated.
  */
 StatusOr<std::optional<segment_index_t>> MergeNextBaseSegment(
-    SegmentationContext& context,
-    const GlyphSegmentation& candidate_segmentation, uint32_t start_segment) {
-  hb_set_unique_ptr triggering_patches = make_hb_set();
-  for (auto condition = candidate_segmentation.Conditions().begin();
-       condition != candidate_segmentation.Conditions().end(); condition++) {
-    if (!condition->IsExclusive()) {
+    SegmentationContext& context, uint32_t start_segment) {
+  // Compute the sizes of all of the candidate patches up front as a single
+  // batch.
+  std::vector<segment_index_t> base_segments;
+  std::vector<btree_set<glyph_id_t>> candidate_patches;
+  for (segment_index_t s = start_segment; s < context.segments.size(); s++) {
+    const btree_set<glyph_id_t>* glyphs = context.ExclusiveGlyphs(s);
+    if (!glyphs) {
       continue;
     }
+    base_segments.push_back(s);
+    candidate_patches.push_back(*glyphs);
+  }
+  auto sizes = TRY(context.PatchSizes(candidate_patches));
 
-    patch_id_t base_patch = condition->activated();
-    segment_index_t base_segment_index =
-        context.patch_id_to_segment_index[base_patch];
-    if (base_segment_index < start_segment) {
-      // Already processed, skip
+  for (uint32_t i = 0; i < base_segments.size(); i++) {
+    segment_index_t base_segment_index = base_segments[i];
+    if (sizes[i] >= context.patch_size_min_bytes) {
       continue;
     }
 
-    if (!TRY(IsPatchTooSmall(context, candidate_segmentation,
-                             base_segment_index, base_patch))) {
-      continue;
-    }
+    VLOG(0) << "Segment " << base_segment_index << " is too small "
+            << "(" << sizes[i] << " < " << context.patch_size_min_bytes
+            << "). Merging...";
 
-    if (TRY(TryMergingACompositeCondition(context, candidate_segmentation,
-                                          base_segment_index, base_patch,
-                                          condition))) {
+    if (TRY(TryMergingACompositeCondition(context, base_segment_index))) {
       // Return to the parent method so it can reanalyze and reform groups
       return base_segment_index;
     }
 
-    if (TRY(TryMergingABaseSegment(context, candidate_segmentation,
-                                   base_segment_index, condition))) {
+    if (TRY(TryMergingABaseSegment(context, base_segment_index))) {
       // Return to the parent method so it can reanalyze and reform groups
       return base_segment_index;
     }
@@ -733,6 +997,89 @@ StatusOr<std::optional<segment_index_t>> MergeNextBaseSegment(
   return std::nullopt;
 }
 
+/*
+ * Checks that the incrementally maintained glyph groups and indices match what
+ * is computed from scratch from the current glyph conditions.
+ */
+Status ValidateGroupings(const SegmentationContext& context) {
+  if (!hb_set_is_empty(context.dirty_glyphs.get())) {
+    return absl::InternalError("Glyph groups have not been updated.");
+  }
+
+  std::vector<btree_set<glyph_id_t>> segment_gids(context.segments.size());
+  btree_map<btree_set<segment_index_t>, btree_set<glyph_id_t>> and_glyph_groups;
+  btree_map<btree_set<segment_index_t>, btree_set<glyph_id_t>> or_glyph_groups;
+  btree_set<glyph_id_t> unmapped_glyphs;
+  for (glyph_id_t gid = 0; gid < context.gid_conditions.size(); gid++) {
+    const auto& condition = context.gid_conditions[gid];
+    auto and_segments = to_btree_set(condition.and_segments.get());
+    auto or_segments = to_btree_set(condition.or_segments.get());
+    for (segment_index_t s : and_segments) {
+      segment_gids[s].insert(gid);
+    }
+    for (segment_index_t s : or_segments) {
+      segment_gids[s].insert(gid);
+    }
+
+    if (!and_segments.empty()) {
+      and_glyph_groups[and_segments].insert(gid);
+    }
+    if (!or_segments.empty()) {
+      or_glyph_groups[or_segments].insert(gid);
+    }
+    if (condition.IsEmpty() &&
+        !hb_set_has(context.initial_closure.get(), gid) &&
+        hb_set_has(context.full_closure.get(), gid)) {
+      unmapped_glyphs.insert(gid);
+    }
+  }
+
+  if (segment_gids != context.segment_gids) {
+    return absl::InternalError("Segment to glyph index is out of date.");
+  }
+  if (and_glyph_groups != context.and_glyph_groups ||
+      or_glyph_groups != context.or_glyph_groups) {
+    return absl::InternalError("Glyph groups are out of date.");
+  }
+
+  // Each or group is split between final_or_glyph_groups and unmapped_glyphs.
+  for (const auto& [or_group, glyphs] : context.final_or_glyph_groups) {
+    auto it = or_glyph_groups.find(or_group);
+    if (glyphs.empty() || it == or_glyph_groups.end()) {
+      return absl::InternalError("Unexpected final or group.");
+    }
+    for (glyph_id_t gid : glyphs) {
+      if (!it->second.contains(gid)) {
+        return absl::InternalError("Unexpected glyph in final or group.");
+      }
+    }
+  }
+  for (const auto& [or_group, glyphs] : or_glyph_groups) {
+    auto it = context.final_or_glyph_groups.find(or_group);
+    for (glyph_id_t gid : glyphs) {
+      if (it == context.final_or_glyph_groups.end() ||
+          !it->second.contains(gid)) {
+        unmapped_glyphs.insert(gid);
+      }
+    }
+  }
+  if (unmapped_glyphs != context.unmapped_glyphs) {
+    return absl::InternalError("Unmapped glyphs are out of date.");
+  }
+
+  btree_set<segment_index_t> fallback_segments;
+  for (segment_index_t s = 0; s < context.segments.size(); s++) {
+    if (!hb_set_is_empty(context.segments[s].get())) {
+      fallback_segments.insert(s);
+    }
+  }
+  if (fallback_segments != context.fallback_segments) {
+    return absl::InternalError("Fallback segments are out of date.");
+  }
+
+  return absl::OkStatus();
+}
+
 /*
  * Ensures that the produce segmentation is:
  * - Disjoint (no duplicated glyphs) and doesn't overlap what's in the initial
@@ -771,47 +1118,47 @@ Status ValidateSegmentation(const SegmentationContext& context,
 StatusOr<GlyphSegmentation> GlyphSegmentation::CodepointToGlyphSegments(
     hb_face_t* face, flat_hash_set<hb_codepoint_t> initial_segment,
     std::vector<flat_hash_set<hb_codepoint_t>> codepoint_segments,
-    uint32_t patch_size_min_bytes, uint32_t patch_size_max_bytes) {
+    uint32_t patch_size_min_bytes, uint32_t patch_size_max_bytes,
+    ThreadPool* pool, PatchSizeEstimator* patch_size_estimator) {
   SegmentationContext context(face, initial_segment, codepoint_segments);
+  context.pool = pool;
+  if (!patch_size_estimator) {
+    // Since patch sizes are just an estimate and we don't need ultra precise
+    // numbers run at a lower brotli quality to improve performance.
+    context.default_patch_size_estimator =
+        std::make_unique<BrotliPatchSizeEstimator>(context.original_font, 9,
+                                                   pool);
+    patch_size_estimator = context.default_patch_size_estimator.get();
+  }
+  context.patch_size_estimator = patch_size_estimator;
   context.patch_size_min_bytes = patch_size_min_bytes;
   context.patch_size_max_bytes = patch_size_max_bytes;
 
   VLOG(0) << "Forming initial segmentation plan.";
-  segment_index_t segment_index = 0;
-  for (const auto& segment : context.segments) {
-    TRYV(AnalyzeSegment(context, segment_index, segment.get()));
-    segment_index++;
-  }
+  TRYV(AnalyzeSegments(context));
   context.LogClosureCount("Inital segment analysis");
 
+  for (segment_index_t s = 0; s < context.segments.size(); s++) {
+    if (hb_set_is_empty(context.segments[s].get())) {
+      // Ignore empty segments.
+      continue;
+    }
+    context.fallback_segments.insert(s);
+  }
+
   segment_index_t last_merged_segment_index = 0;
   while (true) {
-    GlyphSegmentation segmentation;
-    context.ResetGroupings();
     TRYV(GroupGlyphs(context));
-
-    segmentation.unmapped_glyphs_ = context.unmapped_glyphs;
-    segmentation.init_font_glyphs_ =
-        to_btree_set(context.initial_closure.get());
-
-    TRYV(GroupsToSegmentation(context.and_glyph_groups, context.or_glyph_groups,
-                              context.fallback_segments,
-                              context.patch_id_to_segment_index, segmentation));
     context.LogClosureCount("Condition grouping");
 
     if (patch_size_min_bytes == 0) {
-      context.LogCacheStats();
-      TRYV(ValidateSegmentation(context, segmentation));
-      return segmentation;
+      break;
     }
 
-    auto merged = TRY(
-        MergeNextBaseSegment(context, segmentation, last_merged_segment_index));
+    auto merged = TRY(MergeNextBaseSegment(context, last_merged_segment_index));
     if (!merged.has_value()) {
       // Nothing was merged so we're done.
-      context.LogCacheStats();
-      TRYV(ValidateSegmentation(context, segmentation));
-      return segmentation;
+      break;
     }
 
     last_merged_segment_index = *merged;
@@ -820,8 +1167,27 @@ StatusOr<GlyphSegmentation> GlyphSegmentation::CodepointToGlyphSegments(
     TRYV(AnalyzeSegment(context, last_merged_segment_index,
                         context.segments[last_merged_segment_index].get()));
   }
+  context.LogCacheStats();
+  TRYV(ValidateGroupings(context));
+
+  GlyphSegmentation segmentation;
+  segmentation.unmapped_glyphs_ = context.unmapped_glyphs;
+  segmentation.init_font_glyphs_ = to_btree_set(context.initial_closure.get());
+
+  // These glyphs are not activated anywhere but are needed in the full closure
+  // so add them to an activation condition of any segment.
+  auto or_glyph_groups = context.final_or_glyph_groups;
+  for (glyph_id_t gid : context.unmapped_glyphs) {
+    or_glyph_groups[context.fallback_segments].insert(gid);
+  }
+
+  std::vector<segment_index_t> patch_id_to_segment_index;
+  TRYV(GroupsToSegmentation(context.and_glyph_groups, or_glyph_groups,
+                            context.fallback_segments,
+                            patch_id_to_segment_index, segmentation));
 
-  return absl::InternalError("unreachable");
+  TRYV(ValidateSegmentation(context, segmentation));
+  return segmentation;
 }
 
 GlyphSegmentation::ActivationCondition
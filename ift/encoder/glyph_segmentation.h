@@ -8,7 +8,9 @@
 #include "absl/container/btree_set.h"
 #include "absl/container/flat_hash_set.h"
 #include "absl/status/statusor.h"
+#include "common/thread_pool.h"
 #include "hb.h"
+#include "ift/encoder/patch_size_estimator.h"
 
 namespace ift::encoder {
 
@@ -116,13 +118,21 @@ class GlyphSegmentation {
    *
    * initial_segment is the set of codepoints that will be placed into the
    * initial ift font.
+   *
+   * If 'pool' is provided the segments are analyzed concurrently on it. The
+   * result is the same for any number of threads.
+   *
+   * 'patch_size_estimator' is used to size patches when deciding on merges.
+   * If not provided patches are built exactly with brotli quality 9.
    */
   // TODO(garretrieger): also support optional feature segments.
   static absl::StatusOr<GlyphSegmentation> CodepointToGlyphSegments(
       hb_face_t* face, absl::flat_hash_set<hb_codepoint_t> initial_segment,
       std::vector<absl::flat_hash_set<hb_codepoint_t>> codepoint_segments,
       uint32_t patch_size_min_bytes = 0,
-      uint32_t patch_size_max_bytes = UINT32_MAX);
+      uint32_t patch_size_max_bytes = UINT32_MAX,
+      common::ThreadPool* pool = nullptr,
+      PatchSizeEstimator* patch_size_estimator = nullptr);
 
   /*
    * Returns a human readable string representation of this segmentation and
@@ -1,11 +1,23 @@
 #include "ift/encoder/glyph_segmentation.h"
 
+#include <cstdint>
+#include <vector>
+
+#include "absl/container/btree_set.h"
+#include "absl/types/span.h"
 #include "common/font_data.h"
+#include "common/thread_pool.h"
 #include "gtest/gtest.h"
+#include "ift/encoder/patch_size_estimator.h"
 
+using absl::btree_set;
+using absl::flat_hash_set;
+using absl::Span;
+using absl::StatusOr;
 using common::FontData;
 using common::hb_face_unique_ptr;
 using common::make_hb_face;
+using common::ThreadPool;
 
 namespace ift::encoder {
 
@@ -33,6 +45,20 @@ class GlyphSegmentationTest : public ::testing::Test {
   hb_face_unique_ptr noto_nastaliq_urdu;
 };
 
+// Sizes each patch as 100 bytes per glyph, which makes the merges performed
+// easy to predict.
+class GlyphCountEstimator : public PatchSizeEstimator {
+ public:
+  StatusOr<std::vector<uint32_t>> PatchSizes(
+      Span<const btree_set<uint32_t>> gid_sets) override {
+    std::vector<uint32_t> sizes;
+    for (const auto& gids : gid_sets) {
+      sizes.push_back(100 * gids.size());
+    }
+    return sizes;
+  }
+};
+
 TEST_F(GlyphSegmentationTest, SimpleSegmentation) {
   auto segmentation = GlyphSegmentation::CodepointToGlyphSegments(
       roboto.get(), {'a'}, {{'b'}, {'c'}});
@@ -179,6 +205,95 @@ if ((p0 OR p1 OR p2 OR p3)) then p5
 )");
 }
 
+TEST_F(GlyphSegmentationTest, ThreadPool_SameResult) {
+  ThreadPool pool(4);
+
+  std::vector<flat_hash_set<hb_codepoint_t>> segments = {
+      {0x62a}, {0x62b}, {0x62c}, {0x62d}};
+  auto expected = GlyphSegmentation::CodepointToGlyphSegments(
+      noto_nastaliq_urdu.get(), {}, segments);
+  ASSERT_TRUE(expected.ok()) << expected.status();
+  auto segmentation = GlyphSegmentation::CodepointToGlyphSegments(
+      noto_nastaliq_urdu.get(), {}, segments, 0, UINT32_MAX, &pool);
+  ASSERT_TRUE(segmentation.ok()) << segmentation.status();
+  ASSERT_EQ(segmentation->ToString(), expected->ToString());
+
+  // With merging, segments are re-analyzed after each merge.
+  segments = {{'a', 'b', 'd'}, {'e', 'f'}, {'m', 'n', 'o', 'p'}, {'j', 'k'}};
+  expected = GlyphSegmentation::CodepointToGlyphSegments(roboto.get(), {},
+                                                         segments, 370, 700);
+  ASSERT_TRUE(expected.ok()) << expected.status();
+  segmentation = GlyphSegmentation::CodepointToGlyphSegments(
+      roboto.get(), {}, segments, 370, 700, &pool);
+  ASSERT_TRUE(segmentation.ok()) << segmentation.status();
+  ASSERT_EQ(segmentation->ToString(), expected->ToString());
+}
+
+// The following tests check that the glyph groups which are incrementally
+// updated as segments are merged produce the same segmentation as analyzing
+// the merged segments from scratch. Segmentation also internally verifies its
+// incremental bookkeeping (the segment to glyph index and the glyph groups)
+// against a full recompute, so any drift there shows up as an error status.
+
+TEST_F(GlyphSegmentationTest, Merge_MatchesFullRecompute_Conditions) {
+  auto segmentation = GlyphSegmentation::CodepointToGlyphSegments(
+      roboto.get(), {},
+      {{'a', 'b', 'd'}, {'e', 'f'}, {'j', 'k', 'm', 'n'}, {'i', 'l'}}, 370);
+  ASSERT_TRUE(segmentation.ok()) << segmentation.status();
+
+  auto expected = GlyphSegmentation::CodepointToGlyphSegments(
+      roboto.get(), {},
+      {{'a', 'b', 'd'}, {'e', 'f', 'i', 'l'}, {'j', 'k', 'm', 'n'}, {}});
+  ASSERT_TRUE(expected.ok()) << expected.status();
+
+  ASSERT_EQ(segmentation->ToString(), expected->ToString());
+  ASSERT_EQ(segmentation->UnmappedGlyphs(), expected->UnmappedGlyphs());
+}
+
+TEST_F(GlyphSegmentationTest, Merge_MatchesFullRecompute_MultipleMerges) {
+  // {f} is too small and merges with {i} via the (f AND i) condition. {c} is
+  // then too small and has no conditions so merges with the base {d}, and
+  // likewise {x} with {y}.
+  GlyphCountEstimator estimator;
+  auto segmentation = GlyphSegmentation::CodepointToGlyphSegments(
+      roboto.get(), {'a'}, {{'f'}, {'i'}, {'c'}, {'d'}, {'x'}, {'y'}}, 200,
+      UINT32_MAX, nullptr, &estimator);
+  ASSERT_TRUE(segmentation.ok()) << segmentation.status();
+
+  auto expected = GlyphSegmentation::CodepointToGlyphSegments(
+      roboto.get(), {'a'}, {{'f', 'i'}, {}, {'c', 'd'}, {}, {'x', 'y'}, {}});
+  ASSERT_TRUE(expected.ok()) << expected.status();
+
+  ASSERT_EQ(segmentation->ToString(), expected->ToString());
+  ASSERT_EQ(segmentation->UnmappedGlyphs(), expected->UnmappedGlyphs());
+}
+
+TEST_F(GlyphSegmentationTest, Merge_MatchesFullRecompute_OrAndFallback) {
+  // The {0x62d} patch is too small and merges into {0x62c} via the
+  // ((p2 OR p3)) condition. The fallback group which includes both changes as
+  // well.
+  GlyphCountEstimator estimator;
+  auto segmentation = GlyphSegmentation::CodepointToGlyphSegments(
+      noto_nastaliq_urdu.get(), {}, {{0x62a}, {0x62b}, {0x62c}, {0x62d}}, 200,
+      UINT32_MAX, nullptr, &estimator);
+  ASSERT_TRUE(segmentation.ok()) << segmentation.status();
+
+  auto expected = GlyphSegmentation::CodepointToGlyphSegments(
+      noto_nastaliq_urdu.get(), {}, {{0x62a}, {0x62b}, {}, {0x62c, 0x62d}});
+  ASSERT_TRUE(expected.ok()) << expected.status();
+
+  ASSERT_FALSE(segmentation->UnmappedGlyphs().empty());
+  ASSERT_EQ(segmentation->ToString(), expected->ToString());
+  ASSERT_EQ(segmentation->UnmappedGlyphs(), expected->UnmappedGlyphs());
+
+  ThreadPool pool(4);
+  auto threaded = GlyphSegmentation::CodepointToGlyphSegments(
+      noto_nastaliq_urdu.get(), {}, {{0x62a}, {0x62b}, {0x62c}, {0x62d}}, 200,
+      UINT32_MAX, &pool, &estimator);
+  ASSERT_TRUE(threaded.ok()) << threaded.status();
+  ASSERT_EQ(threaded->ToString(), expected->ToString());
+}
+
 // TODO(garretrieger): add test where or_set glyphs are moved back to unmapped due to found "additional conditions".
 
 }  // namespace ift::encoder
\ No newline at end of file
@@ -0,0 +1,54 @@
+#ifndef IFT_ENCODER_INDEX_SET_H_
+#define IFT_ENCODER_INDEX_SET_H_
+
+#include <cstdint>
+#include <utility>
+
+#include "absl/container/inlined_vector.h"
+
+namespace ift::encoder {
+
+/*
+ * A compact set of small non-negative integers stored as a bitset. Copying,
+ * comparing and hashing only touch a few words, and sets of up to 128 values
+ * don't allocate.
+ */
+class IndexSet {
+ public:
+  IndexSet() = default;
+
+  void Insert(uint32_t index) {
+    uint32_t word = index / 64;
+    if (word >= words_.size()) {
+      words_.resize(word + 1, 0);
+    }
+    words_[word] |= uint64_t(1) << (index % 64);
+  }
+
+  bool Contains(uint32_t index) const {
+    uint32_t word = index / 64;
+    return word < words_.size() && (words_[word] >> (index % 64)) & 1;
+  }
+
+  bool empty() const { return words_.empty(); }
+
+  // Words are only ever added to hold a set bit, so there are never trailing
+  // zero words and equal sets always have identical representations.
+  bool operator==(const IndexSet& other) const {
+    return words_ == other.words_;
+  }
+
+  bool operator!=(const IndexSet& other) const { return !(*this == other); }
+
+  template <typename H>
+  friend H AbslHashValue(H h, const IndexSet& s) {
+    return H::combine(std::move(h), s.words_);
+  }
+
+ private:
+  absl::InlinedVector<uint64_t, 2> words_;
+};
+
+}  // namespace ift::encoder
+
+#endif  // IFT_ENCODER_INDEX_SET_H_
@@ -0,0 +1,46 @@
+#include "ift/encoder/index_set.h"
+
+#include "absl/hash/hash.h"
+#include "gtest/gtest.h"
+
+namespace ift::encoder {
+
+TEST(IndexSetTest, InsertAndContains) {
+  IndexSet set;
+  ASSERT_TRUE(set.empty());
+  ASSERT_FALSE(set.Contains(0));
+
+  set.Insert(3);
+  set.Insert(64);
+  set.Insert(200);
+  ASSERT_FALSE(set.empty());
+
+  ASSERT_TRUE(set.Contains(3));
+  ASSERT_TRUE(set.Contains(64));
+  ASSERT_TRUE(set.Contains(200));
+  ASSERT_FALSE(set.Contains(0));
+  ASSERT_FALSE(set.Contains(63));
+  ASSERT_FALSE(set.Contains(199));
+  ASSERT_FALSE(set.Contains(1000));
+}
+
+TEST(IndexSetTest, EqualityAndHash) {
+  IndexSet a;
+  a.Insert(1);
+  a.Insert(130);
+
+  IndexSet b;
+  b.Insert(130);
+  b.Insert(1);
+  b.Insert(1);
+
+  IndexSet c;
+  c.Insert(1);
+
+  ASSERT_EQ(a, b);
+  ASSERT_EQ(absl::HashOf(a), absl::HashOf(b));
+  ASSERT_NE(a, c);
+  ASSERT_NE(c, IndexSet());
+}
+
+}  // namespace ift::encoder
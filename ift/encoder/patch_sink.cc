@@ -0,0 +1,56 @@
+#include "ift/encoder/patch_sink.h"
+
+#include <cstdio>
+#include <string>
+#include <utility>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
+#include "common/font_data.h"
+
+using absl::Status;
+using absl::StrCat;
+using common::FontData;
+
+namespace ift::encoder {
+
+Status InMemoryPatchSink::AddPatch(const std::string& url,
+                                   const FontData& patch) {
+  absl::MutexLock lock(&mutex_);
+  patches_[url].shallow_copy(patch);
+  return absl::OkStatus();
+}
+
+absl::flat_hash_map<std::string, FontData> InMemoryPatchSink::TakePatches() {
+  absl::MutexLock lock(&mutex_);
+  absl::flat_hash_map<std::string, FontData> patches = std::move(patches_);
+  patches_.clear();
+  return patches;
+}
+
+Status FilePatchSink::AddPatch(const std::string& url, const FontData& patch) {
+  std::string path = StrCat(directory_, "/", url);
+  FILE* f = fopen(path.c_str(), "wb");
+  if (!f) {
+    return absl::NotFoundError(StrCat("Unable to open ", path, "."));
+  }
+
+  size_t written = fwrite(patch.data(), 1, patch.size(), f);
+  bool closed = fclose(f) == 0;
+  if (written != patch.size() || !closed) {
+    return absl::InternalError(StrCat("Failed to write to ", path, "."));
+  }
+
+  absl::MutexLock lock(&mutex_);
+  count_++;
+  return absl::OkStatus();
+}
+
+uint32_t FilePatchSink::PatchCount() {
+  absl::MutexLock lock(&mutex_);
+  return count_;
+}
+
+}  // namespace ift::encoder
@@ -0,0 +1,72 @@
+#ifndef IFT_ENCODER_PATCH_SINK_H_
+#define IFT_ENCODER_PATCH_SINK_H_
+
+#include <cstdint>
+#include <string>
+#include <utility>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/synchronization/mutex.h"
+#include "common/font_data.h"
+
+namespace ift::encoder {
+
+/*
+ * Receives the patches produced by an encoder as each one is finalized, this
+ * allows patches to be written out (and released) while the rest of the
+ * encoding is still being generated.
+ */
+class PatchSink {
+ public:
+  virtual ~PatchSink() = default;
+
+  /*
+   * Called once for each patch in the encoding. May be called concurrently
+   * from multiple threads. If an error is returned encoding is stopped.
+   */
+  virtual absl::Status AddPatch(const std::string& url,
+                                const common::FontData& patch) = 0;
+};
+
+/*
+ * Collects all patches in memory.
+ */
+class InMemoryPatchSink : public PatchSink {
+ public:
+  absl::Status AddPatch(const std::string& url,
+                        const common::FontData& patch) override;
+
+  // Returns all patches added so far, and clears this sink.
+  absl::flat_hash_map<std::string, common::FontData> TakePatches();
+
+ private:
+  absl::Mutex mutex_;
+  absl::flat_hash_map<std::string, common::FontData> patches_
+      ABSL_GUARDED_BY(mutex_);
+};
+
+/*
+ * Writes each patch to a file in 'directory' named by the patch url.
+ */
+class FilePatchSink : public PatchSink {
+ public:
+  explicit FilePatchSink(std::string directory)
+      : directory_(std::move(directory)) {}
+
+  absl::Status AddPatch(const std::string& url,
+                        const common::FontData& patch) override;
+
+  uint32_t PatchCount();
+
+ private:
+  const std::string directory_;
+
+  absl::Mutex mutex_;
+  uint32_t count_ ABSL_GUARDED_BY(mutex_) = 0;
+};
+
+}  // namespace ift::encoder
+
+#endif  // IFT_ENCODER_PATCH_SINK_H_
@@ -0,0 +1,67 @@
+#include "ift/encoder/patch_sink.h"
+
+#include <filesystem>
+#include <string>
+
+#include "absl/strings/str_cat.h"
+#include "common/font_data.h"
+#include "gtest/gtest.h"
+
+using absl::StrCat;
+using common::FontData;
+
+namespace ift::encoder {
+
+class PatchSinkTest : public ::testing::Test {
+ protected:
+  static FontData Data(absl::string_view value) {
+    FontData data;
+    data.copy(value);
+    return data;
+  }
+
+  static std::string ReadFile(const std::string& path) {
+    common::hb_blob_unique_ptr blob =
+        common::make_hb_blob(hb_blob_create_from_file_or_fail(path.c_str()));
+    if (!blob.get()) {
+      return "<missing>";
+    }
+    return FontData(blob.get()).string();
+  }
+};
+
+TEST_F(PatchSinkTest, InMemory) {
+  InMemoryPatchSink sink;
+  ASSERT_TRUE(sink.AddPatch("1.tk", Data("abc")).ok());
+  ASSERT_TRUE(sink.AddPatch("2.tk", Data("def")).ok());
+
+  auto patches = sink.TakePatches();
+  ASSERT_EQ(patches.size(), 2);
+  ASSERT_EQ(patches["1.tk"].str(), "abc");
+  ASSERT_EQ(patches["2.tk"].str(), "def");
+
+  ASSERT_TRUE(sink.TakePatches().empty());
+}
+
+TEST_F(PatchSinkTest, File) {
+  std::string directory = StrCat(testing::TempDir(), "/patch_sink_test");
+  std::filesystem::remove_all(directory);
+  std::filesystem::create_directories(directory);
+
+  FilePatchSink sink(directory);
+  ASSERT_TRUE(sink.AddPatch("1.tk", Data("abc")).ok());
+  ASSERT_TRUE(sink.AddPatch("1_2.gk", Data("def")).ok());
+  ASSERT_EQ(sink.PatchCount(), 2);
+
+  ASSERT_EQ(ReadFile(StrCat(directory, "/1.tk")), "abc");
+  ASSERT_EQ(ReadFile(StrCat(directory, "/1_2.gk")), "def");
+
+  std::filesystem::remove_all(directory);
+}
+
+TEST_F(PatchSinkTest, File_MissingDirectory) {
+  FilePatchSink sink(StrCat(testing::TempDir(), "/does/not/exist"));
+  ASSERT_TRUE(absl::IsNotFound(sink.AddPatch("1.tk", Data("abc"))));
+}
+
+}  // namespace ift::encoder
@@ -0,0 +1,238 @@
+#include "ift/encoder/patch_size_estimator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/container/btree_set.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
+#include "common/brotli_binary_diff.h"
+#include "common/compat_id.h"
+#include "common/font_data.h"
+#include "common/font_helper.h"
+#include "common/thread_pool.h"
+#include "common/try.h"
+#include "ift/glyph_data_reader.h"
+
+using absl::btree_set;
+using absl::Span;
+using absl::Status;
+using absl::StatusOr;
+using common::BrotliBinaryDiff;
+using common::CompatId;
+using common::FontData;
+using common::FontHelper;
+using common::ThreadPool;
+
+namespace ift::encoder {
+
+namespace {
+
+// Number of sets built exactly to form the initial fit.
+constexpr uint32_t kInitialSamples = 4;
+
+// Only the most recent samples are used for the fit so that it tracks the
+// kind of sets currently being estimated.
+constexpr uint32_t kMaxSamples = 32;
+
+}  // namespace
+
+BrotliPatchSizeEstimator::BrotliPatchSizeEstimator(const FontData& font,
+                                                   unsigned quality,
+                                                   ThreadPool* pool)
+    : differ_(font, CompatId(),
+              {FontHelper::kGlyf, FontHelper::kGvar, FontHelper::kCFF,
+               FontHelper::kCFF2},
+              quality),
+      pool_(pool) {}
+
+StatusOr<std::vector<uint32_t>> BrotliPatchSizeEstimator::PatchSizes(
+    Span<const btree_set<uint32_t>> gid_sets) {
+  auto patches = TRY(differ_.CreatePatches(gid_sets, pool_));
+  std::vector<uint32_t> sizes;
+  for (const auto& patch : patches) {
+    sizes.push_back(patch.size());
+  }
+  return sizes;
+}
+
+StatusOr<std::unique_ptr<GlyphSizeModelEstimator>>
+GlyphSizeModelEstimator::Create(const FontData& font, unsigned quality,
+                                uint32_t recalibration_interval,
+                                ThreadPool* pool) {
+  std::unique_ptr<GlyphSizeModelEstimator> estimator(
+      new GlyphSizeModelEstimator(font, quality, recalibration_interval,
+                                  pool));
+
+  auto face = font.face();
+  uint32_t glyph_count = hb_face_get_glyph_count(face.get());
+  estimator->glyph_sizes_.resize(glyph_count);
+
+  // Each table is located once, glyphs are then looked up directly in it.
+  auto tables = TRY(GlyphDataReader::ForTables(
+      face.get(), {FontHelper::kGlyf, FontHelper::kGvar, FontHelper::kCFF,
+                   FontHelper::kCFF2}));
+
+  std::vector<Status> statuses(glyph_count);
+  BrotliBinaryDiff brotli(quality);
+  FontData empty;
+  auto compress_glyph = [&](uint32_t gid) {
+    // Concatenated glyph data of 'gid' across all of the glyph data tables.
+    std::string data;
+    for (const auto& [tag, reader] : tables) {
+      auto glyph_data = reader.DataFor(gid);
+      if (!glyph_data.ok()) {
+        statuses[gid] = glyph_data.status();
+        return;
+      }
+      data.append(glyph_data->data(), glyph_data->size());
+    }
+    if (data.empty()) {
+      return;
+    }
+
+    std::vector<uint8_t> compressed;
+    statuses[gid] = brotli.Diff(empty, data, 0, true, compressed);
+    estimator->glyph_sizes_[gid] = compressed.size();
+  };
+
+  if (pool) {
+    pool->ParallelFor(glyph_count, compress_glyph);
+  } else {
+    for (uint32_t gid = 0; gid < glyph_count; gid++) {
+      compress_glyph(gid);
+    }
+  }
+
+  for (const auto& status : statuses) {
+    TRYV(status);
+  }
+  return estimator;
+}
+
+StatusOr<std::vector<uint32_t>> GlyphSizeModelEstimator::PatchSizes(
+    Span<const btree_set<uint32_t>> gid_sets) {
+  // Pick the sets to build exactly: a spread of the first batch to form the
+  // initial fit, then one every 'recalibration_interval_' sets.
+  std::vector<bool> exact(gid_sets.size(), false);
+  if (samples_.empty() && !gid_sets.empty()) {
+    uint32_t count = std::min<uint32_t>(kInitialSamples, gid_sets.size());
+    for (uint32_t i = 0; i < count; i++) {
+      uint32_t index =
+          count > 1 ? i * (gid_sets.size() - 1) / (count - 1) : 0;
+      exact[index] = true;
+    }
+  } else {
+    for (uint32_t i = 0; i < gid_sets.size(); i++) {
+      if (++since_calibration_ >= recalibration_interval_) {
+        exact[i] = true;
+        since_calibration_ = 0;
+      }
+    }
+  }
+
+  std::vector<btree_set<uint32_t>> exact_sets;
+  for (uint32_t i = 0; i < gid_sets.size(); i++) {
+    // Empty sets can't be built as a patch, those are always estimated.
+    exact[i] = exact[i] && !gid_sets[i].empty();
+    if (exact[i]) {
+      exact_sets.push_back(gid_sets[i]);
+    }
+  }
+  std::vector<uint32_t> exact_sizes;
+  if (!exact_sets.empty()) {
+    exact_sizes = TRY(exact_.PatchSizes(exact_sets));
+  }
+
+  std::vector<uint32_t> sizes(gid_sets.size());
+  auto next_exact = exact_sizes.begin();
+  bool fitted = !samples_.empty();
+  for (uint32_t i = 0; i < gid_sets.size(); i++) {
+    if (!exact[i]) {
+      continue;
+    }
+
+    uint64_t sum = GlyphSizeSum(gid_sets[i]);
+    sizes[i] = *next_exact++;
+    if (fitted && sizes[i] > 0) {
+      double error = std::abs((double)Estimate(sum) - (double)sizes[i]) /
+                     (double)sizes[i];
+      max_observed_error_ = std::max(max_observed_error_, error);
+    }
+    samples_.push_back(std::pair((double)sum, (double)sizes[i]));
+  }
+
+  if (!exact_sets.empty()) {
+    if (samples_.size() > kMaxSamples) {
+      samples_.erase(samples_.begin(),
+                     samples_.begin() + (samples_.size() - kMaxSamples));
+    }
+    Refit();
+  }
+
+  for (uint32_t i = 0; i < gid_sets.size(); i++) {
+    if (!exact[i]) {
+      sizes[i] = Estimate(GlyphSizeSum(gid_sets[i]));
+    }
+  }
+  return sizes;
+}
+
+uint64_t GlyphSizeModelEstimator::GlyphSizeSum(
+    const btree_set<uint32_t>& gids) const {
+  uint64_t sum = 0;
+  for (uint32_t gid : gids) {
+    if (gid < glyph_sizes_.size()) {
+      sum += glyph_sizes_[gid];
+    }
+  }
+  return sum;
+}
+
+uint32_t GlyphSizeModelEstimator::Estimate(uint64_t glyph_size_sum) const {
+  double estimate = intercept_ + slope_ * (double)glyph_size_sum;
+  if (estimate <= 0.0) {
+    return 0;
+  }
+  return (uint32_t)std::min(std::round(estimate), (double)UINT32_MAX);
+}
+
+void GlyphSizeModelEstimator::Refit() {
+  double n = samples_.size();
+  double sum_x = 0.0, sum_y = 0.0;
+  for (const auto& [x, y] : samples_) {
+    sum_x += x;
+    sum_y += y;
+  }
+  double mean_x = sum_x / n;
+  double mean_y = sum_y / n;
+
+  double covariance = 0.0, variance = 0.0;
+  for (const auto& [x, y] : samples_) {
+    covariance += (x - mean_x) * (y - mean_y);
+    variance += (x - mean_x) * (x - mean_x);
+  }
+
+  if (variance > 0.0 && covariance > 0.0) {
+    // Least squares line.
+    slope_ = covariance / variance;
+    intercept_ = mean_y - slope_ * mean_x;
+    return;
+  }
+
+  // Not enough spread in the samples to fit a line, scale by the mean ratio.
+  if (sum_x > 0.0) {
+    slope_ = sum_y / sum_x;
+    intercept_ = 0.0;
+  } else {
+    slope_ = 0.0;
+    intercept_ = mean_y;
+  }
+}
+
+}  // namespace ift::encoder
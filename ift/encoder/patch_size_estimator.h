@@ -0,0 +1,108 @@
+#ifndef IFT_ENCODER_PATCH_SIZE_ESTIMATOR_H_
+#define IFT_ENCODER_PATCH_SIZE_ESTIMATOR_H_
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "absl/container/btree_set.h"
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
+#include "common/font_data.h"
+#include "common/thread_pool.h"
+#include "ift/glyph_keyed_diff.h"
+
+namespace ift::encoder {
+
+/*
+ * Estimates the size of glyph keyed patches, used by the segmenter when
+ * deciding whether patches should be merged.
+ */
+class PatchSizeEstimator {
+ public:
+  virtual ~PatchSizeEstimator() = default;
+
+  /*
+   * Returns the estimated size in bytes of a glyph keyed patch for each of
+   * 'gid_sets', in the same order.
+   */
+  virtual absl::StatusOr<std::vector<uint32_t>> PatchSizes(
+      absl::Span<const absl::btree_set<uint32_t>> gid_sets) = 0;
+};
+
+/*
+ * Measures patch sizes by building the patches. Lower brotli qualities trade
+ * a little accuracy for speed.
+ */
+class BrotliPatchSizeEstimator : public PatchSizeEstimator {
+ public:
+  // 'font' must outlive this estimator.
+  BrotliPatchSizeEstimator(const common::FontData& font, unsigned quality = 5,
+                           common::ThreadPool* pool = nullptr);
+
+  absl::StatusOr<std::vector<uint32_t>> PatchSizes(
+      absl::Span<const absl::btree_set<uint32_t>> gid_sets) override;
+
+ private:
+  GlyphKeyedDiff differ_;
+  common::ThreadPool* pool_;
+};
+
+/*
+ * Estimates patch sizes from a table of per glyph compressed sizes computed
+ * once for the font. The estimate for a set of glyphs is a linear function
+ * of the sum of its glyphs' standalone compressed sizes, fit to exact patch
+ * sizes.
+ *
+ * The fit is calibrated on the first few sets requested and is then refit
+ * after every 'recalibration_interval' estimates by building one patch
+ * exactly. This bounds how far the model can drift as the sets being
+ * estimated change in character.
+ */
+class GlyphSizeModelEstimator : public PatchSizeEstimator {
+ public:
+  // 'font' must outlive this estimator.
+  static absl::StatusOr<std::unique_ptr<GlyphSizeModelEstimator>> Create(
+      const common::FontData& font, unsigned quality = 5,
+      uint32_t recalibration_interval = 64,
+      common::ThreadPool* pool = nullptr);
+
+  absl::StatusOr<std::vector<uint32_t>> PatchSizes(
+      absl::Span<const absl::btree_set<uint32_t>> gid_sets) override;
+
+  // The standalone compressed size of each glyph, indexed by gid.
+  const std::vector<uint32_t>& GlyphSizes() const { return glyph_sizes_; }
+
+  /*
+   * The largest relative error between the model's estimate and the exact
+   * size seen so far at recalibration points.
+   */
+  double MaxObservedError() const { return max_observed_error_; }
+
+ private:
+  GlyphSizeModelEstimator(const common::FontData& font, unsigned quality,
+                          uint32_t recalibration_interval,
+                          common::ThreadPool* pool)
+      : exact_(font, quality, pool),
+        recalibration_interval_(recalibration_interval) {}
+
+  uint64_t GlyphSizeSum(const absl::btree_set<uint32_t>& gids) const;
+  uint32_t Estimate(uint64_t glyph_size_sum) const;
+  void Refit();
+
+  BrotliPatchSizeEstimator exact_;
+  std::vector<uint32_t> glyph_sizes_;
+  uint32_t recalibration_interval_;
+  uint32_t since_calibration_ = 0;
+
+  // (glyph size sum, exact patch size) pairs the model is fit to.
+  std::vector<std::pair<double, double>> samples_;
+  double slope_ = 1.0;
+  double intercept_ = 0.0;
+  double max_observed_error_ = 0.0;
+};
+
+}  // namespace ift::encoder
+
+#endif  // IFT_ENCODER_PATCH_SIZE_ESTIMATOR_H_
@@ -0,0 +1,161 @@
+#include "ift/encoder/patch_size_estimator.h"
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "absl/container/btree_set.h"
+#include "common/compat_id.h"
+#include "common/font_data.h"
+#include "common/font_helper.h"
+#include "gtest/gtest.h"
+#include "ift/glyph_keyed_diff.h"
+
+using absl::btree_set;
+using common::CompatId;
+using common::FontData;
+using common::FontHelper;
+
+namespace ift::encoder {
+
+class PatchSizeEstimatorTest : public ::testing::Test {
+ protected:
+  PatchSizeEstimatorTest() {
+    hb_blob_t* blob =
+        hb_blob_create_from_file_or_fail("common/testdata/Roboto-Regular.ttf");
+    assert(blob);
+    roboto.set(blob);
+    hb_blob_destroy(blob);
+  }
+
+  static btree_set<uint32_t> Range(uint32_t start, uint32_t end) {
+    btree_set<uint32_t> gids;
+    for (uint32_t gid = start; gid <= end; gid++) {
+      gids.insert(gid);
+    }
+    return gids;
+  }
+
+  FontData roboto;
+};
+
+TEST_F(PatchSizeEstimatorTest, Brotli_MatchesPatches) {
+  std::vector<btree_set<uint32_t>> gid_sets = {
+      {69},
+      Range(10, 30),
+      Range(100, 140),
+  };
+
+  BrotliPatchSizeEstimator estimator(roboto);
+  auto sizes = estimator.PatchSizes(gid_sets);
+  ASSERT_TRUE(sizes.ok()) << sizes.status();
+
+  GlyphKeyedDiff differ(roboto, CompatId(),
+                        {FontHelper::kGlyf, FontHelper::kGvar,
+                         FontHelper::kCFF, FontHelper::kCFF2},
+                        5);
+  auto patches = differ.CreatePatches(gid_sets);
+  ASSERT_TRUE(patches.ok()) << patches.status();
+
+  ASSERT_EQ(sizes->size(), 3);
+  for (uint32_t i = 0; i < 3; i++) {
+    ASSERT_EQ((*sizes)[i], (*patches)[i].size());
+  }
+}
+
+TEST_F(PatchSizeEstimatorTest, Model_GlyphSizes) {
+  auto estimator = GlyphSizeModelEstimator::Create(roboto);
+  ASSERT_TRUE(estimator.ok()) << estimator.status();
+
+  const auto& glyph_sizes = (*estimator)->GlyphSizes();
+  auto face = roboto.face();
+  ASSERT_EQ(glyph_sizes.size(), hb_face_get_glyph_count(face.get()));
+
+  // gid 1 has no outline.
+  ASSERT_EQ(glyph_sizes[1], 0);
+  ASSERT_GT(glyph_sizes[69], 0);
+}
+
+TEST_F(PatchSizeEstimatorTest, Model_FirstBatchIsExact) {
+  std::vector<btree_set<uint32_t>> gid_sets = {
+      Range(10, 30),
+      Range(100, 140),
+      Range(300, 310),
+      Range(500, 580),
+  };
+
+  auto estimator = GlyphSizeModelEstimator::Create(roboto);
+  ASSERT_TRUE(estimator.ok()) << estimator.status();
+  auto sizes = (*estimator)->PatchSizes(gid_sets);
+  ASSERT_TRUE(sizes.ok()) << sizes.status();
+
+  BrotliPatchSizeEstimator exact(roboto);
+  auto expected = exact.PatchSizes(gid_sets);
+  ASSERT_TRUE(expected.ok()) << expected.status();
+  ASSERT_EQ(*sizes, *expected);
+}
+
+TEST_F(PatchSizeEstimatorTest, Model_Estimates) {
+  auto estimator = GlyphSizeModelEstimator::Create(roboto);
+  ASSERT_TRUE(estimator.ok()) << estimator.status();
+  auto calibration = (*estimator)->PatchSizes(std::vector{
+      Range(10, 30),
+      Range(100, 140),
+      Range(300, 310),
+      Range(500, 580),
+  });
+  ASSERT_TRUE(calibration.ok()) << calibration.status();
+
+  std::vector<btree_set<uint32_t>> gid_sets = {
+      Range(40, 70),
+      Range(200, 260),
+      Range(600, 620),
+  };
+  auto sizes = (*estimator)->PatchSizes(gid_sets);
+  ASSERT_TRUE(sizes.ok()) << sizes.status();
+
+  BrotliPatchSizeEstimator exact(roboto);
+  auto expected = exact.PatchSizes(gid_sets);
+  ASSERT_TRUE(expected.ok()) << expected.status();
+
+  for (uint32_t i = 0; i < gid_sets.size(); i++) {
+    double error = std::abs((double)(*sizes)[i] - (double)(*expected)[i]) /
+                   (double)(*expected)[i];
+    ASSERT_LT(error, 0.35) << "set " << i << ": " << (*sizes)[i] << " vs "
+                           << (*expected)[i];
+  }
+
+  // The empty set is estimated rather than built.
+  sizes = (*estimator)->PatchSizes(std::vector{btree_set<uint32_t>{}});
+  ASSERT_TRUE(sizes.ok()) << sizes.status();
+  ASSERT_EQ(sizes->size(), 1);
+}
+
+TEST_F(PatchSizeEstimatorTest, Model_Recalibrates) {
+  auto estimator = GlyphSizeModelEstimator::Create(roboto, 5, 2);
+  ASSERT_TRUE(estimator.ok()) << estimator.status();
+  ASSERT_EQ((*estimator)->MaxObservedError(), 0.0);
+
+  auto sizes = (*estimator)->PatchSizes(std::vector{
+      Range(10, 30),
+      Range(100, 140),
+  });
+  ASSERT_TRUE(sizes.ok()) << sizes.status();
+  // Nothing to compare against until the model has been fit.
+  ASSERT_EQ((*estimator)->MaxObservedError(), 0.0);
+
+  sizes = (*estimator)->PatchSizes(std::vector{
+      Range(300, 310),
+      Range(500, 580),
+  });
+  ASSERT_TRUE(sizes.ok()) << sizes.status();
+
+  // The second set was built exactly and compared to the model.
+  BrotliPatchSizeEstimator exact(roboto);
+  auto expected = exact.PatchSizes(std::vector{Range(500, 580)});
+  ASSERT_TRUE(expected.ok()) << expected.status();
+  ASSERT_EQ((*sizes)[1], (*expected)[0]);
+  ASSERT_GT((*estimator)->MaxObservedError(), 0.0);
+}
+
+}  // namespace ift::encoder
@@ -0,0 +1,98 @@
+#ifndef IFT_ENCODER_SET_FINGERPRINT_H_
+#define IFT_ENCODER_SET_FINGERPRINT_H_
+
+#include <cstdint>
+#include <string>
+#include <utility>
+
+#include "hb.h"
+
+namespace ift::encoder {
+
+/*
+ * A compact key identifying the contents of a hb_set_t, for use in hash maps.
+ *
+ * Holds a 128 bit fingerprint of the set's ranges and, optionally, the ranges
+ * themselves varint delta encoded for exact comparison. A run of consecutive
+ * values costs a single range, so building, storing and comparing a key scales
+ * with the number of runs in the set rather than with its size. That matters
+ * for CJK segments, which are tens of thousands of mostly contiguous
+ * codepoints.
+ *
+ * Keys without the exact ranges compare by fingerprint alone. Two different
+ * sets colliding in 128 bits is possible but vanishingly unlikely.
+ */
+class SetFingerprint {
+ public:
+  explicit SetFingerprint(const hb_set_t* set, bool exact = true) {
+    uint32_t first = HB_SET_VALUE_INVALID;
+    uint32_t last = HB_SET_VALUE_INVALID;
+    uint32_t previous_end = 0;
+    uint64_t count = 0;
+    while (hb_set_next_range(set, &first, &last)) {
+      uint64_t range = (uint64_t(first) << 32) | last;
+      high_ = Mix(high_ ^ Mix(range + kHighSeed));
+      low_ = Mix(low_ + Mix(range ^ kLowSeed));
+      count++;
+
+      if (exact) {
+        AppendVarint(first - previous_end, ranges_);
+        AppendVarint(last - first, ranges_);
+      }
+      previous_end = last;
+    }
+    high_ = Mix(high_ ^ count);
+    low_ = Mix(low_ + count);
+    exact_ = exact;
+  }
+
+  // Size in bytes of the stored exact ranges.
+  size_t ExactSize() const { return ranges_.size(); }
+
+  bool operator==(const SetFingerprint& other) const {
+    if (high_ != other.high_ || low_ != other.low_) {
+      return false;
+    }
+    return !exact_ || !other.exact_ || ranges_ == other.ranges_;
+  }
+
+  bool operator!=(const SetFingerprint& other) const {
+    return !(*this == other);
+  }
+
+  template <typename H>
+  friend H AbslHashValue(H h, const SetFingerprint& f) {
+    return H::combine(std::move(h), f.high_, f.low_);
+  }
+
+ private:
+  static constexpr uint64_t kHighSeed = 0x9e3779b97f4a7c15ull;
+  static constexpr uint64_t kLowSeed = 0xc2b2ae3d27d4eb4full;
+
+  // splitmix64 finalizer.
+  static uint64_t Mix(uint64_t value) {
+    value ^= value >> 30;
+    value *= 0xbf58476d1ce4e5b9ull;
+    value ^= value >> 27;
+    value *= 0x94d049bb133111ebull;
+    value ^= value >> 31;
+    return value;
+  }
+
+  static void AppendVarint(uint32_t value, std::string& out) {
+    while (value >= 0x80) {
+      out.push_back((char)((value & 0x7F) | 0x80));
+      value >>= 7;
+    }
+    out.push_back((char)value);
+  }
+
+  uint64_t high_ = 0;
+  uint64_t low_ = 0;
+  bool exact_ = true;
+  std::string ranges_;
+};
+
+}  // namespace ift::encoder
+
+#endif  // IFT_ENCODER_SET_FINGERPRINT_H_
@@ -0,0 +1,65 @@
+#include "ift/encoder/set_fingerprint.h"
+
+#include "absl/hash/hash.h"
+#include "common/hb_set_unique_ptr.h"
+#include "gtest/gtest.h"
+
+using common::hb_set_unique_ptr;
+using common::make_hb_set;
+using common::make_hb_set_from_ranges;
+
+namespace ift::encoder {
+
+TEST(SetFingerprintTest, EqualSets) {
+  hb_set_unique_ptr a = make_hb_set(4, 1, 2, 3, 10);
+  hb_set_unique_ptr b = make_hb_set_from_ranges(2, 1, 3, 10, 10);
+
+  ASSERT_EQ(SetFingerprint(a.get()), SetFingerprint(b.get()));
+  ASSERT_EQ(absl::Hash<SetFingerprint>()(SetFingerprint(a.get())),
+            absl::Hash<SetFingerprint>()(SetFingerprint(b.get())));
+
+  hb_set_unique_ptr empty_a = make_hb_set();
+  hb_set_unique_ptr empty_b = make_hb_set();
+  ASSERT_EQ(SetFingerprint(empty_a.get()), SetFingerprint(empty_b.get()));
+}
+
+TEST(SetFingerprintTest, DifferentSets) {
+  hb_set_unique_ptr a = make_hb_set(3, 1, 2, 3);
+  hb_set_unique_ptr b = make_hb_set(3, 1, 2, 4);
+  hb_set_unique_ptr c = make_hb_set(2, 1, 2);
+  hb_set_unique_ptr d = make_hb_set(2, 0x10001, 0x20000);
+  hb_set_unique_ptr e = make_hb_set(2, 0x10000, 0x20001);
+  hb_set_unique_ptr empty = make_hb_set();
+
+  ASSERT_NE(SetFingerprint(a.get()), SetFingerprint(b.get()));
+  ASSERT_NE(SetFingerprint(a.get()), SetFingerprint(c.get()));
+  ASSERT_NE(SetFingerprint(c.get()), SetFingerprint(empty.get()));
+  ASSERT_NE(SetFingerprint(d.get()), SetFingerprint(e.get()));
+
+  ASSERT_NE(SetFingerprint(a.get(), false), SetFingerprint(b.get(), false));
+  ASSERT_NE(absl::Hash<SetFingerprint>()(SetFingerprint(a.get())),
+            absl::Hash<SetFingerprint>()(SetFingerprint(b.get())));
+}
+
+TEST(SetFingerprintTest, Inexact) {
+  hb_set_unique_ptr a = make_hb_set(3, 1, 2, 3);
+  hb_set_unique_ptr b = make_hb_set(3, 1, 2, 3);
+
+  SetFingerprint inexact(a.get(), false);
+  ASSERT_EQ(inexact.ExactSize(), 0);
+  ASSERT_EQ(inexact, SetFingerprint(b.get(), false));
+  ASSERT_EQ(inexact, SetFingerprint(b.get()));
+  ASSERT_EQ(SetFingerprint(b.get()), inexact);
+}
+
+TEST(SetFingerprintTest, CompactRanges) {
+  // A large contiguous block takes a couple of bytes.
+  hb_set_unique_ptr cjk = make_hb_set_from_ranges(1, 0x4E00, 0x9FFF);
+  SetFingerprint fingerprint(cjk.get());
+  ASSERT_LE(fingerprint.ExactSize(), 6);
+
+  hb_set_unique_ptr other = make_hb_set_from_ranges(1, 0x4E00, 0x9FFE);
+  ASSERT_NE(fingerprint, SetFingerprint(other.get()));
+}
+
+}  // namespace ift::encoder
@@ -0,0 +1,228 @@
+#include "ift/encoder/subset_cache.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "absl/log/log.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "common/font_data.h"
+
+using absl::Status;
+using absl::StatusOr;
+using absl::StrCat;
+using absl::string_view;
+using common::FontData;
+using common::hb_blob_unique_ptr;
+using common::make_hb_blob;
+
+namespace fs = std::filesystem;
+
+namespace ift::encoder {
+
+static constexpr char kEntrySuffix[] = ".font";
+
+StatusOr<std::unique_ptr<SubsetCache>> SubsetCache::Open(
+    const std::string& directory, uint64_t max_size_bytes) {
+  std::error_code ec;
+  fs::create_directories(directory, ec);
+  if (ec) {
+    return absl::InternalError(StrCat("Unable to create cache directory ",
+                                      directory, ": ", ec.message()));
+  }
+
+  struct Existing {
+    fs::file_time_type last_write;
+    std::string name;
+    uint64_t size;
+  };
+  std::vector<Existing> existing;
+  for (const auto& file : fs::directory_iterator(directory, ec)) {
+    if (!file.is_regular_file()) {
+      continue;
+    }
+
+    std::string name = file.path().filename().string();
+    if (!absl::EndsWith(name, kEntrySuffix)) {
+      // Left over from an interrupted write.
+      fs::remove(file.path(), ec);
+      continue;
+    }
+
+    existing.push_back(
+        Existing{file.last_write_time(), name, file.file_size()});
+  }
+  if (ec) {
+    return absl::InternalError(StrCat("Unable to read cache directory ",
+                                      directory, ": ", ec.message()));
+  }
+
+  std::sort(existing.begin(), existing.end(),
+            [](const Existing& a, const Existing& b) {
+              return a.last_write < b.last_write;
+            });
+
+  std::unique_ptr<SubsetCache> cache(
+      new SubsetCache(directory, max_size_bytes));
+  absl::MutexLock lock(&cache->mutex_);
+  for (const auto& e : existing) {
+    cache->entries_[e.name].size = e.size;
+    cache->total_size_ += e.size;
+    cache->Touch(e.name);
+  }
+  cache->EvictIfNeeded();
+
+  return cache;
+}
+
+StatusOr<FontData> SubsetCache::Get(string_view key) {
+  std::string name = StrCat(Hash(key), kEntrySuffix);
+  std::string path = PathFor(name);
+
+  absl::MutexLock lock(&mutex_);
+  if (!entries_.contains(name)) {
+    misses_++;
+    return absl::NotFoundError(StrCat("No cache entry for ", key));
+  }
+
+  // harfbuzz will memory map the file when possible.
+  hb_blob_unique_ptr blob =
+      make_hb_blob(hb_blob_create_from_file_or_fail(path.c_str()));
+  if (!blob.get()) {
+    // Removed by someone else, forget about it.
+    total_size_ -= entries_[name].size;
+    lru_.erase(entries_[name].last_used);
+    entries_.erase(name);
+    misses_++;
+    return absl::NotFoundError(StrCat("No cache entry for ", key));
+  }
+
+  Touch(name);
+  // Persist the use so that the recency is kept across runs.
+  std::error_code ec;
+  fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+
+  hits_++;
+  return FontData(std::move(blob));
+}
+
+Status SubsetCache::Put(string_view key, const FontData& font) {
+  std::string name = StrCat(Hash(key), kEntrySuffix);
+  std::string path = PathFor(name);
+
+  uint32_t temp_id;
+  {
+    absl::MutexLock lock(&mutex_);
+    temp_id = next_temp_id_++;
+  }
+
+  // Write to a temporary file first and then move it into place so that
+  // readers never see a partially written entry.
+  std::string temp_path = StrCat(path, ".tmp", getpid(), "_", temp_id);
+  FILE* f = fopen(temp_path.c_str(), "wb");
+  if (!f) {
+    return absl::InternalError(StrCat("Unable to open ", temp_path));
+  }
+  size_t written = fwrite(font.data(), 1, font.size(), f);
+  fclose(f);
+  if (written != font.size()) {
+    std::error_code ec;
+    fs::remove(temp_path, ec);
+    return absl::InternalError(StrCat("Failed to write ", temp_path));
+  }
+
+  std::error_code ec;
+  fs::rename(temp_path, path, ec);
+  if (ec) {
+    fs::remove(temp_path, ec);
+    return absl::InternalError(
+        StrCat("Failed to move ", temp_path, " into the cache."));
+  }
+
+  absl::MutexLock lock(&mutex_);
+  Entry& entry = entries_[name];
+  total_size_ -= entry.size;
+  entry.size = font.size();
+  total_size_ += entry.size;
+  Touch(name);
+  EvictIfNeeded();
+  return absl::OkStatus();
+}
+
+uint64_t SubsetCache::SizeBytes() {
+  absl::MutexLock lock(&mutex_);
+  return total_size_;
+}
+
+uint32_t SubsetCache::Hits() {
+  absl::MutexLock lock(&mutex_);
+  return hits_;
+}
+
+uint32_t SubsetCache::Misses() {
+  absl::MutexLock lock(&mutex_);
+  return misses_;
+}
+
+std::string SubsetCache::Hash(string_view data) {
+  // 128 bit FNV-1a
+  constexpr unsigned __int128 prime =
+      (((unsigned __int128)0x0000000001000000ull) << 64) |
+      0x000000000000013Bull;
+  unsigned __int128 hash =
+      (((unsigned __int128)0x6c62272e07bb0142ull) << 64) |
+      0x62b821756295c58dull;
+  for (unsigned char c : data) {
+    hash ^= c;
+    hash *= prime;
+  }
+
+  return absl::StrFormat("%016x%016x", (uint64_t)(hash >> 64),
+                         (uint64_t)hash);
+}
+
+std::string SubsetCache::PathFor(string_view file_name) const {
+  return (fs::path(directory_) / fs::path(file_name)).string();
+}
+
+void SubsetCache::Touch(const std::string& file_name) {
+  Entry& entry = entries_[file_name];
+  if (entry.last_used) {
+    lru_.erase(entry.last_used);
+  }
+  entry.last_used = ++clock_;
+  lru_[entry.last_used] = file_name;
+}
+
+void SubsetCache::EvictIfNeeded() {
+  while (total_size_ > max_size_bytes_ && !lru_.empty()) {
+    auto oldest = lru_.begin();
+    std::string name = oldest->second;
+    lru_.erase(oldest);
+
+    std::error_code ec;
+    fs::remove(PathFor(name), ec);
+    if (ec) {
+      LOG(WARNING) << "Failed to remove cache entry " << name << ": "
+                   << ec.message();
+    }
+
+    total_size_ -= entries_[name].size;
+    entries_.erase(name);
+  }
+}
+
+}  // namespace ift::encoder
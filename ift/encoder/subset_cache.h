@@ -0,0 +1,92 @@
+#ifndef IFT_ENCODER_SUBSET_CACHE_H_
+#define IFT_ENCODER_SUBSET_CACHE_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/btree_map.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "common/font_data.h"
+
+namespace ift::encoder {
+
+/*
+ * A persistent, content addressed cache of subsetting results which can be
+ * shared between encoder runs.
+ *
+ * Each entry is stored as a file in the cache directory named by a hash of the
+ * entry's key. Cached fonts are memory mapped when read. Once the total size of
+ * the cache exceeds the configured maximum the least recently used entries are
+ * removed.
+ *
+ * Safe to use from multiple threads.
+ */
+class SubsetCache {
+ public:
+  /*
+   * Opens (creating if needed) the cache stored in 'directory'. Any existing
+   * entries are retained, ordered for eviction by their last use.
+   */
+  static absl::StatusOr<std::unique_ptr<SubsetCache>> Open(
+      const std::string& directory, uint64_t max_size_bytes);
+
+  /*
+   * Returns the font stored under 'key', or a NotFoundError if there is none.
+   */
+  absl::StatusOr<common::FontData> Get(absl::string_view key);
+
+  /*
+   * Stores 'font' under 'key', evicting old entries if the cache is now over
+   * its size limit.
+   */
+  absl::Status Put(absl::string_view key, const common::FontData& font);
+
+  uint64_t SizeBytes();
+  uint32_t Hits();
+  uint32_t Misses();
+
+  /*
+   * A 128 bit hash of 'data' formatted as hex. Unlike absl::Hash this is stable
+   * across processes so it's suitable for persistent keys.
+   */
+  static std::string Hash(absl::string_view data);
+
+ private:
+  SubsetCache(std::string directory, uint64_t max_size_bytes)
+      : directory_(std::move(directory)), max_size_bytes_(max_size_bytes) {}
+
+  std::string PathFor(absl::string_view file_name) const;
+
+  // Marks 'file_name' as the most recently used entry.
+  void Touch(const std::string& file_name)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void EvictIfNeeded() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  struct Entry {
+    uint64_t size = 0;
+    uint64_t last_used = 0;
+  };
+
+  const std::string directory_;
+  const uint64_t max_size_bytes_;
+
+  absl::Mutex mutex_;
+  absl::flat_hash_map<std::string, Entry> entries_ ABSL_GUARDED_BY(mutex_);
+  // last used -> file name, the front is the least recently used entry.
+  absl::btree_map<uint64_t, std::string> lru_ ABSL_GUARDED_BY(mutex_);
+  uint64_t clock_ ABSL_GUARDED_BY(mutex_) = 0;
+  uint64_t total_size_ ABSL_GUARDED_BY(mutex_) = 0;
+  uint32_t next_temp_id_ ABSL_GUARDED_BY(mutex_) = 0;
+  uint32_t hits_ ABSL_GUARDED_BY(mutex_) = 0;
+  uint32_t misses_ ABSL_GUARDED_BY(mutex_) = 0;
+};
+
+}  // namespace ift::encoder
+
+#endif  // IFT_ENCODER_SUBSET_CACHE_H_
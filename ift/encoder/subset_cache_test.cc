@@ -0,0 +1,122 @@
+#include "ift/encoder/subset_cache.h"
+
+#include <filesystem>
+#include <memory>
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "common/font_data.h"
+#include "gtest/gtest.h"
+
+using absl::StrCat;
+using common::FontData;
+
+namespace ift::encoder {
+
+class SubsetCacheTest : public ::testing::Test {
+ protected:
+  SubsetCacheTest() {
+    directory = StrCat(testing::TempDir(), "/subset_cache_",
+                       testing::UnitTest::GetInstance()
+                           ->current_test_info()
+                           ->name());
+    std::filesystem::remove_all(directory);
+  }
+
+  ~SubsetCacheTest() override { std::filesystem::remove_all(directory); }
+
+  std::unique_ptr<SubsetCache> Open(uint64_t max_size) {
+    auto cache = SubsetCache::Open(directory, max_size);
+    EXPECT_TRUE(cache.ok()) << cache.status();
+    return std::move(*cache);
+  }
+
+  static FontData Data(absl::string_view value) {
+    FontData data;
+    data.copy(value);
+    return data;
+  }
+
+  std::string directory;
+};
+
+TEST_F(SubsetCacheTest, PutAndGet) {
+  auto cache = Open(1000);
+
+  ASSERT_TRUE(cache->Put("abc", Data("font abc")).ok());
+  ASSERT_TRUE(cache->Put("def", Data("font def")).ok());
+
+  auto result = cache->Get("abc");
+  ASSERT_TRUE(result.ok()) << result.status();
+  EXPECT_EQ(result->str(), "font abc");
+
+  result = cache->Get("def");
+  ASSERT_TRUE(result.ok()) << result.status();
+  EXPECT_EQ(result->str(), "font def");
+
+  // Replacing an entry.
+  ASSERT_TRUE(cache->Put("abc", Data("font abc v2")).ok());
+  result = cache->Get("abc");
+  ASSERT_TRUE(result.ok()) << result.status();
+  EXPECT_EQ(result->str(), "font abc v2");
+
+  EXPECT_EQ(cache->SizeBytes(), 19);
+  EXPECT_EQ(cache->Hits(), 3);
+  EXPECT_EQ(cache->Misses(), 0);
+}
+
+TEST_F(SubsetCacheTest, Miss) {
+  auto cache = Open(1000);
+  ASSERT_TRUE(cache->Put("abc", Data("font abc")).ok());
+
+  auto result = cache->Get("abd");
+  ASSERT_TRUE(absl::IsNotFound(result.status())) << result.status();
+  EXPECT_EQ(cache->Hits(), 0);
+  EXPECT_EQ(cache->Misses(), 1);
+}
+
+TEST_F(SubsetCacheTest, PersistsAcrossRuns) {
+  {
+    auto cache = Open(1000);
+    ASSERT_TRUE(cache->Put("abc", Data("font abc")).ok());
+  }
+
+  auto cache = Open(1000);
+  EXPECT_EQ(cache->SizeBytes(), 8);
+  auto result = cache->Get("abc");
+  ASSERT_TRUE(result.ok()) << result.status();
+  EXPECT_EQ(result->str(), "font abc");
+}
+
+TEST_F(SubsetCacheTest, EvictsLeastRecentlyUsed) {
+  auto cache = Open(20);
+
+  ASSERT_TRUE(cache->Put("a", Data("0123456789")).ok());
+  ASSERT_TRUE(cache->Put("b", Data("0123456789")).ok());
+  EXPECT_EQ(cache->SizeBytes(), 20);
+
+  // Makes 'b' the least recently used entry.
+  ASSERT_TRUE(cache->Get("a").ok());
+
+  ASSERT_TRUE(cache->Put("c", Data("01234")).ok());
+  EXPECT_EQ(cache->SizeBytes(), 15);
+  EXPECT_TRUE(cache->Get("a").ok());
+  EXPECT_TRUE(absl::IsNotFound(cache->Get("b").status()));
+  EXPECT_TRUE(cache->Get("c").ok());
+
+  // A smaller limit on reopen evicts down to the new size.
+  cache = Open(10);
+  EXPECT_EQ(cache->SizeBytes(), 5);
+  EXPECT_TRUE(cache->Get("c").ok());
+}
+
+TEST_F(SubsetCacheTest, Hash) {
+  // Keys are persisted so the hash must never change.
+  EXPECT_EQ(SubsetCache::Hash(""), "6c62272e07bb014262b821756295c58d");
+  EXPECT_EQ(SubsetCache::Hash("a"), "d228cb696f1a8caf78912b704e4a8964");
+  EXPECT_NE(SubsetCache::Hash("ab"), SubsetCache::Hash("ba"));
+  EXPECT_EQ(SubsetCache::Hash("abc").size(), 32);
+}
+
+}  // namespace ift::encoder
@@ -0,0 +1,111 @@
+#include "ift/glyph_data_reader.h"
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_set.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "common/font_data.h"
+#include "common/font_helper.h"
+#include "common/try.h"
+
+using absl::flat_hash_set;
+using absl::StatusOr;
+using absl::string_view;
+using common::FontData;
+using common::FontHelper;
+
+namespace ift {
+
+StatusOr<GlyphDataReader> GlyphDataReader::ForGlyf(hb_face_t* face) {
+  GlyphDataReader reader;
+  reader.offsets_ = FontHelper::TableData(face, FontHelper::kLoca);
+  if (reader.offsets_.empty()) {
+    return absl::NotFoundError("loca table was not found.");
+  }
+
+  FontData head = FontHelper::TableData(face, FontHelper::kHead);
+  if (head.size() < 52) {
+    return absl::InvalidArgumentError("invalid head table, too short.");
+  }
+
+  reader.data_ = FontHelper::TableData(face, FontHelper::kGlyf);
+  bool is_short_loca = !head.str()[51];
+  reader.Init(reader.offsets_.str(), reader.data_.str(), is_short_loca);
+  return reader;
+}
+
+StatusOr<GlyphDataReader> GlyphDataReader::ForGvar(hb_face_t* face) {
+  GlyphDataReader reader;
+  reader.data_ = FontHelper::TableData(face, FontHelper::kGvar);
+  string_view gvar = reader.data_.str();
+  if (gvar.empty()) {
+    return absl::NotFoundError("gvar not in the font.");
+  }
+
+  constexpr uint32_t glyph_count_offset = 12;
+  constexpr uint32_t gvar_flags_offset = 15;
+  constexpr uint32_t data_array_offset = 16;
+  constexpr uint32_t gvar_offsets_table_offset = 20;
+
+  if (gvar.size() < 20) {
+    return absl::InvalidArgumentError("gvar table is too short.");
+  }
+
+  uint16_t glyph_count =
+      TRY(FontHelper::ReadUInt16(gvar.substr(glyph_count_offset)));
+  uint32_t data_offset =
+      TRY(FontHelper::ReadUInt32(gvar.substr(data_array_offset)));
+
+  bool is_wide = (((uint8_t)gvar[gvar_flags_offset]) & 0x01);
+  uint32_t offset_size = is_wide ? 4 : 2;
+  reader.Init(
+      gvar.substr(gvar_offsets_table_offset, (glyph_count + 1) * offset_size),
+      gvar.substr(data_offset), !is_wide);
+  return reader;
+}
+
+StatusOr<GlyphDataReader> GlyphDataReader::ForCff(hb_face_t* face,
+                                                  hb_tag_t tag) {
+  GlyphDataReader reader;
+  reader.data_ = FontHelper::TableData(face, tag);
+  reader.charstrings_ = TRY(FontHelper::CffCharStringsIndex(face, tag));
+  return reader;
+}
+
+StatusOr<std::vector<std::pair<hb_tag_t, GlyphDataReader>>>
+GlyphDataReader::ForTables(hb_face_t* face,
+                           const flat_hash_set<hb_tag_t>& tags) {
+  auto face_tags = FontHelper::GetTags(face);
+
+  bool include_glyf = tags.contains(FontHelper::kGlyf) &&
+                      face_tags.contains(FontHelper::kGlyf) &&
+                      face_tags.contains(FontHelper::kLoca);
+  bool include_gvar =
+      tags.contains(FontHelper::kGvar) && face_tags.contains(FontHelper::kGvar);
+  bool include_cff =
+      tags.contains(FontHelper::kCFF) && face_tags.contains(FontHelper::kCFF);
+  bool include_cff2 =
+      tags.contains(FontHelper::kCFF2) && face_tags.contains(FontHelper::kCFF2);
+
+  std::vector<std::pair<hb_tag_t, GlyphDataReader>> tables;
+  if (include_glyf) {
+    tables.push_back(std::pair(FontHelper::kGlyf, TRY(ForGlyf(face))));
+  }
+  if (include_gvar) {
+    tables.push_back(std::pair(FontHelper::kGvar, TRY(ForGvar(face))));
+  }
+  if (include_cff) {
+    tables.push_back(
+        std::pair(FontHelper::kCFF, TRY(ForCff(face, FontHelper::kCFF))));
+  }
+  if (include_cff2) {
+    tables.push_back(
+        std::pair(FontHelper::kCFF2, TRY(ForCff(face, FontHelper::kCFF2))));
+  }
+  return tables;
+}
+
+}  // namespace ift
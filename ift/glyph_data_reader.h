@@ -0,0 +1,72 @@
+#ifndef IFT_GLYPH_DATA_READER_H_
+#define IFT_GLYPH_DATA_READER_H_
+
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_set.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "common/font_data.h"
+#include "common/font_helper.h"
+#include "common/indexed_data_reader.h"
+#include "hb.h"
+
+namespace ift {
+
+/*
+ * Provides access to the per glyph data in a glyf, gvar, CFF or CFF2 table.
+ * The table data is resolved once at construction, so looking up many glyphs
+ * doesn't repeatedly locate the table and its offsets.
+ */
+class GlyphDataReader {
+ public:
+  static absl::StatusOr<GlyphDataReader> ForGlyf(hb_face_t* face);
+  static absl::StatusOr<GlyphDataReader> ForGvar(hb_face_t* face);
+  // For CFF and CFF2 the per glyph data is the glyph's CharString.
+  static absl::StatusOr<GlyphDataReader> ForCff(hb_face_t* face, hb_tag_t tag);
+
+  /*
+   * Creates a reader for each of the glyph data tables in 'tags' which are
+   * present in 'face'. Readers are in the order the tables are written to a
+   * glyph keyed patch: glyf, gvar, CFF, CFF2.
+   */
+  static absl::StatusOr<std::vector<std::pair<hb_tag_t, GlyphDataReader>>>
+  ForTables(hb_face_t* face, const absl::flat_hash_set<hb_tag_t>& tags);
+
+  absl::StatusOr<absl::string_view> DataFor(uint32_t gid) const {
+    if (charstrings_) {
+      return charstrings_->DataFor(gid);
+    }
+    if (short_offsets_) {
+      return short_offsets_->DataFor(gid);
+    }
+    return long_offsets_->DataFor(gid);
+  }
+
+ private:
+  GlyphDataReader() = default;
+
+  void Init(absl::string_view offsets, absl::string_view data,
+            bool short_offsets) {
+    if (short_offsets) {
+      short_offsets_.emplace(offsets, data);
+    } else {
+      long_offsets_.emplace(offsets, data);
+    }
+  }
+
+  // Keeps the table blobs referenced by the readers alive.
+  common::FontData offsets_;
+  common::FontData data_;
+
+  std::optional<common::IndexedDataReader<uint16_t, 2>> short_offsets_;
+  std::optional<common::IndexedDataReader<uint32_t, 1>> long_offsets_;
+  std::optional<common::FontHelper::CffCharStrings> charstrings_;
+};
+
+}  // namespace ift
+
+#endif  // IFT_GLYPH_DATA_READER_H_
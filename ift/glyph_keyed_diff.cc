@@ -2,15 +2,23 @@
 
 #include <algorithm>
 #include <cstdint>
+#include <utility>
+#include <vector>
 
 #include "absl/container/btree_set.h"
 #include "absl/container/flat_hash_set.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
 #include "common/brotli_binary_diff.h"
+#include "common/brotli_binary_patch.h"
 #include "common/compat_id.h"
 #include "common/font_data.h"
 #include "common/font_helper.h"
+#include "common/thread_pool.h"
+#include "common/try.h"
+#include "ift/glyph_data_reader.h"
 #include "ift/proto/ift_table.h"
 #include "ift/proto/patch_map.h"
 
@@ -18,8 +26,11 @@ using absl::btree_set;
 using absl::flat_hash_set;
 using absl::Status;
 using absl::StatusOr;
+using absl::Span;
 using absl::StrCat;
+using absl::string_view;
 using common::BrotliBinaryDiff;
+using common::BrotliBinaryPatch;
 using common::CompatId;
 using common::FontData;
 using common::FontHelper;
@@ -27,157 +38,230 @@ using common::hb_blob_unique_ptr;
 using common::hb_face_unique_ptr;
 using common::make_hb_blob;
 using common::make_hb_face;
+using common::ThreadPool;
 using ift::proto::IFTTable;
 using ift::proto::PatchMap;
 
 namespace ift {
 
-StatusOr<FontData> GlyphKeyedDiff::CreatePatch(
-    const btree_set<uint32_t>& gids) const {
-  // TODO(garretrieger): use write macros that check for overflows.
-  std::string patch;
-  FontHelper::WriteUInt32(HB_TAG('i', 'f', 'g', 'k'), patch);  // Format Tag
-  FontHelper::WriteUInt32(0, patch);                           // Reserved.
-
-  if (gids.empty()) {
-    return absl::InvalidArgumentError(
-        "There must be at least one gid in the requested patch.");
-  }
-
-  uint32_t max_gid = *std::max_element(gids.begin(), gids.end());
-  if (max_gid > (1 << 24) - 1) {
-    return absl::InvalidArgumentError("Larger then 24 bit gid requested.");
-  }
-
-  bool u16_gids = true;
-  if (max_gid > (1 << 16) - 1) {
-    u16_gids = false;
-  }
+namespace {
 
-  // Flags
-  FontHelper::WriteUInt8(u16_gids ? 0b00000000 : 0b00000001, patch);
-  base_compat_id_.WriteTo(patch);  // Compat ID
+// Size of the data stream header (everything before the per glyph data).
+uint32_t DataStreamHeaderSize(uint32_t glyph_count, bool u16_gids,
+                              uint32_t table_count) {
+  uint32_t glyph_id_width = u16_gids ? 2 : 3;
+  return 5 + glyph_id_width * glyph_count + table_count * 4 +
+         4 * glyph_count * table_count + 4;
+}
 
-  auto uncompressed_data_stream = CreateDataStream(gids, u16_gids);
-  if (!uncompressed_data_stream.ok()) {
-    return uncompressed_data_stream.status();
-  }
+}  // namespace
 
-  FontData empty;
-  FontData compressed_data_stream;
-  auto status = brotli_diff_.Diff(empty, *uncompressed_data_stream,
-                                  &compressed_data_stream);
-  if (!status.ok()) {
-    return status;
+StatusOr<FontData> GlyphKeyedDiff::CreatePatch(
+    const btree_set<uint32_t>& gids) const {
+  auto patches = CreatePatches(Span<const btree_set<uint32_t>>(&gids, 1));
+  if (!patches.ok()) {
+    return patches.status();
   }
+  return std::move(patches->front());
+}
 
-  // Max Uncompressed Length
-  FontHelper::WriteUInt32(uncompressed_data_stream->size(), patch);
+StatusOr<std::vector<FontData>> GlyphKeyedDiff::CreatePatches(
+    Span<const btree_set<uint32_t>> gid_sets, ThreadPool* pool) const {
+  std::vector<bool> u16_gids;
+  for (const auto& gids : gid_sets) {
+    if (gids.empty()) {
+      return absl::InvalidArgumentError(
+          "There must be at least one gid in the requested patch.");
+    }
 
-  // Compressed Data Stream
-  patch += compressed_data_stream.str();
+    uint32_t max_gid = *std::max_element(gids.begin(), gids.end());
+    if (max_gid > (1 << 24) - 1) {
+      return absl::InvalidArgumentError("Larger then 24 bit gid requested.");
+    }
 
-  FontData result(patch);
-  return result;
-}
+    u16_gids.push_back(max_gid <= (1 << 16) - 1);
+  }
 
-StatusOr<FontData> GlyphKeyedDiff::CreateDataStream(
-    const btree_set<uint32_t>& gids, bool u16_gids) const {
   // check for unsupported tags.
   for (auto tag : tags_) {
-    if (tag != FontHelper::kGlyf && tag != FontHelper::kGvar) {
+    if (tag != FontHelper::kGlyf && tag != FontHelper::kGvar &&
+        tag != FontHelper::kCFF && tag != FontHelper::kCFF2) {
       return absl::InvalidArgumentError(
           "Unsupported table type for glyph keyed diff.");
     }
   }
 
+  // Tables in the order they are written to the data stream.
   auto face = font_.face();
-  auto face_tags = FontHelper::GetTags(face.get());
-
-  btree_set<hb_tag_t> processed_tags;
-  std::string offset_data;
-  std::string per_glyph_data;
-
-  bool include_glyf = tags_.contains(FontHelper::kGlyf) &&
-                      face_tags.contains(FontHelper::kGlyf) &&
-                      face_tags.contains(FontHelper::kLoca);
-  bool include_gvar = tags_.contains(FontHelper::kGvar) &&
-                      face_tags.contains(FontHelper::kGvar);
-
-  uint32_t glyph_count = gids.size();
-  uint32_t glyph_id_width = u16_gids ? 2 : 3;
-  uint32_t table_count = (include_glyf ? 1 : 0) + (include_gvar ? 1 : 0);
-  uint32_t header_size = 5 + glyph_id_width * glyph_count + table_count * 4 +
-                         4 * glyph_count * table_count + 4;
-
-  if (tags_.contains(FontHelper::kCFF) &&
-      face_tags.contains(FontHelper::kCFF)) {
-    // TODO(garretrieger): add CFF support
-    return absl::UnimplementedError(
-        "CFF glyph keyed patching not yet implemented.");
+  auto tables = TRY(GlyphDataReader::ForTables(face.get(), tags_));
+
+  // Resolve all of the per glyph data up front, that gives the exact size of
+  // every data stream so they can be written into one preallocated buffer.
+  std::vector<string_view> glyph_data;
+  std::vector<size_t> stream_offsets = {0};
+  for (uint32_t i = 0; i < gid_sets.size(); i++) {
+    const auto& gids = gid_sets[i];
+    size_t stream_size =
+        DataStreamHeaderSize(gids.size(), u16_gids[i], tables.size());
+    for (const auto& [tag, reader] : tables) {
+      for (auto gid : gids) {
+        auto data = TRY(reader.DataFor(gid));
+        glyph_data.push_back(data);
+        stream_size += data.size();
+      }
+    }
+    stream_offsets.push_back(stream_offsets.back() + stream_size);
   }
 
-  if (tags_.contains(FontHelper::kCFF2) &&
-      face_tags.contains(FontHelper::kCFF2)) {
-    // TODO(garretrieger): add CFF2 support
-    return absl::UnimplementedError(
-        "CFF2 glyph keyed patching not yet implemented.");
-  }
+  std::string streams;
+  streams.reserve(stream_offsets.back());
+  auto next_data = glyph_data.begin();
+  for (uint32_t i = 0; i < gid_sets.size(); i++) {
+    const auto& gids = gid_sets[i];
+    uint32_t header_size =
+        DataStreamHeaderSize(gids.size(), u16_gids[i], tables.size());
 
-  if (include_glyf) {
-    processed_tags.insert(FontHelper::kGlyf);
+    // Stream Construction
+    FontHelper::WriteUInt32(gids.size(), streams);   // glyphCount
+    FontHelper::WriteUInt8(tables.size(), streams);  // tableCount
 
+    // glyphIds
     for (auto gid : gids) {
-      auto data = FontHelper::GlyfData(face.get(), gid);
-      if (!data.ok()) {
-        return data.status();
+      if (u16_gids[i]) {
+        FontHelper::WriteUInt16(gid, streams);
+      } else {
+        FontHelper::WriteUInt24(gid, streams);
       }
+    }
+
+    // tables
+    for (const auto& [tag, reader] : tables) {
+      FontHelper::WriteUInt32(tag, streams);
+    }
 
-      FontHelper::WriteUInt32(header_size + per_glyph_data.size(), offset_data);
-      per_glyph_data += *data;
+    // offsets, including the trailing offset.
+    uint32_t offset = header_size;
+    uint32_t data_count = gids.size() * tables.size();
+    for (auto it = next_data; it != next_data + data_count; it++) {
+      FontHelper::WriteUInt32(offset, streams);
+      offset += it->size();
+    }
+    FontHelper::WriteUInt32(offset, streams);
+
+    // per glyph data
+    for (uint32_t j = 0; j < data_count; j++) {
+      streams += *next_data++;
     }
   }
 
-  if (include_gvar) {
-    processed_tags.insert(FontHelper::kGvar);
+  std::vector<FontData> patches(gid_sets.size());
+  std::vector<Status> results(gid_sets.size());
+  auto compress = [&](uint32_t i) {
+    string_view stream = string_view(streams).substr(
+        stream_offsets[i], stream_offsets[i + 1] - stream_offsets[i]);
+
+    // TODO(garretrieger): use write macros that check for overflows.
+    std::string patch;
+    FontHelper::WriteUInt32(HB_TAG('i', 'f', 'g', 'k'), patch);  // Format Tag
+    FontHelper::WriteUInt32(0, patch);                           // Reserved.
+
+    // Flags
+    FontHelper::WriteUInt8(u16_gids[i] ? 0b00000000 : 0b00000001, patch);
+    base_compat_id_.WriteTo(patch);  // Compat ID
+
+    FontData empty;
+    std::vector<uint8_t> compressed_data_stream;
+    results[i] =
+        brotli_diff_.Diff(empty, stream, 0, true, compressed_data_stream);
+    if (!results[i].ok()) {
+      return;
+    }
+
+    // Max Uncompressed Length
+    FontHelper::WriteUInt32(stream.size(), patch);
 
-    for (auto gid : gids) {
-      auto data = FontHelper::GvarData(face.get(), gid);
-      if (!data.ok()) {
-        return data.status();
-      }
+    // Compressed Data Stream
+    patch.append(reinterpret_cast<const char*>(compressed_data_stream.data()),
+                 compressed_data_stream.size());
 
-      FontHelper::WriteUInt32(header_size + per_glyph_data.size(), offset_data);
-      per_glyph_data += *data;
+    patches[i].copy(patch);
+  };
+
+  if (pool) {
+    pool->ParallelFor(gid_sets.size(), compress);
+  } else {
+    for (uint32_t i = 0; i < gid_sets.size(); i++) {
+      compress(i);
     }
   }
 
-  // Add the trailing offset
-  FontHelper::WriteUInt32(header_size + per_glyph_data.size(), offset_data);
+  for (const auto& sc : results) {
+    if (!sc.ok()) {
+      return sc;
+    }
+  }
 
-  // Stream Construction
-  std::string stream;
-  FontHelper::WriteUInt32(gids.size(), stream);           // glyphCount
-  FontHelper::WriteUInt8(processed_tags.size(), stream);  // tableCount
+  return patches;
+}
 
-  // glyphIds
-  for (auto gid : gids) {
-    if (u16_gids) {
-      FontHelper::WriteUInt16(gid, stream);
-    } else {
-      FontHelper::WriteUInt24(gid, stream);
-    }
+StatusOr<FontData> GlyphKeyedDiff::WithCompatId(const FontData& patch,
+                                                CompatId compat_id) {
+  // Format tag (4), reserved (4), flags (1), compat id (16)
+  constexpr uint32_t compat_id_offset = 9;
+  constexpr uint32_t compat_id_end = compat_id_offset + 16;
+  if (patch.size() < compat_id_end || patch.str().substr(0, 4) != "ifgk") {
+    return absl::InvalidArgumentError("Not a glyph keyed patch.");
+  }
+
+  std::string id;
+  compat_id.WriteTo(id);
+  if (patch.str().substr(compat_id_offset, id.size()) == id) {
+    FontData result;
+    result.shallow_copy(patch);
+    return result;
   }
 
-  // tables
-  for (auto tag : processed_tags) {
-    FontHelper::WriteUInt32(tag, stream);
+  std::string updated;
+  updated.reserve(patch.size());
+  updated.append(patch.str().substr(0, compat_id_offset));
+  updated.append(id);
+  updated.append(patch.str().substr(compat_id_end));
+
+  FontData result;
+  result.copy(updated);
+  return result;
+}
+
+StatusOr<FontData> GlyphKeyedDiff::Recompress(
+    const FontData& patch, const BrotliBinaryDiff& brotli_diff) {
+  // Format tag (4), reserved (4), flags (1), compat id (16), max uncompressed
+  // length (4)
+  constexpr uint32_t data_stream_offset = 29;
+  if (patch.size() < data_stream_offset || patch.str().substr(0, 4) != "ifgk") {
+    return absl::InvalidArgumentError("Not a glyph keyed patch.");
   }
 
-  stream += offset_data;
-  stream += per_glyph_data;
+  constexpr uint32_t max_length_offset = 25;
+  uint32_t max_length =
+      TRY(FontHelper::ReadUInt32(patch.str(max_length_offset)));
 
-  FontData result(stream);
+  FontData empty;
+  FontData compressed_stream(patch.str(data_stream_offset));
+  FontData stream;
+  TRYV(BrotliBinaryPatch().Patch(empty, compressed_stream, max_length,
+                                 &stream));
+
+  std::vector<uint8_t> recompressed_stream;
+  TRYV(brotli_diff.Diff(empty, stream.str(), 0, true, recompressed_stream));
+
+  std::string updated;
+  updated.reserve(data_stream_offset + recompressed_stream.size());
+  updated.append(patch.str().substr(0, data_stream_offset));
+  updated.append(reinterpret_cast<const char*>(recompressed_stream.data()),
+                 recompressed_stream.size());
+
+  FontData result;
+  result.copy(updated);
   return result;
 }
 
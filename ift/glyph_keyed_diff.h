@@ -1,11 +1,16 @@
 #ifndef IFT_GLYPH_KEYED_DIFF_H_
 #define IFT_GLYPH_KEYED_DIFF_H_
 
+#include <vector>
+
+#include "absl/container/btree_set.h"
 #include "absl/container/flat_hash_set.h"
 #include "absl/status/statusor.h"
+#include "absl/types/span.h"
 #include "common/brotli_binary_diff.h"
 #include "common/compat_id.h"
 #include "common/font_data.h"
+#include "common/thread_pool.h"
 
 namespace ift {
 
@@ -14,19 +19,45 @@ class GlyphKeyedDiff {
  public:
   GlyphKeyedDiff(const common::FontData& font, common::CompatId base_compat_id,
                  absl::flat_hash_set<hb_tag_t> included_tags,
-                 unsigned quality = 11)
+                 unsigned quality = 11, unsigned window_bits = 0)
       : font_(font),
         base_compat_id_(base_compat_id),
         tags_(included_tags),
-        brotli_diff_(quality) {}
+        brotli_diff_(quality, window_bits) {}
 
   absl::StatusOr<common::FontData> CreatePatch(
       const absl::btree_set<uint32_t>& gids) const;
 
- private:
-  absl::StatusOr<common::FontData> CreateDataStream(
-      const absl::btree_set<uint32_t>& gids, bool u16_gids) const;
+  /*
+   * Creates one patch for each of the provided gid sets, the results are in the
+   * same order as 'gid_sets'.
+   *
+   * The glyph data tables are resolved once for the whole batch and all of the
+   * uncompressed data streams are laid out in a single buffer. If 'pool' is
+   * provided the data streams are compressed concurrently on it.
+   */
+  absl::StatusOr<std::vector<common::FontData>> CreatePatches(
+      absl::Span<const absl::btree_set<uint32_t>> gid_sets,
+      common::ThreadPool* pool = nullptr) const;
+
+  /*
+   * Returns a copy of the glyph keyed patch 'patch' with its compat id changed
+   * to 'compat_id'. The glyph data in a patch doesn't depend on the compat id
+   * so this is much cheaper than regenerating the patch. If 'patch' already
+   * has 'compat_id' the data is shared rather than copied.
+   */
+  static absl::StatusOr<common::FontData> WithCompatId(
+      const common::FontData& patch, common::CompatId compat_id);
 
+  /*
+   * Returns a copy of the glyph keyed patch 'patch' with its data stream
+   * re-encoded by 'brotli_diff'. The decoded contents are unchanged.
+   */
+  static absl::StatusOr<common::FontData> Recompress(
+      const common::FontData& patch,
+      const common::BrotliBinaryDiff& brotli_diff);
+
+ private:
   const common::FontData& font_;
   common::CompatId base_compat_id_;
   absl::flat_hash_set<hb_tag_t> tags_;
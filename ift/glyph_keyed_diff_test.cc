@@ -3,19 +3,23 @@
 #include "absl/status/statusor.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
+#include "common/brotli_binary_diff.h"
 #include "common/brotli_binary_patch.h"
 #include "common/compat_id.h"
 #include "common/font_data.h"
 #include "common/font_helper.h"
+#include "common/thread_pool.h"
 #include "gtest/gtest.h"
 #include "hb-subset.h"
 #include "hb.h"
 #include "ift/proto/ift_table.h"
 
+using absl::btree_set;
 using absl::flat_hash_set;
 using absl::StatusOr;
 using absl::StrCat;
 using absl::string_view;
+using common::BrotliBinaryDiff;
 using common::BrotliBinaryPatch;
 using common::CompatId;
 using common::FontData;
@@ -26,6 +30,7 @@ using common::hb_font_unique_ptr;
 using common::make_hb_blob;
 using common::make_hb_face;
 using common::make_hb_font;
+using common::ThreadPool;
 using ift::proto::IFTTable;
 
 const uint8_t data_stream_u16_short_loca[] = {
@@ -106,6 +111,7 @@ class GlyphKeyedDiffTest : public ::testing::Test {
     original = from_file("ift/testdata/NotoSansJP-Regular.subset.ttf");
     roboto = from_file("common/testdata/Roboto-Regular.Awesome.ttf");
     roboto_vf = from_file("common/testdata/Roboto[wdth,wght].abcd.ttf");
+    ahem = from_file("common/testdata/Ahem.optimized.otf");
   }
 
   FontData from_file(const char* filename) {
@@ -141,6 +147,7 @@ class GlyphKeyedDiffTest : public ::testing::Test {
   FontData original;
   FontData roboto;
   FontData roboto_vf;
+  FontData ahem;
   BrotliBinaryPatch unbrotli;
 };
 
@@ -355,6 +362,56 @@ TEST_F(GlyphKeyedDiffTest, CreatePatch_GlyfGvar) {
   ASSERT_EQ(uncompressed_stream.str(), data_stream);
 }
 
+TEST_F(GlyphKeyedDiffTest, CreatePatch_Cff) {
+  const uint8_t data_stream_header[] = {
+      0x00, 0x00, 0x00, 0x03,  // glyphCount
+      0x01,                    // table count
+
+      // glyphIds[3]
+      0x00, 0x00,  // gid 0
+      0x00, 0x01,  // gid 1
+      0x00, 0xf4,  // gid 244
+
+      // tables[1]
+      'C', 'F', 'F', ' ',
+
+      // offset stream
+      0x00, 0x00, 0x00, 0x1f,  // gid 0
+      0x00, 0x00, 0x00, 0x36,  // gid 1
+      0x00, 0x00, 0x00, 0x37,  // gid 244
+      0x00, 0x00, 0x00, 0x42,  // end
+  };
+
+  // glyf is not in the font and should be ignored.
+  GlyphKeyedDiff differ(ahem, CompatId(1, 2, 3, 4),
+                        {FontHelper::kGlyf, FontHelper::kCFF});
+  auto patch = differ.CreatePatch({0, 1, 244});
+  ASSERT_TRUE(patch.ok()) << patch.status();
+
+  FontData empty;
+  FontData compressed_stream(patch->str(29));
+  FontData uncompressed_stream;
+  auto status = unbrotli.Patch(empty, compressed_stream, &uncompressed_stream);
+  ASSERT_TRUE(status.ok()) << status;
+
+  hb_face_unique_ptr face = ahem.face();
+  std::string data_stream((const char*)data_stream_header, 31);
+  for (uint32_t gid : {0, 1, 244}) {
+    auto charstring = FontHelper::CffData(face.get(), gid);
+    ASSERT_TRUE(charstring.ok()) << charstring.status();
+    data_stream.append(*charstring);
+  }
+
+  ASSERT_EQ(uncompressed_stream.str(), data_stream);
+}
+
+TEST_F(GlyphKeyedDiffTest, CreatePatch_Cff_InvalidGid) {
+  GlyphKeyedDiff differ(ahem, CompatId(1, 2, 3, 4), {FontHelper::kCFF});
+  auto patch = differ.CreatePatch({1, 245});  // gid 245 is not in the font
+  ASSERT_EQ(patch.status(),
+            absl::NotFoundError("Entry 245 not found in offset table."));
+}
+
 TEST_F(GlyphKeyedDiffTest, CreatePatch_Glyf_InvalidGid) {
   GlyphKeyedDiff differ(roboto, CompatId(1, 2, 3, 4), {FontHelper::kGlyf});
   auto patch =
@@ -372,6 +429,73 @@ TEST_F(GlyphKeyedDiffTest, CreatePatch_Glyf_InvalidTable) {
                 "Unsupported table type for glyph keyed diff."));
 }
 
+TEST_F(GlyphKeyedDiffTest, CreatePatches) {
+  GlyphKeyedDiff differ(roboto_vf, CompatId(1, 2, 3, 4),
+                        {FontHelper::kGlyf, FontHelper::kGvar});
+  std::vector<btree_set<uint32_t>> gid_sets = {{1, 3}, {2}, {2, 3, 4}, {1}};
+
+  ThreadPool pool(2);
+  for (ThreadPool* p : {(ThreadPool*)nullptr, &pool}) {
+    auto patches = differ.CreatePatches(gid_sets, p);
+    ASSERT_TRUE(patches.ok()) << patches.status();
+    ASSERT_EQ(patches->size(), gid_sets.size());
+
+    for (uint32_t i = 0; i < gid_sets.size(); i++) {
+      auto expected = differ.CreatePatch(gid_sets[i]);
+      ASSERT_TRUE(expected.ok()) << expected.status();
+      ASSERT_EQ(patches->at(i).str(), expected->str());
+    }
+  }
+}
+
+TEST_F(GlyphKeyedDiffTest, CreatePatches_InvalidGid) {
+  GlyphKeyedDiff differ(roboto, CompatId(1, 2, 3, 4), {FontHelper::kGlyf});
+  std::vector<btree_set<uint32_t>> gid_sets = {{37, 40}, {73, 100}};
+  auto patches = differ.CreatePatches(gid_sets);
+  ASSERT_EQ(patches.status(),
+            absl::NotFoundError("Entry 100 not found in offset table."));
+}
+
+TEST_F(GlyphKeyedDiffTest, WithCompatId) {
+  GlyphKeyedDiff differ(roboto, CompatId(1, 2, 3, 4), {FontHelper::kGlyf});
+  GlyphKeyedDiff other_differ(roboto, CompatId(5, 6, 7, 8),
+                              {FontHelper::kGlyf});
+
+  auto patch = differ.CreatePatch({37, 40, 73});
+  ASSERT_TRUE(patch.ok()) << patch.status();
+  auto expected = other_differ.CreatePatch({37, 40, 73});
+  ASSERT_TRUE(expected.ok()) << expected.status();
+
+  auto updated = GlyphKeyedDiff::WithCompatId(*patch, CompatId(5, 6, 7, 8));
+  ASSERT_TRUE(updated.ok()) << updated.status();
+  ASSERT_EQ(updated->str(), expected->str());
+
+  FontData not_a_patch("ifgk");
+  ASSERT_TRUE(absl::IsInvalidArgument(
+      GlyphKeyedDiff::WithCompatId(not_a_patch, CompatId(5, 6, 7, 8))
+          .status()));
+}
+
+TEST_F(GlyphKeyedDiffTest, Recompress) {
+  GlyphKeyedDiff draft_differ(roboto, CompatId(1, 2, 3, 4),
+                              {FontHelper::kGlyf}, 1);
+  GlyphKeyedDiff differ(roboto, CompatId(1, 2, 3, 4), {FontHelper::kGlyf});
+
+  auto patch = draft_differ.CreatePatch({37, 40, 73});
+  ASSERT_TRUE(patch.ok()) << patch.status();
+  auto expected = differ.CreatePatch({37, 40, 73});
+  ASSERT_TRUE(expected.ok()) << expected.status();
+
+  auto recompressed =
+      GlyphKeyedDiff::Recompress(*patch, BrotliBinaryDiff(11));
+  ASSERT_TRUE(recompressed.ok()) << recompressed.status();
+  ASSERT_EQ(recompressed->str(), expected->str());
+
+  FontData not_a_patch("iftk");
+  ASSERT_TRUE(absl::IsInvalidArgument(
+      GlyphKeyedDiff::Recompress(not_a_patch, BrotliBinaryDiff(11)).status()));
+}
+
 // TODO(garretrieger): more tests for glyph keyed patch creation:
 // - long loca
 // - overflow tests
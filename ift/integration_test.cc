@@ -1,7 +1,10 @@
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "absl/container/flat_hash_set.h"
 #include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
 #include "common/axis_range.h"
 #include "common/font_data.h"
 #include "common/font_helper.h"
@@ -10,7 +13,10 @@
 #include "gtest/gtest.h"
 #include "hb.h"
 #include "ift/client/fontations_client.h"
+#include "ift/client/ift_client.h"
 #include "ift/encoder/encoder.h"
+#include "ift/proto/format_2_patch_map.h"
+#include "ift/proto/ift_table.h"
 #include "ift/proto/patch_map.h"
 #include "ift/testdata/test_segments.h"
 
@@ -189,6 +195,98 @@ class IntegrationTest : public ::testing::Test {
     return flags_1 == 0x01;
   }
 
+  // Extends the init font of 'encoding' for 'codepoints' with the in process
+  // client (client::IftClient) and checks that the result matches 'expected',
+  // the font produced by the fontations client. Glyph data is compared per
+  // glyph ignoring trailing zero padding, and the patch maps are compared by
+  // their remaining (not yet applied) entries.
+  ::testing::AssertionResult NativeClientMatches(
+      const Encoder::Encoding& encoding, btree_set<uint32_t> codepoints,
+      const FontData& expected) {
+    client::MemoryPatchProvider provider(encoding.patches);
+    client::IftClient client(provider);
+    auto native = client.Extend(encoding.init_font,
+                                {.codepoints = std::move(codepoints)});
+    if (!native.ok()) {
+      return ::testing::AssertionFailure()
+             << "native client failed: " << native.status();
+    }
+
+    auto expected_face = expected.face();
+    auto native_face = native->face();
+    auto tags = FontHelper::GetTags(expected_face.get());
+    if (tags != FontHelper::GetTags(native_face.get())) {
+      return ::testing::AssertionFailure() << "table sets differ.";
+    }
+    uint32_t glyph_count = hb_face_get_glyph_count(expected_face.get());
+    if (glyph_count != hb_face_get_glyph_count(native_face.get())) {
+      return ::testing::AssertionFailure() << "glyph counts differ.";
+    }
+
+    for (hb_tag_t tag : tags) {
+      if (tag == FontHelper::kLoca) {
+        // Compared along with glyf.
+        continue;
+      }
+
+      if (tag == FontHelper::kGlyf || tag == FontHelper::kGvar) {
+        for (uint32_t gid = 0; gid < glyph_count; gid++) {
+          auto a = tag == FontHelper::kGlyf
+                       ? FontHelper::GlyfData(expected_face.get(), gid)
+                       : FontHelper::GvarData(expected_face.get(), gid);
+          auto b = tag == FontHelper::kGlyf
+                       ? FontHelper::GlyfData(native_face.get(), gid)
+                       : FontHelper::GvarData(native_face.get(), gid);
+          if (!a.ok() || !b.ok() || StripPadding(*a) != StripPadding(*b)) {
+            return ::testing::AssertionFailure()
+                   << FontHelper::ToString(tag) << " data differs for gid "
+                   << gid;
+          }
+        }
+        continue;
+      }
+
+      if (tag == FontHelper::kIFT || tag == FontHelper::kIFTX) {
+        auto a = proto::Format2PatchMap::Deserialize(
+            FontHelper::TableData(expected_face.get(), tag).str());
+        auto b = proto::Format2PatchMap::Deserialize(
+            FontHelper::TableData(native_face.get(), tag).str());
+        if (!a.ok() || !b.ok() || !(a->GetId() == b->GetId()) ||
+            a->GetUrlTemplate() != b->GetUrlTemplate() ||
+            RemainingEntries(*a) != RemainingEntries(*b)) {
+          return ::testing::AssertionFailure()
+                 << FontHelper::ToString(tag) << " patch maps differ.";
+        }
+        continue;
+      }
+
+      if (FontHelper::TableData(expected_face.get(), tag) !=
+          FontHelper::TableData(native_face.get(), tag)) {
+        return ::testing::AssertionFailure()
+               << FontHelper::ToString(tag) << " tables differ.";
+      }
+    }
+    return ::testing::AssertionSuccess();
+  }
+
+  static absl::string_view StripPadding(absl::string_view data) {
+    while (!data.empty() && data.back() == '\0') {
+      data.remove_suffix(1);
+    }
+    return data;
+  }
+
+  static std::vector<PatchMap::Entry> RemainingEntries(
+      const proto::IFTTable& table) {
+    std::vector<PatchMap::Entry> entries;
+    for (const auto& entry : table.GetPatchMap().GetEntries()) {
+      if (!entry.ignored) {
+        entries.push_back(entry);
+      }
+    }
+    return entries;
+  }
+
   FontData noto_sans_jp_;
   FontData noto_sans_vf_;
 
@@ -288,6 +386,7 @@ TEST_F(IntegrationTest, TableKeyedOnly) {
 
   auto extended = Extend(*encoding, {0x49});
   ASSERT_TRUE(extended.ok()) << extended.status();
+  ASSERT_TRUE(NativeClientMatches(*encoding, {0x49}, *extended));
 
   auto extended_face = extended->face();
   codepoints = FontHelper::ToCodepointsSet(extended_face.get());
@@ -539,6 +638,8 @@ TEST_F(IntegrationTest, MixedMode) {
 
   auto extended = Extend(*encoding, {chunk3_cp, chunk4_cp});
   ASSERT_TRUE(extended.ok()) << extended.status();
+  ASSERT_TRUE(
+      NativeClientMatches(*encoding, {chunk3_cp, chunk4_cp}, *extended));
   auto extended_face = extended->face();
 
   codepoints = FontHelper::ToCodepointsSet(extended_face.get());
@@ -747,6 +848,7 @@ TEST_F(IntegrationTest, MixedMode_LocaLenChange) {
   // ### Phase 1 ###
   auto extended = Extend(*encoding, {chunk3_cp});
   ASSERT_TRUE(extended.ok()) << extended.status();
+  ASSERT_TRUE(NativeClientMatches(*encoding, {chunk3_cp}, *extended));
   auto extended_face = extended->face();
 
   uint32_t gid_count_1 = hb_face_get_glyph_count(encoded_face.get());
@@ -756,6 +858,8 @@ TEST_F(IntegrationTest, MixedMode_LocaLenChange) {
   encoding->init_font.shallow_copy(*extended);
   extended = Extend(*encoding, {chunk2_cp, chunk3_cp});
   ASSERT_TRUE(extended.ok()) << extended.status();
+  ASSERT_TRUE(
+      NativeClientMatches(*encoding, {chunk2_cp, chunk3_cp}, *extended));
   extended_face = extended->face();
 
   uint32_t gid_count_3 = hb_face_get_glyph_count(extended_face.get());
@@ -807,12 +911,15 @@ TEST_F(IntegrationTest, MixedMode_Complex) {
   // Phase 1
   auto extended = Extend(*encoding, {chunk1_cp});
   ASSERT_TRUE(extended.ok()) << extended.status();
+  ASSERT_TRUE(NativeClientMatches(*encoding, {chunk1_cp}, *extended));
   auto extended_face = extended->face();
 
   // Phase 2
   encoding->init_font.shallow_copy(*extended);
   extended = Extend(*encoding, {chunk1_cp, chunk3_cp});
   ASSERT_TRUE(extended.ok()) << extended.status();
+  ASSERT_TRUE(
+      NativeClientMatches(*encoding, {chunk1_cp, chunk3_cp}, *extended));
   extended_face = extended->face();
 
   // Check the results
@@ -852,6 +959,8 @@ TEST_F(IntegrationTest, MixedMode_SequentialDependentPatches) {
 
   auto extended = Extend(*encoding, {chunk3_cp, chunk4_cp});
   ASSERT_TRUE(extended.ok()) << extended.status();
+  ASSERT_TRUE(
+      NativeClientMatches(*encoding, {chunk3_cp, chunk4_cp}, *extended));
   auto extended_face = extended->face();
 
   auto codepoints = FontHelper::ToCodepointsSet(extended_face.get());
@@ -57,6 +57,20 @@ static StatusOr<uint8_t> EncodingToInt(PatchEncoding encoding) {
       StrCat("Unknown patch encoding, ", encoding));
 }
 
+static StatusOr<PatchEncoding> IntToEncoding(uint8_t value) {
+  switch (value) {
+    case 1:
+      return TABLE_KEYED_FULL;
+    case 2:
+      return TABLE_KEYED_PARTIAL;
+    case 3:
+      return GLYPH_KEYED;
+    default:
+      return absl::InvalidArgumentError(
+          StrCat("Unknown patch format, ", (int)value));
+  }
+}
+
 static PatchEncoding PickDefaultEncoding(const PatchMap& patch_map) {
   uint32_t counts[4] = {0, 0, 0};
   for (const auto& e : patch_map.GetEntries()) {
@@ -92,7 +106,115 @@ static uint8_t BiasFormat(uint8_t bias_bytes);
 static Status EncodeAxisSegment(hb_tag_t tag, const common::AxisRange& range,
                                 std::string& out);
 
-static Status EncodeEntries(Span<const PatchMap::Entry> entries,
+static Status DecodeAxisSegment(string_view data, hb_tag_t& tag,
+                                common::AxisRange& range);
+
+static StatusOr<string_view> DecodeEntry(string_view data,
+                                  uint32_t& last_entry_index,
+                                  PatchEncoding default_encoding,
+                                  PatchMap& out) {
+  PatchMap::Coverage coverage;
+
+  READ_UINT8(format, data, 0);
+  data = ClippedSubstr(data, 1);
+
+  if (format & features_and_design_space_bit_mask) {
+    READ_UINT8(feature_count, data, 0);
+    data = ClippedSubstr(data, 1);
+    for (uint32_t i = 0; i < feature_count; i++) {
+      READ_UINT32(tag, data, 0);
+      data = ClippedSubstr(data, 4);
+      coverage.features.insert(tag);
+    }
+
+    READ_UINT16(segment_count, data, 0);
+    data = ClippedSubstr(data, 2);
+    for (uint32_t i = 0; i < segment_count; i++) {
+      hb_tag_t tag;
+      common::AxisRange range;
+      auto s = DecodeAxisSegment(data, tag, range);
+      if (!s.ok()) {
+        return s;
+      }
+      data = ClippedSubstr(data, 12);
+      coverage.design_space[tag] = range;
+    }
+  }
+
+  if (format & child_indices_bit_mask) {
+    READ_UINT8(count, data, 0);
+    data = ClippedSubstr(data, 1);
+    // MSB is the match mode, the remaining 7 bits are the count.
+    coverage.conjunctive = count & 0b10000000;
+    count &= 0b01111111;
+    for (uint32_t i = 0; i < count; i++) {
+      READ_UINT24(index, data, 0);
+      data = ClippedSubstr(data, 3);
+      coverage.child_indices.insert(index);
+    }
+  }
+
+  int64_t delta = 0;
+  if (format & index_delta_bit_mask) {
+    READ_UINT24(value, data, 0);
+    data = ClippedSubstr(data, 3);
+    // Sign extend the int24.
+    delta = (value & 0x800000) ? (int64_t)value - 0x1000000 : value;
+  }
+  int64_t patch_index = (int64_t)last_entry_index + 1 + delta;
+  if (patch_index < 0 || patch_index > 0xFFFFFFFF) {
+    return absl::InvalidArgumentError(
+        StrCat("Entry index out of range: ", patch_index));
+  }
+
+  PatchEncoding encoding = default_encoding;
+  if (format & encoding_bit_mask) {
+    READ_UINT8(encoding_value, data, 0);
+    data = ClippedSubstr(data, 1);
+    auto e = IntToEncoding(encoding_value);
+    if (!e.ok()) {
+      return e.status();
+    }
+    encoding = *e;
+  }
+
+  uint8_t codepoint_format = format & codepoint_bit_mask;
+  if (codepoint_format) {
+    uint32_t bias = 0;
+    if (codepoint_format == two_byte_bias) {
+      READ_UINT16(value, data, 0);
+      data = ClippedSubstr(data, 2);
+      bias = value;
+    } else if (codepoint_format == three_byte_bias) {
+      READ_UINT24(value, data, 0);
+      data = ClippedSubstr(data, 3);
+      bias = value;
+    }
+
+    hb_set_unique_ptr codepoints = make_hb_set();
+    auto remaining = SparseBitSet::Decode(data, codepoints.get());
+    if (!remaining.ok()) {
+      return remaining.status();
+    }
+    data = *remaining;
+
+    hb_codepoint_t cp = HB_SET_VALUE_INVALID;
+    while (hb_set_next(codepoints.get(), &cp)) {
+      coverage.codepoints.insert(cp + bias);
+    }
+  }
+
+  bool ignored = format & ignore_bit_mask;
+  auto s = out.AddEntry(coverage, patch_index, encoding, ignored);
+  if (!s.ok()) {
+    return s;
+  }
+
+  last_entry_index = patch_index;
+  return data;
+}
+
+Status EncodeEntries(Span<const PatchMap::Entry> entries,
                             PatchEncoding default_encoding, std::string& out);
 
 static Status EncodeEntry(const PatchMap::Entry& entry,
@@ -103,6 +225,11 @@ static void EncodeCodepoints(uint8_t bias_bytes,
                              const PatchMap::Coverage& coverage,
                              std::string& out);
 
+static StatusOr<string_view> DecodeEntry(string_view data,
+                                         uint32_t& last_entry_index,
+                                         PatchEncoding default_encoding,
+                                         PatchMap& out);
+
 StatusOr<std::string> Format2PatchMap::Serialize(const IFTTable& ift_table) {
   // TODO(garretrieger): pre-reserve estimated capacity based on patch_map.
   std::string out;
@@ -150,6 +277,62 @@ StatusOr<std::string> Format2PatchMap::Serialize(const IFTTable& ift_table) {
   return out;
 }
 
+StatusOr<IFTTable> Format2PatchMap::Deserialize(string_view data) {
+  constexpr int header_min_length = 35;
+  if (data.size() < header_min_length) {
+    return absl::InvalidArgumentError("Patch map table is too short.");
+  }
+
+  READ_UINT8(format, data, 0);
+  if (format != 0x02) {
+    return absl::InvalidArgumentError(
+        StrCat("Unsupported patch map format, ", (int)format));
+  }
+
+  uint32_t id_values[4];
+  for (uint32_t i = 0; i < 4; i++) {
+    READ_UINT32(value, data, 5 + i * 4);
+    id_values[i] = value;
+  }
+
+  READ_UINT8(default_encoding_value, data, 21);
+  auto default_encoding = IntToEncoding(default_encoding_value);
+  if (!default_encoding.ok()) {
+    return default_encoding.status();
+  }
+
+  READ_UINT24(entry_count, data, 22);
+  READ_UINT32(entries_offset, data, 25);
+  READ_UINT32(id_strings_offset, data, 29);
+  if (id_strings_offset) {
+    return absl::UnimplementedError("String entry ids are not supported.");
+  }
+
+  READ_UINT16(uri_template_length, data, 33);
+  READ_STRING(uri_template, data, header_min_length, uri_template_length);
+
+  if (entries_offset > data.size()) {
+    return absl::InvalidArgumentError("Entries offset is out of bounds.");
+  }
+
+  IFTTable table;
+  table.SetId(CompatId(id_values));
+  table.SetUrlTemplate(uri_template);
+
+  string_view entries = data.substr(entries_offset);
+  uint32_t last_entry_index = 0;
+  for (uint32_t i = 0; i < entry_count; i++) {
+    auto remaining = DecodeEntry(entries, last_entry_index, *default_encoding,
+                                 table.GetPatchMap());
+    if (!remaining.ok()) {
+      return remaining.status();
+    }
+    entries = *remaining;
+  }
+
+  return table;
+}
+
 Status DecodeAxisSegment(absl::string_view data, hb_tag_t& tag,
                          common::AxisRange& range) {
   READ_UINT32(tag_v, data, 0);
@@ -175,6 +358,111 @@ Status EncodeAxisSegment(hb_tag_t tag, const common::AxisRange& range,
   return absl::OkStatus();
 }
 
+StatusOr<string_view> DecodeEntry(string_view data,
+                                  uint32_t& last_entry_index,
+                                  PatchEncoding default_encoding,
+                                  PatchMap& out) {
+  PatchMap::Coverage coverage;
+
+  READ_UINT8(format, data, 0);
+  data = ClippedSubstr(data, 1);
+
+  if (format & features_and_design_space_bit_mask) {
+    READ_UINT8(feature_count, data, 0);
+    data = ClippedSubstr(data, 1);
+    for (uint32_t i = 0; i < feature_count; i++) {
+      READ_UINT32(tag, data, 0);
+      data = ClippedSubstr(data, 4);
+      coverage.features.insert(tag);
+    }
+
+    READ_UINT16(segment_count, data, 0);
+    data = ClippedSubstr(data, 2);
+    for (uint32_t i = 0; i < segment_count; i++) {
+      hb_tag_t tag;
+      common::AxisRange range;
+      auto s = DecodeAxisSegment(data, tag, range);
+      if (!s.ok()) {
+        return s;
+      }
+      data = ClippedSubstr(data, 12);
+      coverage.design_space[tag] = range;
+    }
+  }
+
+  if (format & child_indices_bit_mask) {
+    READ_UINT8(count, data, 0);
+    data = ClippedSubstr(data, 1);
+    // MSB is the match mode, the remaining 7 bits are the count.
+    coverage.conjunctive = count & 0b10000000;
+    count &= 0b01111111;
+    for (uint32_t i = 0; i < count; i++) {
+      READ_UINT24(index, data, 0);
+      data = ClippedSubstr(data, 3);
+      coverage.child_indices.insert(index);
+    }
+  }
+
+  int64_t delta = 0;
+  if (format & index_delta_bit_mask) {
+    READ_UINT24(value, data, 0);
+    data = ClippedSubstr(data, 3);
+    // Sign extend the int24.
+    delta = (value & 0x800000) ? (int64_t)value - 0x1000000 : value;
+  }
+  int64_t patch_index = (int64_t)last_entry_index + 1 + delta;
+  if (patch_index < 0 || patch_index > 0xFFFFFFFF) {
+    return absl::InvalidArgumentError(
+        StrCat("Entry index out of range: ", patch_index));
+  }
+
+  PatchEncoding encoding = default_encoding;
+  if (format & encoding_bit_mask) {
+    READ_UINT8(encoding_value, data, 0);
+    data = ClippedSubstr(data, 1);
+    auto e = IntToEncoding(encoding_value);
+    if (!e.ok()) {
+      return e.status();
+    }
+    encoding = *e;
+  }
+
+  uint8_t codepoint_format = format & codepoint_bit_mask;
+  if (codepoint_format) {
+    uint32_t bias = 0;
+    if (codepoint_format == two_byte_bias) {
+      READ_UINT16(value, data, 0);
+      data = ClippedSubstr(data, 2);
+      bias = value;
+    } else if (codepoint_format == three_byte_bias) {
+      READ_UINT24(value, data, 0);
+      data = ClippedSubstr(data, 3);
+      bias = value;
+    }
+
+    hb_set_unique_ptr codepoints = make_hb_set();
+    auto remaining = SparseBitSet::Decode(data, codepoints.get());
+    if (!remaining.ok()) {
+      return remaining.status();
+    }
+    data = *remaining;
+
+    hb_codepoint_t cp = HB_SET_VALUE_INVALID;
+    while (hb_set_next(codepoints.get(), &cp)) {
+      coverage.codepoints.insert(cp + bias);
+    }
+  }
+
+  bool ignored = format & ignore_bit_mask;
+  auto s = out.AddEntry(coverage, patch_index, encoding, ignored);
+  if (!s.ok()) {
+    return s;
+  }
+
+  last_entry_index = patch_index;
+  return data;
+}
+
 Status EncodeEntries(Span<const PatchMap::Entry> entries,
                      PatchEncoding default_encoding, std::string& out) {
   // TODO(garretrieger): identify and copy existing entries when possible.
@@ -2,6 +2,7 @@
 #define IFT_PROTO_FORMAT_2_PATCH_MAP_H_
 
 #include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
 #include "ift/proto/ift_table.h"
 
 namespace ift::proto {
@@ -9,6 +10,13 @@ namespace ift::proto {
 class Format2PatchMap {
  public:
   static absl::StatusOr<std::string> Serialize(const IFTTable& ift_table);
+
+  /*
+   * Decodes a format 2 patch map table (as found in 'IFT ' or 'IFTX'). The
+   * entries are listed in the same order as in the table. Entries which use
+   * string ids are not supported.
+   */
+  static absl::StatusOr<IFTTable> Deserialize(absl::string_view data);
 };
 
 }  // namespace ift::proto
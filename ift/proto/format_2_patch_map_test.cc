@@ -374,5 +374,79 @@ TEST_F(Format2PatchMapTest, IndexDeltas) {
 
   ASSERT_EQ(*encoded, absl::StrCat(header, entry_0, entry_1, entry_2));
 }
+TEST_F(Format2PatchMapTest, Deserialize) {
+  IFTTable table;
+  PatchMap& map = table.GetPatchMap();
+  PatchMap::Coverage coverage{1, 2, 3};
+  auto sc = map.AddEntry(coverage, 7, TABLE_KEYED_FULL);
+
+  PatchMap::Coverage biased{0x10400, 0x10401, 0x10500};
+  sc.Update(map.AddEntry(biased, 4, GLYPH_KEYED, true));
+
+  PatchMap::Coverage features_and_design_space{300, 301};
+  features_and_design_space.features.insert(HB_TAG('s', 'm', 'c', 'p'));
+  features_and_design_space.design_space[HB_TAG('w', 'g', 'h', 't')] =
+      *common::AxisRange::Range(100, 400);
+  sc.Update(map.AddEntry(features_and_design_space, 5, TABLE_KEYED_PARTIAL));
+
+  PatchMap::Coverage children;
+  children.child_indices.insert(0);
+  children.child_indices.insert(2);
+  children.conjunctive = true;
+  sc.Update(map.AddEntry(children, 6, GLYPH_KEYED));
+  ASSERT_TRUE(sc.ok()) << sc;
+
+  table.SetUrlTemplate("foo/$1");
+  table.SetId({1, 2, 3, 4});
+
+  auto encoded = Format2PatchMap::Serialize(table);
+  ASSERT_TRUE(encoded.ok()) << encoded.status();
+
+  auto decoded = Format2PatchMap::Deserialize(*encoded);
+  ASSERT_TRUE(decoded.ok()) << decoded.status();
+  ASSERT_EQ(*decoded, table);
+
+  auto entries = decoded->GetPatchMap().GetEntries();
+  ASSERT_EQ(entries.size(), 4);
+  ASSERT_TRUE(entries[1].ignored);
+  ASSERT_TRUE(entries[3].coverage.conjunctive);
+  ASSERT_THAT(entries[3].coverage.child_indices, UnorderedElementsAre(0, 2));
+}
+
+TEST_F(Format2PatchMapTest, Deserialize_Invalid) {
+  IFTTable table;
+  PatchMap::Coverage coverage{1, 2, 3};
+  auto sc = table.GetPatchMap().AddEntry(coverage, 7, TABLE_KEYED_FULL);
+  ASSERT_TRUE(sc.ok()) << sc;
+  table.SetUrlTemplate("foo/$1");
+
+  auto encoded = Format2PatchMap::Serialize(table);
+  ASSERT_TRUE(encoded.ok()) << encoded.status();
+
+  // Truncated in the middle of the entry id delta.
+  auto decoded = Format2PatchMap::Deserialize(
+      absl::string_view(*encoded).substr(0, encoded->size() - 4));
+  ASSERT_TRUE(absl::IsInvalidArgument(decoded.status())) << decoded.status();
+
+  // Truncated header.
+  decoded = Format2PatchMap::Deserialize(
+      absl::string_view(*encoded).substr(0, 20));
+  ASSERT_TRUE(absl::IsInvalidArgument(decoded.status())) << decoded.status();
+
+  // Wrong format.
+  std::string format_1 = *encoded;
+  format_1[0] = 0x01;
+  decoded = Format2PatchMap::Deserialize(format_1);
+  ASSERT_TRUE(absl::IsInvalidArgument(decoded.status())) << decoded.status();
+
+  // Child index that refers to a later entry.
+  std::string entries = {
+      0b00000010,        // format = Copy Indices
+      0b00000001,        // count = 1
+      0,          0, 0,  // 0
+  };
+  decoded = Format2PatchMap::Deserialize(absl::StrCat(HeaderSimple(), entries));
+  ASSERT_TRUE(absl::IsInvalidArgument(decoded.status())) << decoded.status();
+}
 
-}  // namespace ift::proto
\ No newline at end of file
+}  // namespace ift::proto
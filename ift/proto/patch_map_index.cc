@@ -0,0 +1,146 @@
+#include "ift/proto/patch_map_index.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "absl/container/btree_set.h"
+#include "absl/container/flat_hash_map.h"
+#include "common/axis_range.h"
+#include "hb.h"
+#include "ift/proto/patch_map.h"
+
+using absl::btree_set;
+using absl::flat_hash_map;
+using common::AxisRange;
+
+namespace ift::proto {
+
+struct PatchMapIndex::Query {
+  const btree_set<hb_tag_t>& features;
+  const flat_hash_map<hb_tag_t, AxisRange>& design_space;
+  // Entry index -> number of target codepoints in the entry's own coverage.
+  // Only holds entries with at least one.
+  flat_hash_map<uint32_t, uint32_t> codepoint_hits;
+  flat_hash_map<uint32_t, Result> memo;
+};
+
+PatchMapIndex::PatchMapIndex(const PatchMap& patch_map)
+    : entries_(patch_map.GetEntries()) {
+  for (uint32_t i = 0; i < entries_.size(); i++) {
+    const auto& coverage = entries_[i].coverage;
+    if (!coverage.codepoints.empty()) {
+      for (uint32_t cp : coverage.codepoints) {
+        by_codepoint_[cp].push_back(i);
+      }
+    } else if (!coverage.features.empty()) {
+      for (hb_tag_t tag : coverage.features) {
+        by_feature_[tag].push_back(i);
+      }
+    } else if (!coverage.design_space.empty()) {
+      for (const auto& [tag, range] : coverage.design_space) {
+        by_axis_[tag].push_back(i);
+      }
+    } else {
+      unconstrained_.push_back(i);
+    }
+  }
+}
+
+std::vector<PatchMapIndex::Match> PatchMapIndex::Activated(
+    const btree_set<uint32_t>& codepoints, const btree_set<hb_tag_t>& features,
+    const flat_hash_map<hb_tag_t, AxisRange>& design_space) const {
+  Query query{features, design_space, {}, {}};
+
+  btree_set<uint32_t> candidates;
+  for (uint32_t cp : codepoints) {
+    auto it = by_codepoint_.find(cp);
+    if (it == by_codepoint_.end()) {
+      continue;
+    }
+    for (uint32_t index : it->second) {
+      if (query.codepoint_hits[index]++ == 0) {
+        candidates.insert(index);
+      }
+    }
+  }
+  for (hb_tag_t tag : features) {
+    auto it = by_feature_.find(tag);
+    if (it != by_feature_.end()) {
+      candidates.insert(it->second.begin(), it->second.end());
+    }
+  }
+  for (const auto& [tag, range] : design_space) {
+    auto it = by_axis_.find(tag);
+    if (it != by_axis_.end()) {
+      candidates.insert(it->second.begin(), it->second.end());
+    }
+  }
+  candidates.insert(unconstrained_.begin(), unconstrained_.end());
+
+  std::vector<Match> result;
+  for (uint32_t index : candidates) {
+    if (entries_[index].ignored) {
+      continue;
+    }
+    Result r = Evaluate(index, query);
+    if (r.matches) {
+      result.push_back(Match{index, r.codepoint_intersection});
+    }
+  }
+  return result;
+}
+
+PatchMapIndex::Result PatchMapIndex::Evaluate(uint32_t entry_index,
+                                              Query& query) const {
+  auto memoized = query.memo.find(entry_index);
+  if (memoized != query.memo.end()) {
+    return memoized->second;
+  }
+
+  const auto& coverage = entries_[entry_index].coverage;
+  auto hits = query.codepoint_hits.find(entry_index);
+  Result result{true, hits != query.codepoint_hits.end() ? hits->second : 0};
+
+  if (!coverage.codepoints.empty() && !result.codepoint_intersection) {
+    result.matches = false;
+  }
+
+  if (result.matches && !coverage.features.empty()) {
+    result.matches =
+        std::any_of(coverage.features.begin(), coverage.features.end(),
+                    [&](hb_tag_t tag) { return query.features.contains(tag); });
+  }
+
+  if (result.matches && !coverage.design_space.empty()) {
+    result.matches = std::any_of(
+        coverage.design_space.begin(), coverage.design_space.end(),
+        [&](const auto& e) {
+          auto it = query.design_space.find(e.first);
+          return it != query.design_space.end() &&
+                 it->second.Intersects(e.second);
+        });
+  }
+
+  if (result.matches && !coverage.child_indices.empty()) {
+    // Only references to earlier entries are valid (as enforced by
+    // PatchMap::AddEntry), which also guarantees this recursion terminates.
+    bool all = true;
+    bool any = false;
+    for (uint32_t child : coverage.child_indices) {
+      Result child_result = child < entry_index ? Evaluate(child, query)
+                                                : Result{false, 0};
+      all = all && child_result.matches;
+      any = any || child_result.matches;
+      if (child_result.matches) {
+        result.codepoint_intersection += child_result.codepoint_intersection;
+      }
+    }
+    result.matches = coverage.conjunctive ? all : any;
+  }
+
+  query.memo[entry_index] = result;
+  return result;
+}
+
+}  // namespace ift::proto
@@ -0,0 +1,79 @@
+#ifndef IFT_PROTO_PATCH_MAP_INDEX_H_
+#define IFT_PROTO_PATCH_MAP_INDEX_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "absl/container/btree_set.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/types/span.h"
+#include "common/axis_range.h"
+#include "hb.h"
+#include "ift/proto/patch_map.h"
+
+namespace ift::proto {
+
+/*
+ * Query index over the entries of a PatchMap, answers "which entries does
+ * this subset definition activate?" without visiting every entry.
+ *
+ * Each entry is filed under its most selective condition: the codepoints it
+ * covers, otherwise its feature tags, otherwise its design space axes. Entries
+ * without any of these (for example pure child entry combinations) are always
+ * evaluated. A query only visits the entries reachable from the target plus
+ * the child entries they reference, child results are memoized per query.
+ *
+ * The index refers to the entries of 'patch_map' which must outlive it and
+ * not be modified.
+ */
+class PatchMapIndex {
+ public:
+  explicit PatchMapIndex(const PatchMap& patch_map);
+
+  struct Match {
+    // Index of the entry in PatchMap::GetEntries().
+    uint32_t entry_index;
+    // Number of target codepoints covered by the entry and all of its
+    // matching child entries, used to rank competing entries.
+    uint32_t codepoint_intersection;
+
+    bool operator==(const Match& other) const {
+      return entry_index == other.entry_index &&
+             codepoint_intersection == other.codepoint_intersection;
+    }
+  };
+
+  /*
+   * Returns the non ignored entries which match the target subset definition,
+   * ordered by entry index.
+   *
+   * An entry matches if each of its non empty codepoint, feature, and design
+   * space conditions intersects the target, and if it has child entries, all
+   * (conjunctive) or any (disjunctive) of them match.
+   */
+  std::vector<Match> Activated(
+      const absl::btree_set<uint32_t>& codepoints,
+      const absl::btree_set<hb_tag_t>& features,
+      const absl::flat_hash_map<hb_tag_t, common::AxisRange>& design_space)
+      const;
+
+ private:
+  struct Result {
+    bool matches;
+    uint32_t codepoint_intersection;
+  };
+
+  struct Query;
+
+  Result Evaluate(uint32_t entry_index, Query& query) const;
+
+  absl::Span<const PatchMap::Entry> entries_;
+  absl::flat_hash_map<uint32_t, std::vector<uint32_t>> by_codepoint_;
+  absl::flat_hash_map<hb_tag_t, std::vector<uint32_t>> by_feature_;
+  absl::flat_hash_map<hb_tag_t, std::vector<uint32_t>> by_axis_;
+  std::vector<uint32_t> unconstrained_;
+};
+
+}  // namespace ift::proto
+
+#endif  // IFT_PROTO_PATCH_MAP_INDEX_H_
@@ -0,0 +1,145 @@
+#include "ift/proto/patch_map_index.h"
+
+#include <vector>
+
+#include "absl/container/btree_set.h"
+#include "absl/container/flat_hash_map.h"
+#include "common/axis_range.h"
+#include "gtest/gtest.h"
+#include "hb.h"
+#include "ift/proto/patch_encoding.h"
+#include "ift/proto/patch_map.h"
+
+using absl::btree_set;
+using absl::flat_hash_map;
+using common::AxisRange;
+
+namespace ift::proto {
+
+typedef PatchMapIndex::Match Match;
+
+constexpr hb_tag_t kSmcp = HB_TAG('s', 'm', 'c', 'p');
+constexpr hb_tag_t kLiga = HB_TAG('l', 'i', 'g', 'a');
+constexpr hb_tag_t kWght = HB_TAG('w', 'g', 'h', 't');
+
+class PatchMapIndexTest : public ::testing::Test {
+ protected:
+  PatchMapIndexTest() {}
+
+  std::vector<Match> Activated(const PatchMap& map,
+                               const btree_set<uint32_t>& codepoints,
+                               const btree_set<hb_tag_t>& features = {},
+                               const flat_hash_map<hb_tag_t, AxisRange>&
+                                   design_space = {}) {
+    PatchMapIndex index(map);
+    return index.Activated(codepoints, features, design_space);
+  }
+};
+
+TEST_F(PatchMapIndexTest, Codepoints) {
+  PatchMap map{
+      {{1, 2, 3}, 1, TABLE_KEYED_FULL},
+      {{4, 5}, 2, GLYPH_KEYED},
+      {{}, 3, GLYPH_KEYED},
+      {{6}, 4, GLYPH_KEYED},
+  };
+
+  std::vector<Match> expected = {{0, 2}, {1, 1}, {2, 0}};
+  ASSERT_EQ(Activated(map, {2, 3, 4}), expected);
+
+  expected = {{2, 0}};
+  ASSERT_EQ(Activated(map, {}), expected);
+  ASSERT_EQ(Activated(map, {7}), expected);
+}
+
+TEST_F(PatchMapIndexTest, Ignored) {
+  PatchMap map;
+  ASSERT_TRUE(map.AddEntry({1, 2}, 1, GLYPH_KEYED, true).ok());
+  ASSERT_TRUE(map.AddEntry({2, 3}, 2, GLYPH_KEYED).ok());
+
+  std::vector<Match> expected = {{1, 1}};
+  ASSERT_EQ(Activated(map, {2}), expected);
+}
+
+TEST_F(PatchMapIndexTest, Features) {
+  PatchMap::Coverage features_only;
+  features_only.features = {kSmcp};
+
+  PatchMap::Coverage codepoints_and_features{1, 2};
+  codepoints_and_features.features = {kSmcp, kLiga};
+
+  PatchMap map;
+  ASSERT_TRUE(map.AddEntry(features_only, 1, GLYPH_KEYED).ok());
+  ASSERT_TRUE(map.AddEntry(codepoints_and_features, 2, GLYPH_KEYED).ok());
+
+  ASSERT_EQ(Activated(map, {1}), std::vector<Match>{});
+
+  std::vector<Match> expected = {{1, 1}};
+  ASSERT_EQ(Activated(map, {1}, {kLiga}), expected);
+
+  expected = {{0, 0}};
+  ASSERT_EQ(Activated(map, {5}, {kSmcp}), expected);
+
+  expected = {{0, 0}, {1, 2}};
+  ASSERT_EQ(Activated(map, {1, 2}, {kSmcp}), expected);
+}
+
+TEST_F(PatchMapIndexTest, DesignSpace) {
+  PatchMap::Coverage design_space_only;
+  design_space_only.design_space = {{kWght, *AxisRange::Range(300, 400)}};
+
+  PatchMap map;
+  ASSERT_TRUE(map.AddEntry(design_space_only, 1, GLYPH_KEYED).ok());
+
+  ASSERT_EQ(Activated(map, {1}), std::vector<Match>{});
+  ASSERT_EQ(Activated(map, {1}, {}, {{kWght, AxisRange::Point(500)}}),
+            std::vector<Match>{});
+
+  std::vector<Match> expected = {{0, 0}};
+  ASSERT_EQ(Activated(map, {1}, {}, {{kWght, *AxisRange::Range(350, 500)}}),
+            expected);
+}
+
+TEST_F(PatchMapIndexTest, ChildIndices) {
+  PatchMap::Coverage conjunctive;
+  conjunctive.child_indices = {0, 1};
+  conjunctive.conjunctive = true;
+
+  PatchMap::Coverage disjunctive;
+  disjunctive.child_indices = {0, 1};
+
+  // Children of children are evaluated as well.
+  PatchMap::Coverage nested{7};
+  nested.child_indices = {2};
+
+  PatchMap map;
+  ASSERT_TRUE(map.AddEntry({1, 2}, 1, GLYPH_KEYED, true).ok());
+  ASSERT_TRUE(map.AddEntry({3}, 2, GLYPH_KEYED, true).ok());
+  ASSERT_TRUE(map.AddEntry(conjunctive, 3, GLYPH_KEYED).ok());
+  ASSERT_TRUE(map.AddEntry(disjunctive, 4, GLYPH_KEYED).ok());
+  ASSERT_TRUE(map.AddEntry(nested, 5, GLYPH_KEYED).ok());
+
+  std::vector<Match> expected = {{3, 1}};
+  ASSERT_EQ(Activated(map, {1, 7}), expected);
+
+  expected = {{2, 3}, {3, 3}};
+  ASSERT_EQ(Activated(map, {1, 2, 3}), expected);
+
+  expected = {{2, 3}, {3, 3}, {4, 4}};
+  ASSERT_EQ(Activated(map, {1, 2, 3, 7}), expected);
+
+  ASSERT_EQ(Activated(map, {7}), std::vector<Match>{});
+}
+
+TEST_F(PatchMapIndexTest, ManyEntries) {
+  PatchMap map;
+  for (uint32_t i = 0; i < 20000; i++) {
+    ASSERT_TRUE(map.AddEntry({i * 2, i * 2 + 1}, i, GLYPH_KEYED).ok());
+  }
+
+  PatchMapIndex index(map);
+  std::vector<Match> expected = {{5, 1}, {10000, 2}};
+  ASSERT_EQ(index.Activated({10, 20000, 20001, 50000}, {}, {}), expected);
+}
+
+}  // namespace ift::proto
@@ -1,25 +1,44 @@
 #include "ift/table_keyed_diff.h"
 
+#include <algorithm>
 #include <string>
+#include <vector>
 
 #include "absl/container/flat_hash_set.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "brotli/brotli_font_diff.h"
+#include "common/brotli_binary_diff.h"
+#include "common/brotli_binary_patch.h"
 #include "common/font_data.h"
 #include "common/font_helper.h"
 #include "common/font_helper_macros.h"
+#include "common/hb_set_unique_ptr.h"
+#include "common/thread_pool.h"
+#include "common/try.h"
 #include "hb.h"
 
 using absl::btree_set;
 using absl::flat_hash_map;
 using absl::flat_hash_set;
 using absl::Status;
+using absl::StatusOr;
+using absl::string_view;
+using brotli::BrotliFontDiff;
+using common::BrotliBinaryDiff;
+using common::BrotliBinaryPatch;
 using common::FontData;
 using common::FontHelper;
+using common::hb_set_unique_ptr;
+using common::make_hb_set;
+using common::ThreadPool;
 
 namespace ift {
 
 Status TableKeyedDiff::Diff(const FontData& font_base,
                             const FontData& font_derived,
-                            FontData* patch /* OUT */) const {
+                            FontData* patch /* OUT */, ThreadPool* pool,
+                            const GlyphMappings* glyph_mappings) const {
   hb_face_t* face_base = font_base.reference_face();
   hb_face_t* face_derived = font_derived.reference_face();
 
@@ -27,6 +46,20 @@ Status TableKeyedDiff::Diff(const FontData& font_base,
   auto derived_tags = FontHelper::GetTags(face_derived);
   auto diff_tags = TagsToDiff(base_tags, derived_tags);
 
+  // The changed tables are collected first so that they can be compressed
+  // independently of each other.
+  struct TableDiff {
+    std::string tag;
+    hb_tag_t t;
+    FontData base;
+    FontData derived;
+    // Set if brotli::BrotliFontDiff produced a patch for this table.
+    FontData font_diff_patch;
+    FontData patch;
+    Status status;
+  };
+  std::vector<TableDiff> table_diffs;
+
   flat_hash_map<std::string, std::pair<uint32_t, FontData>> patches;
   flat_hash_set<hb_tag_t> new_tables;
   flat_hash_set<hb_tag_t> unchanged_tables;
@@ -56,20 +89,79 @@ Status TableKeyedDiff::Diff(const FontData& font_base,
       continue;
     }
 
-    FontData table_patch;
-    auto sc = binary_diff_.Diff(base_table, derived_table, &table_patch);
-    if (!sc.ok()) {
-      hb_face_destroy(face_base);
-      hb_face_destroy(face_derived);
-      return sc;
+    table_diffs.push_back(TableDiff{tag, t, std::move(base_table),
+                                    std::move(derived_table)});
+  }
+
+  if (glyph_mappings) {
+    hb_set_unique_ptr tags = make_hb_set();
+    for (const TableDiff& table_diff : table_diffs) {
+      if (!table_diff.base.empty()) {
+        hb_set_add(tags.get(), table_diff.t);
+      }
+    }
+
+    // The font diff is only an optimization, if it fails all tables use the
+    // regular diff.
+    flat_hash_map<hb_tag_t, FontData> font_diff_patches;
+    if (BrotliFontDiff::DiffTables(glyph_mappings->base_new_to_old, face_base,
+                                   glyph_mappings->derived_old_to_new,
+                                   face_derived, tags.get(), &font_diff_patches,
+                                   pool, binary_diff_.quality())
+            .ok()) {
+      for (TableDiff& table_diff : table_diffs) {
+        auto it = font_diff_patches.find(table_diff.t);
+        if (it != font_diff_patches.end()) {
+          table_diff.font_diff_patch = std::move(it->second);
+        }
+      }
+    }
+  }
+
+  // Start with the largest tables, they bound the time taken when run in
+  // parallel.
+  std::sort(table_diffs.begin(), table_diffs.end(),
+            [](const TableDiff& a, const TableDiff& b) {
+              return a.derived.size() > b.derived.size();
+            });
+  auto compress = [&](uint32_t i) {
+    TableDiff& table_diff = table_diffs[i];
+    if (!table_diff.font_diff_patch.empty()) {
+      // The font diff relies on glyphs shared with the base being byte for
+      // byte identical, so check that the patch reproduces the table.
+      FontData patched;
+      if (BrotliBinaryPatch()
+              .Patch(table_diff.base, table_diff.font_diff_patch,
+                     table_diff.derived.size(), &patched)
+              .ok() &&
+          patched == table_diff.derived) {
+        table_diff.patch = std::move(table_diff.font_diff_patch);
+        return;
+      }
     }
 
-    patches[tag] = std::pair(derived_table.size(), std::move(table_patch));
+    table_diff.status = binary_diff_.Diff(
+        table_diff.base, table_diff.derived, &table_diff.patch);
+  };
+  if (pool && table_diffs.size() > 1) {
+    pool->ParallelFor(table_diffs.size(), compress);
+  } else {
+    for (uint32_t i = 0; i < table_diffs.size(); i++) {
+      compress(i);
+    }
   }
 
   hb_face_destroy(face_base);
   hb_face_destroy(face_derived);
 
+  for (TableDiff& table_diff : table_diffs) {
+    if (!table_diff.status.ok()) {
+      return table_diff.status;
+    }
+    patches[table_diff.tag] =
+        std::pair(table_diff.derived.size(), std::move(table_diff.patch));
+  }
+
   for (hb_tag_t t : unchanged_tables) {
     std::string tag = FontHelper::ToString(t);
     auto it = diff_tags.find(tag);
@@ -136,6 +228,87 @@ Status TableKeyedDiff::Diff(const FontData& font_base,
   return absl::OkStatus();
 }
 
+StatusOr<FontData> TableKeyedDiff::Recompress(
+    const FontData& patch, const Tables& base,
+    const BrotliBinaryDiff& binary_diff, Tables& derived) {
+  // Format tag (4), reserved (4), compat id (16), patches count (2)
+  constexpr uint32_t header_size = 26;
+  constexpr uint32_t entry_header_size = 9;
+  constexpr uint8_t replace_flag = 0b00000001;
+  constexpr uint8_t remove_flag = 0b00000010;
+
+  string_view data = patch.str();
+  if (data.size() < header_size || data.substr(0, 4) != "iftk") {
+    return absl::InvalidArgumentError("Not a table keyed patch.");
+  }
+
+  uint16_t count = TRY(FontHelper::ReadUInt16(data.substr(header_size - 2)));
+  std::vector<uint32_t> offsets;
+  for (uint32_t i = 0; i <= count; i++) {
+    offsets.push_back(
+        TRY(FontHelper::ReadUInt32(data.substr(header_size + i * 4))));
+    if (offsets.back() > data.size() ||
+        (i > 0 && offsets.back() < offsets[i - 1] + entry_header_size)) {
+      return absl::InvalidArgumentError("Invalid table patch offsets.");
+    }
+  }
+
+  derived.clear();
+  for (const auto& [tag, table] : base) {
+    derived[tag].shallow_copy(table);
+  }
+
+  BrotliBinaryPatch binary_patch;
+  std::vector<std::string> entries;
+  for (uint32_t i = 0; i < count; i++) {
+    string_view entry = data.substr(offsets[i], offsets[i + 1] - offsets[i]);
+    hb_tag_t tag = TRY(FontHelper::ReadUInt32(entry));
+    uint8_t flags = TRY(FontHelper::ReadUInt8(entry.substr(4)));
+
+    if (flags & remove_flag) {
+      derived.erase(tag);
+      entries.push_back(std::string(entry));
+      continue;
+    }
+
+    FontData base_table;
+    auto it = base.find(tag);
+    if (!(flags & replace_flag) && it != base.end()) {
+      base_table.shallow_copy(it->second);
+    }
+
+    uint32_t max_length = TRY(FontHelper::ReadUInt32(entry.substr(5)));
+    FontData table;
+    FontData table_patch(entry.substr(entry_header_size));
+    TRYV(binary_patch.Patch(base_table, table_patch, max_length, &table));
+
+    std::vector<uint8_t> sink;
+    TRYV(binary_diff.Diff(base_table, table.str(), 0, true, sink));
+
+    // The tag, flags and max uncompressed length are unchanged.
+    std::string new_entry(entry.substr(0, entry_header_size));
+    new_entry.append(reinterpret_cast<const char*>(sink.data()), sink.size());
+    entries.push_back(std::move(new_entry));
+
+    derived[tag] = std::move(table);
+  }
+
+  std::string result(data.substr(0, header_size));
+  uint32_t current_offset = header_size + (count + 1) * 4;
+  for (const auto& entry : entries) {
+    FontHelper::WriteUInt32(current_offset, result);
+    current_offset += entry.size();
+  }
+  FontHelper::WriteUInt32(current_offset, result);
+  for (const auto& entry : entries) {
+    result += entry;
+  }
+
+  FontData recompressed;
+  recompressed.copy(result);
+  return recompressed;
+}
+
 void TableKeyedDiff::AddAllMatching(const flat_hash_set<uint32_t>& tags,
                                     btree_set<std::string>& result) const {
   for (const uint32_t& t : tags) {
@@ -4,24 +4,30 @@
 #include <initializer_list>
 
 #include "absl/container/btree_set.h"
+#include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
 #include "absl/status/status.h"
+#include "absl/status/statusor.h"
 #include "common/binary_diff.h"
 #include "common/brotli_binary_diff.h"
 #include "common/compat_id.h"
 #include "common/font_data.h"
+#include "common/thread_pool.h"
+#include "hb.h"
 
 namespace ift {
 
 /* Creates a per table brotli binary diff of two fonts. */
 class TableKeyedDiff : public common::BinaryDiff {
  public:
-  TableKeyedDiff(common::CompatId base_compat_id)
-      : binary_diff_(11), base_compat_id_(base_compat_id) {}
+  TableKeyedDiff(common::CompatId base_compat_id,
+                 common::BrotliBinaryDiff binary_diff = DefaultBinaryDiff())
+      : binary_diff_(binary_diff), base_compat_id_(base_compat_id) {}
 
   TableKeyedDiff(common::CompatId base_compat_id,
-                 std::initializer_list<const char*> excluded_tags)
-      : binary_diff_(11),
+                 std::initializer_list<const char*> excluded_tags,
+                 common::BrotliBinaryDiff binary_diff = DefaultBinaryDiff())
+      : binary_diff_(binary_diff),
         base_compat_id_(base_compat_id),
         excluded_tags_(),
         replaced_tags_() {
@@ -31,8 +37,9 @@ class TableKeyedDiff : public common::BinaryDiff {
 
   TableKeyedDiff(common::CompatId base_compat_id,
                  absl::btree_set<std::string> excluded_tags,
-                 absl::btree_set<std::string> replaced_tags)
-      : binary_diff_(11),
+                 absl::btree_set<std::string> replaced_tags,
+                 common::BrotliBinaryDiff binary_diff = DefaultBinaryDiff())
+      : binary_diff_(binary_diff),
         base_compat_id_(base_compat_id),
         excluded_tags_(),
         replaced_tags_() {
@@ -42,9 +49,54 @@ class TableKeyedDiff : public common::BinaryDiff {
 
   absl::Status Diff(const common::FontData& font_base,
                     const common::FontData& font_derived,
-                    common::FontData* patch /* OUT */) const override;
+                    common::FontData* patch /* OUT */) const override {
+    return Diff(font_base, font_derived, patch, nullptr);
+  }
+
+  /*
+   * The glyph id maps of the subset plans which produced the base and
+   * derived fonts.
+   */
+  struct GlyphMappings {
+    const hb_map_t* base_new_to_old;
+    const hb_map_t* derived_old_to_new;
+  };
+
+  /*
+   * As above, but if 'pool' is non-null the changed tables are compressed
+   * concurrently on it. The resulting patch is identical either way.
+   *
+   * If 'glyph_mappings' is provided the glyf, loca, hmtx and vmtx tables are
+   * diffed with brotli::BrotliFontDiff, which references glyphs shared with
+   * the base instead of searching for matches and only compresses the novel
+   * glyph data (at the quality of 'binary_diff'). The regular binary diff is
+   * used instead for any table where that doesn't reproduce the derived table.
+   */
+  absl::Status Diff(const common::FontData& font_base,
+                    const common::FontData& font_derived,
+                    common::FontData* patch /* OUT */,
+                    common::ThreadPool* pool,
+                    const GlyphMappings* glyph_mappings = nullptr) const;
+
+  // The tables of a font, keyed by tag.
+  typedef absl::flat_hash_map<hb_tag_t, common::FontData> Tables;
+
+  /*
+   * Re-encodes the table patches in the table keyed patch 'patch' using
+   * 'binary_diff'. Which tables are patched (and how) is unchanged, only the
+   * brotli encoding of each table patch differs. 'base' holds the tables of the
+   * font that 'patch' applies to; on success 'derived' is set to the tables of
+   * the patched font.
+   */
+  static absl::StatusOr<common::FontData> Recompress(
+      const common::FontData& patch, const Tables& base,
+      const common::BrotliBinaryDiff& binary_diff, Tables& derived /* OUT */);
 
  private:
+  static common::BrotliBinaryDiff DefaultBinaryDiff() {
+    return common::BrotliBinaryDiff(11);
+  }
+
   void AddAllMatching(const absl::flat_hash_set<uint32_t>& tags,
                       absl::btree_set<std::string>& result) const;
   absl::btree_set<std::string> TagsToDiff(
@@ -6,6 +6,7 @@
 #include "common/compat_id.h"
 #include "common/font_data.h"
 #include "common/font_helper.h"
+#include "common/thread_pool.h"
 #include "gtest/gtest.h"
 #include "hb.h"
 
@@ -16,6 +17,7 @@ using common::BrotliBinaryDiff;
 using common::CompatId;
 using common::FontData;
 using common::FontHelper;
+using common::ThreadPool;
 
 namespace ift {
 
@@ -229,6 +231,72 @@ TEST_F(TableKeyedDiffTest, AddTable) {
   ASSERT_EQ(patch.string(), expected);
 }
 
+TEST_F(TableKeyedDiffTest, Recompress) {
+  FontData before = FontHelper::BuildFont({
+      {tag1, "foo"},
+      {tag2, "bar"},
+  });
+
+  FontData after = FontHelper::BuildFont({
+      {tag1, "foofoofoo"},
+      {tag3, "baz"},
+  });
+
+  TableKeyedDiff draft_differ(CompatId(1, 2, 3, 4), BrotliBinaryDiff(1));
+  FontData patch;
+  auto sc = draft_differ.Diff(before, after, &patch);
+  ASSERT_TRUE(sc.ok()) << sc;
+
+  TableKeyedDiff differ(CompatId(1, 2, 3, 4));
+  FontData expected;
+  sc = differ.Diff(before, after, &expected);
+  ASSERT_TRUE(sc.ok()) << sc;
+
+  TableKeyedDiff::Tables base;
+  base[tag1].copy("foo");
+  base[tag2].copy("bar");
+  TableKeyedDiff::Tables derived;
+  auto recompressed = TableKeyedDiff::Recompress(patch, base,
+                                                 BrotliBinaryDiff(11), derived);
+  ASSERT_TRUE(recompressed.ok()) << recompressed.status();
+  ASSERT_EQ(recompressed->str(), expected.str());
+
+  ASSERT_EQ(derived.size(), 2);
+  ASSERT_EQ(derived[tag1].str(), "foofoofoo");
+  ASSERT_EQ(derived[tag3].str(), "baz");
+
+  FontData not_a_patch("ifgk");
+  ASSERT_TRUE(absl::IsInvalidArgument(
+      TableKeyedDiff::Recompress(not_a_patch, base, BrotliBinaryDiff(11),
+                                 derived)
+          .status()));
+}
+
+TEST_F(TableKeyedDiffTest, ParallelDiff) {
+  FontData before = FontHelper::BuildFont({
+      {tag1, "foo"},
+      {tag2, "bar"},
+      {tag3, "baz"},
+  });
+
+  FontData after = FontHelper::BuildFont({
+      {tag1, "foofoofoo"},
+      {tag2, "baaar"},
+      {tag3, "baz"},
+  });
+
+  TableKeyedDiff differ(CompatId(1, 2, 3, 4));
+  FontData expected;
+  auto sc = differ.Diff(before, after, &expected);
+  ASSERT_TRUE(sc.ok()) << sc;
+
+  ThreadPool pool(2);
+  FontData patch;
+  sc = differ.Diff(before, after, &patch, &pool);
+  ASSERT_TRUE(sc.ok()) << sc;
+  ASSERT_EQ(patch.str(), expected.str());
+}
+
 /*
 TEST_F(TableKeyedDiffTest, FilteredDiff) {
   FontData before = FontHelper::BuildFont({
@@ -1,8 +1,11 @@
 #include <google/protobuf/text_format.h>
 
 #include <cstdio>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <optional>
 
 #include "absl/container/btree_set.h"
 #include "absl/container/flat_hash_map.h"
@@ -12,11 +15,15 @@
 #include "absl/status/statusor.h"
 #include "absl/strings/str_cat.h"
 #include "common/axis_range.h"
+#include "common/brotli_dictionary_cache.h"
 #include "common/font_data.h"
 #include "common/try.h"
 #include "hb.h"
 #include "ift/encoder/encoder.h"
+#include "ift/encoder/patch_sink.h"
+#include "ift/encoder/subset_cache.h"
 #include "util/encoder_config.pb.h"
+#include "util/encoding_manifest.pb.h"
 
 /*
  * Utility that converts a standard font file into an IFT font file following a
@@ -39,18 +46,60 @@ ABSL_FLAG(std::string, output_path, "./",
 ABSL_FLAG(std::string, output_font, "out.ttf",
           "Name of the outputted base font.");
 
+ABSL_FLAG(uint32_t, threads, 1,
+          "Number of threads to use when building the subsets and patches. "
+          "The output is the same for any number of threads.");
+
+ABSL_FLAG(bool, incremental, false,
+          "If set, the encoding previously written to output_path is updated "
+          "in place. Only the patches affected by changes to the input font or "
+          "config are regenerated, the rest are reused.");
+
+ABSL_FLAG(bool, dry_run, false,
+          "If set, nothing is encoded. Instead the size of the encoding that "
+          "would be produced (node, patch and byte counts) is estimated and "
+          "printed. This is fast for any config.");
+
+ABSL_FLAG(std::string, profile, "release",
+          "Compression settings to use for the patches. Either 'release' "
+          "(smallest output) or 'draft' (much faster, larger patches).");
+
+ABSL_FLAG(bool, font_diff, false,
+          "If set, the glyf, loca, hmtx and vmtx tables of table keyed patches "
+          "are diffed using the glyph mappings of the subsets so only new "
+          "glyph data is compressed (at the --profile quality), which is much "
+          "faster for large fonts. Has no effect with glyph keyed patches.");
+
+ABSL_FLAG(bool, recompress, false,
+          "If set, input_font and config are ignored. Instead the patches of "
+          "the encoding previously written to output_path are re-encoded in "
+          "place with the settings of --profile. No subsetting is done, so "
+          "this is a fast way to take a draft encoding to release quality.");
+
+ABSL_FLAG(std::string, subset_cache_dir, "",
+          "If set, subsetting results are cached in this directory and reused "
+          "by later runs.");
+
+ABSL_FLAG(uint64_t, subset_cache_max_size_mb, 1024,
+          "Maximum size of the subset cache in megabytes. The least recently "
+          "used entries are removed once it is exceeded.");
+
 using absl::btree_set;
 using absl::flat_hash_map;
 using absl::flat_hash_set;
 using absl::Status;
 using absl::StatusOr;
 using absl::StrCat;
+using common::BrotliDictionaryCache;
+using common::CompatId;
 using common::FontData;
 using common::FontHelper;
 using common::hb_blob_unique_ptr;
 using common::hb_face_unique_ptr;
 using common::make_hb_blob;
 using ift::encoder::Encoder;
+using ift::encoder::FilePatchSink;
+using ift::encoder::SubsetCache;
 
 StatusOr<FontData> load_file(const char* path) {
   hb_blob_unique_ptr blob =
@@ -81,15 +130,129 @@ Status write_file(const std::string& name, const FontData& data) {
   return absl::OkStatus();
 }
 
-void write_patch(const std::string& url, const FontData& patch) {
+// Written to output_path when --incremental is set.
+constexpr char kManifestFile[] = "encoding_manifest.txtpb";
+
+EncodingManifest::CompatId to_proto(const CompatId& id) {
+  const uint32_t* values = id.as_ptr();
+  EncodingManifest::CompatId proto;
+  proto.set_a(values[0]);
+  proto.set_b(values[1]);
+  proto.set_c(values[2]);
+  proto.set_d(values[3]);
+  return proto;
+}
+
+CompatId from_proto(const EncodingManifest::CompatId& proto) {
+  return CompatId(proto.a(), proto.b(), proto.c(), proto.d());
+}
+
+EncodingManifest to_proto(const Encoder::Manifest& manifest) {
+  EncodingManifest proto;
+  proto.set_generation(manifest.generation);
+  proto.set_next_patch_id(manifest.next_patch_id);
+  proto.set_next_patch_set_id(manifest.next_patch_set_id);
+
+  for (const auto& [key, node] : manifest.nodes) {
+    EncodingManifest::Node& node_proto = (*proto.mutable_nodes())[key];
+    node_proto.set_fingerprint(node.fingerprint);
+    *node_proto.mutable_compat_id() = to_proto(node.compat_id);
+    for (uint32_t id : node.patch_ids) {
+      node_proto.add_patch_ids(id);
+    }
+  }
+
+  for (const auto& [key, set] : manifest.glyph_keyed_patch_sets) {
+    EncodingManifest::GlyphKeyedPatchSet& set_proto =
+        (*proto.mutable_glyph_keyed_patch_sets())[key];
+    set_proto.set_uri_template(set.uri_template);
+    *set_proto.mutable_compat_id() = to_proto(set.compat_id);
+    set_proto.set_fingerprint(set.fingerprint);
+    for (const auto& [id, fingerprint] : set.segment_fingerprints) {
+      (*set_proto.mutable_segment_fingerprints())[id] = fingerprint;
+    }
+  }
+
+  return proto;
+}
+
+Encoder::Manifest from_proto(const EncodingManifest& proto) {
+  Encoder::Manifest manifest;
+  manifest.generation = proto.generation();
+  manifest.next_patch_id = proto.next_patch_id();
+  manifest.next_patch_set_id = proto.next_patch_set_id();
+
+  for (const auto& [key, node_proto] : proto.nodes()) {
+    Encoder::Manifest::Node& node = manifest.nodes[key];
+    node.fingerprint = node_proto.fingerprint();
+    node.compat_id = from_proto(node_proto.compat_id());
+    node.patch_ids.assign(node_proto.patch_ids().begin(),
+                          node_proto.patch_ids().end());
+  }
+
+  for (const auto& [key, set_proto] : proto.glyph_keyed_patch_sets()) {
+    Encoder::Manifest::GlyphKeyedPatchSet& set =
+        manifest.glyph_keyed_patch_sets[key];
+    set.uri_template = set_proto.uri_template();
+    set.compat_id = from_proto(set_proto.compat_id());
+    set.fingerprint = set_proto.fingerprint();
+    for (const auto& [id, fingerprint] : set_proto.segment_fingerprints()) {
+      set.segment_fingerprints[id] = fingerprint;
+    }
+  }
+
+  return manifest;
+}
+
+// Loads the init font and patches previously written to output_path.
+Status load_encoding_files(Encoder::Encoding& encoding) {
   std::string output_path = absl::GetFlag(FLAGS_output_path);
-  std::cerr << "  Writing patch: " << StrCat(output_path, "/", url)
-            << std::endl;
-  auto sc = write_file(StrCat(output_path, "/", url), patch);
-  if (!sc.ok()) {
-    std::cerr << sc.message() << std::endl;
-    exit(-1);
+  std::string output_font = absl::GetFlag(FLAGS_output_font);
+
+  // The outputs are overwritten in place, so the previous files are copied
+  // into memory rather than memory mapped.
+  std::string init_font_path = StrCat(output_path, "/", output_font);
+  auto init_font = TRY(load_file(init_font_path.c_str()));
+  encoding.init_font.copy(init_font.str());
+
+  std::error_code ec;
+  for (const auto& file :
+       std::filesystem::directory_iterator(output_path, ec)) {
+    std::string name = file.path().filename().string();
+    if (!file.is_regular_file() || name == kManifestFile ||
+        name == output_font) {
+      continue;
+    }
+    auto patch = TRY(load_file(file.path().c_str()));
+    encoding.patches[name].copy(patch.str());
+  }
+  if (ec) {
+    return absl::InternalError(
+        StrCat("Failed to list ", output_path, ": ", ec.message()));
   }
+
+  return absl::OkStatus();
+}
+
+// Loads the encoding previously written to output_path, if there is one.
+StatusOr<std::optional<Encoder::Encoding>> load_previous_encoding() {
+  std::string output_path = absl::GetFlag(FLAGS_output_path);
+  std::string manifest_path = StrCat(output_path, "/", kManifestFile);
+  auto manifest_text = load_file(manifest_path.c_str());
+  if (absl::IsNotFound(manifest_text.status())) {
+    return std::nullopt;
+  }
+
+  EncodingManifest manifest;
+  if (!google::protobuf::TextFormat::ParseFromString(manifest_text->string(),
+                                                     &manifest)) {
+    return absl::InvalidArgumentError("Failed to parse the encoding manifest.");
+  }
+
+  Encoder::Encoding previous;
+  previous.manifest = from_proto(manifest);
+  TRYV(load_encoding_files(previous));
+  return previous;
 }
 
 int write_output(const Encoder::Encoding& encoding) {
@@ -105,8 +268,16 @@ int write_output(const Encoder::Encoding& encoding) {
     return -1;
   }
 
-  for (const auto& p : encoding.patches) {
-    write_patch(p.first, p.second);
+  if (absl::GetFlag(FLAGS_incremental)) {
+    std::string manifest;
+    google::protobuf::TextFormat::PrintToString(to_proto(encoding.manifest),
+                                                &manifest);
+    FontData manifest_data(manifest);
+    sc = write_file(StrCat(output_path, "/", kManifestFile), manifest_data);
+    if (!sc.ok()) {
+      std::cerr << sc.message() << std::endl;
+      return -1;
+    }
   }
 
   return 0;
@@ -219,6 +390,8 @@ Status ConfigureEncoder(EncoderConfig config, Encoder& encoder) {
   if (config.jump_ahead() > 1) {
     encoder.SetJumpAhead(config.jump_ahead());
   }
+  encoder.SetMaxDepth(config.max_depth());
+  encoder.SetIncludeAllSegmentPatches(config.include_all_segment_patches());
 
   // Check for unsupported settings
   if (config.add_everything_else_segments()) {
@@ -226,21 +399,98 @@ Status ConfigureEncoder(EncoderConfig config, Encoder& encoder) {
         "add_everything_else_segments is not yet supported.");
   }
 
-  if (config.include_all_segment_patches()) {
-    return absl::UnimplementedError(
-        "include_all_segment_patches is not yet supported.");
+  return absl::OkStatus();
+}
+
+void print_plan(const Encoder::EncodingPlan& plan) {
+  std::string qualifier = plan.exact ? "" : " (at most)";
+  std::cout << "  nodes" << qualifier << " = " << plan.node_count << std::endl;
+  for (uint32_t i = 0; i < plan.nodes_per_level.size(); i++) {
+    std::cout << "    level " << i << ": " << plan.nodes_per_level[i]
+              << " nodes, " << plan.edges_per_level[i] << " outgoing edges"
+              << std::endl;
   }
+  std::cout << "  table keyed patches" << qualifier << " = "
+            << plan.table_keyed_patch_count << std::endl;
 
-  if (config.max_depth() > 0) {
-    return absl::UnimplementedError("max_depth is not yet supported.");
+  std::cout << "  glyph keyed patches = " << plan.glyph_keyed_patch_count
+            << std::endl;
+  for (const auto& [design_space, count] : plan.glyph_keyed_patch_counts) {
+    std::cout << "    design space {";
+    for (const auto& [tag, range] : design_space) {
+      std::cout << FontHelper::ToString(tag) << ": [" << range.start() << ", "
+                << range.end() << "], ";
+    }
+    std::cout << "}: " << count << std::endl;
   }
 
-  return absl::OkStatus();
+  std::cout << "  estimated total size = " << plan.estimated_bytes << " bytes"
+            << std::endl;
+}
+
+void print_dictionary_cache_stats(BrotliDictionaryCache& cache) {
+  std::cout << "  dictionary cache hits = " << cache.Hits()
+            << ", misses = " << cache.Misses() << std::endl;
+}
+
+StatusOr<Encoder::EncodeProfile> encode_profile() {
+  std::string name = absl::GetFlag(FLAGS_profile);
+  Encoder::EncodeProfile profile;
+  if (name == "release") {
+    profile = Encoder::EncodeProfile::Release();
+  } else if (name == "draft") {
+    profile = Encoder::EncodeProfile::Draft();
+  } else {
+    return absl::InvalidArgumentError(
+        StrCat("Unknown profile '", name, "', expected release or draft."));
+  }
+  profile.font_diff = absl::GetFlag(FLAGS_font_diff);
+  return profile;
+}
+
+int recompress(const Encoder::EncodeProfile& profile) {
+  Encoder::Encoding previous;
+  auto sc = load_encoding_files(previous);
+  if (!sc.ok()) {
+    std::cerr << "Failed to load the previous encoding: " << sc << std::endl;
+    return -1;
+  }
+
+  Encoder encoder;
+  encoder.SetEncodeProfile(profile);
+  encoder.SetThreads(absl::GetFlag(FLAGS_threads));
+  FilePatchSink patch_sink(absl::GetFlag(FLAGS_output_path));
+  encoder.SetPatchSink(&patch_sink);
+  BrotliDictionaryCache dictionary_cache;
+  encoder.SetDictionaryCache(&dictionary_cache);
+
+  std::cout << ">> recompressing:" << std::endl;
+  auto encoding = encoder.Recompress(previous);
+  if (!encoding.ok()) {
+    std::cerr << "Recompressing failed: " << encoding.status() << std::endl;
+    return -1;
+  }
+
+  print_dictionary_cache_stats(dictionary_cache);
+
+  std::cout << "  wrote " << patch_sink.PatchCount() << " patches to "
+            << absl::GetFlag(FLAGS_output_path) << std::endl;
+  return 0;
 }
 
 int main(int argc, char** argv) {
   auto args = absl::ParseCommandLine(argc, argv);
 
+  auto profile = encode_profile();
+  if (!profile.ok()) {
+    std::cerr << profile.status() << std::endl;
+    return -1;
+  }
+
+  if (absl::GetFlag(FLAGS_recompress)) {
+    return recompress(*profile);
+  }
+
   auto config_text = load_file(absl::GetFlag(FLAGS_config).c_str());
   if (!config_text.ok()) {
     std::cerr << "Failed to load config file: " << config_text.status()
@@ -263,6 +513,22 @@ int main(int argc, char** argv) {
 
   Encoder encoder;
   encoder.SetFace(font->get());
+  encoder.SetThreads(absl::GetFlag(FLAGS_threads));
+  encoder.SetEncodeProfile(*profile);
+
+  std::unique_ptr<SubsetCache> subset_cache;
+  if (!absl::GetFlag(FLAGS_subset_cache_dir).empty()) {
+    auto cache =
+        SubsetCache::Open(absl::GetFlag(FLAGS_subset_cache_dir),
+                          absl::GetFlag(FLAGS_subset_cache_max_size_mb) << 20);
+    if (!cache.ok()) {
+      std::cerr << "Failed to open the subset cache: " << cache.status()
+                << std::endl;
+      return -1;
+    }
+    subset_cache = std::move(*cache);
+    encoder.SetSubsetCache(subset_cache.get());
+  }
 
   auto sc = ConfigureEncoder(config, encoder);
   if (!sc.ok()) {
@@ -271,6 +537,38 @@ int main(int argc, char** argv) {
     return -1;
   }
 
+  if (absl::GetFlag(FLAGS_dry_run)) {
+    std::cout << ">> planning:" << std::endl;
+    auto plan = encoder.Plan();
+    if (!plan.ok()) {
+      std::cerr << "Planning failed: " << plan.status() << std::endl;
+      return -1;
+    }
+    print_plan(*plan);
+    return 0;
+  }
+
+  std::optional<Encoder::Encoding> previous;
+  if (absl::GetFlag(FLAGS_incremental)) {
+    auto loaded = load_previous_encoding();
+    if (!loaded.ok()) {
+      std::cerr << "Failed to load the previous encoding: " << loaded.status()
+                << std::endl;
+      return -1;
+    }
+    previous = std::move(*loaded);
+    if (previous) {
+      encoder.SetPreviousEncoding(&*previous);
+    }
+  }
+
+  // Patches are written out as they are produced rather than once the whole
+  // encoding is done.
+  FilePatchSink patch_sink(absl::GetFlag(FLAGS_output_path));
+  encoder.SetPatchSink(&patch_sink);
+  BrotliDictionaryCache dictionary_cache;
+  encoder.SetDictionaryCache(&dictionary_cache);
+
   std::cout << ">> encoding:" << std::endl;
   auto encoding = encoder.Encode();
   if (!encoding.ok()) {
@@ -278,6 +576,15 @@ int main(int argc, char** argv) {
     return -1;
   }
 
-  std::cout << ">> generating output patches:" << std::endl;
+  if (subset_cache) {
+    std::cout << "  subset cache hits = " << subset_cache->Hits()
+              << ", misses = " << subset_cache->Misses() << std::endl;
+  }
+  print_dictionary_cache_stats(dictionary_cache);
+
+  std::cout << "  wrote " << patch_sink.PatchCount() << " patches to "
+            << absl::GetFlag(FLAGS_output_path) << std::endl;
+
+  std::cout << ">> writing init font:" << std::endl;
   return write_output(*encoding);
 }
@@ -4,7 +4,9 @@
 #include <cstdio>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <sstream>
+#include <utility>
 
 #include "absl/container/btree_map.h"
 #include "absl/container/btree_set.h"
@@ -18,10 +20,12 @@
 #include "absl/strings/str_cat.h"
 #include "common/font_data.h"
 #include "common/hb_set_unique_ptr.h"
+#include "common/thread_pool.h"
 #include "common/try.h"
 #include "hb.h"
 #include "ift/encoder/encoder.h"
 #include "ift/encoder/glyph_segmentation.h"
+#include "ift/encoder/patch_size_estimator.h"
 #include "ift/url_template.h"
 
 /*
@@ -53,6 +57,18 @@ ABSL_FLAG(uint32_t, max_patch_size_bytes, UINT32_MAX,
           "The segmenter will avoid merges which result in patches larger than "
           "this amount.");
 
+ABSL_FLAG(uint32_t, threads, 1,
+          "Number of threads to use for the segment analysis. The output is "
+          "the same for any number of threads.");
+
+ABSL_FLAG(std::string, patch_size_estimator, "model",
+          "How patch sizes are estimated when deciding on merges. 'model' "
+          "estimates from per glyph compressed sizes, periodically checked "
+          "against a real patch. 'brotli' builds every patch.");
+
+ABSL_FLAG(uint32_t, patch_size_quality, 5,
+          "Brotli quality used when estimating patch sizes.");
+
 using absl::btree_map;
 using absl::btree_set;
 using absl::flat_hash_map;
@@ -69,7 +85,10 @@ using common::make_hb_blob;
 using common::make_hb_set;
 using ift::URLTemplate;
 using ift::encoder::Encoder;
+using ift::encoder::BrotliPatchSizeEstimator;
 using ift::encoder::GlyphSegmentation;
+using ift::encoder::GlyphSizeModelEstimator;
+using ift::encoder::PatchSizeEstimator;
 
 StatusOr<FontData> LoadFile(const char* path) {
   hb_blob_unique_ptr blob =
@@ -360,9 +379,38 @@ int main(int argc, char** argv) {
   auto groups =
       GroupCodepoints(*codepoints, absl::GetFlag(FLAGS_number_of_segments));
 
+  std::unique_ptr<common::ThreadPool> pool;
+  if (absl::GetFlag(FLAGS_threads) > 1) {
+    // The calling thread also runs tasks while it waits.
+    pool =
+        std::make_unique<common::ThreadPool>(absl::GetFlag(FLAGS_threads) - 1);
+  }
+
+  FontData font_data(font->get());
+  std::unique_ptr<PatchSizeEstimator> estimator;
+  std::string estimator_name = absl::GetFlag(FLAGS_patch_size_estimator);
+  unsigned quality = absl::GetFlag(FLAGS_patch_size_quality);
+  if (estimator_name == "model") {
+    auto model =
+        GlyphSizeModelEstimator::Create(font_data, quality, 64, pool.get());
+    if (!model.ok()) {
+      std::cerr << "Failed to create patch size model: " << model.status()
+                << std::endl;
+      return -1;
+    }
+    estimator = std::move(*model);
+  } else if (estimator_name == "brotli") {
+    estimator = std::make_unique<BrotliPatchSizeEstimator>(font_data, quality,
+                                                           pool.get());
+  } else {
+    std::cerr << "Unknown patch size estimator: " << estimator_name
+              << std::endl;
+    return -1;
+  }
+
   auto result = ift::encoder::GlyphSegmentation::CodepointToGlyphSegments(
       font->get(), {}, groups, absl::GetFlag(FLAGS_min_patch_size_bytes),
-      absl::GetFlag(FLAGS_max_patch_size_bytes));
+      absl::GetFlag(FLAGS_max_patch_size_bytes), pool.get(), estimator.get());
   if (!result.ok()) {
     std::cerr << result.status() << std::endl;
     return -1;